@@ -0,0 +1,620 @@
+/*
+ * This program is part of libredstone.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* generates a region with mapgen's terrain, times reading, parsing,
+ * writing and flushing it, as well as the containers underneath, and
+ * prints the results as JSON
+ */
+
+#include "redstone.h"
+#include "config.h"
+#include "terrain.h"
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#if HAVE_MKDIR
+#  if MKDIR_TAKES_ONE_ARG
+#    define mkdir(a, b) mkdir(a)
+#  endif
+#else
+#  if HAVE__MKDIR
+#    define mkdir(a, b) _mkdir(a)
+#  else
+#    error "Don't know how to create a directory on this system."
+#  endif
+#endif
+
+#define CHUNKS 1024
+#define DEFAULT_ITERATIONS 5
+#define DEFAULT_SEED 1
+
+/* how many elements the container phases use */
+#define CONTAINER_OPS (1 << 20)
+
+/* one buffer per chunk in the region */
+typedef struct
+{
+    uint8_t* data[CHUNKS];
+    size_t length[CHUNKS];
+} Buffers;
+
+/* one timed phase -- only the best run is kept */
+typedef struct
+{
+    const char* name;
+    double best;
+    double total;
+    unsigned int runs;
+    size_t chunks;
+    size_t bytes;
+    /* for phases that don't work on chunks */
+    size_t operations;
+} Result;
+
+static double now(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static void record(Result* result, double seconds)
+{
+    if (result->runs == 0 || seconds < result->best)
+        result->best = seconds;
+    result->total += seconds;
+    result->runs++;
+}
+
+static void buffers_clear(Buffers* buffers)
+{
+    unsigned int i;
+    for (i = 0; i < CHUNKS; i++)
+    {
+        rs_free(buffers->data[i]);
+        buffers->data[i] = NULL;
+        buffers->length[i] = 0;
+    }
+}
+
+static size_t buffers_size(Buffers* buffers)
+{
+    size_t size = 0;
+    unsigned int i;
+    for (i = 0; i < CHUNKS; i++)
+        size += buffers->length[i];
+    return size;
+}
+
+static bool generate_region(const char* path, uint32_t seed)
+{
+    RSRegion* region = rs_region_open(path, true);
+    if (!region)
+        return false;
+    
+    RSTagBuilder* builder = rs_tag_builder_new();
+    RSTag* empty = take_byte_array(0x4000, rs_malloc0(0x4000));
+    rs_tag_ref(empty);
+    TerrainScratch* scratch = rs_new(TerrainScratch, 1);
+    
+    bool success = true;
+    unsigned int i;
+    for (i = 0; i < CHUNKS && success; i++)
+    {
+        RSNBT* nbt = rs_nbt_new();
+        rs_nbt_set_root(nbt, create_chunk(builder, empty, scratch, i % 32, i / 32, seed, NULL));
+        success = rs_nbt_write_to_region(nbt, region, i % 32, i / 32);
+        rs_nbt_free(nbt);
+    }
+    
+    rs_free(scratch);
+    rs_tag_unref(empty);
+    rs_tag_builder_free(builder);
+    rs_region_close(region);
+    return success;
+}
+
+static bool copy_file(const char* from, const char* to)
+{
+    FILE* in = fopen(from, "rb");
+    if (!in)
+        return false;
+    FILE* out = fopen(to, "wb");
+    if (!out)
+    {
+        fclose(in);
+        return false;
+    }
+    
+    char buf[1024 * 64];
+    size_t len;
+    bool success = true;
+    while ((len = fread(buf, 1, sizeof(buf), in)) > 0)
+    {
+        if (fwrite(buf, 1, len, out) != len)
+        {
+            success = false;
+            break;
+        }
+    }
+    
+    fclose(in);
+    if (fclose(out) != 0)
+        success = false;
+    return success;
+}
+
+/* reads every chunk's compressed data out of the region */
+static bool bench_read(const char* path, Buffers* compressed, Result* result)
+{
+    buffers_clear(compressed);
+    
+    double start = now();
+    RSRegion* region = rs_region_open(path, false);
+    if (!region)
+        return false;
+    
+    unsigned int i;
+    for (i = 0; i < CHUNKS; i++)
+    {
+        size_t len = rs_region_get_chunk_length(region, i % 32, i / 32);
+        compressed->data[i] = rs_memdup(rs_region_get_chunk_data(region, i % 32, i / 32), len);
+        compressed->length[i] = len;
+    }
+    rs_region_close(region);
+    record(result, now() - start);
+    
+    result->chunks = CHUNKS;
+    result->bytes = buffers_size(compressed);
+    return true;
+}
+
+static bool bench_decompress(Buffers* compressed, Buffers* raw, Result* result)
+{
+    buffers_clear(raw);
+    
+    double start = now();
+    unsigned int i;
+    for (i = 0; i < CHUNKS; i++)
+    {
+        rs_decompress(RS_ZLIB, compressed->data[i], compressed->length[i], &(raw->data[i]), &(raw->length[i]));
+        if (!raw->data[i])
+            return false;
+    }
+    record(result, now() - start);
+    
+    result->chunks = CHUNKS;
+    result->bytes = buffers_size(raw);
+    return true;
+}
+
+static bool bench_parse(Buffers* raw, RSNBT** nbts, Result* result)
+{
+    unsigned int i;
+    for (i = 0; i < CHUNKS; i++)
+    {
+        if (nbts[i])
+            rs_nbt_free(nbts[i]);
+        nbts[i] = NULL;
+    }
+    
+    double start = now();
+    for (i = 0; i < CHUNKS; i++)
+    {
+        nbts[i] = rs_nbt_parse(raw->data[i], raw->length[i], RS_UNCOMPRESSED);
+        if (!nbts[i])
+            return false;
+    }
+    record(result, now() - start);
+    
+    result->chunks = CHUNKS;
+    result->bytes = buffers_size(raw);
+    return true;
+}
+
+/* visits every tag, and folds the contents into sum so none of this
+ * can be skipped
+ */
+static size_t traverse(RSTag* tag, uint64_t* sum)
+{
+    RSTagIterator it;
+    RSTag* child;
+    const char* key;
+    size_t count = 1;
+    
+    switch (rs_tag_get_type(tag))
+    {
+    case RS_TAG_BYTE:
+    case RS_TAG_SHORT:
+    case RS_TAG_INT:
+    case RS_TAG_LONG:
+        *sum += rs_tag_get_integer(tag);
+        break;
+    case RS_TAG_FLOAT:
+    case RS_TAG_DOUBLE:
+        *sum += (uint64_t)rs_tag_get_float(tag);
+        break;
+    case RS_TAG_BYTE_ARRAY:
+    {
+        const uint8_t* data = rs_tag_peek_byte_array(tag);
+        uint32_t i, len = rs_tag_get_byte_array_length(tag);
+        for (i = 0; i < len; i++)
+            *sum += data[i];
+        break;
+    }
+    case RS_TAG_INT_ARRAY:
+    {
+        const uint32_t* data = rs_tag_peek_int_array(tag);
+        uint32_t i, len = rs_tag_get_int_array_length(tag);
+        for (i = 0; i < len; i++)
+            *sum += data[i];
+        break;
+    }
+    case RS_TAG_STRING:
+        *sum += strlen(rs_tag_get_string(tag));
+        break;
+    case RS_TAG_LIST:
+        rs_tag_list_iterator_init(tag, &it);
+        while (rs_tag_list_iterator_next(&it, &child))
+            count += traverse(child, sum);
+        break;
+    case RS_TAG_COMPOUND:
+        rs_tag_compound_iterator_init(tag, &it);
+        while (rs_tag_compound_iterator_next(&it, &key, &child))
+        {
+            *sum += strlen(key);
+            count += traverse(child, sum);
+        }
+        break;
+    default:
+        break;
+    };
+    
+    return count;
+}
+
+static bool bench_traverse(RSNBT** nbts, Buffers* raw, Result* result)
+{
+    uint64_t sum = 0;
+    size_t tags = 0;
+    
+    double start = now();
+    unsigned int i;
+    for (i = 0; i < CHUNKS; i++)
+        tags += traverse(rs_nbt_get_root(nbts[i]), &sum);
+    record(result, now() - start);
+    
+    result->chunks = CHUNKS;
+    result->bytes = buffers_size(raw);
+    return tags > 0 && sum > 0;
+}
+
+static bool bench_serialize(RSNBT** nbts, Result* result)
+{
+    Buffers out;
+    memset(&out, 0, sizeof(out));
+    
+    double start = now();
+    unsigned int i;
+    for (i = 0; i < CHUNKS; i++)
+    {
+        if (!rs_nbt_write(nbts[i], (void**)&(out.data[i]), &(out.length[i]), RS_UNCOMPRESSED))
+        {
+            buffers_clear(&out);
+            return false;
+        }
+    }
+    record(result, now() - start);
+    
+    result->chunks = CHUNKS;
+    result->bytes = buffers_size(&out);
+    buffers_clear(&out);
+    return true;
+}
+
+static bool bench_compress(Buffers* raw, Result* result)
+{
+    Buffers out;
+    memset(&out, 0, sizeof(out));
+    
+    double start = now();
+    unsigned int i;
+    for (i = 0; i < CHUNKS; i++)
+    {
+        rs_compress(RS_ZLIB, raw->data[i], raw->length[i], &(out.data[i]), &(out.length[i]));
+        if (!out.data[i])
+        {
+            buffers_clear(&out);
+            return false;
+        }
+    }
+    record(result, now() - start);
+    
+    /* measured by how much goes in, like everything else */
+    result->chunks = CHUNKS;
+    result->bytes = buffers_size(raw);
+    buffers_clear(&out);
+    return true;
+}
+
+/* rewrites count chunks of a fresh copy of the region, and times only
+ * the flush. Each chunk gets the data of its neighbour, so some grow
+ * and some shrink.
+ */
+static bool bench_flush(const char* path, const char* scratch, Buffers* compressed, unsigned int count, Result* result)
+{
+    if (!copy_file(path, scratch))
+        return false;
+    
+    RSRegion* region = rs_region_open(scratch, true);
+    if (!region)
+        return false;
+    
+    result->chunks = count;
+    result->bytes = 0;
+    unsigned int n;
+    for (n = 0; n < count; n++)
+    {
+        unsigned int i = n * (CHUNKS / count);
+        unsigned int from = (i + 1) % CHUNKS;
+        rs_region_set_chunk_data(region, i % 32, i / 32, compressed->data[from], compressed->length[from], RS_ZLIB);
+        result->bytes += compressed->length[from];
+    }
+    
+    double start = now();
+    rs_region_flush(region);
+    record(result, now() - start);
+    
+    rs_region_close(region);
+    remove(scratch);
+    return true;
+}
+
+static bool bench_array_append(Result* result)
+{
+    double start = now();
+    RSArray* array = rs_array_new(sizeof(uint64_t));
+    uint64_t i;
+    for (i = 0; i < CONTAINER_OPS; i++)
+        rs_array_append(array, i);
+    record(result, now() - start);
+    
+    bool success = array->length == CONTAINER_OPS &&
+        rs_array_index(array, uint64_t, CONTAINER_OPS - 1) == CONTAINER_OPS - 1;
+    rs_array_free(array);
+    
+    result->operations = CONTAINER_OPS;
+    result->bytes = CONTAINER_OPS * sizeof(uint64_t);
+    return success;
+}
+
+/* fills an integer map, then looks up, iterates over, and removes
+ * every key, timing each separately
+ */
+static bool bench_hash_map(Result* insert, Result* lookup, Result* iterate, Result* remove)
+{
+    RSHashMap* map = rs_hash_map_new(RS_HASH_MAP_INTEGER_KEYS);
+    
+    /* values are key + 1, so none of them are NULL */
+    double start = now();
+    int64_t i;
+    for (i = 0; i < CONTAINER_OPS; i++)
+        rs_hash_map_insert_int(map, i, (void*)(intptr_t)(i + 1));
+    record(insert, now() - start);
+    bool success = rs_hash_map_get_size(map) == CONTAINER_OPS;
+    
+    uint64_t sum = 0;
+    start = now();
+    for (i = 0; i < CONTAINER_OPS; i++)
+        sum += (intptr_t)rs_hash_map_lookup_int(map, i);
+    record(lookup, now() - start);
+    success = success && sum == (uint64_t)CONTAINER_OPS * (CONTAINER_OPS + 1) / 2;
+    
+    RSHashMapIterator it;
+    void* value;
+    sum = 0;
+    start = now();
+    rs_hash_map_iterator_init(map, &it);
+    while (rs_hash_map_iterator_next_int(&it, NULL, &value))
+        sum += (intptr_t)value;
+    record(iterate, now() - start);
+    success = success && sum == (uint64_t)CONTAINER_OPS * (CONTAINER_OPS + 1) / 2;
+    
+    start = now();
+    for (i = 0; i < CONTAINER_OPS; i++)
+        success = rs_hash_map_remove_int(map, i) && success;
+    record(remove, now() - start);
+    success = success && rs_hash_map_get_size(map) == 0;
+    
+    rs_hash_map_free(map);
+    
+    Result* results[] = {insert, lookup, iterate, remove};
+    for (i = 0; i < 4; i++)
+    {
+        results[i]->operations = CONTAINER_OPS;
+        results[i]->bytes = CONTAINER_OPS * sizeof(int64_t);
+    }
+    return success;
+}
+
+static void print_results(Result* results, unsigned int count, unsigned int iterations, uint32_t seed)
+{
+    printf("{\n");
+    printf("  \"library\": \"libredstone\",\n");
+    printf("  \"version\": \"%s\",\n", LIBREDSTONE_VERSION);
+    printf("  \"codec\": \"%s\",\n", rs_get_codec());
+    printf("  \"seed\": %u,\n", seed);
+    printf("  \"chunks\": %u,\n", CHUNKS);
+    printf("  \"iterations\": %u,\n", iterations);
+    printf("  \"results\": {\n");
+    
+    unsigned int i;
+    for (i = 0; i < count; i++)
+    {
+        Result* r = &(results[i]);
+        printf("    \"%s\": {\n", r->name);
+        if (r->operations)
+        {
+            printf("      \"operations\": %zu,\n", r->operations);
+        } else {
+            printf("      \"chunks\": %zu,\n", r->chunks);
+        }
+        printf("      \"bytes\": %zu,\n", r->bytes);
+        printf("      \"best_seconds\": %.9f,\n", r->best);
+        printf("      \"mean_seconds\": %.9f,\n", r->runs ? r->total / r->runs : 0.0);
+        if (r->operations)
+        {
+            printf("      \"operations_per_second\": %.3f,\n", r->best > 0 ? r->operations / r->best : 0.0);
+        } else {
+            printf("      \"chunks_per_second\": %.3f,\n", r->best > 0 ? r->chunks / r->best : 0.0);
+        }
+        printf("      \"megabytes_per_second\": %.3f\n", r->best > 0 ? r->bytes / r->best / 1e6 : 0.0);
+        printf("    }%s\n", i + 1 < count ? "," : "");
+    }
+    
+    printf("  }\n");
+    printf("}\n");
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-n iterations] [-s seed] [workdir]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int iterations = DEFAULT_ITERATIONS;
+    uint32_t seed = DEFAULT_SEED;
+    const char* workdir = "bench-world";
+    
+    int arg;
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc)
+        {
+            iterations = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            seed = strtoul(argv[++arg], NULL, 10);
+        } else if (argv[arg][0] != '-') {
+            workdir = argv[arg];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    if (mkdir(workdir, 0777) == -1 && errno != EEXIST)
+    {
+        fprintf(stderr, "could not create %s\n", workdir);
+        return 1;
+    }
+    
+    char* path = rs_malloc(strlen(workdir) + 32);
+    char* scratch = rs_malloc(strlen(workdir) + 32);
+    sprintf(path, "%s/r.0.0.mca", workdir);
+    sprintf(scratch, "%s/flush.mca", workdir);
+    
+    /* always start from the same world */
+    fprintf(stderr, "generating %s ...\n", path);
+    remove(path);
+    if (!generate_region(path, seed))
+    {
+        fprintf(stderr, "could not generate %s\n", path);
+        return 1;
+    }
+    
+    enum
+    {
+        READ, DECOMPRESS, PARSE, TRAVERSE, SERIALIZE, COMPRESS,
+        FLUSH_1, FLUSH_10, FLUSH_ALL, ARRAY_APPEND, HASH_MAP_INSERT,
+        HASH_MAP_LOOKUP, HASH_MAP_ITERATE, HASH_MAP_REMOVE, PHASES
+    };
+    Result results[PHASES];
+    memset(results, 0, sizeof(results));
+    results[READ].name = "region-read";
+    results[DECOMPRESS].name = "decompress";
+    results[PARSE].name = "parse";
+    results[TRAVERSE].name = "traverse";
+    results[SERIALIZE].name = "serialize";
+    results[COMPRESS].name = "compress";
+    results[FLUSH_1].name = "flush-1";
+    results[FLUSH_10].name = "flush-10";
+    results[FLUSH_ALL].name = "flush-1024";
+    results[ARRAY_APPEND].name = "array-append";
+    results[HASH_MAP_INSERT].name = "hash-map-insert";
+    results[HASH_MAP_LOOKUP].name = "hash-map-lookup";
+    results[HASH_MAP_ITERATE].name = "hash-map-iterate";
+    results[HASH_MAP_REMOVE].name = "hash-map-remove";
+    
+    Buffers* compressed = rs_new0(Buffers, 1);
+    Buffers* raw = rs_new0(Buffers, 1);
+    RSNBT** nbts = rs_new0(RSNBT*, CHUNKS);
+    bool success = true;
+    
+    unsigned int i;
+    for (i = 0; i < iterations && success; i++)
+    {
+        fprintf(stderr, "run %u of %u ...\n", i + 1, iterations);
+        success = bench_read(path, compressed, &(results[READ])) &&
+            bench_decompress(compressed, raw, &(results[DECOMPRESS])) &&
+            bench_parse(raw, nbts, &(results[PARSE])) &&
+            bench_traverse(nbts, raw, &(results[TRAVERSE])) &&
+            bench_serialize(nbts, &(results[SERIALIZE])) &&
+            bench_compress(raw, &(results[COMPRESS])) &&
+            bench_flush(path, scratch, compressed, 1, &(results[FLUSH_1])) &&
+            bench_flush(path, scratch, compressed, 10, &(results[FLUSH_10])) &&
+            bench_flush(path, scratch, compressed, CHUNKS, &(results[FLUSH_ALL])) &&
+            bench_array_append(&(results[ARRAY_APPEND])) &&
+            bench_hash_map(&(results[HASH_MAP_INSERT]), &(results[HASH_MAP_LOOKUP]),
+                           &(results[HASH_MAP_ITERATE]), &(results[HASH_MAP_REMOVE]));
+    }
+    
+    if (success)
+    {
+        print_results(results, PHASES, iterations, seed);
+    } else {
+        fprintf(stderr, "benchmark failed\n");
+    }
+    
+    for (i = 0; i < CHUNKS; i++)
+    {
+        if (nbts[i])
+            rs_nbt_free(nbts[i]);
+    }
+    rs_free(nbts);
+    buffers_clear(compressed);
+    buffers_clear(raw);
+    rs_free(compressed);
+    rs_free(raw);
+    rs_free(path);
+    rs_free(scratch);
+    
+    return success ? 0 : 1;
+}
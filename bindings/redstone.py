@@ -5,7 +5,7 @@ import os.path
 
 import ctypes
 import ctypes.util
-from ctypes import c_int, c_uint, c_uint8, c_size_t, c_int64, c_uint32
+from ctypes import c_int, c_uint, c_uint8, c_size_t, c_int64, c_uint32, c_uint64
 from ctypes import c_double, c_float
 from ctypes import c_void_p, c_char_p, c_bool
 
@@ -102,7 +102,7 @@ class RedstoneMetaclass(type):
         obj = super(RedstoneMetaclass, cls).__new__(cls, name, bases, dct)
         
         for methname in dir(m):
-            if methname.startswith('__'):
+            if methname.startswith('_'):
                 continue
             res, args = getattr(m, methname)
             methname = methname.rstrip('_')
@@ -229,11 +229,42 @@ rs.rs_malloc.argtypes = [c_size_t]
 rs.rs_free.restype = None
 rs.rs_free.argtypes = [c_void_p]
 
+MEMORY_OTHER, MEMORY_TAG, MEMORY_LIST, MEMORY_NBT, MEMORY_COMPRESSION, MEMORY_REGION, MEMORY_SUBSYSTEMS = range(7)
+
+class _MemoryCounters(ctypes.Structure):
+    _fields_ = [('bytes', c_size_t), ('peak_bytes', c_size_t), ('in_use', c_size_t), ('allocations', c_size_t)]
+class _MemoryStats(ctypes.Structure):
+    _fields_ = [('enabled', c_bool), ('total', _MemoryCounters), ('subsystems', _MemoryCounters * MEMORY_SUBSYSTEMS)]
+
+rs.rs_memory_get_stats.restype = None
+rs.rs_memory_get_stats.argtypes = [ctypes.POINTER(_MemoryStats)]
+rs.rs_memory_get_subsystem_name.restype = c_char_p
+rs.rs_memory_get_subsystem_name.argtypes = [c_int]
+
+def get_memory_stats():
+    """Returns a dictionary mapping subsystem names (and 'total') to
+    dictionaries of counters, or None if RS_MEMORY_STATS was not set
+    to 1 when libredstone first allocated memory."""
+    stats = _MemoryStats()
+    rs.rs_memory_get_stats(ctypes.byref(stats))
+    if not stats.enabled:
+        return None
+    
+    def counters(c):
+        return dict((name, getattr(c, name)) for name, _ in _MemoryCounters._fields_)
+    ret = {'total': counters(stats.total)}
+    for i in range(MEMORY_SUBSYSTEMS):
+        name = rs.rs_memory_get_subsystem_name(i)
+        if not isinstance(name, str):
+            name = name.decode()
+        ret[name] = counters(stats.subsystems[i])
+    return ret
+
 ##
 ## compression.h
 ##
 
-AUTO_COMPRESSION, GZIP, ZLIB, UNKNOWN_COMPRESSION = range(4)
+AUTO_COMPRESSION, GZIP, ZLIB, UNKNOWN_COMPRESSION, UNCOMPRESSED, LZ4, ZSTD = range(7)
 
 rs.rs_decompress.restype = None
 rs.rs_decompress.argtypes = [c_int, c_void_p, c_size_t, c_void_p, c_void_p]
@@ -241,6 +272,12 @@ rs.rs_compress.restype = None
 rs.rs_compress.argtypes = [c_int, c_void_p, c_size_t, c_void_p, c_void_p]
 rs.rs_get_compression_type.restype = c_int
 rs.rs_get_compression_type.argtypes = [c_void_p, c_size_t]
+rs.rs_set_codec.restype = c_bool
+rs.rs_set_codec.argtypes = [c_char_p]
+rs.rs_get_codec.restype = c_char_p
+rs.rs_get_codec.argtypes = []
+rs.rs_get_available_codec.restype = c_char_p
+rs.rs_get_available_codec.argtypes = [c_uint]
 
 def _compress_helper(func, err, enc, indata):
     try:
@@ -272,6 +309,93 @@ def get_compression_type(data):
     inbuf = ctypes.create_string_buffer(data)
     return rs.rs_get_compression_type(inbuf, ctypes.sizeof(inbuf))
 
+def _codec_name(name):
+    if not isinstance(name, str):
+        name = name.decode()
+    return name
+
+def set_codec(name):
+    try:
+        encoded = name.encode()
+    except AttributeError:
+        encoded = name
+    if not rs.rs_set_codec(encoded):
+        raise ValueError("codec not available: %s" % (name,))
+def get_codec():
+    return _codec_name(rs.rs_get_codec())
+def get_available_codecs():
+    codecs = []
+    while True:
+        name = rs.rs_get_available_codec(len(codecs))
+        if name is None:
+            return codecs
+        codecs.append(_codec_name(name))
+
+class InflateStream(RedstoneObject):
+    class Methods:
+        _prefix_ = 'inflate_stream'
+        new = (c_void_p, [c_int])
+        free = (None, [c_void_p])
+        feed = (c_size_t, [c_void_p, c_void_p, c_size_t])
+        drain = (c_size_t, [c_void_p, c_void_p, c_size_t])
+        is_finished = (c_bool, [c_void_p])
+        has_failed = (c_bool, [c_void_p])
+    
+    @classmethod
+    def new(cls, enc=AUTO_COMPRESSION):
+        ptr = cls._new(enc)
+        if not ptr:
+            raise ValueError("unsupported compression type: %s" % (enc,))
+        return cls(ptr)
+    
+    def feed(self, data):
+        """Feed in as much of data as fits, and return how much that was."""
+        return self._feed(self, data, len(data))
+    def drain(self, size=65536):
+        """Return up to size bytes of output."""
+        buf = ctypes.create_string_buffer(size)
+        n = self._drain(self, buf, size)
+        if self._has_failed(self):
+            raise RuntimeError("could not decompress stream")
+        return buf.raw[:n]
+    @property
+    def finished(self):
+        return self._is_finished(self)
+
+class DeflateStream(RedstoneObject):
+    class Methods:
+        _prefix_ = 'deflate_stream'
+        new = (c_void_p, [c_int, c_void_p])
+        free = (None, [c_void_p])
+        feed = (c_size_t, [c_void_p, c_void_p, c_size_t])
+        finish = (None, [c_void_p])
+        drain = (c_size_t, [c_void_p, c_void_p, c_size_t])
+        is_finished = (c_bool, [c_void_p])
+        has_failed = (c_bool, [c_void_p])
+    
+    @classmethod
+    def new(cls, enc=GZIP):
+        ptr = cls._new(enc, None)
+        if not ptr:
+            raise ValueError("unsupported compression type: %s" % (enc,))
+        return cls(ptr)
+    
+    def feed(self, data):
+        """Feed in as much of data as fits, and return how much that was."""
+        return self._feed(self, data, len(data))
+    def finish(self):
+        self._finish(self)
+    def drain(self, size=65536):
+        """Return up to size bytes of output."""
+        buf = ctypes.create_string_buffer(size)
+        n = self._drain(self, buf, size)
+        if self._has_failed(self):
+            raise RuntimeError("could not compress stream")
+        return buf.raw[:n]
+    @property
+    def finished(self):
+        return self._is_finished(self)
+
 ##
 ## tag.h
 ##
@@ -285,6 +409,9 @@ class Tag(RedstoneCountedObject):
         # new, newv are C-conveniences, we don't need them
         ref = (None, [c_void_p])
         unref = (None, [c_void_p])
+        copy = (c_void_p, [c_void_p])
+        hash = (c_uint64, [c_void_p])
+        equal = (c_bool, [c_void_p, c_void_p])
         
         find = (c_void_p, [c_void_p, c_char_p])
         print_ = (None, [c_void_p, c_void_p])
@@ -354,6 +481,17 @@ class Tag(RedstoneCountedObject):
         return self._get_type(self)
     type = property(get_type)
     
+    def copy(self):
+        return Tag(self._copy(self), True)
+    
+    # structural comparisons -- == compares identity
+    def hash(self):
+        return self._hash(self)
+    def equal(self, other):
+        if not isinstance(other, Tag):
+            return False
+        return self._equal(self, other)
+    
     def find(self, name):
         try:
             name = name.encode()
@@ -689,6 +827,7 @@ class Region(RedstoneObject):
         set_chunk_data_full = (None, [c_void_p, c_uint8, c_uint8, c_void_p, c_uint32, c_int, c_uint32])
         clear_chunk = (None, [c_void_p, c_uint8, c_uint8])
         flush = (None, [c_void_p])
+        transcode = (c_bool, [c_void_p, c_void_p, c_int, c_void_p, c_uint])
     
     _destructor_ = "_close"
     
@@ -731,6 +870,11 @@ class Region(RedstoneObject):
         self._clear_chunk(self, x, z)
     def flush(self):
         self._flush(self)
+    def transcode(self, dst, enc, nthreads=0):
+        if not isinstance(dst, Region):
+            raise TypeError("given region is not a Region")
+        if not self._transcode(self, dst, enc, None, nthreads):
+            raise RuntimeError("could not convert every chunk")
 
 ##
 ## nbt.h
@@ -0,0 +1,127 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "array.h"
+
+#include "memory.h"
+#include "error.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define RS_ARRAY_MIN_CAPACITY 8
+
+RSArray* rs_array_new(size_t element_size)
+{
+    return rs_array_sized_new(element_size, 0);
+}
+
+RSArray* rs_array_sized_new(size_t element_size, size_t reserve)
+{
+    rs_return_val_if_fail(element_size > 0, NULL);
+    
+    RSArray* self = rs_new0(RSArray, 1);
+    self->element_size = element_size;
+    rs_array_reserve(self, reserve);
+    return self;
+}
+
+void rs_array_free(RSArray* self)
+{
+    rs_return_if_fail(self);
+    
+    rs_free(self->data);
+    rs_free(self);
+}
+
+void rs_array_reserve(RSArray* self, size_t reserve)
+{
+    rs_return_if_fail(self);
+    
+    if (reserve <= self->capacity)
+        return;
+    
+    /* double each time, so appending one at a time is cheap */
+    size_t capacity = self->capacity ? self->capacity : RS_ARRAY_MIN_CAPACITY;
+    while (capacity < reserve)
+        capacity *= 2;
+    
+    self->data = rs_realloc(self->data, capacity * self->element_size);
+    self->capacity = capacity;
+}
+
+void rs_array_set_length(RSArray* self, size_t length)
+{
+    rs_return_if_fail(self);
+    
+    if (length > self->length)
+    {
+        rs_array_reserve(self, length);
+        memset((uint8_t*)self->data + self->length * self->element_size, 0, (length - self->length) * self->element_size);
+    }
+    
+    self->length = length;
+}
+
+void rs_array_clear(RSArray* self)
+{
+    rs_return_if_fail(self);
+    self->length = 0;
+}
+
+void rs_array_append_vals(RSArray* self, const void* elements, size_t n)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(elements || n == 0);
+    
+    rs_array_reserve(self, self->length + n);
+    memcpy((uint8_t*)self->data + self->length * self->element_size, elements, n * self->element_size);
+    self->length += n;
+}
+
+void rs_array_insert_vals(RSArray* self, size_t i, const void* elements, size_t n)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(i <= self->length);
+    rs_return_if_fail(elements || n == 0);
+    
+    rs_array_reserve(self, self->length + n);
+    uint8_t* at = (uint8_t*)self->data + i * self->element_size;
+    memmove(at + n * self->element_size, at, (self->length - i) * self->element_size);
+    memcpy(at, elements, n * self->element_size);
+    self->length += n;
+}
+
+void rs_array_remove_index(RSArray* self, size_t i)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(i < self->length);
+    
+    uint8_t* at = (uint8_t*)self->data + i * self->element_size;
+    memmove(at, at + self->element_size, (self->length - i - 1) * self->element_size);
+    self->length--;
+}
+
+void rs_array_remove_index_fast(RSArray* self, size_t i)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(i < self->length);
+    
+    self->length--;
+    if (i != self->length)
+    {
+        uint8_t* data = self->data;
+        memcpy(data + i * self->element_size, data + self->length * self->element_size, self->element_size);
+    }
+}
+
+void rs_array_sort(RSArray* self, RSCompareFunction compare)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(compare);
+    
+    if (self->length > 1)
+        qsort(self->data, self->length, self->element_size, compare);
+}
@@ -0,0 +1,190 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_ARRAY_H_INCLUDED__
+#define __RS_ARRAY_H_INCLUDED__
+
+#include <stdlib.h>
+
+/**
+ * A comparison function, used in rs_array_sort().
+ *
+ * This works just like the comparison function given to qsort(): it
+ * gets pointers to two elements, and returns a negative number, zero,
+ * or a positive number if the first is less than, equal to, or
+ * greater than the second.
+ */
+typedef int (*RSCompareFunction)(const void* a, const void* b);
+
+/**
+ * A growable array.
+ *
+ * This stores elements of a fixed size back to back in one block of
+ * memory, which grows as needed. Unlike an RSList, finding its length
+ * or getting an element by index takes no time at all, and walking
+ * through it is friendly to the CPU cache.
+ *
+ * The data and length members may be read directly; use
+ * rs_array_index() to get at an element. Elements are copied in and
+ * out by value, so an array of pointers has an element size of
+ * sizeof(void*). Pointers into data are only good until the array is
+ * next changed.
+ */
+typedef struct _RSArray RSArray;
+struct _RSArray
+{
+    /** the elements, one after another */
+    void* data;
+    /** the number of elements */
+    size_t length;
+
+    /* private */
+    size_t element_size;
+    size_t capacity;
+};
+
+/**
+ * Create a new, empty array.
+ *
+ * \param element_size the size of each element, in bytes
+ * \return the new array
+ * \sa rs_array_sized_new, rs_array_free
+ */
+RSArray* rs_array_new(size_t element_size);
+
+/**
+ * Create a new, empty array with room for some elements.
+ *
+ * This is just like rs_array_new(), but it allocates space for
+ * reserve elements up front, so adding that many won't need to grow
+ * the array.
+ *
+ * \param element_size the size of each element, in bytes
+ * \param reserve how many elements to make room for
+ * \return the new array
+ * \sa rs_array_new, rs_array_reserve
+ */
+RSArray* rs_array_sized_new(size_t element_size, size_t reserve);
+
+/**
+ * Free an array.
+ *
+ * This frees the array and its element storage. Like rs_list_free(),
+ * it does not free anything the elements point to.
+ *
+ * \param self the array to free
+ * \sa rs_array_new
+ */
+void rs_array_free(RSArray* self);
+
+/**
+ * Make sure an array has room for a number of elements.
+ *
+ * \param self the array
+ * \param reserve the number of elements, in total, to make room for
+ */
+void rs_array_reserve(RSArray* self, size_t reserve);
+
+/**
+ * Change the number of elements in an array.
+ *
+ * New elements are filled with zeros.
+ *
+ * \param self the array
+ * \param length the new length
+ * \sa rs_array_clear
+ */
+void rs_array_set_length(RSArray* self, size_t length);
+
+/**
+ * Remove all elements from an array.
+ *
+ * The array keeps its storage, so it can be filled again without
+ * growing.
+ *
+ * \param self the array
+ * \sa rs_array_set_length
+ */
+void rs_array_clear(RSArray* self);
+
+/**
+ * Add elements to the end of an array.
+ *
+ * \param self the array
+ * \param elements the elements to copy in
+ * \param n the number of elements
+ * \sa rs_array_append, rs_array_insert_vals
+ */
+void rs_array_append_vals(RSArray* self, const void* elements, size_t n);
+
+/**
+ * Insert elements into the middle of an array.
+ *
+ * Elements at index i and above are moved up to make room.
+ *
+ * \param self the array
+ * \param i the index to insert at, no more than the length
+ * \param elements the elements to copy in
+ * \param n the number of elements
+ * \sa rs_array_append_vals
+ */
+void rs_array_insert_vals(RSArray* self, size_t i, const void* elements, size_t n);
+
+/**
+ * Remove an element from an array.
+ *
+ * Elements after it are moved down to fill the gap, so this keeps the
+ * order of the array.
+ *
+ * \param self the array
+ * \param i the index of the element to remove
+ * \sa rs_array_remove_index_fast
+ */
+void rs_array_remove_index(RSArray* self, size_t i);
+
+/**
+ * Remove an element from an array, without keeping the order.
+ *
+ * The last element is moved into the gap, so this takes the same time
+ * however long the array is.
+ *
+ * \param self the array
+ * \param i the index of the element to remove
+ * \sa rs_array_remove_index
+ */
+void rs_array_remove_index_fast(RSArray* self, size_t i);
+
+/**
+ * Sort an array.
+ *
+ * \param self the array
+ * \param compare the function used to compare two elements
+ */
+void rs_array_sort(RSArray* self, RSCompareFunction compare);
+
+/**
+ * Add one element to the end of an array.
+ *
+ * The element must be an lvalue, since its address is taken.
+ *
+ * \param array the array
+ * \param element the element to copy in
+ * \sa rs_array_append_vals
+ */
+#define rs_array_append(array, element) rs_array_append_vals((array), &(element), 1)
+
+/**
+ * Get an element of an array.
+ *
+ * This can be assigned to as well as read. The index is not checked.
+ *
+ * \param array the array
+ * \param type the type of the elements
+ * \param i the index of the element
+ * \return the element
+ */
+#define rs_array_index(array, type, i) (((type*)((array)->data))[(i)])
+
+#endif /* __RS_ARRAY_H_INCLUDED__ */
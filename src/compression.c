@@ -3,146 +3,280 @@
  * See redstone.h for details.
  */
 
+#define RS_MEMORY_SUBSYSTEM RS_MEMORY_COMPRESSION
+
+#include "config.h"
 #include "compression.h"
 
 #include "error.h"
+#include "memory.h"
+#include "trace.h"
 
 #include <zlib.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
 
 /* nice, hefty 256kb buffers for storing uncompressed data */
 #define RS_Z_BUFFER_SIZE (1024 * 256)
 /* significantly less hefty 16kb buffers for compressed data */
 #define RS_Z_SMALL_BUFFER_SIZE (1024 * 16)
 
-void rs_decompress(RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** outdata, size_t* outdatalen)
+/* smallest buffer rs_decompress starts out with */
+#define RS_Z_MIN_OUTPUT_SIZE 1024
+/* deflate can't do better than about 1032:1 */
+#define RS_Z_MAX_RATIO 1032
+/* when the size isn't known -- chunks usually shrink to a fifth or so */
+#define RS_Z_GUESS_RATIO 4
+/* 10 byte header, 8 byte trailer */
+#define RS_Z_GZIP_MIN_SIZE 18
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_PTHREAD) && defined(HAVE_TLS)
+#define RS_Z_THREAD_CONTEXTS
+#endif
+
+/* how a codec's decompress call went */
+typedef enum
+{
+    RS_CODEC_OK,
+    /* the output didn't fit, and the buffer couldn't grow */
+    RS_CODEC_FULL,
+    RS_CODEC_BAD_DATA,
+} RSCodecResult;
+
+/* a compression backend. Every backend reads and writes plain RFC 1950
+ * (zlib) and RFC 1952 (gzip) streams, so they can be mixed freely --
+ * they only differ in speed, and in exactly which bytes they
+ * compress to.
+ *
+ * Backends keep whatever state they like in the contexts made by
+ * *_new, which are only used by one thread at a time, and enc is
+ * always either RS_GZIP or RS_ZLIB.
+ */
+typedef struct
+{
+    const char* name;
+    
+    void* (*decompressor_new)(void);
+    void (*decompressor_free)(void* state);
+    /* decompresses into *bufp, which has room for *capp bytes, and
+     * stores the length written in *outlen. If grow is set, the buffer
+     * is rs_realloc'd (and *capp updated) when it fills up.
+     */
+    RSCodecResult (*decompress)(void* state, RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** bufp, size_t* capp, bool grow, size_t* outlen);
+    
+    void* (*compressor_new)(void);
+    void (*compressor_free)(void* state);
+    /* compresses into a new rs_malloc'd buffer, returns false on error */
+    bool (*compress)(void* state, RSCompressionType enc, const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen);
+    /* whether compress honors these options -- if not, zlib is used
+     * instead. NULL means it honors all of them
+     */
+    bool (*accepts)(const RSCompressionOptions* options);
+} RSCodec;
+
+/*
+ * zlib (or zlib-ng, built in zlib-compatible mode) streaming backend
+ */
+
+typedef struct
 {
     z_stream strm;
+    bool initialized;
+} RSZlibDecompressor;
+
+/* deflate can't switch between gzip and zlib headers on reset, so
+ * keep a stream for each
+ */
+#define RS_Z_GZIP_STREAM 0
+#define RS_Z_ZLIB_STREAM 1
+
+typedef struct
+{
+    z_stream strm[2];
+    bool initialized[2];
+    /* what each stream was last set up with */
+    RSCompressionOptions options[2];
+} RSZlibCompressor;
+
+static void* _rs_zlib_decompressor_new(void)
+{
+    return rs_new0(RSZlibDecompressor, 1);
+}
+
+static void _rs_zlib_decompressor_free(void* state)
+{
+    RSZlibDecompressor* self = state;
+    if (self->initialized)
+        inflateEnd(&(self->strm));
+    rs_free(self);
+}
+
+/* gets the zlib state ready for a new stream */
+static int _rs_zlib_decompressor_reset(RSZlibDecompressor* self, RSCompressionType enc)
+{
+    z_stream* strm = &(self->strm);
     int ret;
     
-    /* initialize output to NULL, so we can check later
-       also, this means error */
-    *outdata = NULL;
-    *outdatalen = 0;
-    
-    /* guess compression type */
-    if (enc == RS_AUTO_COMPRESSION)
-        enc = rs_get_compression_type(gzdata, gzdatalen);
+    /* magick window bits to handle gzip headers (or not!) */
+    int window_bits = (enc == RS_GZIP) ? (16 + MAX_WBITS) : MAX_WBITS;
     
-    /* if it's not GZIP or ZLIB, return error */
-    if (enc != RS_GZIP && enc != RS_ZLIB)
-        return;
+    if (self->initialized)
+    {
+        /* reuse the zlib state from last time */
+        return inflateReset2(strm, window_bits);
+    }
     
-    /* our output buffer */
-    uint8_t output_buffer[RS_Z_BUFFER_SIZE];
-    size_t output_write_head = 0;
+    strm->zalloc = Z_NULL;
+    strm->zfree = Z_NULL;
+    strm->opaque = Z_NULL;
+    strm->avail_in = 0;
+    strm->next_in = Z_NULL;
+    ret = inflateInit2(strm, window_bits);
+    self->initialized = (ret == Z_OK);
+    return ret;
+}
+
+/* inflates straight into the output buffer, growing it as needed */
+static RSCodecResult _rs_zlib_decompress(void* state, RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** bufp, size_t* capp, bool grow, size_t* outlen)
+{
+    RSZlibDecompressor* self = state;
+    z_stream* strm = &(self->strm);
+    int ret;
     
-    /* initialize zlib state */
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    strm.avail_in = gzdatalen;
-    strm.next_in = gzdata;
+    *outlen = 0;
     
-    /* magick deflate init to handle gzip headers (or not!) */
-    ret = inflateInit2(&strm, (enc == RS_GZIP) ? (16 + MAX_WBITS) : MAX_WBITS);
+    ret = _rs_zlib_decompressor_reset(self, enc);
     if (ret != Z_OK)
     {
         /* data could not be inflated */
-        return;
+        return RS_CODEC_BAD_DATA;
     }
     
-    /* loop continues until the output buffer is not full */
-    do
+    strm->avail_in = gzdatalen;
+    strm->next_in = gzdata;
+    strm->avail_out = *capp;
+    strm->next_out = *bufp;
+    
+    while (true)
     {
-        /* set up the output buffer */
-        strm.avail_out = RS_Z_BUFFER_SIZE;
-        strm.next_out = output_buffer;
-        
         /* inflate as much as possible */
-        ret = inflate(&strm, Z_NO_FLUSH);
+        ret = inflate(strm, Z_NO_FLUSH);
+        *outlen = strm->next_out - *bufp;
         
         /* make sure we're not clobbered */
         if (ret == Z_STREAM_ERROR)
             rs_error("error decompressing stream"); /* FIXME */
         
-        /* handle errors */
-        switch (ret)
-        {
-        case Z_NEED_DICT:
-        case Z_DATA_ERROR:
-            /* level data is not valid gzip data */
-            inflateEnd(&strm);
-            if (*outdata)
-            {
-                rs_free(*outdata);
-                *outdata = NULL;
-                *outdatalen = 0;
-            }
-            return;
-        case Z_MEM_ERROR:
-            /* ran out of memory */
-            inflateEnd(&strm);
-            if (*outdata)
-            {
-                rs_free(*outdata);
-                *outdata = NULL;
-                *outdatalen = 0;
-            }
-            return;
-        };
-        
-        size_t avail = RS_Z_BUFFER_SIZE - strm.avail_out;
+        if (ret == Z_OK)
+            continue;
         
-        /* do something with output_buffer */
+        if (ret == Z_STREAM_END)
+            return RS_CODEC_OK;
         
-        if (*outdata == NULL)
+        if (ret == Z_BUF_ERROR && strm->avail_out == 0)
         {
-            *outdatalen = avail;
-            *outdata = rs_malloc(avail);
-            output_write_head = 0;            
-        } else {
-            *outdatalen += avail;
-            *outdata = rs_realloc(*outdata, *outdatalen);
+            if (!grow)
+                return RS_CODEC_FULL;
+            
+            /* out of room, so make some more */
+            *capp *= 2;
+            *bufp = rs_realloc(*bufp, *capp);
+            strm->next_out = *bufp + *outlen;
+            strm->avail_out = *capp - *outlen;
+            continue;
         }
         
-        /* write the data after it */
-        memcpy(*outdata + output_write_head, output_buffer, avail);
-        output_write_head += avail;
-    } while (strm.avail_out == 0);
-    
-    /* free zlib info */
-    inflateEnd(&strm);
+        /* an error -- the state is reset before it's used again */
+        return RS_CODEC_BAD_DATA;
+    }
+}
+
+static void* _rs_zlib_compressor_new(void)
+{
+    return rs_new0(RSZlibCompressor, 1);
+}
+
+static void _rs_zlib_compressor_free(void* state)
+{
+    RSZlibCompressor* self = state;
+    if (self->initialized[RS_Z_GZIP_STREAM])
+        deflateEnd(&(self->strm[RS_Z_GZIP_STREAM]));
+    if (self->initialized[RS_Z_ZLIB_STREAM])
+        deflateEnd(&(self->strm[RS_Z_ZLIB_STREAM]));
+    rs_free(self);
+}
+
+/* gets a deflate stream ready, reusing as much as the options allow */
+static int _rs_zlib_compressor_reset(RSZlibCompressor* self, unsigned int which, RSCompressionType enc, const RSCompressionOptions* options)
+{
+    z_stream* strm = &(self->strm[which]);
+    RSCompressionOptions* old = &(self->options[which]);
+    int ret;
     
-    /* we ran out of input, so we better be at the end of the stream */
-    if (ret != Z_STREAM_END)
+    if (self->initialized[which])
     {
-            /* level data is not valid gzip data */
-            if (*outdata)
+        /* level and strategy can change on the fly, but memory level
+         * and window size need a whole new stream
+         */
+        if (old->mem_level == options->mem_level && old->window_bits == options->window_bits)
+        {
+            /* reuse the zlib state from last time */
+            ret = deflateReset(strm);
+            if (ret == Z_OK && (old->level != options->level || old->strategy != options->strategy))
             {
-                rs_free(*outdata);
-                *outdata = NULL;
-                *outdatalen = 0;
+                ret = deflateParams(strm, options->level, options->strategy);
+                if (ret == Z_OK)
+                    *old = *options;
             }
-            return;
+            return ret;
+        }
+        
+        deflateEnd(strm);
+        self->initialized[which] = false;
     }
     
-    /* our data is correct and properly placed, so... */
+    strm->zalloc = Z_NULL;
+    strm->zfree = Z_NULL;
+    strm->opaque = Z_NULL;
+    
+    /* start deflating, with magick gzip arguments (or not) */
+    ret = deflateInit2(strm, options->level, Z_DEFLATED,
+                       (enc == RS_GZIP) ? (16 + options->window_bits) : options->window_bits,
+                       options->mem_level, options->strategy);
+    self->initialized[which] = (ret == Z_OK);
+    *old = *options;
+    return ret;
 }
 
-void rs_compress(RSCompressionType enc, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen)
+static bool _rs_zlib_compress(void* state, RSCompressionType enc, const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen)
 {
-    z_stream strm;
+    RSZlibCompressor* self = state;
     int ret;
     /* keep track of our flush state */
     int flush;
     
-    /* initialize our output */
-    *gzdata = NULL;
-    *gzdatalen = 0;
-    
-    /* return error if not gzip or zlib */
-    if (enc != RS_GZIP && enc != RS_ZLIB)
-        return;
+    unsigned int which = (enc == RS_GZIP) ? RS_Z_GZIP_STREAM : RS_Z_ZLIB_STREAM;
+    z_stream* strm = &(self->strm[which]);
     
     /* the buffer we read from -- data is copied in to it */
     uint8_t input_buffer[RS_Z_BUFFER_SIZE];
@@ -152,22 +286,11 @@ void rs_compress(RSCompressionType enc, uint8_t* rawdata, size_t rawdatalen, uin
     /* temporary storage for gzip'd output */
     uint8_t output_buffer[RS_Z_SMALL_BUFFER_SIZE];
     
-    /* initialize zlib state */
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    
-    /* start deflating, with magick gzip arguments (or not) */
-    /* RLE -- significantly faster, but very slightly less space efficient */
-    /* compression level 1 gives OK results faster -- bandwidth is cheap, latency is not */
-    /* FIXME configurable settings! */
-    ret = deflateInit2(&strm, 1, Z_DEFLATED,
-                       (enc == RS_GZIP) ? (16 + MAX_WBITS) : MAX_WBITS,
-                       8, Z_RLE);
+    ret = _rs_zlib_compressor_reset(self, which, enc, options);
     if (ret != Z_OK)
     {
         /* level data could not be deflated */
-        return;
+        return false;
     }
     
     /* shovel in data until we run out */
@@ -177,10 +300,10 @@ void rs_compress(RSCompressionType enc, uint8_t* rawdata, size_t rawdatalen, uin
         memcpy(input_buffer, &rawdata[input_read_head], copylen);
         input_read_head += copylen;
         
-        strm.avail_in = copylen;
+        strm->avail_in = copylen;
 
         /* set up the input pointer */
-        strm.next_in = input_buffer;
+        strm->next_in = input_buffer;
         
         /* set flush if this is the end */
         flush = (input_read_head == rawdatalen) ? Z_FINISH : Z_NO_FLUSH;
@@ -189,53 +312,1902 @@ void rs_compress(RSCompressionType enc, uint8_t* rawdata, size_t rawdatalen, uin
         do
         {
             /* set up output buffer */
-            strm.next_out = output_buffer;
-            strm.avail_out = RS_Z_SMALL_BUFFER_SIZE;
+            strm->next_out = output_buffer;
+            strm->avail_out = RS_Z_SMALL_BUFFER_SIZE;
             
             /* deflate */
-            ret = deflate(&strm, flush);
+            ret = deflate(strm, flush);
             
             /* make sure we're not corrupted */
-            rs_return_if_fail(ret != Z_STREAM_ERROR);
+            rs_return_val_if_fail(ret != Z_STREAM_ERROR, false);
             
             /* FIXME error checking? */
             
             /* available output */
-            size_t avail = RS_Z_SMALL_BUFFER_SIZE - strm.avail_out;
+            size_t avail = RS_Z_SMALL_BUFFER_SIZE - strm->avail_out;
             
             /* copy output buffer to the end of gzdata */
             *gzdata = rs_realloc(*gzdata, *gzdatalen + avail);
             memcpy(*gzdata + *gzdatalen, output_buffer, avail);
             *gzdatalen += avail;
-        } while (strm.avail_out == 0);
+        } while (strm->avail_out == 0);
         
         /* be sure we used up all input */
-        rs_return_if_fail(strm.avail_in == 0);
+        rs_return_val_if_fail(strm->avail_in == 0, false);
     } while (flush != Z_FINISH);
     
     /* we've finished the stream */
-    rs_return_if_fail(ret == Z_STREAM_END);
+    rs_return_val_if_fail(ret == Z_STREAM_END, false);
+    return true;
+}
+
+static const RSCodec zlib_codec = {
+#ifdef ZLIBNG_VERSION
+    "zlib-ng",
+#else
+    "zlib",
+#endif
+    _rs_zlib_decompressor_new,
+    _rs_zlib_decompressor_free,
+    _rs_zlib_decompress,
+    _rs_zlib_compressor_new,
+    _rs_zlib_compressor_free,
+    _rs_zlib_compress,
+    NULL,
+};
+
+#ifdef HAVE_LIBDEFLATE
+
+/*
+ * libdeflate one-shot backend -- much faster on whole buffers, but it
+ * can't pick up where it left off, so it starts over when the output
+ * doesn't fit
+ */
+
+static void* _rs_libdeflate_decompressor_new(void)
+{
+    return libdeflate_alloc_decompressor();
+}
+
+static void _rs_libdeflate_decompressor_free(void* state)
+{
+    libdeflate_free_decompressor(state);
+}
+
+static RSCodecResult _rs_libdeflate_decompress(void* state, RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** bufp, size_t* capp, bool grow, size_t* outlen)
+{
+    enum libdeflate_result ret;
     
-    /* clean up zlib */
-    deflateEnd(&strm);
+    while (true)
+    {
+        if (enc == RS_GZIP)
+        {
+            ret = libdeflate_gzip_decompress(state, gzdata, gzdatalen, *bufp, *capp, outlen);
+        } else {
+            ret = libdeflate_zlib_decompress(state, gzdata, gzdatalen, *bufp, *capp, outlen);
+        }
+        
+        if (ret == LIBDEFLATE_SUCCESS)
+            return RS_CODEC_OK;
+        
+        if (ret != LIBDEFLATE_INSUFFICIENT_SPACE)
+        {
+            *outlen = 0;
+            return RS_CODEC_BAD_DATA;
+        }
+        
+        if (!grow)
+        {
+            *outlen = *capp;
+            return RS_CODEC_FULL;
+        }
+        
+        *capp *= 2;
+        *bufp = rs_realloc(*bufp, *capp);
+    }
 }
 
-RSCompressionType rs_get_compression_type(void* data, size_t len)
+/* libdeflate compressors are made for one level, so keep track */
+typedef struct
 {
-    if (data == NULL || len < 3)
-        return RS_UNKNOWN_COMPRESSION;
+    struct libdeflate_compressor* compressor;
+    int level;
+} RSLibdeflateCompressor;
+
+static void* _rs_libdeflate_compressor_new(void)
+{
+    return rs_new0(RSLibdeflateCompressor, 1);
+}
+
+static void _rs_libdeflate_compressor_free(void* state)
+{
+    RSLibdeflateCompressor* self = state;
+    if (self->compressor)
+        libdeflate_free_compressor(self->compressor);
+    rs_free(self);
+}
+
+static bool _rs_libdeflate_compress(void* state, RSCompressionType enc, const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen)
+{
+    RSLibdeflateCompressor* self = state;
+    size_t bound, len;
+    uint8_t* buf;
     
-    uint8_t* bytes = (uint8_t*)data;
+    /* libdeflate's default is 6, like zlib's */
+    int level = (options->level < 0) ? 6 : options->level;
+    if (!self->compressor || self->level != level)
+    {
+        if (self->compressor)
+            libdeflate_free_compressor(self->compressor);
+        self->compressor = libdeflate_alloc_compressor(level);
+        self->level = level;
+        if (!self->compressor)
+            return false;
+    }
+    struct libdeflate_compressor* compressor = self->compressor;
     
-    /* if you're confused about this code, go check out the RFCs! */
+    if (enc == RS_GZIP)
+    {
+        bound = libdeflate_gzip_compress_bound(compressor, rawdatalen);
+        buf = rs_malloc(bound);
+        len = libdeflate_gzip_compress(compressor, rawdata, rawdatalen, buf, bound);
+    } else {
+        bound = libdeflate_zlib_compress_bound(compressor, rawdatalen);
+        buf = rs_malloc(bound);
+        len = libdeflate_zlib_compress(compressor, rawdata, rawdatalen, buf, bound);
+    }
     
-    /* zlib check -- compression type 8, and checksum must work out */
-    if ((bytes[0] & 0x0F) == 0x08 && (((int)bytes[0] << 8) + (int)bytes[1]) % 31 == 0)
-        return RS_ZLIB;
+    /* can't happen, given the bound */
+    if (len == 0)
+    {
+        rs_free(buf);
+        return false;
+    }
     
-    /* gzip check -- header bytes and compression type 8 */
-    if (bytes[0] == 0x1f && bytes[1] == 0x8b && bytes[2] == 0x08)
-        return RS_GZIP;
+    *gzdata = rs_realloc(buf, len);
+    *gzdatalen = len;
+    return true;
+}
+
+/* libdeflate only has levels. Its fast levels already beat zlib's RLE
+ * strategy (the default) at its own game, so that is let through, but
+ * anything else it would quietly ignore goes to zlib
+ */
+static bool _rs_libdeflate_accepts(const RSCompressionOptions* options)
+{
+    if (options->strategy != RS_STRATEGY_DEFAULT && options->strategy != RS_STRATEGY_RLE)
+        return false;
+    return options->mem_level == 8 && options->window_bits == MAX_WBITS;
+}
+
+static const RSCodec libdeflate_codec = {
+    "libdeflate",
+    _rs_libdeflate_decompressor_new,
+    _rs_libdeflate_decompressor_free,
+    _rs_libdeflate_decompress,
+    _rs_libdeflate_compressor_new,
+    _rs_libdeflate_compressor_free,
+    _rs_libdeflate_compress,
+    _rs_libdeflate_accepts,
+};
+
+#endif /* HAVE_LIBDEFLATE */
+
+/*
+ * LZ4 block streams, as written by lz4-java's LZ4BlockOutputStream.
+ * This isn't deflate, so it's used for RS_LZ4 whichever codec is
+ * selected. Blocks are handed to liblz4 if it's around, and to a
+ * simple built-in implementation otherwise.
+ */
+
+/* every block starts with "LZ4Block", then a token byte, and the
+ * compressed length, length, and checksum as little-endian 32-bit ints
+ */
+#define RS_LZ4_MAGIC "LZ4Block"
+#define RS_LZ4_MAGIC_SIZE 8
+#define RS_LZ4_HEADER_SIZE 21
+/* the token is the method, ORed with the block size level */
+#define RS_LZ4_METHOD_MASK 0xf0
+#define RS_LZ4_METHOD_RAW 0x10
+#define RS_LZ4_METHOD_LZ4 0x20
+#define RS_LZ4_LEVEL_MASK 0x0f
+#define RS_LZ4_LEVEL_BASE 10
+/* each byte of an LZ4 block can stand for at most 255 bytes of output
+ * (a match length byte), plus a little for the first token
+ */
+#define RS_LZ4_MAX_RATIO 255
+#define RS_LZ4_MAX_EXTRA 16
+/* 64kb blocks, like lz4-java's default, which is level 6 */
+#define RS_LZ4_BLOCK_SIZE (1024 * 64)
+#define RS_LZ4_BLOCK_LEVEL 6
+/* checksums are xxhash32 with this seed, with the top 4 bits dropped */
+#define RS_LZ4_SEED 0x9747b28c
+#define RS_LZ4_CHECKSUM_MASK 0x0fffffff
+
+static inline uint32_t _rs_lz4_read32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void _rs_lz4_write32(uint8_t* p, uint32_t val)
+{
+    p[0] = val & 0xff;
+    p[1] = (val >> 8) & 0xff;
+    p[2] = (val >> 16) & 0xff;
+    p[3] = (val >> 24) & 0xff;
+}
+
+#define RS_XXH_PRIME1 2654435761U
+#define RS_XXH_PRIME2 2246822519U
+#define RS_XXH_PRIME3 3266489917U
+#define RS_XXH_PRIME4 668265263U
+#define RS_XXH_PRIME5 374761393U
+#define RS_XXH_ROTL(x, r) (((x) << (r)) | ((x) >> (32 - (r))))
+
+/* xxhash32, for the block checksums */
+static uint32_t _rs_xxh32(const uint8_t* data, size_t len, uint32_t seed)
+{
+    const uint8_t* end = data + len;
+    uint32_t h;
+    
+    if (len >= 16)
+    {
+        uint32_t v1 = seed + RS_XXH_PRIME1 + RS_XXH_PRIME2;
+        uint32_t v2 = seed + RS_XXH_PRIME2;
+        uint32_t v3 = seed;
+        uint32_t v4 = seed - RS_XXH_PRIME1;
+        
+        for (; end - data >= 16; data += 16)
+        {
+            v1 = RS_XXH_ROTL(v1 + _rs_lz4_read32(data) * RS_XXH_PRIME2, 13) * RS_XXH_PRIME1;
+            v2 = RS_XXH_ROTL(v2 + _rs_lz4_read32(data + 4) * RS_XXH_PRIME2, 13) * RS_XXH_PRIME1;
+            v3 = RS_XXH_ROTL(v3 + _rs_lz4_read32(data + 8) * RS_XXH_PRIME2, 13) * RS_XXH_PRIME1;
+            v4 = RS_XXH_ROTL(v4 + _rs_lz4_read32(data + 12) * RS_XXH_PRIME2, 13) * RS_XXH_PRIME1;
+        }
+        
+        h = RS_XXH_ROTL(v1, 1) + RS_XXH_ROTL(v2, 7) + RS_XXH_ROTL(v3, 12) + RS_XXH_ROTL(v4, 18);
+    } else {
+        h = seed + RS_XXH_PRIME5;
+    }
+    
+    h += (uint32_t)len;
+    for (; end - data >= 4; data += 4)
+        h = RS_XXH_ROTL(h + _rs_lz4_read32(data) * RS_XXH_PRIME3, 17) * RS_XXH_PRIME4;
+    for (; data < end; data++)
+        h = RS_XXH_ROTL(h + *data * RS_XXH_PRIME5, 11) * RS_XXH_PRIME1;
+    
+    h ^= h >> 15;
+    h *= RS_XXH_PRIME2;
+    h ^= h >> 13;
+    h *= RS_XXH_PRIME3;
+    h ^= h >> 16;
+    return h;
+}
+
+#ifdef HAVE_LZ4
+
+static bool _rs_lz4_decompress_block(const uint8_t* src, size_t srclen, uint8_t* dst, size_t dstlen)
+{
+    return LZ4_decompress_safe((const char*)src, (char*)dst, srclen, dstlen) == (int)dstlen;
+}
+
+static size_t _rs_lz4_compress_block(const uint8_t* src, size_t srclen, uint8_t* dst, size_t dstcap)
+{
+    return LZ4_compress_default((const char*)src, (char*)dst, srclen, dstcap);
+}
+
+#else /* !HAVE_LZ4 */
+
+/* LZ4 block format rules */
+#define RS_LZ4_MIN_MATCH 4
+/* the last 5 bytes are always literals */
+#define RS_LZ4_LAST_LITERALS 5
+/* and the last match starts at least 12 bytes before the end */
+#define RS_LZ4_MATCH_LIMIT 12
+#define RS_LZ4_MAX_OFFSET 65535
+#define RS_LZ4_HASH_BITS 12
+
+/* reads the rest of a length that didn't fit in the token */
+static inline bool _rs_lz4_read_length(const uint8_t** ip, const uint8_t* end, size_t* len)
+{
+    uint8_t byte;
+    do
+    {
+        if (*ip >= end)
+            return false;
+        byte = *((*ip)++);
+        *len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/* decodes one block, which must come out to exactly dstlen bytes */
+static bool _rs_lz4_decompress_block(const uint8_t* src, size_t srclen, uint8_t* dst, size_t dstlen)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + srclen;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dstlen;
+    
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+        
+        /* literals */
+        size_t litlen = token >> 4;
+        if (litlen == 15 && !_rs_lz4_read_length(&ip, iend, &litlen))
+            return false;
+        if (litlen > (size_t)(iend - ip) || litlen > (size_t)(oend - op))
+            return false;
+        memcpy(op, ip, litlen);
+        ip += litlen;
+        op += litlen;
+        
+        /* the last sequence has no match */
+        if (ip == iend)
+            break;
+        
+        /* the match, which may overlap what it's copying */
+        if (iend - ip < 2)
+            return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return false;
+        
+        size_t matchlen = token & 0x0f;
+        if (matchlen == 15 && !_rs_lz4_read_length(&ip, iend, &matchlen))
+            return false;
+        matchlen += RS_LZ4_MIN_MATCH;
+        if (matchlen > (size_t)(oend - op))
+            return false;
+        
+        const uint8_t* match = op - offset;
+        while (matchlen--)
+            *op++ = *match++;
+    }
+    
+    return op == oend;
+}
+
+/* writes a length that didn't fit in the token */
+static inline void _rs_lz4_write_length(uint8_t** op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *((*op)++) = 255;
+    *((*op)++) = len;
+}
+
+/* writes one sequence (matchlen is 0 for the last), or returns false
+ * if it won't fit
+ */
+static bool _rs_lz4_write_sequence(uint8_t** op, uint8_t* oend, const uint8_t* literals, size_t litlen, size_t offset, size_t matchlen)
+{
+    /* worst case, with both lengths extended */
+    size_t needed = 1 + litlen / 255 + 1 + litlen + 2 + matchlen / 255 + 1;
+    if (needed > (size_t)(oend - *op))
+        return false;
+    
+    uint8_t* token = (*op)++;
+    *token = (litlen < 15 ? litlen : 15) << 4;
+    if (litlen >= 15)
+        _rs_lz4_write_length(op, litlen - 15);
+    memcpy(*op, literals, litlen);
+    *op += litlen;
+    
+    if (matchlen == 0)
+        return true;
+    
+    *((*op)++) = offset & 0xff;
+    *((*op)++) = offset >> 8;
+    matchlen -= RS_LZ4_MIN_MATCH;
+    *token |= (matchlen < 15 ? matchlen : 15);
+    if (matchlen >= 15)
+        _rs_lz4_write_length(op, matchlen - 15);
+    return true;
+}
+
+/* greedy, single-probe compression -- nowhere near as good as liblz4,
+ * but still far faster than deflate. Returns 0 if the output doesn't
+ * fit in dstcap.
+ */
+static size_t _rs_lz4_compress_block(const uint8_t* src, size_t srclen, uint8_t* dst, size_t dstcap)
+{
+    /* blocks are 64kb at most, so positions fit in 16 bits */
+    uint16_t table[1 << RS_LZ4_HASH_BITS];
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dstcap;
+    size_t ip = 0;
+    size_t anchor = 0;
+    
+    memset(table, 0, sizeof(table));
+    
+    while (ip + RS_LZ4_MATCH_LIMIT <= srclen)
+    {
+        uint32_t seq = _rs_lz4_read32(src + ip);
+        uint32_t hash = (seq * RS_XXH_PRIME1) >> (32 - RS_LZ4_HASH_BITS);
+        size_t ref = table[hash];
+        table[hash] = ip;
+        
+        if (ref >= ip || ip - ref > RS_LZ4_MAX_OFFSET || _rs_lz4_read32(src + ref) != seq)
+        {
+            ip++;
+            continue;
+        }
+        
+        size_t matchlen = RS_LZ4_MIN_MATCH;
+        while (ip + matchlen < srclen - RS_LZ4_LAST_LITERALS && src[ref + matchlen] == src[ip + matchlen])
+            matchlen++;
+        
+        if (!_rs_lz4_write_sequence(&op, oend, src + anchor, ip - anchor, ip - ref, matchlen))
+            return 0;
+        
+        ip += matchlen;
+        anchor = ip;
+    }
+    
+    if (!_rs_lz4_write_sequence(&op, oend, src + anchor, srclen - anchor, 0, 0))
+        return 0;
+    return op - dst;
+}
+
+#endif /* HAVE_LZ4 */
+
+/* walks the block headers to find the total length, returns false if
+ * they don't make sense -- including lengths that the compressed data
+ * couldn't possibly expand to, so a corrupt header can't ask for an
+ * enormous buffer
+ */
+static bool _rs_lz4_get_size(const uint8_t* data, size_t len, size_t* size)
+{
+    size_t max_size = len * RS_LZ4_MAX_RATIO;
+    bool seen_block = false;
+    *size = 0;
+    
+    while (len > 0 || !seen_block)
+    {
+        if (len < RS_LZ4_HEADER_SIZE || memcmp(data, RS_LZ4_MAGIC, RS_LZ4_MAGIC_SIZE) != 0)
+            return false;
+        
+        uint8_t method = data[8] & RS_LZ4_METHOD_MASK;
+        uint8_t level = data[8] & RS_LZ4_LEVEL_MASK;
+        uint32_t clen = _rs_lz4_read32(data + 9);
+        uint32_t dlen = _rs_lz4_read32(data + 13);
+        
+        if (method != RS_LZ4_METHOD_RAW && method != RS_LZ4_METHOD_LZ4)
+            return false;
+        if (dlen > (1U << (RS_LZ4_LEVEL_BASE + level)) || clen > len - RS_LZ4_HEADER_SIZE)
+            return false;
+        if (method == RS_LZ4_METHOD_RAW && clen != dlen)
+            return false;
+        if (dlen > (uint64_t)clen * RS_LZ4_MAX_RATIO + RS_LZ4_MAX_EXTRA)
+            return false;
+        
+        seen_block = true;
+        
+        /* an empty block marks the end */
+        if (dlen == 0)
+            break;
+        
+        *size += dlen;
+        if (*size > max_size)
+            return false;
+        data += RS_LZ4_HEADER_SIZE + clen;
+        len -= RS_LZ4_HEADER_SIZE + clen;
+    }
+    
+    return true;
+}
+
+/* makes sure *bufp can hold size bytes */
+static bool _rs_reserve_output(uint8_t** bufp, size_t* capp, bool grow, size_t size)
+{
+    if (size <= *capp)
+        return true;
+    if (!grow)
+        return false;
+    
+    *capp = size;
+    *bufp = rs_realloc(*bufp, size);
+    return true;
+}
+
+static RSCodecResult _rs_lz4_decompress(uint8_t* data, size_t len, uint8_t** bufp, size_t* capp, bool grow, size_t* outlen)
+{
+    size_t size;
+    
+    *outlen = 0;
+    if (!_rs_lz4_get_size(data, len, &size))
+        return RS_CODEC_BAD_DATA;
+    if (!_rs_reserve_output(bufp, capp, grow, size))
+        return RS_CODEC_FULL;
+    
+    /* the headers have all been checked already */
+    uint8_t* out = *bufp;
+    while (len > 0)
+    {
+        uint8_t method = data[8] & RS_LZ4_METHOD_MASK;
+        uint32_t clen = _rs_lz4_read32(data + 9);
+        uint32_t dlen = _rs_lz4_read32(data + 13);
+        uint32_t checksum = _rs_lz4_read32(data + 17);
+        uint8_t* block = data + RS_LZ4_HEADER_SIZE;
+        
+        if (dlen == 0)
+            break;
+        
+        if (method == RS_LZ4_METHOD_RAW)
+        {
+            memcpy(out, block, dlen);
+        } else if (!_rs_lz4_decompress_block(block, clen, out, dlen)) {
+            return RS_CODEC_BAD_DATA;
+        }
+        
+        if ((_rs_xxh32(out, dlen, RS_LZ4_SEED) & RS_LZ4_CHECKSUM_MASK) != checksum)
+            return RS_CODEC_BAD_DATA;
+        
+        out += dlen;
+        data += RS_LZ4_HEADER_SIZE + clen;
+        len -= RS_LZ4_HEADER_SIZE + clen;
+    }
+    
+    *outlen = size;
+    return RS_CODEC_OK;
+}
+
+static void _rs_lz4_write_header(uint8_t* header, uint8_t method, uint32_t clen, uint32_t dlen, uint32_t checksum)
+{
+    memcpy(header, RS_LZ4_MAGIC, RS_LZ4_MAGIC_SIZE);
+    header[8] = method | RS_LZ4_BLOCK_LEVEL;
+    _rs_lz4_write32(header + 9, clen);
+    _rs_lz4_write32(header + 13, dlen);
+    _rs_lz4_write32(header + 17, checksum);
+}
+
+static void _rs_lz4_compress(const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** outdata, size_t* outlen)
+{
+    /* blocks are only compressed if that makes them smaller, so the
+     * worst case is every block stored as-is, plus the end block
+     */
+    size_t blocks = (rawdatalen + RS_LZ4_BLOCK_SIZE - 1) / RS_LZ4_BLOCK_SIZE;
+    uint8_t* out = rs_malloc((blocks + 1) * RS_LZ4_HEADER_SIZE + rawdatalen);
+    size_t pos = 0;
+    size_t read_head = 0;
+    
+    while (read_head < rawdatalen)
+    {
+        uint8_t* src = rawdata + read_head;
+        uint32_t dlen = MIN(RS_LZ4_BLOCK_SIZE, rawdatalen - read_head);
+        uint8_t* header = out + pos;
+        uint8_t* block = header + RS_LZ4_HEADER_SIZE;
+        uint8_t method = RS_LZ4_METHOD_LZ4;
+        uint32_t clen = 0;
+        
+        if (options->level != 0)
+            clen = _rs_lz4_compress_block(src, dlen, block, dlen - 1);
+        if (clen == 0)
+        {
+            method = RS_LZ4_METHOD_RAW;
+            memcpy(block, src, dlen);
+            clen = dlen;
+        }
+        
+        _rs_lz4_write_header(header, method, clen, dlen, _rs_xxh32(src, dlen, RS_LZ4_SEED) & RS_LZ4_CHECKSUM_MASK);
+        pos += RS_LZ4_HEADER_SIZE + clen;
+        read_head += dlen;
+    }
+    
+    _rs_lz4_write_header(out + pos, RS_LZ4_METHOD_RAW, 0, 0, 0);
+    pos += RS_LZ4_HEADER_SIZE;
+    
+    *outdata = rs_realloc(out, pos);
+    *outlen = pos;
+}
+
+/*
+ * zstd, optionally with a dictionary. Like LZ4, this is a format of
+ * its own, so it's used for RS_ZSTD whichever codec is selected.
+ */
+
+/* every frame starts with these */
+#define RS_ZSTD_MAGIC "\x28\xb5\x2f\xfd"
+#define RS_ZSTD_MAGIC_SIZE 4
+/* levels above this are far too slow for chunks */
+#define RS_ZSTD_MAX_LEVEL 9
+/* zstd does better than deflate -- at best, a whole 128kb block can be
+ * one repeated byte, stored in 4
+ */
+#define RS_ZSTD_MAX_RATIO ((1024 * 128) / 4)
+
+struct _RSDictionary
+{
+    unsigned int refcount;
+    uint8_t* data;
+    size_t length;
+    
+#ifdef HAVE_ZSTD
+    /* digested versions, made the first time they are needed */
+    ZSTD_DDict* ddict;
+    ZSTD_CDict* cdicts[RS_ZSTD_MAX_LEVEL + 1];
+#endif
+};
+
+RSDictionary* rs_dictionary_new(const void* data, size_t len)
+{
+    rs_return_val_if_fail(data, NULL);
+    rs_return_val_if_fail(len > 0, NULL);
+    
+    RSDictionary* self = rs_new0(RSDictionary, 1);
+    self->refcount = 1;
+    self->data = memcpy(rs_malloc(len), data, len);
+    self->length = len;
+    return self;
+}
+
+RSDictionary* rs_dictionary_new_from_file(const char* path)
+{
+    rs_return_val_if_fail(path, NULL);
+    
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    
+    RSDictionary* self = NULL;
+    long len = -1;
+    if (fseek(f, 0, SEEK_END) == 0)
+        len = ftell(f);
+    if (len > 0 && fseek(f, 0, SEEK_SET) == 0)
+    {
+        uint8_t* data = rs_malloc(len);
+        if (fread(data, 1, len, f) == (size_t)len)
+            self = rs_dictionary_new(data, len);
+        rs_free(data);
+    }
+    
+    fclose(f);
+    return self;
+}
+
+bool rs_dictionary_write_to_file(RSDictionary* self, const char* path)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(path, false);
+    
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+    
+    bool ok = (fwrite(self->data, 1, self->length, f) == self->length);
+    if (fclose(f) != 0)
+        ok = false;
+    return ok;
+}
+
+void rs_dictionary_ref(RSDictionary* self)
+{
+    rs_return_if_fail(self);
+    __atomic_add_fetch(&(self->refcount), 1, __ATOMIC_RELAXED);
+}
+
+void rs_dictionary_unref(RSDictionary* self)
+{
+    rs_return_if_fail(self);
+    
+    if (__atomic_sub_fetch(&(self->refcount), 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    
+#ifdef HAVE_ZSTD
+    unsigned int i;
+    if (self->ddict)
+        ZSTD_freeDDict(self->ddict);
+    for (i = 0; i <= RS_ZSTD_MAX_LEVEL; i++)
+    {
+        if (self->cdicts[i])
+            ZSTD_freeCDict(self->cdicts[i]);
+    }
+#endif
+    
+    rs_free(self->data);
+    rs_free(self);
+}
+
+const void* rs_dictionary_get_data(RSDictionary* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    return self->data;
+}
+
+size_t rs_dictionary_get_length(RSDictionary* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return self->length;
+}
+
+#ifdef HAVE_ZSTD
+
+RSDictionary* rs_dictionary_train(const void* samples, const size_t* sizes, unsigned int count, size_t capacity)
+{
+    rs_return_val_if_fail(samples, NULL);
+    rs_return_val_if_fail(sizes, NULL);
+    rs_return_val_if_fail(capacity > 0, NULL);
+    
+    uint8_t* buf = rs_malloc(capacity);
+    size_t len = ZDICT_trainFromBuffer(buf, capacity, samples, sizes, count);
+    
+    RSDictionary* self = NULL;
+    if (!ZDICT_isError(len))
+        self = rs_dictionary_new(buf, len);
+    
+    rs_free(buf);
+    return self;
+}
+
+/* digested dictionaries can be shared between threads, but making
+ * them isn't free, so whoever loses the race to make one throws theirs
+ * away
+ */
+static ZSTD_DDict* _rs_dictionary_get_ddict(RSDictionary* self)
+{
+    ZSTD_DDict* ddict = __atomic_load_n(&(self->ddict), __ATOMIC_ACQUIRE);
+    if (ddict)
+        return ddict;
+    
+    ZSTD_DDict* expected = NULL;
+    ddict = ZSTD_createDDict(self->data, self->length);
+    if (ddict && !__atomic_compare_exchange_n(&(self->ddict), &expected, ddict, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        ZSTD_freeDDict(ddict);
+        ddict = expected;
+    }
+    return ddict;
+}
+
+static ZSTD_CDict* _rs_dictionary_get_cdict(RSDictionary* self, int level)
+{
+    ZSTD_CDict* cdict = __atomic_load_n(&(self->cdicts[level]), __ATOMIC_ACQUIRE);
+    if (cdict)
+        return cdict;
+    
+    ZSTD_CDict* expected = NULL;
+    cdict = ZSTD_createCDict(self->data, self->length, level);
+    if (cdict && !__atomic_compare_exchange_n(&(self->cdicts[level]), &expected, cdict, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        ZSTD_freeCDict(cdict);
+        cdict = expected;
+    }
+    return cdict;
+}
+
+/* returns the length zstd recorded, or false if it didn't. That's
+ * only read from the frame header, so callers must check it against
+ * RS_ZSTD_MAX_RATIO before trusting it
+ */
+static bool _rs_zstd_get_size(const uint8_t* data, size_t len, size_t* size)
+{
+    unsigned long long content_size = ZSTD_getFrameContentSize(data, len);
+    if (content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size == ZSTD_CONTENTSIZE_ERROR)
+        return false;
+    if (content_size > SIZE_MAX)
+        content_size = SIZE_MAX;
+    
+    *size = content_size;
+    return true;
+}
+
+static RSCodecResult _rs_zstd_decompress(ZSTD_DCtx** dctxp, RSDictionary* dictionary, uint8_t* data, size_t len, uint8_t** bufp, size_t* capp, bool grow, size_t* outlen)
+{
+    ZSTD_DDict* ddict = NULL;
+    size_t size;
+    
+    *outlen = 0;
+    if (!*dctxp)
+        *dctxp = ZSTD_createDCtx();
+    if (dictionary)
+        ddict = _rs_dictionary_get_ddict(dictionary);
+    if (!*dctxp || (dictionary && !ddict))
+        return RS_CODEC_BAD_DATA;
+    
+    /* frames we write always have their size, but others may not, in
+     * which case just keep trying with more room
+     */
+    bool size_known = _rs_zstd_get_size(data, len, &size);
+    if (size_known && size / RS_ZSTD_MAX_RATIO > len)
+        return RS_CODEC_BAD_DATA;
+    if (size_known && !_rs_reserve_output(bufp, capp, grow, size))
+        return RS_CODEC_FULL;
+    
+    while (true)
+    {
+        size_t ret;
+        if (ddict)
+        {
+            ret = ZSTD_decompress_usingDDict(*dctxp, *bufp, *capp, data, len, ddict);
+        } else {
+            ret = ZSTD_decompressDCtx(*dctxp, *bufp, *capp, data, len);
+        }
+        
+        if (!ZSTD_isError(ret))
+        {
+            *outlen = ret;
+            return RS_CODEC_OK;
+        }
+        
+        if (size_known || *capp >= len * RS_ZSTD_MAX_RATIO)
+            return RS_CODEC_BAD_DATA;
+        if (!grow)
+            return RS_CODEC_FULL;
+        
+        *capp *= 2;
+        *bufp = rs_realloc(*bufp, *capp);
+    }
+}
+
+static bool _rs_zstd_compress(ZSTD_CCtx** cctxp, const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** outdata, size_t* outlen)
+{
+    int level = (options->level <= 0) ? ZSTD_CLEVEL_DEFAULT : options->level;
+    ZSTD_CDict* cdict = NULL;
+    size_t ret;
+    
+    if (!*cctxp)
+        *cctxp = ZSTD_createCCtx();
+    if (options->dictionary)
+        cdict = _rs_dictionary_get_cdict(options->dictionary, level);
+    if (!*cctxp || (options->dictionary && !cdict))
+        return false;
+    
+    size_t bound = ZSTD_compressBound(rawdatalen);
+    uint8_t* buf = rs_malloc(bound);
+    if (cdict)
+    {
+        ret = ZSTD_compress_usingCDict(*cctxp, buf, bound, rawdata, rawdatalen, cdict);
+    } else {
+        ret = ZSTD_compressCCtx(*cctxp, buf, bound, rawdata, rawdatalen, level);
+    }
+    
+    if (ZSTD_isError(ret))
+    {
+        rs_free(buf);
+        return false;
+    }
+    
+    *outdata = rs_realloc(buf, ret);
+    *outlen = ret;
+    return true;
+}
+
+#else /* !HAVE_ZSTD */
+
+/* without zstd, dictionaries can still be passed around, but not
+ * trained or used
+ */
+
+RSDictionary* rs_dictionary_train(const void* samples, const size_t* sizes, unsigned int count, size_t capacity)
+{
+    return NULL;
+}
+
+#endif /* HAVE_ZSTD */
+
+#ifdef HAVE_PTHREAD
+
+/*
+ * parallel deflate, pigz-style -- the input is cut into blocks that are
+ * deflated on their own as raw streams, each primed with the tail of
+ * the block before it so very little is lost, then joined up behind a
+ * single header with the checksums combined
+ */
+
+/* same as pigz */
+#define RS_Z_PARALLEL_BLOCK_SIZE (1024 * 128)
+/* room for the sync flush marker and any leftover bits */
+#define RS_Z_PARALLEL_SLACK 16
+
+typedef struct
+{
+    RSCompressionType enc;
+    const RSCompressionOptions* options;
+    uint8_t* rawdata;
+    size_t rawdatalen;
+    size_t count;
+    
+    /* deflated data, its length, and a crc32 or adler32 for each block */
+    uint8_t** blocks;
+    size_t* lengths;
+    uLong* checks;
+    
+    pthread_mutex_t lock;
+    /* the next block nobody has started on */
+    size_t next;
+    bool failed;
+} RSZParallelJob;
+
+static inline size_t _rs_z_parallel_block_length(RSZParallelJob* job, size_t i)
+{
+    return MIN(RS_Z_PARALLEL_BLOCK_SIZE, job->rawdatalen - i * RS_Z_PARALLEL_BLOCK_SIZE);
+}
+
+static bool _rs_z_parallel_deflate_block(z_stream* strm, RSZParallelJob* job, size_t i)
+{
+    uint8_t* block = job->rawdata + i * RS_Z_PARALLEL_BLOCK_SIZE;
+    size_t len = _rs_z_parallel_block_length(job, i);
+    bool last = (i == job->count - 1);
+    
+    if (deflateReset(strm) != Z_OK)
+        return false;
+    
+    /* blocks are always bigger than the window, so this never reaches
+     * past the start of the data
+     */
+    if (i > 0)
+    {
+        size_t window = (size_t)1 << job->options->window_bits;
+        if (deflateSetDictionary(strm, block - window, window) != Z_OK)
+            return false;
+    }
+    
+    /* every block but the last ends on a byte boundary, so they can be
+     * glued together as-is
+     */
+    size_t bound = deflateBound(strm, len) + RS_Z_PARALLEL_SLACK;
+    uint8_t* out = rs_malloc(bound);
+    strm->next_in = block;
+    strm->avail_in = len;
+    strm->next_out = out;
+    strm->avail_out = bound;
+    
+    int ret = deflate(strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (last ? (ret != Z_STREAM_END) : (ret != Z_OK || strm->avail_in != 0 || strm->avail_out == 0))
+    {
+        rs_free(out);
+        return false;
+    }
+    
+    job->blocks[i] = out;
+    job->lengths[i] = bound - strm->avail_out;
+    if (job->enc == RS_GZIP)
+    {
+        job->checks[i] = crc32(crc32(0L, Z_NULL, 0), block, len);
+    } else {
+        job->checks[i] = adler32(adler32(0L, Z_NULL, 0), block, len);
+    }
+    return true;
+}
+
+static void* _rs_z_parallel_worker(void* data)
+{
+    RSZParallelJob* job = data;
+    const RSCompressionOptions* options = job->options;
+    z_stream strm;
+    
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    bool ok = (deflateInit2(&strm, options->level, Z_DEFLATED, -options->window_bits,
+                            options->mem_level, options->strategy) == Z_OK);
+    
+    while (true)
+    {
+        pthread_mutex_lock(&(job->lock));
+        if (!ok)
+            job->failed = true;
+        size_t i = job->next++;
+        bool done = job->failed || i >= job->count;
+        pthread_mutex_unlock(&(job->lock));
+    
+        if (done)
+            break;
+    
+        if (!_rs_z_parallel_deflate_block(&strm, job, i))
+        {
+            pthread_mutex_lock(&(job->lock));
+            job->failed = true;
+            pthread_mutex_unlock(&(job->lock));
+        }
+    }
+    
+    if (ok)
+        deflateEnd(&strm);
+    return NULL;
+}
+
+/* writes the same header deflate would have */
+static size_t _rs_z_parallel_write_header(RSCompressionType enc, const RSCompressionOptions* options, uint8_t* out)
+{
+    int level = (options->level == Z_DEFAULT_COMPRESSION) ? 6 : options->level;
+    bool fast = (level < 2 || options->strategy >= RS_STRATEGY_HUFFMAN_ONLY);
+    
+    if (enc == RS_GZIP)
+    {
+        /* no name, no timestamp, unix */
+        static const uint8_t gzip_header[] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+        memcpy(out, gzip_header, sizeof(gzip_header));
+        out[8] = (level == 9) ? 2 : (fast ? 4 : 0);
+        return sizeof(gzip_header);
+    }
+    
+    unsigned int level_flags = fast ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+    unsigned int header = (((options->window_bits - 8) << 4 | Z_DEFLATED) << 8) | (level_flags << 6);
+    header += 31 - (header % 31);
+    out[0] = header >> 8;
+    out[1] = header & 0xff;
+    return 2;
+}
+
+static bool _rs_z_compress_parallel(RSCompressionType enc, const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen)
+{
+    RSZParallelJob job;
+    job.enc = enc;
+    job.options = options;
+    job.rawdata = rawdata;
+    job.rawdatalen = rawdatalen;
+    job.count = (rawdatalen + RS_Z_PARALLEL_BLOCK_SIZE - 1) / RS_Z_PARALLEL_BLOCK_SIZE;
+    job.blocks = rs_new0(uint8_t*, job.count);
+    job.lengths = rs_new0(size_t, job.count);
+    job.checks = rs_new0(uLong, job.count);
+    pthread_mutex_init(&(job.lock), NULL);
+    job.next = 0;
+    job.failed = false;
+    
+    unsigned int threads = options->threads;
+    if (threads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? cpus : 1;
+    }
+    threads = MIN(threads, job.count);
+    
+    /* the calling thread pitches in too, so start one fewer. If a
+     * thread can't be started, the rest just do more of the work.
+     */
+    pthread_t* workers = rs_new0(pthread_t, threads);
+    unsigned int started = 0;
+    while (started + 1 < threads && pthread_create(&(workers[started]), NULL, _rs_z_parallel_worker, &job) == 0)
+        started++;
+    _rs_z_parallel_worker(&job);
+    
+    unsigned int t;
+    for (t = 0; t < started; t++)
+        pthread_join(workers[t], NULL);
+    rs_free(workers);
+    pthread_mutex_destroy(&(job.lock));
+    
+    size_t i;
+    if (!job.failed)
+    {
+        /* 10 byte gzip header, and 8 byte trailer at most */
+        size_t total = 18;
+        uLong check = job.checks[0];
+        for (i = 0; i < job.count; i++)
+        {
+            total += job.lengths[i];
+            if (i > 0)
+            {
+                z_off_t len = _rs_z_parallel_block_length(&job, i);
+                check = (enc == RS_GZIP) ? crc32_combine(check, job.checks[i], len) : adler32_combine(check, job.checks[i], len);
+            }
+        }
+    
+        uint8_t* out = rs_malloc(total);
+        uint8_t* head = out;
+        head += _rs_z_parallel_write_header(enc, options, head);
+        for (i = 0; i < job.count; i++)
+        {
+            memcpy(head, job.blocks[i], job.lengths[i]);
+            head += job.lengths[i];
+        }
+    
+        if (enc == RS_GZIP)
+        {
+            /* little-endian crc32 and length */
+            uint32_t isize = (uint32_t)rawdatalen;
+            unsigned int b;
+            for (b = 0; b < 4; b++)
+                *head++ = (check >> (8 * b)) & 0xff;
+            for (b = 0; b < 4; b++)
+                *head++ = (isize >> (8 * b)) & 0xff;
+        } else {
+            /* big-endian adler32 */
+            unsigned int b;
+            for (b = 0; b < 4; b++)
+                *head++ = (check >> (24 - 8 * b)) & 0xff;
+        }
+    
+        *gzdata = out;
+        *gzdatalen = head - out;
+    }
+    
+    for (i = 0; i < job.count; i++)
+    {
+        if (job.blocks[i])
+            rs_free(job.blocks[i]);
+    }
+    rs_free(job.blocks);
+    rs_free(job.lengths);
+    rs_free(job.checks);
+    return !job.failed;
+}
+
+#endif /* HAVE_PTHREAD */
+
+/*
+ * codec selection
+ */
+
+/* fastest first -- the first one is the default */
+static const RSCodec* const codecs[] = {
+#ifdef HAVE_LIBDEFLATE
+    &libdeflate_codec,
+#endif
+    &zlib_codec,
+    NULL
+};
+
+static const RSCodec* current_codec = NULL;
+
+static const RSCodec* _rs_find_codec(const char* name)
+{
+    unsigned int i;
+    for (i = 0; codecs[i] != NULL; i++)
+    {
+        if (strcmp(codecs[i]->name, name) == 0)
+            return codecs[i];
+    }
+    
+    return NULL;
+}
+
+static const RSCodec* _rs_get_codec(void)
+{
+    const RSCodec* codec = __atomic_load_n(&current_codec, __ATOMIC_ACQUIRE);
+    if (codec)
+        return codec;
+    
+    /* RS_CODEC can pick the default */
+    codec = codecs[0];
+    const char* env = getenv("RS_CODEC");
+    if (env && _rs_find_codec(env))
+        codec = _rs_find_codec(env);
+    
+    __atomic_store_n(&current_codec, codec, __ATOMIC_RELEASE);
+    return codec;
+}
+
+bool rs_set_codec(const char* name)
+{
+    rs_return_val_if_fail(name, false);
+    
+    const RSCodec* codec = _rs_find_codec(name);
+    if (!codec)
+        return false;
+    
+    __atomic_store_n(&current_codec, codec, __ATOMIC_RELEASE);
+    return true;
+}
+
+const char* rs_get_codec(void)
+{
+    return _rs_get_codec()->name;
+}
+
+const char* rs_get_available_codec(unsigned int i)
+{
+    if (i >= sizeof(codecs) / sizeof(codecs[0]) - 1)
+        return NULL;
+    return codecs[i]->name;
+}
+
+/*
+ * reusable contexts -- these hold state for whichever codec was in use
+ * the last time, and swap it out if the codec has changed since
+ */
+
+struct _RSDecompressor
+{
+    const RSCodec* codec;
+    void* state;
+    
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx* zstd;
+#endif
+};
+
+struct _RSCompressor
+{
+    const RSCodec* codec;
+    void* state;
+    
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx* zstd;
+#endif
+};
+
+/* contexts are long-lived caches, so they always use the global memory
+ * functions, never whatever is pushed (see rs_memory_push)
+ */
+
+RSDecompressor* rs_decompressor_new(void)
+{
+    rs_memory_push(NULL);
+    RSDecompressor* self = rs_new0(RSDecompressor, 1);
+    rs_memory_pop();
+    return self;
+}
+
+void rs_decompressor_free(RSDecompressor* self)
+{
+    rs_return_if_fail(self);
+    
+    rs_memory_push(NULL);
+    if (self->state)
+        self->codec->decompressor_free(self->state);
+#ifdef HAVE_ZSTD
+    if (self->zstd)
+        ZSTD_freeDCtx(self->zstd);
+#endif
+    rs_free(self);
+    rs_memory_pop();
+}
+
+/* returns the state for the current codec, or NULL if it can't be made */
+static void* _rs_decompressor_get_state(RSDecompressor* self)
+{
+    const RSCodec* codec = _rs_get_codec();
+    if (self->codec == codec && self->state)
+        return self->state;
+    
+    rs_memory_push(NULL);
+    if (self->state)
+        self->codec->decompressor_free(self->state);
+    self->codec = codec;
+    self->state = codec->decompressor_new();
+    rs_memory_pop();
+    return self->state;
+}
+
+/* decompresses with the current codec, or whatever enc needs */
+static RSCodecResult _rs_decompressor_run(RSDecompressor* self, RSCompressionType enc, RSDictionary* dictionary, uint8_t* gzdata, size_t gzdatalen, uint8_t** bufp, size_t* capp, bool grow, size_t* outlen)
+{
+    *outlen = 0;
+    
+    switch (enc)
+    {
+    case RS_GZIP:
+    case RS_ZLIB:
+        break;
+    case RS_UNCOMPRESSED:
+        if (!_rs_reserve_output(bufp, capp, grow, gzdatalen))
+            return RS_CODEC_FULL;
+        memcpy(*bufp, gzdata, gzdatalen);
+        *outlen = gzdatalen;
+        return RS_CODEC_OK;
+    case RS_LZ4:
+        return _rs_lz4_decompress(gzdata, gzdatalen, bufp, capp, grow, outlen);
+#ifdef HAVE_ZSTD
+    case RS_ZSTD:
+        return _rs_zstd_decompress(&(self->zstd), dictionary, gzdata, gzdatalen, bufp, capp, grow, outlen);
+#endif
+    default:
+        /* unknown, so return error */
+        return RS_CODEC_BAD_DATA;
+    };
+    
+    void* state = _rs_decompressor_get_state(self);
+    if (!state)
+        return RS_CODEC_BAD_DATA;
+    
+    return self->codec->decompress(state, enc, gzdata, gzdatalen, bufp, capp, grow, outlen);
+}
+
+void rs_decompressor_decompress(RSDecompressor* self, RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** outdata, size_t* outdatalen)
+{
+    rs_decompressor_decompress_full(self, enc, NULL, gzdata, gzdatalen, outdata, outdatalen);
+}
+
+void rs_decompressor_decompress_full(RSDecompressor* self, RSCompressionType enc, RSDictionary* dictionary, uint8_t* gzdata, size_t gzdatalen, uint8_t** outdata, size_t* outdatalen)
+{
+    rs_return_if_fail(self);
+    
+    /* initialize output to NULL, so we can check later
+       also, this means error */
+    *outdata = NULL;
+    *outdatalen = 0;
+    
+    /* guess compression type */
+    if (enc == RS_AUTO_COMPRESSION)
+        enc = rs_get_compression_type(gzdata, gzdatalen);
+    
+    _rs_trace_begin(RS_TRACE_DECOMPRESS, gzdatalen);
+    
+    /* start with the best guess we have, so usually there's no need
+     * to grow the buffer at all
+     */
+    size_t cap = rs_get_decompressed_size(enc, gzdata, gzdatalen, 0);
+    if (cap < RS_Z_MIN_OUTPUT_SIZE)
+        cap = RS_Z_MIN_OUTPUT_SIZE;
+    uint8_t* buf = rs_malloc(cap);
+    size_t len;
+    
+    if (_rs_decompressor_run(self, enc, dictionary, gzdata, gzdatalen, &buf, &cap, true, &len) != RS_CODEC_OK)
+    {
+        /* level data is not valid gzip data */
+        rs_free(buf);
+        _rs_trace_end(RS_TRACE_DECOMPRESS, 0);
+        return;
+    }
+    
+    /* give back any room we didn't need */
+    if (len < cap)
+        buf = rs_realloc(buf, len > 0 ? len : 1);
+    
+    *outdata = buf;
+    *outdatalen = len;
+    _rs_trace_end(RS_TRACE_DECOMPRESS, len);
+}
+
+bool rs_decompressor_decompress_into(RSDecompressor* self, RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t* out, size_t outcap, size_t* outlen)
+{
+    return rs_decompressor_decompress_into_full(self, enc, NULL, gzdata, gzdatalen, out, outcap, outlen);
+}
+
+bool rs_decompressor_decompress_into_full(RSDecompressor* self, RSCompressionType enc, RSDictionary* dictionary, uint8_t* gzdata, size_t gzdatalen, uint8_t* out, size_t outcap, size_t* outlen)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(out || outcap == 0, false);
+    rs_return_val_if_fail(outlen, false);
+    
+    if (enc == RS_AUTO_COMPRESSION)
+        enc = rs_get_compression_type(gzdata, gzdatalen);
+    
+    _rs_trace_begin(RS_TRACE_DECOMPRESS, gzdatalen);
+    bool ok = false;
+    switch (_rs_decompressor_run(self, enc, dictionary, gzdata, gzdatalen, &out, &outcap, false, outlen))
+    {
+    case RS_CODEC_OK:
+        ok = true;
+        break;
+    case RS_CODEC_FULL:
+        *outlen = outcap;
+        break;
+    default:
+        *outlen = 0;
+        break;
+    }
+    _rs_trace_end(RS_TRACE_DECOMPRESS, *outlen);
+    
+    return ok;
+}
+
+size_t rs_get_decompressed_size(RSCompressionType enc, void* data, size_t len, size_t hint)
+{
+    if (enc == RS_AUTO_COMPRESSION)
+        enc = rs_get_compression_type(data, len);
+    
+    if (hint > 0)
+        return hint;
+    
+    size_t size;
+    if (enc == RS_UNCOMPRESSED)
+        return len;
+    if (enc == RS_LZ4 && _rs_lz4_get_size(data, len, &size))
+        return size;
+#ifdef HAVE_ZSTD
+    if (enc == RS_ZSTD && _rs_zstd_get_size(data, len, &size) && size / RS_ZSTD_MAX_RATIO <= len)
+        return size;
+#endif
+    
+    /* gzip ends with the uncompressed size (mod 2^32), in little
+     * endian -- but don't believe anything deflate couldn't produce,
+     * in case this is corrupt
+     */
+    if (enc == RS_GZIP && len >= RS_Z_GZIP_MIN_SIZE)
+    {
+        uint8_t* trailer = (uint8_t*)data + len - 4;
+        size_t isize = (size_t)trailer[0] | ((size_t)trailer[1] << 8) | ((size_t)trailer[2] << 16) | ((size_t)trailer[3] << 24);
+        if (isize <= len * RS_Z_MAX_RATIO)
+            return isize;
+    }
+    
+    return len * RS_Z_GUESS_RATIO;
+}
+
+RSCompressor* rs_compressor_new(void)
+{
+    rs_memory_push(NULL);
+    RSCompressor* self = rs_new0(RSCompressor, 1);
+    rs_memory_pop();
+    return self;
+}
+
+void rs_compressor_free(RSCompressor* self)
+{
+    rs_return_if_fail(self);
+    
+    rs_memory_push(NULL);
+    if (self->state)
+        self->codec->compressor_free(self->state);
+#ifdef HAVE_ZSTD
+    if (self->zstd)
+        ZSTD_freeCCtx(self->zstd);
+#endif
+    rs_free(self);
+    rs_memory_pop();
+}
+
+void rs_compression_options_init(RSCompressionOptions* options)
+{
+    rs_return_if_fail(options);
+    
+    /* compression level 1 gives OK results faster -- bandwidth is cheap, latency is not */
+    options->level = 1;
+    /* RLE -- significantly faster, but very slightly less space efficient */
+    options->strategy = RS_STRATEGY_RLE;
+    options->mem_level = 8;
+    options->window_bits = MAX_WBITS;
+    options->dictionary = NULL;
+    options->threads = 1;
+}
+
+void rs_compressor_compress(RSCompressor* self, RSCompressionType enc, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen)
+{
+    rs_compressor_compress_full(self, enc, NULL, rawdata, rawdatalen, gzdata, gzdatalen);
+}
+
+static void _rs_compressor_compress(RSCompressor* self, RSCompressionType enc, const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen)
+{
+    RSCompressionOptions defaults;
+    if (!options)
+    {
+        rs_compression_options_init(&defaults);
+        options = &defaults;
+    }
+    
+    /* initialize our output */
+    *gzdata = NULL;
+    *gzdatalen = 0;
+    
+    rs_return_if_fail(options->level >= -1 && options->level <= RS_ZSTD_MAX_LEVEL);
+    rs_return_if_fail(options->mem_level >= 1 && options->mem_level <= 9);
+    rs_return_if_fail(options->window_bits >= 9 && options->window_bits <= 15);
+    
+    if (enc == RS_UNCOMPRESSED)
+    {
+        *gzdata = memcpy(rs_malloc(rawdatalen > 0 ? rawdatalen : 1), rawdata, rawdatalen);
+        *gzdatalen = rawdatalen;
+        return;
+    }
+    
+    if (enc == RS_LZ4)
+    {
+        _rs_lz4_compress(options, rawdata, rawdatalen, gzdata, gzdatalen);
+        return;
+    }
+    
+#ifdef HAVE_ZSTD
+    if (enc == RS_ZSTD)
+    {
+        _rs_zstd_compress(&(self->zstd), options, rawdata, rawdatalen, gzdata, gzdatalen);
+        return;
+    }
+#endif
+    
+    /* return error if not gzip or zlib */
+    if (enc != RS_GZIP && enc != RS_ZLIB)
+        return;
+
+#ifdef HAVE_PTHREAD
+    /* big enough to be worth splitting up between threads */
+    if (options->threads != 1 && rawdatalen >= 2 * RS_Z_PARALLEL_BLOCK_SIZE)
+    {
+        _rs_z_compress_parallel(enc, options, rawdata, rawdatalen, gzdata, gzdatalen);
+        return;
+    }
+#endif
+
+    const RSCodec* codec = _rs_get_codec();
+    if (codec->accepts && !codec->accepts(options))
+        codec = &zlib_codec;
+    if (self->codec != codec || !self->state)
+    {
+        rs_memory_push(NULL);
+        if (self->state)
+            self->codec->compressor_free(self->state);
+        self->codec = codec;
+        self->state = codec->compressor_new();
+        rs_memory_pop();
+        if (!self->state)
+            return;
+    }
+    
+    if (!codec->compress(self->state, enc, options, rawdata, rawdatalen, gzdata, gzdatalen))
+    {
+        /* level data could not be deflated */
+        rs_free(*gzdata);
+        *gzdata = NULL;
+        *gzdatalen = 0;
+    }
+}
+
+void rs_compressor_compress_full(RSCompressor* self, RSCompressionType enc, const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen)
+{
+    rs_return_if_fail(self);
+    
+    _rs_trace_begin(RS_TRACE_COMPRESS, rawdatalen);
+    _rs_compressor_compress(self, enc, options, rawdata, rawdatalen, gzdata, gzdatalen);
+    _rs_trace_end(RS_TRACE_COMPRESS, *gzdatalen);
+}
+
+/* every thread gets its own pair of contexts for rs_decompress and
+ * rs_compress, which are freed when the thread exits
+ */
+typedef struct
+{
+    RSDecompressor* decompressor;
+    RSCompressor* compressor;
+} RSZThreadContexts;
+
+#ifdef RS_Z_THREAD_CONTEXTS
+
+static pthread_once_t thread_contexts_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_contexts_key;
+static bool thread_contexts_ok = false;
+static __thread RSZThreadContexts* thread_contexts = NULL;
+
+static void _rs_z_thread_contexts_free(void* data)
+{
+    RSZThreadContexts* contexts = data;
+    if (contexts->decompressor)
+        rs_decompressor_free(contexts->decompressor);
+    if (contexts->compressor)
+        rs_compressor_free(contexts->compressor);
+    rs_memory_push(NULL);
+    rs_free(contexts);
+    rs_memory_pop();
+    thread_contexts = NULL;
+}
+
+static void _rs_z_thread_contexts_init(void)
+{
+    thread_contexts_ok = (pthread_key_create(&thread_contexts_key, _rs_z_thread_contexts_free) == 0);
+}
+
+/* returns NULL if contexts can't be kept around */
+static RSZThreadContexts* _rs_z_get_thread_contexts(void)
+{
+    if (thread_contexts)
+        return thread_contexts;
+    
+    pthread_once(&thread_contexts_once, _rs_z_thread_contexts_init);
+    if (!thread_contexts_ok)
+        return NULL;
+    
+    rs_memory_push(NULL);
+    thread_contexts = rs_new0(RSZThreadContexts, 1);
+    rs_memory_pop();
+    pthread_setspecific(thread_contexts_key, thread_contexts);
+    return thread_contexts;
+}
+
+#else /* !RS_Z_THREAD_CONTEXTS */
+
+/* without thread-local storage, every call makes its own context */
+static inline RSZThreadContexts* _rs_z_get_thread_contexts(void)
+{
+    return NULL;
+}
+
+#endif /* RS_Z_THREAD_CONTEXTS */
+
+void rs_decompress(RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** outdata, size_t* outdatalen)
+{
+    rs_decompress_full(enc, NULL, gzdata, gzdatalen, outdata, outdatalen);
+}
+
+void rs_decompress_full(RSCompressionType enc, RSDictionary* dictionary, uint8_t* gzdata, size_t gzdatalen, uint8_t** outdata, size_t* outdatalen)
+{
+    RSZThreadContexts* contexts = _rs_z_get_thread_contexts();
+    if (!contexts)
+    {
+        RSDecompressor* decompressor = rs_decompressor_new();
+        rs_decompressor_decompress_full(decompressor, enc, dictionary, gzdata, gzdatalen, outdata, outdatalen);
+        rs_decompressor_free(decompressor);
+        return;
+    }
+    
+    if (!contexts->decompressor)
+        contexts->decompressor = rs_decompressor_new();
+    rs_decompressor_decompress_full(contexts->decompressor, enc, dictionary, gzdata, gzdatalen, outdata, outdatalen);
+}
+
+bool rs_decompress_into(RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t* out, size_t outcap, size_t* outlen)
+{
+    return rs_decompress_into_full(enc, NULL, gzdata, gzdatalen, out, outcap, outlen);
+}
+
+bool rs_decompress_into_full(RSCompressionType enc, RSDictionary* dictionary, uint8_t* gzdata, size_t gzdatalen, uint8_t* out, size_t outcap, size_t* outlen)
+{
+    RSZThreadContexts* contexts = _rs_z_get_thread_contexts();
+    bool ret;
+    if (!contexts)
+    {
+        RSDecompressor* decompressor = rs_decompressor_new();
+        ret = rs_decompressor_decompress_into_full(decompressor, enc, dictionary, gzdata, gzdatalen, out, outcap, outlen);
+        rs_decompressor_free(decompressor);
+        return ret;
+    }
+    
+    if (!contexts->decompressor)
+        contexts->decompressor = rs_decompressor_new();
+    return rs_decompressor_decompress_into_full(contexts->decompressor, enc, dictionary, gzdata, gzdatalen, out, outcap, outlen);
+}
+
+void rs_compress(RSCompressionType enc, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen)
+{
+    rs_compress_full(enc, NULL, rawdata, rawdatalen, gzdata, gzdatalen);
+}
+
+void rs_compress_full(RSCompressionType enc, const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen)
+{
+    RSZThreadContexts* contexts = _rs_z_get_thread_contexts();
+    if (!contexts)
+    {
+        RSCompressor* compressor = rs_compressor_new();
+        rs_compressor_compress_full(compressor, enc, options, rawdata, rawdatalen, gzdata, gzdatalen);
+        rs_compressor_free(compressor);
+        return;
+    }
+    
+    if (!contexts->compressor)
+        contexts->compressor = rs_compressor_new();
+    rs_compressor_compress_full(contexts->compressor, enc, options, rawdata, rawdatalen, gzdata, gzdatalen);
+}
+
+/*
+ * incremental streams
+ */
+
+/* how much fed data a stream holds on to */
+#define RS_Z_STREAM_BUFFER_SIZE (1024 * 64)
+
+/* input that has been fed in, but not used yet, lives in data[start..end) */
+typedef struct
+{
+    uint8_t data[RS_Z_STREAM_BUFFER_SIZE];
+    size_t start;
+    size_t end;
+} RSZStreamBuffer;
+
+static size_t _rs_z_stream_buffer_feed(RSZStreamBuffer* self, const uint8_t* data, size_t len)
+{
+    /* move leftovers to the front, to make as much room as possible */
+    if (self->start > 0)
+    {
+        memmove(self->data, self->data + self->start, self->end - self->start);
+        self->end -= self->start;
+        self->start = 0;
+    }
+    
+    size_t copylen = MIN(len, RS_Z_STREAM_BUFFER_SIZE - self->end);
+    memcpy(self->data + self->end, data, copylen);
+    self->end += copylen;
+    return copylen;
+}
+
+struct _RSInflateStream
+{
+    z_stream strm;
+    RSZStreamBuffer input;
+    bool finished;
+    bool failed;
+};
+
+RSInflateStream* rs_inflate_stream_new(RSCompressionType enc)
+{
+    rs_return_val_if_fail(enc == RS_GZIP || enc == RS_ZLIB || enc == RS_AUTO_COMPRESSION, NULL);
+    
+    RSInflateStream* self = rs_new0(RSInflateStream, 1);
+    self->strm.zalloc = Z_NULL;
+    self->strm.zfree = Z_NULL;
+    self->strm.opaque = Z_NULL;
+    
+    /* +16 is gzip only, +32 detects either */
+    int window_bits = MAX_WBITS + ((enc == RS_GZIP) ? 16 : (enc == RS_ZLIB) ? 0 : 32);
+    if (inflateInit2(&(self->strm), window_bits) != Z_OK)
+    {
+        rs_free(self);
+        return NULL;
+    }
+    
+    return self;
+}
+
+void rs_inflate_stream_free(RSInflateStream* self)
+{
+    rs_return_if_fail(self);
+    inflateEnd(&(self->strm));
+    rs_free(self);
+}
+
+size_t rs_inflate_stream_feed(RSInflateStream* self, const uint8_t* data, size_t len)
+{
+    rs_return_val_if_fail(self, 0);
+    rs_return_val_if_fail(data || len == 0, 0);
+    
+    /* swallow anything after the end, so callers don't get stuck */
+    if (self->finished || self->failed)
+        return len;
+    return _rs_z_stream_buffer_feed(&(self->input), data, len);
+}
+
+size_t rs_inflate_stream_drain(RSInflateStream* self, uint8_t* out, size_t outlen)
+{
+    rs_return_val_if_fail(self, 0);
+    rs_return_val_if_fail(out || outlen == 0, 0);
+    
+    if (self->finished || self->failed)
+        return 0;
+    
+    /* the trailer can still be read with no room for output, which
+     * matters if out is exactly as big as what's left -- but zlib
+     * won't take a NULL buffer
+     */
+    uint8_t dummy;
+    z_stream* strm = &(self->strm);
+    strm->next_in = self->input.data + self->input.start;
+    strm->avail_in = self->input.end - self->input.start;
+    strm->next_out = out ? out : &dummy;
+    strm->avail_out = outlen;
+    
+    int ret = inflate(strm, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END)
+    {
+        self->finished = true;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        /* Z_BUF_ERROR just means there was nothing to do */
+        self->failed = true;
+    }
+    
+    self->input.start = self->input.end - strm->avail_in;
+    return outlen - strm->avail_out;
+}
+
+bool rs_inflate_stream_is_finished(RSInflateStream* self)
+{
+    rs_return_val_if_fail(self, false);
+    return self->finished;
+}
+
+bool rs_inflate_stream_has_failed(RSInflateStream* self)
+{
+    rs_return_val_if_fail(self, false);
+    return self->failed;
+}
+
+struct _RSDeflateStream
+{
+    z_stream strm;
+    RSZStreamBuffer input;
+    /* no more input is coming */
+    bool finishing;
+    bool finished;
+    bool failed;
+};
+
+RSDeflateStream* rs_deflate_stream_new(RSCompressionType enc, const RSCompressionOptions* options)
+{
+    rs_return_val_if_fail(enc == RS_GZIP || enc == RS_ZLIB, NULL);
+    
+    RSCompressionOptions defaults;
+    if (!options)
+    {
+        rs_compression_options_init(&defaults);
+        options = &defaults;
+    }
+    
+    rs_return_val_if_fail(options->level >= -1 && options->level <= 9, NULL);
+    rs_return_val_if_fail(options->mem_level >= 1 && options->mem_level <= 9, NULL);
+    rs_return_val_if_fail(options->window_bits >= 9 && options->window_bits <= 15, NULL);
+    
+    RSDeflateStream* self = rs_new0(RSDeflateStream, 1);
+    self->strm.zalloc = Z_NULL;
+    self->strm.zfree = Z_NULL;
+    self->strm.opaque = Z_NULL;
+    
+    if (deflateInit2(&(self->strm), options->level, Z_DEFLATED,
+                     (enc == RS_GZIP) ? (16 + options->window_bits) : options->window_bits,
+                     options->mem_level, options->strategy) != Z_OK)
+    {
+        rs_free(self);
+        return NULL;
+    }
+    
+    return self;
+}
+
+void rs_deflate_stream_free(RSDeflateStream* self)
+{
+    rs_return_if_fail(self);
+    deflateEnd(&(self->strm));
+    rs_free(self);
+}
+
+size_t rs_deflate_stream_feed(RSDeflateStream* self, const uint8_t* data, size_t len)
+{
+    rs_return_val_if_fail(self, 0);
+    rs_return_val_if_fail(data || len == 0, 0);
+    rs_return_val_if_fail(!self->finishing, 0);
+    
+    if (self->failed)
+        return len;
+    return _rs_z_stream_buffer_feed(&(self->input), data, len);
+}
+
+void rs_deflate_stream_finish(RSDeflateStream* self)
+{
+    rs_return_if_fail(self);
+    self->finishing = true;
+}
+
+size_t rs_deflate_stream_drain(RSDeflateStream* self, uint8_t* out, size_t outlen)
+{
+    rs_return_val_if_fail(self, 0);
+    rs_return_val_if_fail(out || outlen == 0, 0);
+    
+    if (self->finished || self->failed || outlen == 0)
+        return 0;
+    
+    z_stream* strm = &(self->strm);
+    strm->next_in = self->input.data + self->input.start;
+    strm->avail_in = self->input.end - self->input.start;
+    strm->next_out = out;
+    strm->avail_out = outlen;
+    
+    int ret = deflate(strm, self->finishing ? Z_FINISH : Z_NO_FLUSH);
+    if (ret == Z_STREAM_END)
+    {
+        self->finished = true;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        self->failed = true;
+    }
+    
+    self->input.start = self->input.end - strm->avail_in;
+    return outlen - strm->avail_out;
+}
+
+bool rs_deflate_stream_is_finished(RSDeflateStream* self)
+{
+    rs_return_val_if_fail(self, false);
+    return self->finished;
+}
+
+bool rs_deflate_stream_has_failed(RSDeflateStream* self)
+{
+    rs_return_val_if_fail(self, false);
+    return self->failed;
+}
+
+RSCompressionType rs_get_compression_type(void* data, size_t len)
+{
+    if (data == NULL || len < 3)
+        return RS_UNKNOWN_COMPRESSION;
+    
+    uint8_t* bytes = (uint8_t*)data;
+    
+    /* if you're confused about this code, go check out the RFCs! */
+    
+    /* zstd check -- frame magic, which would fail the zlib check anyway */
+    if (len >= RS_ZSTD_MAGIC_SIZE && memcmp(bytes, RS_ZSTD_MAGIC, RS_ZSTD_MAGIC_SIZE) == 0)
+        return RS_ZSTD;
+    
+    /* zlib check -- compression type 8, and checksum must work out */
+    if ((bytes[0] & 0x0F) == 0x08 && (((int)bytes[0] << 8) + (int)bytes[1]) % 31 == 0)
+        return RS_ZLIB;
+    
+    /* gzip check -- header bytes and compression type 8 */
+    if (bytes[0] == 0x1f && bytes[1] == 0x8b && bytes[2] == 0x08)
+        return RS_GZIP;
+    
+    /* LZ4 check -- every block starts with the magic */
+    if (len >= RS_LZ4_MAGIC_SIZE && memcmp(bytes, RS_LZ4_MAGIC, RS_LZ4_MAGIC_SIZE) == 0)
+        return RS_LZ4;
     
     return RS_UNKNOWN_COMPRESSION;
 }
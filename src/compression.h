@@ -9,6 +9,7 @@
 #include "memory.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * Supported compression methods.
@@ -40,8 +41,233 @@ typedef enum
      * Used by rs_get_compression_type() to indicate unknown type.
      */
     RS_UNKNOWN_COMPRESSION,
+    
+    /**
+     * No compression at all (for region file NBT, in newer
+     * versions). Decompressing this just copies the data.
+     */
+    RS_UNCOMPRESSED,
+    
+    /**
+     * LZ4 block streams, as written by lz4-java's LZ4BlockOutputStream
+     * (for region file NBT, in newer versions). Much faster than the
+     * others, but the data is larger.
+     */
+    RS_LZ4,
+    
+    /**
+     * Zstandard, optionally with a dictionary (see RSDictionary). This
+     * is not something Minecraft can read, and it is only available if
+     * libredstone was built with zstd. It compresses better than zlib
+     * and decompresses several times faster, especially with a
+     * dictionary trained on chunks from the same world.
+     */
+    RS_ZSTD,
 } RSCompressionType;
 
+struct _RSDictionary;
+/**
+ * A compression dictionary.
+ *
+ * Chunks from the same world have a lot in common, and compressing
+ * each one on its own can't take advantage of that. A dictionary
+ * trained from a sample of chunks (see rs_dictionary_train()) can,
+ * and makes RS_ZSTD data much smaller.
+ *
+ * Data compressed with a dictionary can only be decompressed with the
+ * same dictionary, so regions look for one in a file named dict.zstd
+ * next to them (see rs_region_get_dictionary()).
+ *
+ * Dictionaries are reference counted, and can be shared between
+ * threads.
+ */
+typedef struct _RSDictionary RSDictionary;
+
+/**
+ * Create a dictionary from the given data.
+ *
+ * \param data the dictionary data, which is copied
+ * \param len the length of data
+ * \return a new dictionary, with one reference
+ * \sa rs_dictionary_unref
+ */
+RSDictionary* rs_dictionary_new(const void* data, size_t len);
+
+/**
+ * Load a dictionary from a file.
+ *
+ * \param path the file to load
+ * \return a new dictionary with one reference, or NULL on error
+ * \sa rs_dictionary_write_to_file
+ */
+RSDictionary* rs_dictionary_new_from_file(const char* path);
+
+/**
+ * Train a new dictionary.
+ *
+ * The samples are all stored one after another in samples, and sizes
+ * holds the length of each one. A few thousand uncompressed chunks
+ * make a good set of samples, and zstd recommends a capacity of about
+ * 110kb.
+ *
+ * \param samples the samples, concatenated
+ * \param sizes the length of each sample
+ * \param count how many samples there are
+ * \param capacity the largest the dictionary can be
+ * \return a new dictionary, or NULL if training failed, or zstd
+ * isn't available
+ */
+RSDictionary* rs_dictionary_train(const void* samples, const size_t* sizes, unsigned int count, size_t capacity);
+
+/**
+ * Save a dictionary to a file.
+ *
+ * \param self the dictionary
+ * \param path the file to write
+ * \return true on success
+ * \sa rs_dictionary_new_from_file
+ */
+bool rs_dictionary_write_to_file(RSDictionary* self, const char* path);
+
+/**
+ * Add a reference to a dictionary.
+ *
+ * \param self the dictionary
+ * \sa rs_dictionary_unref
+ */
+void rs_dictionary_ref(RSDictionary* self);
+
+/**
+ * Remove a reference from a dictionary, freeing it if it was the last.
+ *
+ * \param self the dictionary
+ * \sa rs_dictionary_ref
+ */
+void rs_dictionary_unref(RSDictionary* self);
+
+/**
+ * Get the raw contents of a dictionary.
+ *
+ * \param self the dictionary
+ * \return the data, owned by the dictionary
+ * \sa rs_dictionary_get_length
+ */
+const void* rs_dictionary_get_data(RSDictionary* self);
+
+/**
+ * Get the length of a dictionary.
+ *
+ * \param self the dictionary
+ * \return the length in bytes
+ * \sa rs_dictionary_get_data
+ */
+size_t rs_dictionary_get_length(RSDictionary* self);
+
+/**
+ * Compression strategies.
+ *
+ * These have the same meaning as the zlib strategies of the same
+ * name. Codecs and encodings that don't have strategies ignore them.
+ */
+typedef enum
+{
+    /**
+     * For ordinary data.
+     */
+    RS_STRATEGY_DEFAULT = 0,
+    
+    /**
+     * For data with lots of small, somewhat random values.
+     */
+    RS_STRATEGY_FILTERED = 1,
+    
+    /**
+     * Huffman coding only, with no string matching.
+     */
+    RS_STRATEGY_HUFFMAN_ONLY = 2,
+    
+    /**
+     * Only match runs of the same byte -- nearly as fast as
+     * RS_STRATEGY_HUFFMAN_ONLY, but works well on block data.
+     */
+    RS_STRATEGY_RLE = 3,
+    
+    /**
+     * Like RS_STRATEGY_DEFAULT, but without dynamic Huffman codes.
+     */
+    RS_STRATEGY_FIXED = 4,
+} RSCompressionStrategy;
+
+/**
+ * Settings that trade compression speed against size.
+ *
+ * Fill one of these in with rs_compression_options_init(), change
+ * whatever you need, and pass it to rs_compress_full(),
+ * rs_nbt_write_full() and friends, or make it the default for a region
+ * with rs_region_set_compression_options().
+ *
+ * The defaults (level 1, RS_STRATEGY_RLE) favor speed, since that is
+ * what matters most for saving worlds while they are in use. For
+ * archiving, use level 9 and RS_STRATEGY_DEFAULT.
+ */
+typedef struct
+{
+    /**
+     * The compression level, from 0 (none) to 9 (smallest), or -1 for
+     * the codec's own default. For RS_LZ4, 0 stores the data as-is,
+     * and anything else compresses it. For RS_ZSTD, 0 is the same as
+     * -1.
+     */
+    int level;
+    
+    /**
+     * The compression strategy. The "libdeflate" codec (see
+     * rs_set_codec()) has no strategies: it treats RS_STRATEGY_RLE
+     * like RS_STRATEGY_DEFAULT, and hands anything else over to zlib.
+     */
+    RSCompressionStrategy strategy;
+    
+    /**
+     * How much memory to use for compression state, from 1 to 9. Only
+     * used by zlib, so with the "libdeflate" codec, anything but the
+     * default of 8 compresses with zlib instead.
+     */
+    int mem_level;
+    
+    /**
+     * The base-2 log of the window size, from 9 to 15. Smaller windows
+     * use less memory, but compress worse. Only used by zlib, so with
+     * the "libdeflate" codec, anything but the default of 15
+     * compresses with zlib instead.
+     */
+    int window_bits;
+    
+    /**
+     * The dictionary to compress with, or NULL. Only used by RS_ZSTD,
+     * and no reference is taken, so it must last until the call
+     * returns.
+     */
+    RSDictionary* dictionary;
+
+    /**
+     * How many threads to compress RS_GZIP and RS_ZLIB data with, or 0
+     * for one per processor. Large buffers are split into blocks that
+     * are deflated in parallel, pigz-style, and joined back up into a
+     * single ordinary stream a few bytes larger than usual. Buffers
+     * too small to split are always compressed on the calling thread.
+     * The default is 1.
+     */
+    unsigned int threads;
+} RSCompressionOptions;
+
+/**
+ * Fill in the default compression options.
+ *
+ * \param options the options to fill in
+ * \sa RSCompressionOptions
+ */
+void rs_compression_options_init(RSCompressionOptions* options);
+
 /**
  * Decompress the given data.
  *
@@ -52,6 +278,11 @@ typedef enum
  *
  * In the event of an error, *outdata will be set to NULL.
  *
+ * The output is inflated straight into a buffer sized with
+ * rs_get_decompressed_size(), which only grows if that guess was too
+ * small. The zlib state used is kept around for the next call in the
+ * same thread (see RSDecompressor).
+ *
  * \param enc the type of encoding to decompress with
  * \param gzdata the data to decompress
  * \param gzdatalen the length of gzdata
@@ -61,6 +292,86 @@ typedef enum
  */
 void rs_decompress(RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** outdata, size_t* outdatalen);
 
+/**
+ * Decompress the given data, with a dictionary.
+ *
+ * This works exactly like rs_decompress(), but can decompress RS_ZSTD
+ * data that was compressed with a dictionary. Other encodings ignore
+ * the dictionary.
+ *
+ * \param enc the type of encoding to decompress with
+ * \param dictionary the dictionary the data was compressed with, or NULL
+ * \param gzdata the data to decompress
+ * \param gzdatalen the length of gzdata
+ * \param outdata where to store the output buffer
+ * \param outdatalen where to store the output buffer length
+ * \sa rs_decompress, RSDictionary
+ */
+void rs_decompress_full(RSCompressionType enc, RSDictionary* dictionary, uint8_t* gzdata, size_t gzdatalen, uint8_t** outdata, size_t* outdatalen);
+
+/**
+ * Decompress the given data into a buffer you provide.
+ *
+ * This works like rs_decompress(), but inflates straight into out,
+ * which has room for outcap bytes, so no memory is allocated for the
+ * output. Use rs_get_decompressed_size() to find out how big out
+ * should be, or reuse one buffer that is big enough for everything.
+ *
+ * If the data is invalid, this returns false and sets *outlen to
+ * 0. If the output doesn't fit, it returns false and sets *outlen to
+ * outcap, and the contents of out are undefined.
+ *
+ * \param enc the type of encoding to decompress with
+ * \param gzdata the data to decompress
+ * \param gzdatalen the length of gzdata
+ * \param out where to write the decompressed data
+ * \param outcap how many bytes fit in out
+ * \param outlen where to store the decompressed length
+ * \return true if all the data was decompressed
+ * \sa rs_decompress, rs_decompress_into_full, rs_get_decompressed_size
+ */
+bool rs_decompress_into(RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t* out, size_t outcap, size_t* outlen);
+
+/**
+ * Decompress the given data into a buffer you provide, with a
+ * dictionary.
+ *
+ * This works exactly like rs_decompress_into(), but can decompress
+ * RS_ZSTD data that was compressed with a dictionary, which
+ * rs_decompress_into() rejects as invalid. Other encodings ignore the
+ * dictionary.
+ *
+ * \param enc the type of encoding to decompress with
+ * \param dictionary the dictionary the data was compressed with, or NULL
+ * \param gzdata the data to decompress
+ * \param gzdatalen the length of gzdata
+ * \param out where to write the decompressed data
+ * \param outcap how many bytes fit in out
+ * \param outlen where to store the decompressed length
+ * \return true if all the data was decompressed
+ * \sa rs_decompress_into, RSDictionary
+ */
+bool rs_decompress_into_full(RSCompressionType enc, RSDictionary* dictionary, uint8_t* gzdata, size_t gzdatalen, uint8_t* out, size_t outcap, size_t* outlen);
+
+/**
+ * Guess how long data will be once it's decompressed.
+ *
+ * If hint is non-zero, it is returned as-is -- use it when you know
+ * the size from somewhere else. Otherwise, gzip data records its
+ * size in its trailer, and that is returned (unless it is clearly
+ * wrong). LZ4 and uncompressed data always give the exact size. zlib
+ * data doesn't record it, so for that, this returns a generous guess
+ * based on len.
+ *
+ * \param enc the type of encoding the data uses
+ * \param data the compressed data
+ * \param len the length of the compressed data
+ * \param hint the known size, or 0
+ * \return the expected decompressed size
+ * \sa rs_decompress_into
+ */
+size_t rs_get_decompressed_size(RSCompressionType enc, void* data, size_t len, size_t hint);
+
 /**
  * Compress the given data.
  *
@@ -71,15 +382,422 @@ void rs_decompress(RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uin
  *
  * In the event of an error, *gzdata will be set to NULL.
  *
+ * The zlib state used is kept around for the next call in the same
+ * thread (see RSCompressor).
+ *
  * \param enc the type of encoding to compress with
  * \param rawdata the data to compress
  * \param rawdatalen the length of rawdata
  * \param gzdata where to store the compressed output buffer
  * \param gzdatalen where to store the compressed output buffer length
- * \sa rs_decompress, rs_free
+ * \sa rs_decompress, rs_compress_full, rs_free
  */
 void rs_compress(RSCompressionType enc, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen);
 
+/**
+ * Compress the given data, with the given options.
+ *
+ * This works exactly like rs_compress(), except that it uses the given
+ * options instead of the defaults.
+ *
+ * \param enc the type of encoding to compress with
+ * \param options the compression options to use, or NULL for defaults
+ * \param rawdata the data to compress
+ * \param rawdatalen the length of rawdata
+ * \param gzdata where to store the compressed output buffer
+ * \param gzdatalen where to store the compressed output buffer length
+ * \sa rs_compress, RSCompressionOptions
+ */
+void rs_compress_full(RSCompressionType enc, const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen);
+
+/**
+ * A reusable decompression context.
+ *
+ * Setting up zlib allocates and clears a few hundred kilobytes of
+ * state (other codecs are similar), so decompressing many small buffers (like chunks) is much
+ * faster if that state is kept around between calls. An
+ * RSDecompressor does just that. rs_decompress() uses one of these per
+ * thread automatically, so you only need your own if you want to
+ * control its lifetime.
+ *
+ * A decompressor must only be used by one thread at a time.
+ *
+ * \sa rs_decompressor_new, rs_decompressor_decompress, RSCompressor
+ */
+typedef struct _RSDecompressor RSDecompressor;
+
+/**
+ * Create a new decompression context.
+ *
+ * \return the new context, to be freed with rs_decompressor_free()
+ * \sa rs_decompressor_free
+ */
+RSDecompressor* rs_decompressor_new(void);
+
+/**
+ * Free a decompression context.
+ *
+ * \param self the context to free
+ * \sa rs_decompressor_new
+ */
+void rs_decompressor_free(RSDecompressor* self);
+
+/**
+ * Decompress the given data, with a reusable context.
+ *
+ * This works exactly like rs_decompress(), but uses (and keeps) the
+ * zlib state in the given context.
+ *
+ * \param self the context to use
+ * \param enc the type of encoding to decompress with
+ * \param gzdata the data to decompress
+ * \param gzdatalen the length of gzdata
+ * \param outdata where to store the output buffer
+ * \param outdatalen where to store the output buffer length
+ * \sa rs_decompress
+ */
+void rs_decompressor_decompress(RSDecompressor* self, RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** outdata, size_t* outdatalen);
+
+/**
+ * Decompress the given data, with a reusable context and a dictionary.
+ *
+ * This works exactly like rs_decompress_full(), but uses (and keeps)
+ * the decompression state in the given context.
+ *
+ * \param self the context to use
+ * \param enc the type of encoding to decompress with
+ * \param dictionary the dictionary the data was compressed with, or NULL
+ * \param gzdata the data to decompress
+ * \param gzdatalen the length of gzdata
+ * \param outdata where to store the output buffer
+ * \param outdatalen where to store the output buffer length
+ * \sa rs_decompress_full
+ */
+void rs_decompressor_decompress_full(RSDecompressor* self, RSCompressionType enc, RSDictionary* dictionary, uint8_t* gzdata, size_t gzdatalen, uint8_t** outdata, size_t* outdatalen);
+
+/**
+ * Decompress into a buffer you provide, with a reusable context.
+ *
+ * This works exactly like rs_decompress_into(), but uses (and keeps)
+ * the zlib state in the given context.
+ *
+ * \param self the context to use
+ * \param enc the type of encoding to decompress with
+ * \param gzdata the data to decompress
+ * \param gzdatalen the length of gzdata
+ * \param out where to write the decompressed data
+ * \param outcap how many bytes fit in out
+ * \param outlen where to store the decompressed length
+ * \return true if all the data was decompressed
+ * \sa rs_decompress_into
+ */
+bool rs_decompressor_decompress_into(RSDecompressor* self, RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t* out, size_t outcap, size_t* outlen);
+
+/**
+ * Decompress into a buffer you provide, with a reusable context and a
+ * dictionary.
+ *
+ * This works exactly like rs_decompress_into_full(), but uses (and
+ * keeps) the decompression state in the given context.
+ *
+ * \param self the context to use
+ * \param enc the type of encoding to decompress with
+ * \param dictionary the dictionary the data was compressed with, or NULL
+ * \param gzdata the data to decompress
+ * \param gzdatalen the length of gzdata
+ * \param out where to write the decompressed data
+ * \param outcap how many bytes fit in out
+ * \param outlen where to store the decompressed length
+ * \return true if all the data was decompressed
+ * \sa rs_decompress_into_full
+ */
+bool rs_decompressor_decompress_into_full(RSDecompressor* self, RSCompressionType enc, RSDictionary* dictionary, uint8_t* gzdata, size_t gzdatalen, uint8_t* out, size_t outcap, size_t* outlen);
+
+/**
+ * A reusable compression context.
+ *
+ * This is the compression counterpart to RSDecompressor, and
+ * rs_compress() uses one per thread in the same way.
+ *
+ * A compressor must only be used by one thread at a time.
+ *
+ * \sa rs_compressor_new, rs_compressor_compress, RSDecompressor
+ */
+typedef struct _RSCompressor RSCompressor;
+
+/**
+ * Create a new compression context.
+ *
+ * \return the new context, to be freed with rs_compressor_free()
+ * \sa rs_compressor_free
+ */
+RSCompressor* rs_compressor_new(void);
+
+/**
+ * Free a compression context.
+ *
+ * \param self the context to free
+ * \sa rs_compressor_new
+ */
+void rs_compressor_free(RSCompressor* self);
+
+/**
+ * Compress the given data, with a reusable context.
+ *
+ * This works exactly like rs_compress(), but uses (and keeps) the
+ * zlib state in the given context.
+ *
+ * \param self the context to use
+ * \param enc the type of encoding to compress with
+ * \param rawdata the data to compress
+ * \param rawdatalen the length of rawdata
+ * \param gzdata where to store the compressed output buffer
+ * \param gzdatalen where to store the compressed output buffer length
+ * \sa rs_compress
+ */
+void rs_compressor_compress(RSCompressor* self, RSCompressionType enc, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen);
+
+/**
+ * Compress the given data, with a reusable context and options.
+ *
+ * This works exactly like rs_compress_full(), but uses (and keeps)
+ * the zlib state in the given context. Switching between different
+ * options is cheapest when only the level and strategy change.
+ *
+ * \param self the context to use
+ * \param enc the type of encoding to compress with
+ * \param options the compression options to use, or NULL for defaults
+ * \param rawdata the data to compress
+ * \param rawdatalen the length of rawdata
+ * \param gzdata where to store the compressed output buffer
+ * \param gzdatalen where to store the compressed output buffer length
+ * \sa rs_compress_full
+ */
+void rs_compressor_compress_full(RSCompressor* self, RSCompressionType enc, const RSCompressionOptions* options, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen);
+
+/**
+ * An incremental decompressor.
+ *
+ * rs_decompress() needs all of the input, and makes room for all of
+ * the output, at once. An RSInflateStream instead takes input a piece
+ * at a time with rs_inflate_stream_feed(), and hands back output a
+ * piece at a time with rs_inflate_stream_drain(), so it can sit
+ * between sockets, pipes or files without ever holding more than a
+ * small, fixed amount of data.
+ *
+ * The usual loop is to feed in whatever input is at hand, then drain
+ * until rs_inflate_stream_drain() returns less than the space it was
+ * given. At that point everything fed in so far has been used up, and
+ * the next feed will take a whole buffer's worth again.
+ *
+ * Streams always use zlib, whatever codec is selected, and only
+ * handle RS_GZIP and RS_ZLIB data. A stream must only be used by one
+ * thread at a time.
+ *
+ * \sa rs_inflate_stream_new, RSDeflateStream
+ */
+typedef struct _RSInflateStream RSInflateStream;
+
+/**
+ * Create a new decompression stream.
+ *
+ * \param enc RS_GZIP, RS_ZLIB, or RS_AUTO_COMPRESSION to accept either
+ * \return the new stream, or NULL if enc is not supported
+ * \sa rs_inflate_stream_free
+ */
+RSInflateStream* rs_inflate_stream_new(RSCompressionType enc);
+
+/**
+ * Free a decompression stream.
+ *
+ * \param self the stream to free
+ * \sa rs_inflate_stream_new
+ */
+void rs_inflate_stream_free(RSInflateStream* self);
+
+/**
+ * Give compressed data to a decompression stream.
+ *
+ * The data is copied into the stream's input buffer, which has a
+ * fixed size. If it fills up, only part of the data is taken, and the
+ * rest should be fed in again after a drain.
+ *
+ * \param self the stream to feed
+ * \param data the compressed data
+ * \param len the length of data
+ * \return how many bytes of data were taken
+ * \sa rs_inflate_stream_drain
+ */
+size_t rs_inflate_stream_feed(RSInflateStream* self, const uint8_t* data, size_t len);
+
+/**
+ * Get decompressed data out of a decompression stream.
+ *
+ * This decompresses as much of the fed data as fits in out. Anything
+ * left over is kept for the next call.
+ *
+ * \param self the stream to drain
+ * \param out where to write decompressed data
+ * \param outlen how much room there is in out
+ * \return how many bytes were written to out
+ * \sa rs_inflate_stream_feed, rs_inflate_stream_is_finished
+ */
+size_t rs_inflate_stream_drain(RSInflateStream* self, uint8_t* out, size_t outlen);
+
+/**
+ * Check whether a decompression stream has reached the end of its
+ * data.
+ *
+ * Once this is true, all output has been drained, and anything fed in
+ * after the end of the stream is ignored.
+ *
+ * \param self the stream to check
+ * \return true if the stream is finished
+ */
+bool rs_inflate_stream_is_finished(RSInflateStream* self);
+
+/**
+ * Check whether a decompression stream has been given bad data.
+ *
+ * A failed stream stops producing output for good.
+ *
+ * \param self the stream to check
+ * \return true if the data was corrupt
+ */
+bool rs_inflate_stream_has_failed(RSInflateStream* self);
+
+/**
+ * An incremental compressor.
+ *
+ * This is the compressing counterpart of RSInflateStream, and works
+ * the same way: feed in raw data with rs_deflate_stream_feed(), and
+ * drain compressed data with rs_deflate_stream_drain() until it
+ * returns less than the space it was given. Once all the input is in,
+ * call rs_deflate_stream_finish(), then drain until
+ * rs_deflate_stream_is_finished() is true.
+ *
+ * Streams always use zlib, and only write RS_GZIP and RS_ZLIB data.
+ * They are never split up between threads, so the threads option is
+ * ignored.
+ *
+ * \sa rs_deflate_stream_new, RSInflateStream
+ */
+typedef struct _RSDeflateStream RSDeflateStream;
+
+/**
+ * Create a new compression stream.
+ *
+ * \param enc RS_GZIP or RS_ZLIB
+ * \param options the compression options to use, or NULL for defaults
+ * \return the new stream, or NULL if enc or options are not supported
+ * \sa rs_deflate_stream_free
+ */
+RSDeflateStream* rs_deflate_stream_new(RSCompressionType enc, const RSCompressionOptions* options);
+
+/**
+ * Free a compression stream.
+ *
+ * \param self the stream to free
+ * \sa rs_deflate_stream_new
+ */
+void rs_deflate_stream_free(RSDeflateStream* self);
+
+/**
+ * Give raw data to a compression stream.
+ *
+ * As with rs_inflate_stream_feed(), only as much as fits in the
+ * stream's input buffer is taken.
+ *
+ * \param self the stream to feed
+ * \param data the data to compress
+ * \param len the length of data
+ * \return how many bytes of data were taken
+ * \sa rs_deflate_stream_drain, rs_deflate_stream_finish
+ */
+size_t rs_deflate_stream_feed(RSDeflateStream* self, const uint8_t* data, size_t len);
+
+/**
+ * Mark the end of a compression stream's input.
+ *
+ * Nothing more can be fed in after this, and the next drains write
+ * out the rest of the compressed data.
+ *
+ * \param self the stream to finish
+ * \sa rs_deflate_stream_is_finished
+ */
+void rs_deflate_stream_finish(RSDeflateStream* self);
+
+/**
+ * Get compressed data out of a compression stream.
+ *
+ * \param self the stream to drain
+ * \param out where to write compressed data
+ * \param outlen how much room there is in out
+ * \return how many bytes were written to out
+ * \sa rs_deflate_stream_feed
+ */
+size_t rs_deflate_stream_drain(RSDeflateStream* self, uint8_t* out, size_t outlen);
+
+/**
+ * Check whether all of a compression stream's output has been drained.
+ *
+ * \param self the stream to check
+ * \return true if the stream has been finished and fully drained
+ */
+bool rs_deflate_stream_is_finished(RSDeflateStream* self);
+
+/**
+ * Check whether a compression stream has run into an error.
+ *
+ * \param self the stream to check
+ * \return true if compression failed
+ */
+bool rs_deflate_stream_has_failed(RSDeflateStream* self);
+
+/**
+ * Select the codec used for compression and decompression.
+ *
+ * libredstone can be built with more than one implementation of
+ * deflate. "zlib" is always available (it is called "zlib-ng" when
+ * built against zlib-ng in zlib-compatible mode), and "libdeflate" is
+ * available if it was found at build time. libdeflate is much faster
+ * at whole buffers like chunks, so it is the default when it is
+ * there. The RS_CODEC environment variable can also be used to pick
+ * the default.
+ *
+ * All codecs read and write standard gzip and zlib streams, so data
+ * written by one can always be read by another, though the exact
+ * compressed bytes may differ.
+ *
+ * Contexts (see RSDecompressor and RSCompressor) switch over the next
+ * time they are used.
+ *
+ * \param name the codec to use
+ * \return true if the codec is available, false otherwise
+ * \sa rs_get_codec, rs_get_available_codec
+ */
+bool rs_set_codec(const char* name);
+
+/**
+ * Get the name of the codec currently in use.
+ *
+ * \return the codec name
+ * \sa rs_set_codec
+ */
+const char* rs_get_codec(void);
+
+/**
+ * List the codecs that are available.
+ *
+ * Call this with i = 0, 1, 2, ... until it returns NULL. The fastest
+ * codec comes first.
+ *
+ * \param i the index of the codec
+ * \return the codec name, or NULL if there aren't that many
+ * \sa rs_set_codec
+ */
+const char* rs_get_available_codec(unsigned int i);
+
 /**
  * Use this to intelligently guess compression type.
  *
@@ -87,6 +805,9 @@ void rs_compress(RSCompressionType enc, uint8_t* rawdata, size_t rawdatalen, uin
  * compression type cannot be guessed, it will return
  * RS_UNKNOWN_COMPRESSION.
  *
+ * This never returns RS_UNCOMPRESSED, since there's no way to
+ * recognize uncompressed data in general.
+ *
  * \param data the data to guess for
  * \param len the length of the data
  * \return the guessed compression type
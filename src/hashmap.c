@@ -0,0 +1,344 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "hashmap.h"
+
+#include "memory.h"
+#include "error.h"
+
+#include <string.h>
+
+#define RS_HASH_MAP_MIN_CAPACITY 16
+
+/* the top bit is always set in a stored hash, so 0 means empty */
+#define RS_HASH_MAP_USED ((uint64_t)1 << 63)
+
+typedef struct
+{
+    uint64_t hash;
+    union
+    {
+        char* string;
+        int64_t integer;
+    } key;
+    void* value;
+} RSHashMapSlot;
+
+struct _RSHashMap
+{
+    RSHashMapKeyType key_type;
+    RSListFunction value_free;
+    
+    /* capacity is always a power of two, and never more than 3/4 full */
+    RSHashMapSlot* slots;
+    size_t capacity;
+    size_t size;
+};
+
+/* FNV-1a */
+static inline uint64_t _rs_hash_map_hash_string(const char* key)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *key; key++)
+    {
+        hash ^= (uint8_t)*key;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash | RS_HASH_MAP_USED;
+}
+
+/* the splitmix64 finalizer, so nearby integers spread out */
+static inline uint64_t _rs_hash_map_hash_integer(int64_t key)
+{
+    uint64_t hash = (uint64_t)key;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash | RS_HASH_MAP_USED;
+}
+
+RSHashMap* rs_hash_map_new(RSHashMapKeyType key_type)
+{
+    return rs_hash_map_new_full(key_type, NULL);
+}
+
+RSHashMap* rs_hash_map_new_full(RSHashMapKeyType key_type, RSListFunction value_free)
+{
+    rs_return_val_if_fail(key_type == RS_HASH_MAP_STRING_KEYS || key_type == RS_HASH_MAP_INTEGER_KEYS, NULL);
+    
+    RSHashMap* self = rs_new0(RSHashMap, 1);
+    self->key_type = key_type;
+    self->value_free = value_free;
+    return self;
+}
+
+/* frees the key copy and the value, but leaves the slot alone */
+static inline void _rs_hash_map_slot_free(RSHashMap* self, RSHashMapSlot* slot)
+{
+    if (self->key_type == RS_HASH_MAP_STRING_KEYS)
+        rs_free(slot->key.string);
+    if (self->value_free)
+        self->value_free(slot->value);
+}
+
+void rs_hash_map_clear(RSHashMap* self)
+{
+    rs_return_if_fail(self);
+    
+    size_t i;
+    for (i = 0; i < self->capacity && self->size > 0; i++)
+    {
+        if (self->slots[i].hash)
+        {
+            _rs_hash_map_slot_free(self, &(self->slots[i]));
+            self->slots[i].hash = 0;
+            self->size--;
+        }
+    }
+}
+
+void rs_hash_map_free(RSHashMap* self)
+{
+    rs_return_if_fail(self);
+    
+    rs_hash_map_clear(self);
+    rs_free(self->slots);
+    rs_free(self);
+}
+
+size_t rs_hash_map_get_size(RSHashMap* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return self->size;
+}
+
+static inline bool _rs_hash_map_slot_matches(RSHashMap* self, RSHashMapSlot* slot, uint64_t hash, const char* string, int64_t integer)
+{
+    if (slot->hash != hash)
+        return false;
+    if (self->key_type == RS_HASH_MAP_STRING_KEYS)
+        return strcmp(slot->key.string, string) == 0;
+    return slot->key.integer == integer;
+}
+
+/* returns the slot holding the key, or the empty slot where it would go */
+static RSHashMapSlot* _rs_hash_map_find(RSHashMap* self, uint64_t hash, const char* string, int64_t integer)
+{
+    size_t mask = self->capacity - 1;
+    size_t i = hash & mask;
+    while (true)
+    {
+        RSHashMapSlot* slot = &(self->slots[i]);
+        if (!slot->hash || _rs_hash_map_slot_matches(self, slot, hash, string, integer))
+            return slot;
+        i = (i + 1) & mask;
+    }
+}
+
+static void _rs_hash_map_resize(RSHashMap* self, size_t capacity)
+{
+    RSHashMapSlot* old_slots = self->slots;
+    size_t old_capacity = self->capacity;
+    
+    self->slots = rs_new0(RSHashMapSlot, capacity);
+    self->capacity = capacity;
+    
+    /* keys are all different, so just drop each one in the first gap */
+    size_t i;
+    for (i = 0; i < old_capacity; i++)
+    {
+        if (!old_slots[i].hash)
+            continue;
+        
+        size_t j = old_slots[i].hash & (capacity - 1);
+        while (self->slots[j].hash)
+            j = (j + 1) & (capacity - 1);
+        self->slots[j] = old_slots[i];
+    }
+    
+    rs_free(old_slots);
+}
+
+static void _rs_hash_map_insert(RSHashMap* self, uint64_t hash, const char* string, int64_t integer, void* value)
+{
+    if ((self->size + 1) * 4 > self->capacity * 3)
+        _rs_hash_map_resize(self, self->capacity ? self->capacity * 2 : RS_HASH_MAP_MIN_CAPACITY);
+    
+    RSHashMapSlot* slot = _rs_hash_map_find(self, hash, string, integer);
+    if (slot->hash)
+    {
+        /* replacing -- keep the key we already have */
+        if (self->value_free && slot->value != value)
+            self->value_free(slot->value);
+        slot->value = value;
+        return;
+    }
+    
+    slot->hash = hash;
+    if (self->key_type == RS_HASH_MAP_STRING_KEYS)
+    {
+        slot->key.string = rs_strdup(string);
+    } else {
+        slot->key.integer = integer;
+    }
+    slot->value = value;
+    self->size++;
+}
+
+static RSHashMapSlot* _rs_hash_map_lookup(RSHashMap* self, uint64_t hash, const char* string, int64_t integer)
+{
+    if (self->size == 0)
+        return NULL;
+    
+    RSHashMapSlot* slot = _rs_hash_map_find(self, hash, string, integer);
+    return slot->hash ? slot : NULL;
+}
+
+static bool _rs_hash_map_remove(RSHashMap* self, uint64_t hash, const char* string, int64_t integer)
+{
+    RSHashMapSlot* slot = _rs_hash_map_lookup(self, hash, string, integer);
+    if (!slot)
+        return false;
+    
+    _rs_hash_map_slot_free(self, slot);
+    self->size--;
+    
+    /* shift later entries back into the gap, so lookups never have to
+     * skip over deleted slots
+     */
+    size_t mask = self->capacity - 1;
+    size_t gap = slot - self->slots;
+    size_t i = (gap + 1) & mask;
+    while (self->slots[i].hash)
+    {
+        size_t home = self->slots[i].hash & mask;
+        /* move it if its home is not between the gap and here */
+        if (((i - home) & mask) >= ((i - gap) & mask))
+        {
+            self->slots[gap] = self->slots[i];
+            gap = i;
+        }
+        i = (i + 1) & mask;
+    }
+    self->slots[gap].hash = 0;
+    
+    return true;
+}
+
+void rs_hash_map_insert(RSHashMap* self, const char* key, void* value)
+{
+    rs_return_if_fail(self && self->key_type == RS_HASH_MAP_STRING_KEYS);
+    rs_return_if_fail(key);
+    
+    _rs_hash_map_insert(self, _rs_hash_map_hash_string(key), key, 0, value);
+}
+
+void* rs_hash_map_lookup(RSHashMap* self, const char* key)
+{
+    rs_return_val_if_fail(self && self->key_type == RS_HASH_MAP_STRING_KEYS, NULL);
+    rs_return_val_if_fail(key, NULL);
+    
+    RSHashMapSlot* slot = _rs_hash_map_lookup(self, _rs_hash_map_hash_string(key), key, 0);
+    return slot ? slot->value : NULL;
+}
+
+bool rs_hash_map_contains(RSHashMap* self, const char* key)
+{
+    rs_return_val_if_fail(self && self->key_type == RS_HASH_MAP_STRING_KEYS, false);
+    rs_return_val_if_fail(key, false);
+    
+    return _rs_hash_map_lookup(self, _rs_hash_map_hash_string(key), key, 0) != NULL;
+}
+
+bool rs_hash_map_remove(RSHashMap* self, const char* key)
+{
+    rs_return_val_if_fail(self && self->key_type == RS_HASH_MAP_STRING_KEYS, false);
+    rs_return_val_if_fail(key, false);
+    
+    return _rs_hash_map_remove(self, _rs_hash_map_hash_string(key), key, 0);
+}
+
+void rs_hash_map_insert_int(RSHashMap* self, int64_t key, void* value)
+{
+    rs_return_if_fail(self && self->key_type == RS_HASH_MAP_INTEGER_KEYS);
+    
+    _rs_hash_map_insert(self, _rs_hash_map_hash_integer(key), NULL, key, value);
+}
+
+void* rs_hash_map_lookup_int(RSHashMap* self, int64_t key)
+{
+    rs_return_val_if_fail(self && self->key_type == RS_HASH_MAP_INTEGER_KEYS, NULL);
+    
+    RSHashMapSlot* slot = _rs_hash_map_lookup(self, _rs_hash_map_hash_integer(key), NULL, key);
+    return slot ? slot->value : NULL;
+}
+
+bool rs_hash_map_contains_int(RSHashMap* self, int64_t key)
+{
+    rs_return_val_if_fail(self && self->key_type == RS_HASH_MAP_INTEGER_KEYS, false);
+    
+    return _rs_hash_map_lookup(self, _rs_hash_map_hash_integer(key), NULL, key) != NULL;
+}
+
+bool rs_hash_map_remove_int(RSHashMap* self, int64_t key)
+{
+    rs_return_val_if_fail(self && self->key_type == RS_HASH_MAP_INTEGER_KEYS, false);
+    
+    return _rs_hash_map_remove(self, _rs_hash_map_hash_integer(key), NULL, key);
+}
+
+void rs_hash_map_iterator_init(RSHashMap* self, RSHashMapIterator* it)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(it);
+    
+    it->map = self;
+    it->index = 0;
+}
+
+static RSHashMapSlot* _rs_hash_map_iterator_next(RSHashMapIterator* it)
+{
+    RSHashMap* self = it->map;
+    while (it->index < self->capacity)
+    {
+        RSHashMapSlot* slot = &(self->slots[it->index++]);
+        if (slot->hash)
+            return slot;
+    }
+    
+    return NULL;
+}
+
+bool rs_hash_map_iterator_next(RSHashMapIterator* it, const char** key, void** value)
+{
+    rs_return_val_if_fail(it && it->map, false);
+    rs_return_val_if_fail(it->map->key_type == RS_HASH_MAP_STRING_KEYS, false);
+    
+    RSHashMapSlot* slot = _rs_hash_map_iterator_next(it);
+    if (!slot)
+        return false;
+    
+    if (key)
+        *key = slot->key.string;
+    if (value)
+        *value = slot->value;
+    return true;
+}
+
+bool rs_hash_map_iterator_next_int(RSHashMapIterator* it, int64_t* key, void** value)
+{
+    rs_return_val_if_fail(it && it->map, false);
+    rs_return_val_if_fail(it->map->key_type == RS_HASH_MAP_INTEGER_KEYS, false);
+    
+    RSHashMapSlot* slot = _rs_hash_map_iterator_next(it);
+    if (!slot)
+        return false;
+    
+    if (key)
+        *key = slot->key.integer;
+    if (value)
+        *value = slot->value;
+    return true;
+}
@@ -0,0 +1,184 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_HASHMAP_H_INCLUDED__
+#define __RS_HASHMAP_H_INCLUDED__
+
+#include "list.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * The kinds of keys a hash map can have.
+ *
+ * \sa rs_hash_map_new
+ */
+typedef enum
+{
+    /** nul-terminated strings, which the map copies */
+    RS_HASH_MAP_STRING_KEYS,
+    /** 64-bit integers */
+    RS_HASH_MAP_INTEGER_KEYS
+} RSHashMapKeyType;
+
+struct _RSHashMap;
+/**
+ * A hash map.
+ *
+ * This maps keys (either strings, or integers) to pointers. It keeps
+ * everything in one flat table, using open addressing with linear
+ * probing, so a lookup usually touches a single cache line.
+ *
+ * A map only works with one kind of key, chosen when it is created:
+ * use the plain functions for string keys, and the _int functions for
+ * integer keys.
+ *
+ * \sa rs_hash_map_new
+ */
+typedef struct _RSHashMap RSHashMap;
+
+/**
+ * Iterator for hash maps.
+ *
+ * Initialize this with rs_hash_map_iterator_init(). The map must not
+ * be changed while iterating, except to change the value of the
+ * current entry with rs_hash_map_insert(). Entries come out in no
+ * particular order.
+ *
+ * \sa rs_hash_map_iterator_init
+ */
+typedef struct
+{
+    /* private */
+    RSHashMap* map;
+    size_t index;
+} RSHashMapIterator;
+
+/**
+ * Create a new, empty hash map.
+ *
+ * \param key_type the kind of keys the map uses
+ * \return the new map
+ * \sa rs_hash_map_new_full, rs_hash_map_free
+ */
+RSHashMap* rs_hash_map_new(RSHashMapKeyType key_type);
+
+/**
+ * Create a new, empty hash map that owns its values.
+ *
+ * This is just like rs_hash_map_new(), but value_free is called on
+ * each value when it is replaced or removed, or when the map is
+ * cleared or freed. For example, use rs_free() if each value was
+ * allocated with rs_malloc().
+ *
+ * \param key_type the kind of keys the map uses
+ * \param value_free the function to free values with, or NULL
+ * \return the new map
+ * \sa rs_hash_map_new, rs_hash_map_free
+ */
+RSHashMap* rs_hash_map_new_full(RSHashMapKeyType key_type, RSListFunction value_free);
+
+/**
+ * Free a hash map, and its copies of the keys.
+ *
+ * \param self the map to free
+ * \sa rs_hash_map_new
+ */
+void rs_hash_map_free(RSHashMap* self);
+
+/**
+ * Remove everything from a hash map.
+ *
+ * \param self the map
+ */
+void rs_hash_map_clear(RSHashMap* self);
+
+/**
+ * Get the number of entries in a hash map.
+ *
+ * \param self the map
+ * \return the number of entries
+ */
+size_t rs_hash_map_get_size(RSHashMap* self);
+
+/**
+ * Add or replace an entry in a map with string keys.
+ *
+ * The key is copied, so it need not outlive the call.
+ *
+ * \param self the map
+ * \param key the key
+ * \param value the value to store
+ * \sa rs_hash_map_lookup, rs_hash_map_insert_int
+ */
+void rs_hash_map_insert(RSHashMap* self, const char* key, void* value);
+
+/**
+ * Find the value for a key in a map with string keys.
+ *
+ * \param self the map
+ * \param key the key
+ * \return the value, or NULL if the key is not in the map
+ * \sa rs_hash_map_contains, rs_hash_map_lookup_int
+ */
+void* rs_hash_map_lookup(RSHashMap* self, const char* key);
+
+/**
+ * Check whether a key is in a map with string keys.
+ *
+ * Use this to tell a missing key from one that has a NULL value.
+ *
+ * \param self the map
+ * \param key the key
+ * \return true if the key is in the map
+ * \sa rs_hash_map_lookup
+ */
+bool rs_hash_map_contains(RSHashMap* self, const char* key);
+
+/**
+ * Remove an entry from a map with string keys.
+ *
+ * \param self the map
+ * \param key the key
+ * \return true if the key was in the map
+ * \sa rs_hash_map_insert
+ */
+bool rs_hash_map_remove(RSHashMap* self, const char* key);
+
+/** Integer-key version of rs_hash_map_insert(). */
+void rs_hash_map_insert_int(RSHashMap* self, int64_t key, void* value);
+/** Integer-key version of rs_hash_map_lookup(). */
+void* rs_hash_map_lookup_int(RSHashMap* self, int64_t key);
+/** Integer-key version of rs_hash_map_contains(). */
+bool rs_hash_map_contains_int(RSHashMap* self, int64_t key);
+/** Integer-key version of rs_hash_map_remove(). */
+bool rs_hash_map_remove_int(RSHashMap* self, int64_t key);
+
+/**
+ * Initialize a hash map iterator.
+ *
+ * \param self the map to iterate over
+ * \param it the iterator to initialize
+ * \sa rs_hash_map_iterator_next, rs_hash_map_iterator_next_int
+ */
+void rs_hash_map_iterator_init(RSHashMap* self, RSHashMapIterator* it);
+
+/**
+ * Get the next entry from a map with string keys.
+ *
+ * \param it the iterator
+ * \param key where to put the key, or NULL
+ * \param value where to put the value, or NULL
+ * \return true if there was another entry, false when done
+ * \sa rs_hash_map_iterator_init
+ */
+bool rs_hash_map_iterator_next(RSHashMapIterator* it, const char** key, void** value);
+
+/** Integer-key version of rs_hash_map_iterator_next(). */
+bool rs_hash_map_iterator_next_int(RSHashMapIterator* it, int64_t* key, void** value);
+
+#endif /* __RS_HASHMAP_H_INCLUDED__ */
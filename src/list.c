@@ -3,14 +3,17 @@
  * See redstone.h for details.
  */
 
+#define RS_MEMORY_SUBSYSTEM RS_MEMORY_LIST
+
 #include "list.h"
 
 #include "memory.h"
+#include "slice.h"
 #include "error.h"
 
 RSList* rs_list_cell_new(void)
 {
-    RSList* cell = rs_new0(RSList, 1);
+    RSList* cell = rs_slice_new0(RSList);
     return cell;
 }
 
@@ -76,7 +79,7 @@ RSList* rs_list_remove(RSList* first, RSList* cell)
     if (cell == first)
     {
         RSList* next = first->next;
-        rs_free(first);
+        rs_slice_free(RSList, first);
         return next;
     }
     
@@ -87,7 +90,7 @@ RSList* rs_list_remove(RSList* first, RSList* cell)
         if (current == cell)
         {
             last->next = current->next;
-            rs_free(current);
+            rs_slice_free(RSList, current);
             return first;
         }
         
@@ -116,7 +119,7 @@ RSList* rs_list_pop(RSList* first)
     }
     
     RSList* next = first->next;
-    rs_free(first);
+    rs_slice_free(RSList, first);
     return next;
 }
 
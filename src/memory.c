@@ -3,13 +3,27 @@
  * See redstone.h for details.
  */
 
+#include "config.h"
 #include "memory.h"
 #include "error.h"
 
+#include <stdint.h>
 #include <string.h>
 
+#ifdef HAVE_TLS
+#define RS_MEMORY_THREAD_LOCAL __thread
+#else
+#define RS_MEMORY_THREAD_LOCAL /**/
+#endif
+
+#define RS_MEMORY_STACK_DEPTH 16
+
 static RSMemoryFunctions* memfuncs = NULL;
 
+/* functions pushed by rs_memory_push -- NULL entries mean memfuncs */
+static RS_MEMORY_THREAD_LOCAL RSMemoryFunctions* memstack[RS_MEMORY_STACK_DEPTH];
+static RS_MEMORY_THREAD_LOCAL unsigned int memstack_depth = 0;
+
 void rs_set_memory_functions(RSMemoryFunctions* funcs)
 {
     if (funcs)
@@ -22,27 +36,86 @@ void rs_set_memory_functions(RSMemoryFunctions* funcs)
     memfuncs = funcs;
 }
 
-void* rs_malloc(size_t size)
+RSMemoryFunctions* rs_get_memory_functions(void)
 {
-    void* ret = NULL;
+    return memfuncs;
+}
 
-    if (memfuncs)
+void rs_memory_push(RSMemoryFunctions* funcs)
+{
+    rs_return_if_fail(memstack_depth < RS_MEMORY_STACK_DEPTH);
+    if (funcs)
     {
-        ret = memfuncs->malloc(memfuncs, size);
-    } else {
-        ret = malloc(size);
+        rs_return_if_fail(funcs->malloc);
+        rs_return_if_fail(funcs->free);
+        rs_return_if_fail(funcs->realloc);
     }
     
-    if (!ret)
-        rs_error("out of memory");
-    return ret;
+    memstack[memstack_depth++] = funcs;
 }
 
-void rs_free(void* ptr)
+void rs_memory_pop(void)
 {
-    if (!ptr)
-        return;
+    rs_return_if_fail(memstack_depth > 0);
+    memstack_depth--;
+}
+
+RSMemoryFunctions* rs_memory_peek(void)
+{
+    if (memstack_depth == 0)
+        return NULL;
+    return memstack[memstack_depth - 1];
+}
+
+RSMemoryFunctions* _rs_memory_get_owner(void* ptr)
+{
+    unsigned int i = memstack_depth;
+    while (i > 0)
+    {
+        RSMemoryFunctions* funcs = memstack[--i];
+        if (!funcs)
+            continue;
+        if (!funcs->owns || funcs->owns(funcs, ptr))
+            return funcs;
+    }
     
+    return NULL;
+}
+
+/* pushed functions to allocate from -- NULL means the global ones */
+static inline RSMemoryFunctions* _rs_memory_get_pushed(void)
+{
+    if (memstack_depth == 0)
+        return NULL;
+    return memstack[memstack_depth - 1];
+}
+
+/* the global functions, or the system allocator -- these may return NULL */
+static inline void* _rs_memory_global_malloc(size_t size)
+{
+    return memfuncs ? memfuncs->malloc(memfuncs, size) : malloc(size);
+}
+
+static inline void* _rs_memory_global_malloc0(size_t size)
+{
+    if (!memfuncs)
+        return calloc(size, 1);
+    if (memfuncs->malloc0)
+        return memfuncs->malloc0(memfuncs, size);
+    
+    void* ret = memfuncs->malloc(memfuncs, size);
+    if (ret)
+        memset(ret, 0, size);
+    return ret;
+}
+
+static inline void* _rs_memory_global_realloc(void* ptr, size_t size)
+{
+    return memfuncs ? memfuncs->realloc(memfuncs, ptr, size) : realloc(ptr, size);
+}
+
+static inline void _rs_memory_global_free(void* ptr)
+{
     if (memfuncs)
     {
         memfuncs->free(memfuncs, ptr);
@@ -51,15 +124,165 @@ void rs_free(void* ptr)
     }
 }
 
-void* rs_realloc(void* ptr, size_t size)
+/*
+ * memory statistics
+ */
+
+/* put in front of every allocation from the global functions, while
+ * statistics are kept -- 16 bytes keeps the alignment malloc gave us
+ */
+typedef struct
+{
+    size_t size;
+    RSMemorySubsystem subsystem;
+} RSMemoryHeader;
+
+#define RS_MEMORY_HEADER 16
+
+/* -1 until the environment has been checked */
+static int memstats_state = -1;
+static RSMemoryCounters memstats_total;
+static RSMemoryCounters memstats[RS_MEMORY_SUBSYSTEMS];
+
+static const char* memstats_names[RS_MEMORY_SUBSYSTEMS] = {
+    "other",
+    "tag",
+    "list",
+    "nbt",
+    "compression",
+    "region",
+};
+
+bool _rs_memory_stats_enabled(void)
+{
+    int state = __atomic_load_n(&memstats_state, __ATOMIC_RELAXED);
+    if (state < 0)
+    {
+        /* every thread that gets here comes to the same answer */
+        const char* env = getenv("RS_MEMORY_STATS");
+        state = (env && strcmp(env, "1") == 0) ? 1 : 0;
+        __atomic_store_n(&memstats_state, state, __ATOMIC_RELAXED);
+    }
+    
+    return state;
+}
+
+static inline void _rs_memory_counters_resize(RSMemoryCounters* counters, size_t old_size, size_t size)
+{
+    size_t bytes;
+    if (size >= old_size)
+    {
+        bytes = __atomic_add_fetch(&(counters->bytes), size - old_size, __ATOMIC_RELAXED);
+    } else {
+        bytes = __atomic_sub_fetch(&(counters->bytes), old_size - size, __ATOMIC_RELAXED);
+    }
+    
+    size_t peak = __atomic_load_n(&(counters->peak_bytes), __ATOMIC_RELAXED);
+    while (bytes > peak && !__atomic_compare_exchange_n(&(counters->peak_bytes), &peak, bytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* subsystems past the end (like the slice allocator's slabs, which
+ * are counted slice by slice instead) get a header, but no counting
+ */
+void _rs_memory_count(RSMemorySubsystem subsystem, size_t size)
+{
+    if ((unsigned int)subsystem >= RS_MEMORY_SUBSYSTEMS)
+        return;
+    
+    RSMemoryCounters* counters[2] = {&memstats_total, &memstats[subsystem]};
+    unsigned int i;
+    for (i = 0; i < 2; i++)
+    {
+        __atomic_add_fetch(&(counters[i]->in_use), 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&(counters[i]->allocations), 1, __ATOMIC_RELAXED);
+        _rs_memory_counters_resize(counters[i], 0, size);
+    }
+}
+
+void _rs_memory_uncount(RSMemorySubsystem subsystem, size_t size)
+{
+    if ((unsigned int)subsystem >= RS_MEMORY_SUBSYSTEMS)
+        return;
+    
+    RSMemoryCounters* counters[2] = {&memstats_total, &memstats[subsystem]};
+    unsigned int i;
+    for (i = 0; i < 2; i++)
+    {
+        __atomic_sub_fetch(&(counters[i]->in_use), 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&(counters[i]->bytes), size, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void* _rs_memory_header_add(void* raw, size_t size, RSMemorySubsystem subsystem)
+{
+    if (!raw)
+        return NULL;
+    
+    RSMemoryHeader* header = raw;
+    header->size = size;
+    header->subsystem = subsystem;
+    _rs_memory_count(subsystem, size);
+    return (uint8_t*)raw + RS_MEMORY_HEADER;
+}
+
+static inline RSMemoryHeader* _rs_memory_header_get(void* ptr)
+{
+    return (RSMemoryHeader*)((uint8_t*)ptr - RS_MEMORY_HEADER);
+}
+
+void rs_memory_get_stats(RSMemoryStats* stats)
+{
+    rs_return_if_fail(stats);
+    
+    memset(stats, 0, sizeof(RSMemoryStats));
+    stats->enabled = _rs_memory_stats_enabled();
+    if (!stats->enabled)
+        return;
+    
+    RSMemoryCounters* counters[RS_MEMORY_SUBSYSTEMS + 1];
+    RSMemoryCounters* out[RS_MEMORY_SUBSYSTEMS + 1];
+    unsigned int i;
+    for (i = 0; i < RS_MEMORY_SUBSYSTEMS; i++)
+    {
+        counters[i] = &memstats[i];
+        out[i] = &(stats->subsystems[i]);
+    }
+    counters[i] = &memstats_total;
+    out[i] = &(stats->total);
+    
+    for (i = 0; i < RS_MEMORY_SUBSYSTEMS + 1; i++)
+    {
+        out[i]->bytes = __atomic_load_n(&(counters[i]->bytes), __ATOMIC_RELAXED);
+        out[i]->peak_bytes = __atomic_load_n(&(counters[i]->peak_bytes), __ATOMIC_RELAXED);
+        out[i]->in_use = __atomic_load_n(&(counters[i]->in_use), __ATOMIC_RELAXED);
+        out[i]->allocations = __atomic_load_n(&(counters[i]->allocations), __ATOMIC_RELAXED);
+    }
+}
+
+const char* rs_memory_get_subsystem_name(RSMemorySubsystem subsystem)
+{
+    if ((unsigned int)subsystem >= RS_MEMORY_SUBSYSTEMS)
+        return NULL;
+    return memstats_names[subsystem];
+}
+
+/*
+ * allocation
+ */
+
+void* _rs_malloc_full(size_t size, RSMemorySubsystem subsystem)
 {
     void* ret = NULL;
+    RSMemoryFunctions* funcs = _rs_memory_get_pushed();
     
-    if (memfuncs)
+    if (funcs)
     {
-        ret = memfuncs->realloc(memfuncs, ptr, size);
+        ret = funcs->malloc(funcs, size);
+    } else if (_rs_memory_stats_enabled()) {
+        ret = _rs_memory_header_add(_rs_memory_global_malloc(RS_MEMORY_HEADER + size), size, subsystem);
     } else {
-        ret = realloc(ptr, size);
+        ret = _rs_memory_global_malloc(size);
     }
     
     if (!ret)
@@ -67,33 +290,311 @@ void* rs_realloc(void* ptr, size_t size)
     return ret;
 }
 
-void* rs_malloc0(size_t size)
+void* _rs_malloc0_full(size_t size, RSMemorySubsystem subsystem)
 {
     void* ret = NULL;
+    RSMemoryFunctions* funcs = _rs_memory_get_pushed();
     
-    if (memfuncs)
+    if (funcs)
     {
-        if (memfuncs->malloc0)
+        if (funcs->malloc0)
         {
-            ret = memfuncs->malloc0(memfuncs, size);
+            ret = funcs->malloc0(funcs, size);
         } else {
-            ret = memset(rs_malloc(size), 0, size);
+            ret = memset(_rs_malloc_full(size, subsystem), 0, size);
         }
+    } else if (_rs_memory_stats_enabled()) {
+        ret = _rs_memory_header_add(_rs_memory_global_malloc0(RS_MEMORY_HEADER + size), size, subsystem);
     } else {
-        ret = calloc(size, 1);
+        ret = _rs_memory_global_malloc0(size);
     }
     
     if (!ret)
         rs_error("out of memory");
     return ret;
-}           
+}
 
-void* rs_memdup(const void* ptr, size_t size)
+void* _rs_realloc_full(void* ptr, size_t size, RSMemorySubsystem subsystem)
+{
+    if (!ptr)
+        return _rs_malloc_full(size, subsystem);
+    
+    void* ret = NULL;
+    
+    /* memory stays with whatever it came from */
+    RSMemoryFunctions* funcs = _rs_memory_get_owner(ptr);
+    if (funcs)
+    {
+        ret = funcs->realloc(funcs, ptr, size);
+    } else if (_rs_memory_stats_enabled()) {
+        RSMemoryHeader* header = _rs_memory_header_get(ptr);
+        size_t old_size = header->size;
+        RSMemorySubsystem old_subsystem = header->subsystem;
+        
+        header = _rs_memory_global_realloc(header, RS_MEMORY_HEADER + size);
+        if (header)
+        {
+            header->size = size;
+            if ((unsigned int)old_subsystem < RS_MEMORY_SUBSYSTEMS)
+            {
+                _rs_memory_counters_resize(&memstats_total, old_size, size);
+                _rs_memory_counters_resize(&memstats[old_subsystem], old_size, size);
+            }
+            ret = (uint8_t*)header + RS_MEMORY_HEADER;
+        }
+    } else {
+        ret = _rs_memory_global_realloc(ptr, size);
+    }
+    
+    if (!ret)
+        rs_error("out of memory");
+    return ret;
+}
+
+void* _rs_memdup_full(const void* ptr, size_t size, RSMemorySubsystem subsystem)
 {
     void* ret;
     if (!ptr)
         return NULL;
     
-    ret = rs_malloc(size);
+    ret = _rs_malloc_full(size, subsystem);
     return memcpy(ret, ptr, size);
 }
+
+void* rs_malloc(size_t size)
+{
+    return _rs_malloc_full(size, RS_MEMORY_OTHER);
+}
+
+void rs_free(void* ptr)
+{
+    if (!ptr)
+        return;
+    
+    RSMemoryFunctions* funcs = _rs_memory_get_owner(ptr);
+    if (funcs)
+    {
+        funcs->free(funcs, ptr);
+    } else if (_rs_memory_stats_enabled()) {
+        RSMemoryHeader* header = _rs_memory_header_get(ptr);
+        _rs_memory_uncount(header->subsystem, header->size);
+        _rs_memory_global_free(header);
+    } else {
+        _rs_memory_global_free(ptr);
+    }
+}
+
+void* rs_realloc(void* ptr, size_t size)
+{
+    return _rs_realloc_full(ptr, size, RS_MEMORY_OTHER);
+}
+
+void* rs_malloc0(size_t size)
+{
+    return _rs_malloc0_full(size, RS_MEMORY_OTHER);
+}
+
+void* rs_memdup(const void* ptr, size_t size)
+{
+    return _rs_memdup_full(ptr, size, RS_MEMORY_OTHER);
+}
+
+/*
+ * bump arenas
+ */
+
+#define RS_ARENA_ALIGN 16
+#define RS_ARENA_ROUND(size) (((size) + RS_ARENA_ALIGN - 1) & ~((size_t)RS_ARENA_ALIGN - 1))
+#define RS_ARENA_DEFAULT_BLOCK_SIZE (1024 * 64)
+
+typedef struct _RSArenaBlock RSArenaBlock;
+struct _RSArenaBlock
+{
+    RSArenaBlock* next;
+    /* bytes of room after the header, and how many are handed out */
+    size_t size;
+    size_t used;
+};
+
+/* keeps allocations aligned */
+#define RS_ARENA_BLOCK_HEADER RS_ARENA_ROUND(sizeof(RSArenaBlock))
+/* every allocation starts with its size, for realloc */
+#define RS_ARENA_HEADER RS_ARENA_ALIGN
+
+struct _RSArena
+{
+    /* must come first, so the vtable can be turned back into the arena */
+    RSMemoryFunctions funcs;
+    
+    size_t block_size;
+    /* newest first -- only the newest is allocated from */
+    RSArenaBlock* blocks;
+    size_t total_size;
+    /* the newest allocation, which can grow and shrink in place */
+    uint8_t* last;
+};
+
+/* blocks always come from the global functions, whatever is pushed */
+static void* _rs_arena_global_malloc(size_t size)
+{
+    void* ret = _rs_memory_global_malloc(size);
+    if (!ret)
+        rs_error("out of memory");
+    return ret;
+}
+
+static inline uint8_t* _rs_arena_block_data(RSArenaBlock* block)
+{
+    return (uint8_t*)block + RS_ARENA_BLOCK_HEADER;
+}
+
+static inline size_t* _rs_arena_size_of(void* ptr)
+{
+    return (size_t*)((uint8_t*)ptr - RS_ARENA_HEADER);
+}
+
+static RSArenaBlock* _rs_arena_add_block(RSArena* self, size_t size)
+{
+    RSArenaBlock* block = _rs_arena_global_malloc(RS_ARENA_BLOCK_HEADER + size);
+    block->next = self->blocks;
+    block->size = size;
+    block->used = 0;
+    
+    self->blocks = block;
+    self->total_size += size;
+    return block;
+}
+
+static void* _rs_arena_malloc(void* data, size_t size)
+{
+    RSArena* self = data;
+    size_t needed = RS_ARENA_HEADER + RS_ARENA_ROUND(size);
+    
+    RSArenaBlock* block = self->blocks;
+    if (!block || block->size - block->used < needed)
+    {
+        /* grow geometrically, so resets end up with one big block */
+        size_t block_size = self->block_size;
+        if (block && block->size * 2 > block_size)
+            block_size = block->size * 2;
+        if (needed > block_size)
+            block_size = needed;
+        block = _rs_arena_add_block(self, block_size);
+    }
+    
+    uint8_t* ret = _rs_arena_block_data(block) + block->used + RS_ARENA_HEADER;
+    block->used += needed;
+    *_rs_arena_size_of(ret) = size;
+    self->last = ret;
+    return ret;
+}
+
+static void _rs_arena_free(void* data, void* ptr)
+{
+    RSArena* self = data;
+    
+    /* only the newest allocation can be given back */
+    if (ptr == self->last)
+    {
+        self->blocks->used -= RS_ARENA_HEADER + RS_ARENA_ROUND(*_rs_arena_size_of(ptr));
+        self->last = NULL;
+    }
+}
+
+static void* _rs_arena_realloc(void* data, void* ptr, size_t size)
+{
+    RSArena* self = data;
+    if (!ptr)
+        return _rs_arena_malloc(self, size);
+    
+    size_t* sizep = _rs_arena_size_of(ptr);
+    size_t old_size = RS_ARENA_ROUND(*sizep);
+    size_t new_size = RS_ARENA_ROUND(size);
+    
+    /* the newest allocation can just move the end of the block */
+    if (ptr == self->last && self->blocks->used - old_size + new_size <= self->blocks->size)
+    {
+        self->blocks->used = self->blocks->used - old_size + new_size;
+        *sizep = size;
+        return ptr;
+    }
+    
+    if (size <= *sizep)
+        return ptr;
+    
+    void* ret = _rs_arena_malloc(self, size);
+    memcpy(ret, ptr, *sizep);
+    return ret;
+}
+
+static bool _rs_arena_owns(void* data, void* ptr)
+{
+    RSArena* self = data;
+    RSArenaBlock* block;
+    for (block = self->blocks; block != NULL; block = block->next)
+    {
+        uint8_t* start = _rs_arena_block_data(block);
+        if ((uint8_t*)ptr >= start && (uint8_t*)ptr < start + block->used)
+            return true;
+    }
+    
+    return false;
+}
+
+RSArena* rs_arena_new(size_t block_size)
+{
+    RSArena* self = _rs_arena_global_malloc(sizeof(RSArena));
+    memset(self, 0, sizeof(RSArena));
+    
+    self->funcs.malloc = _rs_arena_malloc;
+    self->funcs.free = _rs_arena_free;
+    self->funcs.realloc = _rs_arena_realloc;
+    self->funcs.owns = _rs_arena_owns;
+    self->block_size = block_size ? RS_ARENA_ROUND(block_size) : RS_ARENA_DEFAULT_BLOCK_SIZE;
+    
+    return self;
+}
+
+static void _rs_arena_free_blocks(RSArena* self)
+{
+    while (self->blocks)
+    {
+        RSArenaBlock* next = self->blocks->next;
+        _rs_memory_global_free(self->blocks);
+        self->blocks = next;
+    }
+    
+    self->total_size = 0;
+    self->last = NULL;
+}
+
+void rs_arena_free(RSArena* self)
+{
+    rs_return_if_fail(self);
+    
+    _rs_arena_free_blocks(self);
+    _rs_memory_global_free(self);
+}
+
+void rs_arena_reset(RSArena* self)
+{
+    rs_return_if_fail(self);
+    
+    /* swap a chain of blocks for one as big as all of them together */
+    if (self->blocks && self->blocks->next)
+    {
+        size_t total_size = self->total_size;
+        _rs_arena_free_blocks(self);
+        _rs_arena_add_block(self, total_size);
+    }
+    
+    if (self->blocks)
+        self->blocks->used = 0;
+    self->last = NULL;
+}
+
+RSMemoryFunctions* rs_arena_get_memory_functions(RSArena* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    return &(self->funcs);
+}
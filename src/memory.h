@@ -7,6 +7,7 @@
 #define __RS_MEMORY_H_INCLUDED__
 
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 
 /* basic memory management hooks / functions */
@@ -17,6 +18,8 @@ typedef void* (*RSMalloc)(void*, size_t);
 typedef void* (*RSRealloc)(void*, void*, size_t);
 /** free function type */
 typedef void (*RSFree)(void*, void*);
+/** ownership test function type */
+typedef bool (*RSOwns)(void*, void*);
 
 /**
  * Memory management vtable.
@@ -41,6 +44,14 @@ typedef struct
 
     /** optional -- a malloc that returns a zero-filled buffer */
     RSMalloc malloc0;
+    
+    /**
+     * optional -- returns whether the given memory came from these
+     * functions. Only used for functions installed with
+     * rs_memory_push(), so that memory allocated before they were
+     * pushed can still be freed while they are.
+     */
+    RSOwns owns;
 } RSMemoryFunctions;
 
 /**
@@ -49,11 +60,147 @@ typedef struct
  * Use this to tell libredstone what memory functions to use. See
  * RSMemoryFunctions for more information.
  *
+ * Memory is always freed with the functions that are installed at the
+ * time it is freed, so only change them while libredstone holds no
+ * memory.
+ *
  * \param funcs the vtable to use
- * \sa RSMemoryFunctions
+ * \sa RSMemoryFunctions, rs_get_memory_functions
  */
 void rs_set_memory_functions(RSMemoryFunctions* funcs);
 
+/**
+ * Get the memory management vtable.
+ *
+ * \return the vtable set with rs_set_memory_functions(), or NULL if
+ * the system allocator is in use
+ * \sa rs_set_memory_functions
+ */
+RSMemoryFunctions* rs_get_memory_functions(void);
+
+/**
+ * Use different memory functions in this thread, for a while.
+ *
+ * Every thread has its own stack of memory functions. While the stack
+ * is not empty, everything this thread allocates comes from the
+ * functions on top, instead of the ones from
+ * rs_set_memory_functions(). This lets a worker thread send all of
+ * its allocations to its own RSArena, for example, without affecting
+ * any other thread.
+ *
+ * Memory is freed (or reallocated) by whichever functions it came
+ * from: the stack is searched from the top for functions whose owns
+ * test claims it, and if nothing does, the global functions are used.
+ * Functions without an owns test claim everything freed while they
+ * are above it on the stack, so anything allocated before they were
+ * pushed must not be freed until they are popped.
+ *
+ * Pushing NULL goes back to the global functions until it is popped,
+ * which is handy for allocating things that must outlive the memory
+ * functions below it. libredstone does this for its own long-lived
+ * caches. Reading a tag tree never allocates, so it is fine to read a
+ * long-lived tree while an arena is pushed, and a copy made meanwhile
+ * only shares array data that came from the arena too.
+ *
+ * The stack holds up to 16 entries. Without thread-local storage,
+ * there is one stack shared by all threads.
+ *
+ * \param funcs the vtable to use, or NULL for the global one
+ * \sa rs_memory_pop, rs_memory_peek, RSArena
+ */
+void rs_memory_push(RSMemoryFunctions* funcs);
+
+/**
+ * Go back to the memory functions in use before rs_memory_push().
+ *
+ * Memory allocated by the popped functions must not be freed after
+ * they are popped -- for an RSArena, just reset it instead.
+ *
+ * \sa rs_memory_push
+ */
+void rs_memory_pop(void);
+
+/**
+ * Get the memory functions on top of this thread's stack.
+ *
+ * \return the vtable most recently pushed, or NULL if the stack is
+ * empty or NULL was pushed
+ * \sa rs_memory_push
+ */
+RSMemoryFunctions* rs_memory_peek(void);
+
+/* used by the slice allocator -- returns the pushed functions that own
+ * ptr, or NULL if it belongs to the global ones
+ */
+RSMemoryFunctions* _rs_memory_get_owner(void* ptr);
+
+struct _RSArena;
+/**
+ * A bump allocator.
+ *
+ * An arena hands out memory from large blocks, one allocation after
+ * another, and frees everything at once when it is reset. That makes
+ * allocating almost free, and throwing away a whole tree of tags
+ * (say, from parsing a chunk) takes a single call. Freeing memory
+ * from an arena only gives it back if it was the most recent
+ * allocation; otherwise it is kept until the next reset.
+ *
+ * Use it by pushing its memory functions:
+ *
+ *     RSArena* arena = rs_arena_new(0);
+ *     for (each chunk)
+ *     {
+ *         rs_memory_push(rs_arena_get_memory_functions(arena));
+ *         ... parse and process the chunk ...
+ *         rs_memory_pop();
+ *         rs_arena_reset(arena);
+ *     }
+ *     rs_arena_free(arena);
+ *
+ * An arena's blocks come from the global memory functions. An arena
+ * must only be used by one thread at a time.
+ *
+ * \sa rs_arena_new, rs_memory_push
+ */
+typedef struct _RSArena RSArena;
+
+/**
+ * Create a new arena.
+ *
+ * \param block_size the size of the blocks to allocate from, or 0 for
+ * the default of 64kb. Bigger allocations get a block of their own.
+ * \return the new arena
+ * \sa rs_arena_free
+ */
+RSArena* rs_arena_new(size_t block_size);
+
+/**
+ * Free an arena, and all memory allocated from it.
+ *
+ * \param self the arena to free, which must not be pushed
+ * \sa rs_arena_new
+ */
+void rs_arena_free(RSArena* self);
+
+/**
+ * Free all memory allocated from an arena at once.
+ *
+ * The arena keeps its blocks (merged into one, if it had to grow) so
+ * the next round of allocations doesn't need any more.
+ *
+ * \param self the arena to reset, which must not be pushed
+ */
+void rs_arena_reset(RSArena* self);
+
+/**
+ * Get the memory functions that allocate from an arena.
+ *
+ * \param self the arena
+ * \return the vtable, owned by the arena, to pass to rs_memory_push()
+ * \sa rs_memory_push
+ */
+RSMemoryFunctions* rs_arena_get_memory_functions(RSArena* self);
+
 /**
  * A safer malloc.
  *
@@ -183,4 +330,111 @@ void* rs_memdup(const void* ptr, size_t size);
  */
 #define rs_strdup(str) ((char*)rs_memdup((str), strlen(str) + 1))
 
+/**
+ * The parts of libredstone that memory statistics are kept for.
+ *
+ * \sa RSMemoryStats
+ */
+typedef enum
+{
+    /** anything not listed below, including your own rs_malloc() calls */
+    RS_MEMORY_OTHER,
+    /** tags, their strings and arrays (see tag.h) */
+    RS_MEMORY_TAG,
+    /** list cells (see list.h) */
+    RS_MEMORY_LIST,
+    /** NBT documents and their buffers (see nbt.h) */
+    RS_MEMORY_NBT,
+    /** compressed and decompressed buffers, and codec state */
+    RS_MEMORY_COMPRESSION,
+    /** region files and their staged chunk writes (see region.h) */
+    RS_MEMORY_REGION,
+    
+    /** the number of subsystems */
+    RS_MEMORY_SUBSYSTEMS
+} RSMemorySubsystem;
+
+/**
+ * Memory counters for one subsystem.
+ *
+ * \sa RSMemoryStats
+ */
+typedef struct
+{
+    /** bytes currently allocated */
+    size_t bytes;
+    /** the most bytes ever allocated at once */
+    size_t peak_bytes;
+    /** allocations currently live */
+    size_t in_use;
+    /** total number of allocations ever made */
+    size_t allocations;
+} RSMemoryCounters;
+
+/**
+ * Memory statistics.
+ *
+ * These are only kept if the RS_MEMORY_STATS environment variable is
+ * set to "1" when libredstone first allocates memory, since each
+ * allocation then needs a small header to remember its size. They
+ * cover memory from rs_malloc() and the slice allocator, but not
+ * memory allocated while functions are pushed with rs_memory_push()
+ * (an RSArena keeps track of its own blocks), or memory that zlib and
+ * friends allocate for themselves.
+ *
+ * Filled in by rs_memory_get_stats(). The numbers are a snapshot, and
+ * may be slightly out of date if other threads are allocating at the
+ * same time.
+ *
+ * \sa rs_memory_get_stats
+ */
+typedef struct
+{
+    /** whether statistics are being kept at all */
+    bool enabled;
+    /** counters for everything together */
+    RSMemoryCounters total;
+    /** counters for each subsystem, indexed by RSMemorySubsystem */
+    RSMemoryCounters subsystems[RS_MEMORY_SUBSYSTEMS];
+} RSMemoryStats;
+
+/**
+ * Get memory statistics.
+ *
+ * If statistics are not being kept, everything is zero and
+ * stats->enabled is false. See RSMemoryStats.
+ *
+ * \param stats where to write the statistics
+ * \sa RSMemoryStats, rs_memory_get_subsystem_name
+ */
+void rs_memory_get_stats(RSMemoryStats* stats);
+
+/**
+ * Get a short, human-readable name for a subsystem.
+ *
+ * \param subsystem the subsystem
+ * \return the name, like "tag", or NULL if subsystem is out of range
+ * \sa RSMemorySubsystem
+ */
+const char* rs_memory_get_subsystem_name(RSMemorySubsystem subsystem);
+
+/* internal -- allocators that count against a given subsystem. Source
+ * files in libredstone define RS_MEMORY_SUBSYSTEM before including
+ * this, so that their allocations are counted against it.
+ */
+void* _rs_malloc_full(size_t size, RSMemorySubsystem subsystem);
+void* _rs_malloc0_full(size_t size, RSMemorySubsystem subsystem);
+void* _rs_realloc_full(void* ptr, size_t size, RSMemorySubsystem subsystem);
+void* _rs_memdup_full(const void* ptr, size_t size, RSMemorySubsystem subsystem);
+bool _rs_memory_stats_enabled(void);
+void _rs_memory_count(RSMemorySubsystem subsystem, size_t size);
+void _rs_memory_uncount(RSMemorySubsystem subsystem, size_t size);
+
+#ifdef RS_MEMORY_SUBSYSTEM
+#define rs_malloc(size) _rs_malloc_full((size), RS_MEMORY_SUBSYSTEM)
+#define rs_malloc0(size) _rs_malloc0_full((size), RS_MEMORY_SUBSYSTEM)
+#define rs_realloc(ptr, size) _rs_realloc_full((ptr), (size), RS_MEMORY_SUBSYSTEM)
+#define rs_memdup(ptr, size) _rs_memdup_full((ptr), (size), RS_MEMORY_SUBSYSTEM)
+#endif
+
 #endif /* __RS_MEMORY_H_INCLUDED__ */
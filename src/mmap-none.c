@@ -3,6 +3,8 @@
  * See redstone.h for details.
  */
 
+#define RS_MEMORY_SUBSYSTEM RS_MEMORY_REGION
+
 #include "config.h"
 #ifdef MMAP_NONE
  
@@ -3,6 +3,8 @@
  * See redstone.h for details.
  */
 
+#define RS_MEMORY_SUBSYSTEM RS_MEMORY_NBT
+
 #include "nbt.h"
 
 #include "error.h"
@@ -10,6 +12,7 @@
 #include "mmap.h"
 #include "rsendian.h"
 #include "list.h"
+#include "trace.h"
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -67,8 +70,7 @@ RSNBT* rs_nbt_parse_from_file(const char* path)
         return NULL;
     }
     
-    RSCompressionType enc = rs_get_compression_type(map, stat_buf.st_size);
-    self = rs_nbt_parse(map, stat_buf.st_size, enc);
+    self = rs_nbt_parse(map, stat_buf.st_size, RS_AUTO_COMPRESSION);
     
     munmap(map, stat_buf.st_size);
     return self;
@@ -85,7 +87,12 @@ RSNBT* rs_nbt_parse_from_region(RSRegion* region, uint8_t x, uint8_t z)
     if (!data || len == 0)
         return NULL;
     
-    return rs_nbt_parse(data, len, enc);
+    /* only look for a dictionary if it could be needed */
+    RSDictionary* dictionary = NULL;
+    if (enc == RS_ZSTD)
+        dictionary = rs_region_get_dictionary(region);
+    
+    return rs_nbt_parse_full(data, len, enc, dictionary);
 }
 
 /* internal helper to parse string tags */
@@ -108,6 +115,87 @@ static inline char* _rs_nbt_parse_string(void** datap, uint32_t* lenp)
     return ret;
 }
 
+/* size of one element in a list of numbers, or 0 for other lists */
+static inline uint32_t _rs_nbt_number_width(RSTagType type)
+{
+    switch (type)
+    {
+    case RS_TAG_BYTE:
+        return 1;
+    case RS_TAG_SHORT:
+        return 2;
+    case RS_TAG_INT:
+    case RS_TAG_FLOAT:
+        return 4;
+    case RS_TAG_LONG:
+    case RS_TAG_DOUBLE:
+        return 8;
+    default:
+        return 0;
+    };
+}
+
+/* internal helper to parse the elements of a list of numbers all at
+ * once, so the list can store them packed
+ */
+static bool _rs_nbt_parse_numbers(RSTag* list, RSTagType type, uint32_t count, void** datap, uint32_t* lenp)
+{
+    uint8_t* data = *datap;
+    uint32_t width, i;
+    int64_t* ints;
+    float* floats;
+    double* doubles;
+    
+    width = _rs_nbt_number_width(type);
+    rs_return_val_if_fail(width, false);
+    
+    if ((uint64_t)count * width > *lenp)
+        return false;
+    
+    if (type == RS_TAG_FLOAT)
+    {
+        floats = rs_new(float, count);
+        rs_endian_convert_u32_array(floats, data, count);
+        rs_tag_list_set_floats(list, floats, count);
+        rs_free(floats);
+    } else if (type == RS_TAG_DOUBLE) {
+        doubles = rs_new(double, count);
+        rs_endian_convert_u64_array(doubles, data, count);
+        rs_tag_list_set_doubles(list, doubles, count);
+        rs_free(doubles);
+    } else {
+        /* convert in bulk into the front of ints, then widen in place,
+         * back to front so nothing is overwritten before it's read */
+        ints = rs_new(int64_t, count);
+        switch (type)
+        {
+        case RS_TAG_BYTE:
+            for (i = count; i > 0; i--)
+                ints[i - 1] = ((int8_t*)data)[i - 1];
+            break;
+        case RS_TAG_SHORT:
+            rs_endian_convert_u16_array(ints, data, count);
+            for (i = count; i > 0; i--)
+                ints[i - 1] = ((int16_t*)ints)[i - 1];
+            break;
+        case RS_TAG_INT:
+            rs_endian_convert_u32_array(ints, data, count);
+            for (i = count; i > 0; i--)
+                ints[i - 1] = ((int32_t*)ints)[i - 1];
+            break;
+        default:
+            rs_endian_convert_u64_array(ints, data, count);
+            break;
+        };
+        rs_tag_list_set_integers(list, ints, count);
+        rs_free(ints);
+    }
+    
+    *datap += count * width;
+    *lenp -= count * width;
+    return true;
+}
+
 /* internal helper to parse nbt tags recursively */
 static RSTag* _rs_nbt_parse_tag(RSTagType type, void** datap, uint32_t* lenp)
 {
@@ -121,7 +209,7 @@ static RSTag* _rs_nbt_parse_tag(RSTagType type, void** datap, uint32_t* lenp)
     int16_t int_short;
     int32_t int_int;
     int64_t int_long;
-    uint32_t int_len, i;
+    uint32_t int_len;
 
     float float_float;
     double float_double;
@@ -210,15 +298,10 @@ static RSTag* _rs_nbt_parse_tag(RSTagType type, void** datap, uint32_t* lenp)
         if (*lenp < int_len * sizeof(uint32_t))
             break;
         int_array = rs_new(uint32_t, int_len);
-        for (i = 0; i < int_len; i++)
-        {
-            memcpy(&(int_array[i]), *datap, sizeof(uint32_t));
-            int_array[i] = rs_endian_uint32(int_array[i]);
-            *datap += sizeof(uint32_t);
-            *lenp -= sizeof(uint32_t);
-        }
-        rs_tag_set_int_array(ret, int_len, int_array);
-        rs_free(int_array);
+        rs_endian_convert_u32_array(int_array, *datap, int_len);
+        *datap += int_len * sizeof(uint32_t);
+        *lenp -= int_len * sizeof(uint32_t);
+        rs_tag_take_int_array(ret, int_len, int_array);
         return ret;
     
     case RS_TAG_STRING:
@@ -241,18 +324,22 @@ static RSTag* _rs_nbt_parse_tag(RSTagType type, void** datap, uint32_t* lenp)
         if (int_int <= 0)
             return ret;
         
+        if (subtype >= RS_TAG_BYTE && subtype <= RS_TAG_DOUBLE)
+        {
+            if (!_rs_nbt_parse_numbers(ret, subtype, int_int, datap, lenp))
+                break;
+            return ret;
+        }
+        
         while (*lenp > 0)
         {
             RSTag* tmptag = _rs_nbt_parse_tag(subtype, datap, lenp);
             if (!tmptag)
                 break;
-            rs_tag_list_insert(ret, 0, tmptag);
+            rs_tag_list_insert(ret, rs_tag_list_get_length(ret), tmptag);
             int_int--;
             if (int_int == 0)
-            {
-                rs_tag_list_reverse(ret);
                 return ret;
-            }
         }
         
         /* if we make it here, it's an error */
@@ -297,21 +384,50 @@ static RSTag* _rs_nbt_parse_tag(RSTagType type, void** datap, uint32_t* lenp)
 }
 
 RSNBT* rs_nbt_parse(void* data, size_t len, RSCompressionType enc)
+{
+    return rs_nbt_parse_full(data, len, enc, NULL);
+}
+
+RSNBT* rs_nbt_parse_full(void* data, size_t len, RSCompressionType enc, RSDictionary* dictionary)
 {
     uint8_t* expanded = NULL;
     size_t expanded_size = 0;
     
-    rs_decompress(enc, data, len, &expanded, &expanded_size);
+    if (enc == RS_AUTO_COMPRESSION)
+    {
+        enc = rs_get_compression_type(data, len);
+        
+        /* the guess can't know about uncompressed data, but here it
+         * has to start with a compound tag, with a name that fits
+         */
+        uint8_t* bytes = data;
+        if (enc == RS_UNKNOWN_COMPRESSION && len >= 3 && bytes[0] == RS_TAG_COMPOUND &&
+            3 + (((size_t)bytes[1] << 8) | bytes[2]) <= len)
+            enc = RS_UNCOMPRESSED;
+    }
+    
+    /* uncompressed data can be read where it is */
+    uint8_t* owned = NULL;
+    if (enc == RS_UNCOMPRESSED)
+    {
+        expanded = data;
+        expanded_size = len;
+    } else {
+        rs_decompress_full(enc, dictionary, data, len, &owned, &expanded_size);
+        expanded = owned;
+    }
     if (!expanded)
         return NULL;
     
     /* make sure there's actually *some* data to work with */
     if (expanded_size < 4)
     {
-        rs_free(expanded);
+        rs_free(owned);
         return NULL;
     }
     
+    _rs_trace_begin(RS_TRACE_NBT_PARSE, expanded_size);
+    
     RSNBT* self = rs_new0(RSNBT, 1);
     void* read_head = expanded;
     uint32_t left = expanded_size;
@@ -325,7 +441,8 @@ RSNBT* rs_nbt_parse(void* data, size_t len, RSCompressionType enc)
     self->root_name = _rs_nbt_parse_string(&read_head, &left);
     if (self->root_name == NULL)
     {
-        rs_free(expanded);
+        _rs_trace_end(RS_TRACE_NBT_PARSE, 0);
+        rs_free(owned);
         rs_nbt_free(self);
         return NULL;
     }
@@ -333,15 +450,17 @@ RSNBT* rs_nbt_parse(void* data, size_t len, RSCompressionType enc)
     self->root = _rs_nbt_parse_tag(root_type, &read_head, &left);
     if (self->root == NULL || left != 0)
     {
-        rs_free(expanded);
+        _rs_trace_end(RS_TRACE_NBT_PARSE, 0);
+        rs_free(owned);
         rs_nbt_free(self);
         return NULL;
     }
     
     /* now we must sink the floating reference */
     rs_tag_ref(self->root);
+    _rs_trace_end(RS_TRACE_NBT_PARSE, expanded_size);
     
-    rs_free(expanded);
+    rs_free(owned);
     return self;
 }
 
@@ -361,9 +480,74 @@ void rs_nbt_free(RSNBT* self)
 
 /* two helpers -- size calculators and writers */
 
+/* writes out the elements of a list of numbers, in bulk */
+static void _rs_nbt_write_numbers(RSTag* tag, void** destp)
+{
+    RSTagType type = rs_tag_list_get_type(tag);
+    uint32_t count = rs_tag_list_get_length(tag);
+    uint8_t* dest = *destp;
+    uint32_t i;
+    int64_t* ints;
+    double* doubles;
+    
+    if (type == RS_TAG_FLOAT || type == RS_TAG_DOUBLE)
+    {
+        doubles = rs_new(double, count);
+        rs_tag_list_get_doubles(tag, doubles, count);
+        for (i = 0; i < count; i++)
+        {
+            if (type == RS_TAG_FLOAT)
+            {
+                float float_float = rs_endian_float(doubles[i]);
+                memcpy(dest, &float_float, 4);
+                dest += 4;
+            } else {
+                double float_double = rs_endian_double(doubles[i]);
+                memcpy(dest, &float_double, 8);
+                dest += 8;
+            }
+        }
+        rs_free(doubles);
+    } else {
+        ints = rs_new(int64_t, count);
+        rs_tag_list_get_integers(tag, ints, count);
+        for (i = 0; i < count; i++)
+        {
+            int16_t int_short;
+            int32_t int_int;
+            int64_t int_long;
+            switch (type)
+            {
+            case RS_TAG_BYTE:
+                ((int8_t*)dest)[0] = ints[i];
+                dest += 1;
+                break;
+            case RS_TAG_SHORT:
+                int_short = rs_endian_int16(ints[i]);
+                memcpy(dest, &int_short, 2);
+                dest += 2;
+                break;
+            case RS_TAG_INT:
+                int_int = rs_endian_int32(ints[i]);
+                memcpy(dest, &int_int, 4);
+                dest += 4;
+                break;
+            default:
+                int_long = rs_endian_int64(ints[i]);
+                memcpy(dest, &int_long, 8);
+                dest += 8;
+                break;
+            };
+        }
+        rs_free(ints);
+    }
+    
+    *destp = dest;
+}
+
 static uint32_t _rs_nbt_tag_length(RSTag* tag)
 {
-    uint32_t tmp = 0;
+    uint32_t tmp = 0, width;
     RSTagIterator it;
     const char* subname;
     RSTag* subtag;
@@ -391,6 +575,9 @@ static uint32_t _rs_nbt_tag_length(RSTag* tag)
         return 2 + strlen(rs_tag_get_string(tag));
     case RS_TAG_LIST:
         tmp = 1 + 4;
+        width = _rs_nbt_number_width(rs_tag_list_get_type(tag));
+        if (width)
+            return tmp + width * rs_tag_list_get_length(tag);
         rs_tag_list_iterator_init(tag, &it);
         while (rs_tag_list_iterator_next(&it, &subtag))
             tmp += _rs_nbt_tag_length(subtag);
@@ -418,8 +605,8 @@ static void _rs_nbt_write_tag(RSTag* tag, void** destp)
     RSTagIterator it;
     const char* subname;
     RSTag* subtag;
-    uint32_t* int_array;
-    uint32_t i, int_len;
+    const uint32_t* int_array;
+    uint32_t int_len;
     
     switch (rs_tag_get_type(tag))
     {
@@ -452,20 +639,17 @@ static void _rs_nbt_write_tag(RSTag* tag, void** destp)
     case RS_TAG_BYTE_ARRAY:
         ((uint32_t*)dest)[0] = rs_endian_uint32(rs_tag_get_byte_array_length(tag));
         dest += 4;
-        memcpy(dest, rs_tag_get_byte_array(tag), rs_tag_get_byte_array_length(tag));
+        memcpy(dest, rs_tag_peek_byte_array(tag), rs_tag_get_byte_array_length(tag));
         dest += rs_tag_get_byte_array_length(tag);
         *destp = dest;
         break;
     case RS_TAG_INT_ARRAY:
         int_len = rs_tag_get_int_array_length(tag);
-        int_array = rs_tag_get_int_array(tag);
+        int_array = rs_tag_peek_int_array(tag);
         ((uint32_t*)dest)[0] = rs_endian_uint32(int_len);
         dest += 4;
-        for (i = 0; i < int_len; i++)
-        {
-            ((uint32_t*)dest)[0] = rs_endian_uint32(int_array[i]);
-            dest += 4;
-        }
+        rs_endian_convert_u32_array(dest, int_array, int_len);
+        dest += int_len * 4;
         *destp = dest;
         break;
     
@@ -484,6 +668,12 @@ static void _rs_nbt_write_tag(RSTag* tag, void** destp)
         dest += 4;
         *destp = dest;
         
+        if (_rs_nbt_number_width(rs_tag_list_get_type(tag)))
+        {
+            _rs_nbt_write_numbers(tag, destp);
+            break;
+        }
+        
         rs_tag_list_iterator_init(tag, &it);
         while (rs_tag_list_iterator_next(&it, &subtag))
         {
@@ -515,6 +705,11 @@ static void _rs_nbt_write_tag(RSTag* tag, void** destp)
 }
 
 bool rs_nbt_write(RSNBT* self, void** datap, size_t* lenp, RSCompressionType enc)
+{
+    return rs_nbt_write_full(self, datap, lenp, enc, NULL);
+}
+
+bool rs_nbt_write_full(RSNBT* self, void** datap, size_t* lenp, RSCompressionType enc, const RSCompressionOptions* options)
 {
     rs_return_val_if_fail(self, false);
     rs_return_val_if_fail(datap, false);
@@ -525,6 +720,8 @@ bool rs_nbt_write(RSNBT* self, void** datap, size_t* lenp, RSCompressionType enc
     if (self->root_name == NULL)
         return false;
     
+    _rs_trace_begin(RS_TRACE_NBT_WRITE, 0);
+    
     /* first, get how big the uncompressed version will be */
     uint32_t rawlen = _rs_nbt_tag_length(self->root);
     rawlen += 2 + strlen(self->root_name); /* for name */
@@ -541,8 +738,9 @@ bool rs_nbt_write(RSNBT* self, void** datap, size_t* lenp, RSCompressionType enc
     rawhead += strlen(self->root_name);
     
     _rs_nbt_write_tag(self->root, &rawhead);
+    _rs_trace_end(RS_TRACE_NBT_WRITE, rawlen);
     
-    rs_compress(enc, rawbuf, rawlen, (uint8_t**)datap, lenp);
+    rs_compress_full(enc, options, rawbuf, rawlen, (uint8_t**)datap, lenp);
     rs_free(rawbuf);
     if (*datap == NULL)
         return false;
@@ -552,23 +750,54 @@ bool rs_nbt_write(RSNBT* self, void** datap, size_t* lenp, RSCompressionType enc
 bool rs_nbt_write_to_region(RSNBT* self, RSRegion* region, uint8_t x, uint8_t z)
 {
     rs_return_val_if_fail(region, false);
+    return rs_nbt_write_to_region_full(self, region, x, z, rs_region_get_compression_options(region));
+}
+
+bool rs_nbt_write_to_region_full(RSNBT* self, RSRegion* region, uint8_t x, uint8_t z, const RSCompressionOptions* options)
+{
+    rs_return_val_if_fail(region, false);
+    
+    RSCompressionType enc = rs_region_get_compression(region);
+    
+    /* RS_ZSTD uses the region's dictionary, unless told otherwise */
+    RSCompressionOptions with_dictionary;
+    if (enc == RS_ZSTD && (!options || !options->dictionary))
+    {
+        if (options)
+        {
+            with_dictionary = *options;
+        } else {
+            rs_compression_options_init(&with_dictionary);
+        }
+        with_dictionary.dictionary = rs_region_get_dictionary(region);
+        options = &with_dictionary;
+    }
     
     void* outdata;
     size_t outlen;
-    if (!rs_nbt_write(self, &outdata, &outlen, RS_ZLIB))
+    if (!rs_nbt_write_full(self, &outdata, &outlen, enc, options))
         return false; /* TODO cascading proper error handling */
     
-    rs_region_set_chunk_data(region, x, z, outdata, outlen, RS_ZLIB);
+    rs_region_set_chunk_data(region, x, z, outdata, outlen, enc);
     
     rs_free(outdata);
     return true;
 }
 
 bool rs_nbt_write_to_file(RSNBT* self, const char* path)
+{
+    /* standalone files can be big, so use every processor */
+    RSCompressionOptions options;
+    rs_compression_options_init(&options);
+    options.threads = 0;
+    return rs_nbt_write_to_file_full(self, path, &options);
+}
+
+bool rs_nbt_write_to_file_full(RSNBT* self, const char* path, const RSCompressionOptions* options)
 {
     void* outdata;
     size_t outlen;
-    if (!rs_nbt_write(self, &outdata, &outlen, RS_GZIP))
+    if (!rs_nbt_write_full(self, &outdata, &outlen, RS_GZIP, options))
         return false;
     
     FILE* f = fopen(path, "wb");
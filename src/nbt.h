@@ -18,16 +18,29 @@ typedef struct _RSNBT RSNBT;
 
 /* creating / reading / freeing */
 RSNBT* rs_nbt_new(void);
+/* with RS_AUTO_COMPRESSION, these (and parse_from_file) also take
+ * uncompressed NBT, unlike rs_get_compression_type() */
 RSNBT* rs_nbt_parse(void* data, size_t len, RSCompressionType enc);
+/* for RS_ZSTD data written with a dictionary (may be NULL) */
+RSNBT* rs_nbt_parse_full(void* data, size_t len, RSCompressionType enc, RSDictionary* dictionary);
 RSNBT* rs_nbt_parse_from_region(RSRegion* region, uint8_t x, uint8_t z);
 RSNBT* rs_nbt_parse_from_file(const char* path);
 void rs_nbt_free(RSNBT* self);
 
 /* writing (returns true on success) */
 bool rs_nbt_write(RSNBT* self, void** datap, size_t* lenp, RSCompressionType enc);
-/* must flush region after writes */
+/* options may be NULL for the defaults */
+bool rs_nbt_write_full(RSNBT* self, void** datap, size_t* lenp, RSCompressionType enc, const RSCompressionOptions* options);
+/* must flush region after writes. These use the region's compression
+ * type and dictionary, and the plain version uses its default options
+ * too (see rs_region_set_compression and
+ * rs_region_set_compression_options)
+ */
 bool rs_nbt_write_to_region(RSNBT* self, RSRegion* region, uint8_t x, uint8_t z);
+bool rs_nbt_write_to_region_full(RSNBT* self, RSRegion* region, uint8_t x, uint8_t z, const RSCompressionOptions* options);
+/* gzip'd, with one thread per processor for large files */
 bool rs_nbt_write_to_file(RSNBT* self, const char* path);
+bool rs_nbt_write_to_file_full(RSNBT* self, const char* path, const RSCompressionOptions* options);
 
 /* getting info */
 const char* rs_nbt_get_name(RSNBT* self);
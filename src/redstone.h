@@ -21,15 +21,20 @@
 /* utilities */
 #include "util.h"
 #include "memory.h"
+#include "slice.h"
 #include "rsendian.h"
 #include "error.h"
 #include "compression.h"
+#include "trace.h"
 
 /* data types */
 #include "list.h"
+#include "array.h"
+#include "hashmap.h"
 
 /* save file interfaces */
 #include "region.h"
 #include "nbt.h"
+#include "world.h"
 
 #endif /* __REDSTONE_H_INCLUDED__ */
@@ -3,13 +3,18 @@
  * See redstone.h for details.
  */
 
+#define RS_MEMORY_SUBSYSTEM RS_MEMORY_REGION
+
+#include "config.h"
 #include "region.h"
 
 #include "error.h"
 #include "memory.h"
 #include "mmap.h"
 #include "rsendian.h"
-#include "list.h"
+#include "array.h"
+#include "hashmap.h"
+#include "trace.h"
 
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -17,6 +22,10 @@
 #include <stdint.h>
 #include <time.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
@@ -42,6 +51,29 @@ struct __PACKED__ ChunkLocation
 };
 #pragma pack()
 
+/* encoding 127 means a custom compression type, named with a
+ * namespaced string (a big-endian length, then the name) that comes
+ * before the chunk data
+ */
+#define RS_REGION_CUSTOM_ENCODING 127
+#define RS_REGION_ZSTD_NAME "libredstone:zstd"
+
+/* the sector count in the location table is one byte, so a chunk (and
+ * its 5-byte header) can take up at most this many bytes
+ */
+#define RS_REGION_MAX_CHUNK_SIZE (255 * 4096)
+
+/* how many bytes the name for a custom encoding takes up, or 0 */
+static inline uint32_t _rs_region_get_name_length(RSCompressionType enc)
+{
+    if (enc == RS_ZSTD)
+        return 2 + strlen(RS_REGION_ZSTD_NAME);
+    return 0;
+}
+
+/* the dictionary for RS_ZSTD chunks lives next to the region file */
+#define RS_REGION_DICTIONARY_NAME "dict.zstd"
+
 /* for cached chunk writes */
 struct ChunkWrite
 {
@@ -71,8 +103,18 @@ struct _RSRegion
     struct ChunkLocation* locations;
     uint32_t* timestamps;
     
-    /* list of ChunkWrite structs */
-    RSList* cached_writes;
+    /* ChunkWrite pointers, in the order they were first made, and
+     * indexed by x + z*32 -- only for regions opened for writing */
+    RSArray* cached_writes;
+    RSHashMap* cached_write_index;
+    
+    /* used by rs_nbt_write_to_region() */
+    RSCompressionType compression;
+    RSCompressionOptions compression_options;
+    
+    /* loaded the first time it's needed */
+    RSDictionary* dictionary;
+    bool dictionary_loaded;
 };
 
 RSRegion* rs_region_open(const char* path, bool write)
@@ -115,7 +157,13 @@ RSRegion* rs_region_open(const char* path, bool write)
     self->fd = fd;    
     self->fsize = stat_buf.st_size;
     self->map = map;
-    self->cached_writes = NULL;
+    if (write)
+    {
+        self->cached_writes = rs_array_new(sizeof(struct ChunkWrite*));
+        self->cached_write_index = rs_hash_map_new(RS_HASH_MAP_INTEGER_KEYS);
+    }
+    self->compression = RS_ZLIB;
+    rs_compression_options_init(&(self->compression_options));
     
     self->locations = NULL;
     self->timestamps = NULL;
@@ -132,11 +180,18 @@ void rs_region_close(RSRegion* self)
 {
     rs_return_if_fail(self);
     
-    if (self->write && self->cached_writes)
+    if (self->write && self->cached_writes->length > 0)
         rs_region_flush(self);
-    rs_assert(self->cached_writes == NULL);
+    if (self->write)
+    {
+        rs_assert(self->cached_writes->length == 0);
+        rs_array_free(self->cached_writes);
+        rs_hash_map_free(self->cached_write_index);
+    }
     
     rs_free(self->path);
+    if (self->dictionary)
+        rs_dictionary_unref(self->dictionary);
     if (self->map)
         munmap(self->map, self->fsize);
     close(self->fd);
@@ -169,6 +224,23 @@ static void* _rs_region_get_data(RSRegion* self, uint8_t x, uint8_t z)
     return self->map + (rs_endian_uint24(self->locations[x + z*32].offset) * 4096);
 }
 
+/* LOCAL helper that returns how much of the chunk data is taken up by
+ * the name of a custom encoding, if it has one
+ */
+static uint32_t _rs_region_get_custom_name_length(RSRegion* self, uint8_t x, uint8_t z)
+{
+    uint8_t* data = (uint8_t*)_rs_region_get_data(self, x, z);
+    if (!data || data[4] != RS_REGION_CUSTOM_ENCODING)
+        return 0;
+    
+    /* don't trust the name length further than the data goes */
+    uint32_t len = rs_endian_uint32(((uint32_t*)data)[0]) - 1;
+    if (len < 2)
+        return 0;
+    uint32_t name_len = 2 + ((data[5] << 8) | data[6]);
+    return (name_len <= len) ? name_len : 0;
+}
+
 uint32_t rs_region_get_chunk_length(RSRegion* self, uint8_t x, uint8_t z)
 {
     if (!rs_region_contains_chunk(self, x, z))
@@ -179,7 +251,7 @@ uint32_t rs_region_get_chunk_length(RSRegion* self, uint8_t x, uint8_t z)
         return 0;
     
     /* size is big-endian, and 1 larger than it should be */
-    return rs_endian_uint32(size_int[0]) - 1;
+    return rs_endian_uint32(size_int[0]) - 1 - _rs_region_get_custom_name_length(self, x, z);
 }
 
 RSCompressionType rs_region_get_chunk_compression(RSRegion* self, uint8_t x, uint8_t z)
@@ -198,6 +270,15 @@ RSCompressionType rs_region_get_chunk_compression(RSRegion* self, uint8_t x, uin
         return RS_GZIP;
     case 2:
         return RS_ZLIB;
+    case 3:
+        return RS_UNCOMPRESSED;
+    case 4:
+        return RS_LZ4;
+    case RS_REGION_CUSTOM_ENCODING:
+        if (_rs_region_get_custom_name_length(self, x, z) == 2 + strlen(RS_REGION_ZSTD_NAME) &&
+            memcmp(compression_byte + 7, RS_REGION_ZSTD_NAME, strlen(RS_REGION_ZSTD_NAME)) == 0)
+            return RS_ZSTD;
+        break;
     default:
         break;
     };
@@ -215,8 +296,8 @@ void* rs_region_get_chunk_data(RSRegion* self, uint8_t x, uint8_t z)
     if (!ret)
         return NULL;
     
-    /* chunk data starts 5 bytes after */
-    return ret + 5;
+    /* chunk data starts 5 bytes after, or after the encoding name */
+    return ret + 5 + _rs_region_get_custom_name_length(self, x, z);
 }
 
 bool rs_region_contains_chunk(RSRegion* self, uint8_t x, uint8_t z)
@@ -224,6 +305,10 @@ bool rs_region_contains_chunk(RSRegion* self, uint8_t x, uint8_t z)
     rs_return_val_if_fail(self, false);
     rs_return_val_if_fail(x < 32 && z < 32, false);
     
+    /* empty (new) region files have no tables */
+    if (self->locations == NULL)
+        return false;
+    
     uint16_t i = z * 32 + x;
     if (self->locations[i].offset == 0)
         return false;
@@ -235,6 +320,27 @@ bool rs_region_contains_chunk(RSRegion* self, uint8_t x, uint8_t z)
     return true;
 }
 
+void rs_region_get_chunk_sectors(RSRegion* self, uint8_t x, uint8_t z, uint32_t* offset, uint32_t* count)
+{
+    if (offset)
+        *offset = 0;
+    if (count)
+        *count = 0;
+    if (!rs_region_contains_chunk(self, x, z))
+        return;
+    
+    if (offset)
+        *offset = rs_endian_uint24(self->locations[x + z*32].offset);
+    if (count)
+        *count = self->locations[x + z*32].sector_count;
+}
+
+uint32_t rs_region_get_sector_count(RSRegion* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return (self->fsize + 4095) / 4096;
+}
+
 void rs_region_set_chunk_data(RSRegion* self, uint8_t x, uint8_t z, void* data, uint32_t len, RSCompressionType enc)
 {
     uint32_t timestamp = time(NULL);
@@ -251,45 +357,59 @@ void rs_region_set_chunk_data_full(RSRegion* self, uint8_t x, uint8_t z, void* d
         return;
     }
     
-    /* first, check if there's a cached write already, and clear it if
-     * needed
+    if (len > 0 && data != NULL && enc == RS_AUTO_COMPRESSION)
+        enc = rs_get_compression_type(data, len);
+    
+    /* anything bigger would wrap the sector count, and the location
+     * table would point at the wrong data
      */
-    RSList* cell = self->cached_writes;
-    for (; cell != NULL; cell = cell->next)
+    if (len > 0 && data != NULL && (uint64_t)len + _rs_region_get_name_length(enc) + 4 + 1 > RS_REGION_MAX_CHUNK_SIZE)
     {
-        struct ChunkWrite* write = cell->data;
-        rs_assert(write);
-        
-        if (write->x == x && write->z == z)
-            break;
+        rs_critical("chunk data is too large for a region file.");
+        return;
     }
     
-    if (cell)
+    /* first, check if there's a cached write already, and clear it if
+     * needed -- it will be reused for this write
+     */
+    struct ChunkWrite* job = rs_hash_map_lookup_int(self->cached_write_index, x + z*32);
+    if (job)
     {
-        struct ChunkWrite* write = cell->data;
-        rs_free(write->data);
-        rs_free(write);
-        self->cached_writes = rs_list_remove(self->cached_writes, cell);
+        rs_free(job->data);
+        job->data = NULL;
     }
     
-    if (len > 0 && data != NULL && enc == RS_AUTO_COMPRESSION)
-        enc = rs_get_compression_type(data, len);
-    
-    /* copy the data */
+    /* copy the data, after the name for custom encodings */
     void* data_copy = NULL;
     if (len > 0 && data != NULL)
-        data_copy = memcpy(rs_malloc(len), data, len);
+    {
+        const char* name = (enc == RS_ZSTD) ? RS_REGION_ZSTD_NAME : NULL;
+        uint32_t name_len = _rs_region_get_name_length(enc);
+        
+        data_copy = rs_malloc(name_len + len);
+        if (name)
+        {
+            ((uint8_t*)data_copy)[0] = (name_len - 2) >> 8;
+            ((uint8_t*)data_copy)[1] = (name_len - 2) & 0xff;
+            memcpy(data_copy + 2, name, name_len - 2);
+        }
+        memcpy(data_copy + name_len, data, len);
+        len += name_len;
+    }
     
-    /* now, create a new write struct */
-    struct ChunkWrite* job = rs_new0(struct ChunkWrite, 1);
-    job->x = x;
-    job->z = z;
+    /* now, create a new write struct if there wasn't one */
+    if (!job)
+    {
+        job = rs_new0(struct ChunkWrite, 1);
+        job->x = x;
+        job->z = z;
+        rs_array_append(self->cached_writes, job);
+        rs_hash_map_insert_int(self->cached_write_index, x + z*32, job);
+    }
     job->data = data_copy;
     job->length = len;
     job->encoding = enc;
     job->timestamp = timestamp;
-    
-    self->cached_writes = rs_list_push(self->cached_writes, job);
 }
 
 void rs_region_clear_chunk(RSRegion* self, uint8_t x, uint8_t z)
@@ -306,20 +426,39 @@ static inline uint8_t _rs_region_get_encoding(RSCompressionType enc)
         return 1;
     case RS_ZLIB:
         return 2;
+    case RS_UNCOMPRESSED:
+        return 3;
+    case RS_LZ4:
+        return 4;
+    case RS_ZSTD:
+        return RS_REGION_CUSTOM_ENCODING;
     default:
         rs_return_val_if_reached(0); /* unhandled compression type */
     };
     return 0;
 }
 
+/* sorts OrderedChunkWrites by where they are in the file -- chunks
+ * being added all have the same order, so break ties by position
+ */
+static int _rs_region_compare_ordered_writes(const void* a, const void* b)
+{
+    const struct OrderedChunkWrite* wa = a;
+    const struct OrderedChunkWrite* wb = b;
+    
+    if (wa->order != wb->order)
+        return (wa->order < wb->order) ? -1 : 1;
+    return (wa->write->x + wa->write->z * 32) - (wb->write->x + wb->write->z * 32);
+}
+
 /* writes are cached until this is called */
 void rs_region_flush(RSRegion* self)
 {
     rs_return_if_fail(self);
     
-    RSList* cell;
+    size_t n;
     
-    if (self->write && self->cached_writes)
+    if (self->write && self->cached_writes->length > 0)
     {
         /* check to see if this is a brand-new file */
         if (self->map == NULL)
@@ -328,10 +467,9 @@ void rs_region_flush(RSRegion* self)
             
             /* first, figure out how big the file needs to be */
             uint32_t final_size = 0;
-            cell = self->cached_writes;
-            for (; cell != NULL; cell = cell->next)
+            for (n = 0; n < self->cached_writes->length; n++)
             {
-                struct ChunkWrite* write = cell->data;
+                struct ChunkWrite* write = rs_array_index(self->cached_writes, struct ChunkWrite*, n);
                 rs_assert(write);
                 
                 /* be sure to account for extra size/compression info */
@@ -349,6 +487,7 @@ void rs_region_flush(RSRegion* self)
             rs_assert(final_size % 4096 == 0);
             
             /* resize the file, and remap */
+            _rs_trace_begin(RS_TRACE_REGION_REMAP, self->fsize);
             if (ftruncate(self->fd, final_size) < 0)
             {
                 rs_error("file resize failed"); /* FIXME */
@@ -362,15 +501,18 @@ void rs_region_flush(RSRegion* self)
             
             self->locations = (struct ChunkLocation*)(self->map);
             self->timestamps = (uint32_t*)(self->map + 4096);
+            _rs_trace_end(RS_TRACE_REGION_REMAP, final_size);
             
             /* zero out the headers */
             memset(self->map, 0, 4096 * 2);
             
             /* now, we can iterate through the writes and copy them in */
+            _rs_trace_begin(RS_TRACE_REGION_GROW, 0);
+            size_t written = 0;
             uint32_t cur_sector = 2;
-            for (cell = self->cached_writes; cell != NULL; cell = cell->next)
+            for (n = 0; n < self->cached_writes->length; n++)
             {
-                struct ChunkWrite* write = cell->data;
+                struct ChunkWrite* write = rs_array_index(self->cached_writes, struct ChunkWrite*, n);
                 rs_assert(write);
                 
                 unsigned int i = write->x + write->z*32;
@@ -403,16 +545,17 @@ void rs_region_flush(RSRegion* self)
                 /* write out the data */
                 rs_assert(write->data);
                 memcpy(dest + 4 + 1, write->data, write->length);
+                written += write->length + 4 + 1;
                 
                 /* move along */
                 cur_sector += sector_count;
             }
+            _rs_trace_end(RS_TRACE_REGION_GROW, written);
         } else {
             /* there's already header info in place, we just need to
              * shuffle things around and update it
              */
             
-            RSList* cell;
             uint32_t sectors_added = 0;
             
             void* read_head;
@@ -425,13 +568,13 @@ void rs_region_flush(RSRegion* self)
              * efficiently rewrite the region in only two passes
              */
             
-            RSList* shrinks = NULL;
-            RSList* grows = NULL;
+            RSArray* shrinks = rs_array_new(sizeof(struct OrderedChunkWrite));
+            RSArray* grows = rs_array_new(sizeof(struct OrderedChunkWrite));
             
-            for (cell = self->cached_writes; cell != NULL; cell = cell->next)
+            for (n = 0; n < self->cached_writes->length; n++)
             {
-                struct ChunkWrite* write = cell->data;
-                RSList** dest = NULL;
+                struct ChunkWrite* write = rs_array_index(self->cached_writes, struct ChunkWrite*, n);
+                RSArray* dest = NULL;
                 
                 bool exists = rs_region_contains_chunk(self, write->x, write->z);
                 if (write->data == NULL && !exists)
@@ -443,10 +586,10 @@ void rs_region_flush(RSRegion* self)
                 if (write->data == NULL || (exists && write->length <= rs_region_get_chunk_length(self, write->x, write->z)))
                 {
                     /* this write will shrink the file */
-                    dest = &shrinks;
+                    dest = shrinks;
                 } else {
                     /* this write will grow the file */
-                    dest = &grows;
+                    dest = grows;
                     sectors_added += (write->length + 4 + 1) / 4096;
                     if ((write->length + 4 + 1) % 4096 > 0)
                         sectors_added++;
@@ -456,64 +599,48 @@ void rs_region_flush(RSRegion* self)
                     }
                 }
                 
-                /* make sure we have a list to insert into */
+                /* make sure we have an array to add to */
                 rs_assert(dest != NULL);
                 
-                struct OrderedChunkWrite* ordered_write = rs_new(struct OrderedChunkWrite, 1);
-                ordered_write->write = write;
-                ordered_write->order = rs_endian_uint24(self->locations[write->z * 32 + write->x].offset);
+                struct OrderedChunkWrite ordered_write;
+                ordered_write.write = write;
+                ordered_write.order = rs_endian_uint24(self->locations[write->z * 32 + write->x].offset);
                 if (!exists)
                 {
                     /* so this chunk is being *added* not modified. We
                      * want to add chunks at the very beginning of the
                      * grow process (taking place at the *end* of the
                      * file), so we need these to show up at the very
-                     * end of the list.
+                     * end of the array.
                      */
-                    ordered_write->order = UINT32_MAX;
+                    ordered_write.order = UINT32_MAX;
                 }
                 
-                while (true)
-                {
-                    if (*dest == NULL)
-                    {
-                        /* end of the line -- must insert it here */
-                        *dest = rs_list_push(*dest, ordered_write);
-                        break;
-                    } else {
-                        /* check to see if we should insert here */
-                        struct OrderedChunkWrite* other = (*dest)->data;
-                        if (ordered_write->order <= other->order)
-                        {
-                            /* make sure we don't have any duplicate writes */
-                            rs_assert(write->x != other->write->x || write->z != other->write->z);
-                            
-                            /* insert before this element! */
-                            *dest = rs_list_push(*dest, ordered_write);
-                            break;
-                        }
-                        
-                        dest = &((*dest)->next);
-                    }
-                }   
+                rs_array_append(dest, ordered_write);
             }
             
+            /* cached writes are unique per chunk, so there are no duplicates */
+            rs_array_sort(shrinks, _rs_region_compare_ordered_writes);
+            rs_array_sort(grows, _rs_region_compare_ordered_writes);
+            
             /* save the old file size, write to new one */
             uint32_t new_fsize = self->fsize;
             
             /* shrink the file */
-            if (shrinks)
+            _rs_trace_begin(RS_TRACE_REGION_SHRINK, 0);
+            size_t moved = 0;
+            if (shrinks->length > 0)
             {
                 /* skip ahead to the first interesting part */
-                struct OrderedChunkWrite* first = shrinks->data;
+                struct OrderedChunkWrite* first = &rs_array_index(shrinks, struct OrderedChunkWrite, 0);
                 read_head = _rs_region_get_data(self, first->write->x, first->write->z);
                 read_head_sector = rs_endian_uint24(self->locations[first->write->z * 32 + first->write->x].offset);
                 write_head = read_head;
                 write_head_sector = read_head_sector;
             }
-            for (cell = shrinks; cell != NULL; cell = cell->next)
+            for (n = 0; n < shrinks->length; n++)
             {
-                struct OrderedChunkWrite* ordered_write = cell->data;
+                struct OrderedChunkWrite* ordered_write = &rs_array_index(shrinks, struct OrderedChunkWrite, n);
                 struct ChunkWrite* write = ordered_write->write;
                 
                 /* move the read head up to the start of this data */
@@ -539,6 +666,7 @@ void rs_region_flush(RSRegion* self)
                 }
                 
                 memmove(write_head, read_head, data_start - read_head);
+                moved += data_start - read_head;
                 write_head += data_start - read_head;
                 write_head_sector += sectors_to_write;
                 read_head += data_start - read_head;
@@ -573,6 +701,7 @@ void rs_region_flush(RSRegion* self)
                     ((uint32_t*)write_head)[0] = rs_endian_uint32(write->length + 1);
                     ((uint8_t*)write_head)[4] = enc;
                     memcpy(write_head + 4 + 1, write->data, write->length);
+                    moved += write->length + 4 + 1;
                     
                     write_head += new_size * 4096;
                     new_fsize += new_size * 4096;
@@ -584,12 +713,36 @@ void rs_region_flush(RSRegion* self)
                 new_fsize -= old_size * 4096;
                 read_head_sector += old_size;
             }
-            rs_list_foreach(shrinks, rs_free);
-            rs_list_free(shrinks);
+            if (shrinks->length > 0)
+            {
+                /* move everything after the last shrink down, too */
+                void* data_end = self->map + self->fsize;
+                rs_assert(data_end >= read_head);
+                uint32_t sectors_to_write = (data_end - read_head) / 4096;
+                
+                for (uint8_t z = 0; z < 32; z++)
+                {
+                    for (uint8_t x = 0; x < 32; x++)
+                    {
+                        uint32_t sector = rs_endian_uint24(self->locations[z * 32 + x].offset);
+                        if (sector >= read_head_sector && sector < read_head_sector + sectors_to_write)
+                        {
+                            uint32_t new_sector = sector - (read_head_sector - write_head_sector);
+                            self->locations[z * 32 + x].offset = rs_endian_uint24(new_sector);
+                        }
+                    }
+                }
+                
+                memmove(write_head, read_head, data_end - read_head);
+                moved += data_end - read_head;
+            }
+            rs_array_free(shrinks);
+            _rs_trace_end(RS_TRACE_REGION_SHRINK, moved);
             
             /* resize the file to account for both shrinking and growing */
             new_fsize += sectors_added * 4096;
             rs_assert(new_fsize % 4096 == 0);
+            _rs_trace_begin(RS_TRACE_REGION_REMAP, self->fsize);
             if (msync(self->map, self->fsize, MS_SYNC) < 0)
             {
                 rs_error("sync failed"); /* FIXME */
@@ -607,18 +760,20 @@ void rs_region_flush(RSRegion* self)
             self->fsize = new_fsize;
             self->locations = (struct ChunkLocation*)(self->map);
             self->timestamps = (uint32_t*)(self->map + 4096);
+            _rs_trace_end(RS_TRACE_REGION_REMAP, new_fsize);
             
             /* grow the file (in reverse, so copying doesn't overwrite
              * information we still need)
              */
+            _rs_trace_begin(RS_TRACE_REGION_GROW, 0);
+            moved = 0;
             write_head = self->map + self->fsize;
             write_head_sector = self->fsize / 4096;
             read_head = write_head - (sectors_added * 4096);
             read_head_sector = write_head_sector - sectors_added;
-            grows = rs_list_reverse(grows);
-            for (cell = grows; cell != NULL; cell = cell->next)
+            for (n = grows->length; n > 0; n--)
             {
-                struct OrderedChunkWrite* ordered_write = cell->data;
+                struct OrderedChunkWrite* ordered_write = &rs_array_index(grows, struct OrderedChunkWrite, n - 1);
                 struct ChunkWrite* write = ordered_write->write;
                 uint16_t i = write->z * 32 + write->x;
                 if (rs_region_contains_chunk(self, write->x, write->z))
@@ -652,6 +807,7 @@ void rs_region_flush(RSRegion* self)
                     write_head -= read_head - data_end;
                     write_head_sector -= sectors_to_write;
                     memmove(write_head, data_end, read_head - data_end);
+                    moved += read_head - data_end;
                     read_head -= read_head - data_end;
                     read_head_sector -= sectors_to_write;
                     rs_assert(read_head == data_end);
@@ -677,6 +833,7 @@ void rs_region_flush(RSRegion* self)
                     ((uint32_t*)write_head)[0] = rs_endian_uint32(write->length + 1);
                     ((uint8_t*)write_head)[4] = enc;
                     memcpy(write_head + 4 + 1, write->data, write->length);
+                    moved += write->length + 4 + 1;
                     
                     /* move read head past old chunk */
                     read_head -= old_sectors * 4096;
@@ -701,29 +858,254 @@ void rs_region_flush(RSRegion* self)
                     ((uint32_t*)write_head)[0] = rs_endian_uint32(write->length + 1);
                     ((uint8_t*)write_head)[4] = enc;
                     memcpy(write_head + 4 + 1, write->data, write->length);
+                    moved += write->length + 4 + 1;
                 }
             }
-            rs_list_foreach(grows, rs_free);
-            rs_list_free(grows);
+            rs_array_free(grows);
+            _rs_trace_end(RS_TRACE_REGION_GROW, moved);
             
             /* all done (*phew*) */
         }
     }
     
     /* clear the cached writes */
-    cell = self->cached_writes;
-    for (; cell != NULL; cell = cell->next)
+    if (self->write)
     {
-        struct ChunkWrite* write = cell->data;
-        rs_free(write->data);
-        rs_free(write);
+        for (n = 0; n < self->cached_writes->length; n++)
+        {
+            struct ChunkWrite* write = rs_array_index(self->cached_writes, struct ChunkWrite*, n);
+            rs_free(write->data);
+            rs_free(write);
+        }
+        rs_array_clear(self->cached_writes);
+        rs_hash_map_clear(self->cached_write_index);
     }
-    rs_list_free(self->cached_writes);
-    self->cached_writes = NULL;
     
     /* sync the memory */
-    if (self->map && msync(self->map, self->fsize, MS_SYNC) < 0)
+    if (self->map)
+    {
+        _rs_trace_begin(RS_TRACE_REGION_SYNC, self->fsize);
+        if (msync(self->map, self->fsize, MS_SYNC) < 0)
+        {
+            rs_error("sync failed"); /* FIXME */
+        }
+        _rs_trace_end(RS_TRACE_REGION_SYNC, self->fsize);
+    }
+}
+
+void rs_region_set_compression(RSRegion* self, RSCompressionType enc)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(enc == RS_GZIP || enc == RS_ZLIB || enc == RS_UNCOMPRESSED || enc == RS_LZ4 || enc == RS_ZSTD);
+    
+    self->compression = enc;
+}
+
+RSCompressionType rs_region_get_compression(RSRegion* self)
+{
+    rs_return_val_if_fail(self, RS_UNKNOWN_COMPRESSION);
+    return self->compression;
+}
+
+void rs_region_set_compression_options(RSRegion* self, const RSCompressionOptions* options)
+{
+    rs_return_if_fail(self);
+    
+    if (options)
+    {
+        self->compression_options = *options;
+    } else {
+        rs_compression_options_init(&(self->compression_options));
+    }
+}
+
+const RSCompressionOptions* rs_region_get_compression_options(RSRegion* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    return &(self->compression_options);
+}
+
+RSDictionary* rs_region_get_dictionary(RSRegion* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    if (!self->dictionary_loaded)
     {
-        rs_error("sync failed"); /* FIXME */
+        self->dictionary_loaded = true;
+        
+        /* swap the file name for the dictionary's */
+        const char* sep = strrchr(self->path, '/');
+#ifdef _WIN32
+        const char* winsep = strrchr(self->path, '\\');
+        if (winsep > sep)
+            sep = winsep;
+#endif
+        size_t dir_len = sep ? (size_t)(sep - self->path) + 1 : 0;
+        char* dict_path = rs_malloc(dir_len + strlen(RS_REGION_DICTIONARY_NAME) + 1);
+        memcpy(dict_path, self->path, dir_len);
+        strcpy(dict_path + dir_len, RS_REGION_DICTIONARY_NAME);
+        
+        self->dictionary = rs_dictionary_new_from_file(dict_path);
+        rs_free(dict_path);
     }
+    
+    return self->dictionary;
+}
+
+void rs_region_set_dictionary(RSRegion* self, RSDictionary* dictionary)
+{
+    rs_return_if_fail(self);
+    
+    if (dictionary)
+        rs_dictionary_ref(dictionary);
+    if (self->dictionary)
+        rs_dictionary_unref(self->dictionary);
+    self->dictionary = dictionary;
+    self->dictionary_loaded = true;
+}
+
+/* for rs_region_transcode */
+typedef struct
+{
+    RSRegion* src;
+    RSDictionary* src_dictionary;
+    RSCompressionType enc;
+    RSCompressionOptions options;
+    
+    /* recompressed chunks, NULL if there's no chunk or it failed */
+    uint8_t* data[32 * 32];
+    size_t lengths[32 * 32];
+    
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+    /* the next chunk nobody has started on */
+    unsigned int next;
+} RSRegionTranscodeJob;
+
+static void _rs_region_transcode_chunk(RSRegionTranscodeJob* job, unsigned int i)
+{
+    uint8_t x = i % 32;
+    uint8_t z = i / 32;
+    if (!rs_region_contains_chunk(job->src, x, z))
+        return;
+    
+    uint8_t* rawdata;
+    size_t rawdatalen;
+    rs_decompress_full(rs_region_get_chunk_compression(job->src, x, z), job->src_dictionary,
+                       rs_region_get_chunk_data(job->src, x, z), rs_region_get_chunk_length(job->src, x, z),
+                       &rawdata, &rawdatalen);
+    if (!rawdata)
+        return;
+    
+    rs_compress_full(job->enc, &(job->options), rawdata, rawdatalen, &(job->data[i]), &(job->lengths[i]));
+    rs_free(rawdata);
+}
+
+static void* _rs_region_transcode_worker(void* data)
+{
+    RSRegionTranscodeJob* job = data;
+    while (true)
+    {
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&(job->lock));
+#endif
+        unsigned int i = job->next++;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&(job->lock));
+#endif
+        
+        if (i >= 32 * 32)
+            break;
+        _rs_region_transcode_chunk(job, i);
+    }
+    
+    return NULL;
+}
+
+bool rs_region_transcode(RSRegion* src, RSRegion* dst, RSCompressionType enc, const RSCompressionOptions* options, unsigned int nthreads)
+{
+    rs_return_val_if_fail(src && dst, false);
+    rs_return_val_if_fail(enc != RS_AUTO_COMPRESSION && enc != RS_UNKNOWN_COMPRESSION, false);
+    if (!(dst->write))
+    {
+        rs_critical("region is not opened in write mode.");
+        return false;
+    }
+    
+    RSRegionTranscodeJob* job = rs_new0(RSRegionTranscodeJob, 1);
+    job->src = src;
+    job->enc = enc;
+    job->options = options ? *options : dst->compression_options;
+    /* chunks are small, so threads are better spent on other chunks */
+    job->options.threads = 1;
+    if (enc == RS_ZSTD && !job->options.dictionary)
+        job->options.dictionary = rs_region_get_dictionary(dst);
+    /* load it now, rather than racing to load it from every thread */
+    job->src_dictionary = rs_region_get_dictionary(src);
+    
+#ifdef HAVE_PTHREAD
+    if (nthreads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (cpus > 0) ? cpus : 1;
+    }
+    
+    /* the calling thread works too, and if a thread can't be started
+     * the others pick up the slack
+     */
+    pthread_mutex_init(&(job->lock), NULL);
+    pthread_t* workers = rs_new0(pthread_t, nthreads);
+    unsigned int started = 0;
+    while (started + 1 < nthreads && pthread_create(&(workers[started]), NULL, _rs_region_transcode_worker, job) == 0)
+        started++;
+    _rs_region_transcode_worker(job);
+    
+    unsigned int t;
+    for (t = 0; t < started; t++)
+        pthread_join(workers[t], NULL);
+    rs_free(workers);
+    pthread_mutex_destroy(&(job->lock));
+#else
+    _rs_region_transcode_worker(job);
+#endif
+    
+    /* writes are cached in dst, so this copies them all once more --
+     * but it keeps the file-writing logic in one place
+     */
+    bool success = true;
+    unsigned int i;
+    for (i = 0; i < 32 * 32; i++)
+    {
+        uint8_t x = i % 32;
+        uint8_t z = i / 32;
+        if (!rs_region_contains_chunk(src, x, z))
+            continue;
+        
+        uint32_t timestamp = rs_region_get_chunk_timestamp(src, x, z);
+        if (job->data[i] && job->lengths[i] + _rs_region_get_name_length(enc) + 4 + 1 > RS_REGION_MAX_CHUNK_SIZE)
+        {
+            /* it grew too big to write -- keep the old one instead */
+            rs_free(job->data[i]);
+            job->data[i] = NULL;
+        }
+        if (job->data[i])
+        {
+            rs_region_set_chunk_data_full(dst, x, z, job->data[i], job->lengths[i], enc, timestamp);
+            rs_free(job->data[i]);
+            continue;
+        }
+        
+        /* better to keep the chunk as it was than to lose it, but there's
+         * no way to write out an encoding we don't know
+         */
+        success = false;
+        RSCompressionType old_enc = rs_region_get_chunk_compression(src, x, z);
+        if (old_enc != RS_UNKNOWN_COMPRESSION)
+            rs_region_set_chunk_data_full(dst, x, z, rs_region_get_chunk_data(src, x, z), rs_region_get_chunk_length(src, x, z), old_enc, timestamp);
+    }
+    
+    rs_free(job);
+    rs_region_flush(dst);
+    return success;
 }
@@ -124,6 +124,34 @@ void* rs_region_get_chunk_data(RSRegion* self, uint8_t x, uint8_t z);
  */
 bool rs_region_contains_chunk(RSRegion* self, uint8_t x, uint8_t z);
 
+/**
+ * Get where a chunk is stored in the region file.
+ *
+ * Region files are made of 4096-byte sectors; the first two hold the
+ * location and timestamp tables, and each chunk takes up a run of the
+ * rest. If the chunk does not exist, both are 0.
+ *
+ * \param self the region file
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \param offset where to put the first sector of the chunk, or NULL
+ * \param count where to put the number of sectors it uses, or NULL
+ * \sa rs_region_get_sector_count
+ */
+void rs_region_get_chunk_sectors(RSRegion* self, uint8_t x, uint8_t z, uint32_t* offset, uint32_t* count);
+
+/**
+ * Get the number of sectors in the region file.
+ *
+ * This includes the two header sectors, and any sectors no chunk is
+ * using.
+ *
+ * \param self the region file
+ * \return the number of 4096-byte sectors in the file
+ * \sa rs_region_get_chunk_sectors
+ */
+uint32_t rs_region_get_sector_count(RSRegion* self);
+
 /**
  * Set the data for a given chunk.
  *
@@ -157,6 +185,10 @@ void rs_region_set_chunk_data(RSRegion* self, uint8_t x, uint8_t z, void* data,
  * If the given compression type is RS_AUTO_COMPRESSION, the
  * compression type will be guessed from the given data.
  *
+ * A chunk can take up at most 255 sectors in a region file, so data
+ * longer than 255 * 4096 - 5 bytes (less the name, for RS_ZSTD) is
+ * refused with a critical error, and the chunk is left as it was.
+ *
  * See rs_region_set_chunk_data() for a version that automatically
  * sets the modification time to the current time. If you want to
  * delete a chunk instead, use rs_region_clear_chunk().
@@ -206,4 +238,106 @@ void rs_region_clear_chunk(RSRegion* self, uint8_t x, uint8_t z);
  */
 void rs_region_flush(RSRegion* self);
 
+/**
+ * Set the compression type used for new chunks in this region.
+ *
+ * This is used by rs_nbt_write_to_region() when it writes chunks to
+ * this region. Regions start out using RS_ZLIB, which every version
+ * of Minecraft can read; RS_LZ4 and RS_UNCOMPRESSED are much faster,
+ * but need a newer version.
+ *
+ * \param self the region
+ * \param enc the compression type to use (not RS_AUTO_COMPRESSION)
+ * \sa rs_region_get_compression, rs_region_set_compression_options
+ */
+void rs_region_set_compression(RSRegion* self, RSCompressionType enc);
+
+/**
+ * Get the compression type used for new chunks in this region.
+ *
+ * \param self the region
+ * \return the compression type
+ * \sa rs_region_set_compression
+ */
+RSCompressionType rs_region_get_compression(RSRegion* self);
+
+/**
+ * Set the default compression options for this region.
+ *
+ * These are used by rs_nbt_write_to_region() when it writes chunks to
+ * this region. Regions start out with the defaults from
+ * rs_compression_options_init().
+ *
+ * \param self the region
+ * \param options the options to use, or NULL to go back to the defaults
+ * \sa rs_region_get_compression_options, RSCompressionOptions
+ */
+void rs_region_set_compression_options(RSRegion* self, const RSCompressionOptions* options);
+
+/**
+ * Get the default compression options for this region.
+ *
+ * \param self the region
+ * \return the options, owned by the region
+ * \sa rs_region_set_compression_options
+ */
+const RSCompressionOptions* rs_region_get_compression_options(RSRegion* self);
+
+/**
+ * Get the dictionary used for RS_ZSTD chunks in this region.
+ *
+ * The first time this is called, it loads the dictionary from a file
+ * named dict.zstd in the same directory as the region file, if there
+ * is one. It is kept around until the region is closed.
+ * rs_nbt_parse_from_region() and rs_nbt_write_to_region() use this
+ * automatically.
+ *
+ * \param self the region
+ * \return the dictionary, owned by the region, or NULL if there is none
+ * \sa rs_region_set_dictionary, RSDictionary
+ */
+RSDictionary* rs_region_get_dictionary(RSRegion* self);
+
+/**
+ * Set the dictionary used for RS_ZSTD chunks in this region.
+ *
+ * This replaces the one from dict.zstd, if any. The region keeps its
+ * own reference to the dictionary.
+ *
+ * \param self the region
+ * \param dictionary the dictionary to use, or NULL for none
+ * \sa rs_region_get_dictionary
+ */
+void rs_region_set_dictionary(RSRegion* self, RSDictionary* dictionary);
+
+/**
+ * Recompress every chunk in a region into another region.
+ *
+ * This decompresses each chunk in src and compresses it again with
+ * the given encoding and options, without parsing it into tags, then
+ * writes it to dst with its original timestamp. Chunks are spread
+ * across nthreads threads, so converting a whole world is about as
+ * fast as the compression itself.
+ *
+ * dst must be opened in write mode, and is flushed before this
+ * returns. Use a new file for dst, and it will be written out with no
+ * gaps between chunks; chunks already in dst that src doesn't have are
+ * left alone. For RS_ZSTD, chunks in src are read with src's
+ * dictionary, and written with the one in options, or dst's (see
+ * rs_region_get_dictionary()) if options doesn't have one.
+ *
+ * If a chunk can't be decompressed or compressed, or comes out too
+ * large for a region file, it is copied to dst exactly as it was, and
+ * this returns false once the rest are done.
+ *
+ * \param src the region to read from
+ * \param dst the region to write to
+ * \param enc the compression type to write chunks with
+ * \param options the compression options, or NULL for dst's defaults
+ * \param nthreads how many threads to use, or 0 for one per processor
+ * \return true if every chunk was converted
+ * \sa rs_region_set_compression_options, rs_region_flush
+ */
+bool rs_region_transcode(RSRegion* src, RSRegion* dst, RSCompressionType enc, const RSCompressionOptions* options, unsigned int nthreads);
+
 #endif /* __RS_REGION_H_INCLUDED__ */
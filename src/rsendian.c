@@ -3,29 +3,102 @@
  * See redstone.h for details.
  */
 
+#include "config.h"
+
+#define RS_ENDIAN_NO_INLINE
 #include "rsendian.h"
 
-#define UNKNOWN_ENDIAN 0
-#define BIG_ENDIAN 1
-#define LITTLE_ENDIAN 2
+#include <stdbool.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RS_ENDIAN_SSE2
+#endif
+
+#if defined(HAVE_AVX2_DISPATCH)
+#include <immintrin.h>
+#define RS_ENDIAN_AVX2
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RS_ENDIAN_NEON
+#endif
+
+#if defined(RS_ENDIAN_BIG_HOST) || defined(RS_ENDIAN_LITTLE_HOST)
+
+/* the byte order is known at compile time, so these are the same as
+ * the inline versions in the header
+ */
+
+uint16_t rs_endian_uint16(uint16_t in)
+{
+    return _rs_endian_inline_uint16(in);
+}
+
+int16_t rs_endian_int16(int16_t in)
+{
+    return (int16_t)_rs_endian_inline_uint16(in);
+}
+
+uint32_t rs_endian_uint24(uint32_t in)
+{
+    return _rs_endian_inline_uint24(in);
+}
+
+uint32_t rs_endian_uint32(uint32_t in)
+{
+    return _rs_endian_inline_uint32(in);
+}
+
+int32_t rs_endian_int32(int32_t in)
+{
+    return (int32_t)_rs_endian_inline_uint32(in);
+}
 
-static int endianness = UNKNOWN_ENDIAN;
+uint64_t rs_endian_uint64(uint64_t in)
+{
+    return _rs_endian_inline_uint64(in);
+}
+
+int64_t rs_endian_int64(int64_t in)
+{
+    return (int64_t)_rs_endian_inline_uint64(in);
+}
+
+float rs_endian_float(float in)
+{
+    return _rs_endian_inline_float(in);
+}
+
+double rs_endian_double(double in)
+{
+    return _rs_endian_inline_double(in);
+}
+
+#else /* byte order unknown at compile time */
+
+#define RS_UNKNOWN_ENDIAN 0
+#define RS_BIG_ENDIAN 1
+#define RS_LITTLE_ENDIAN 2
+
+static int endianness = RS_UNKNOWN_ENDIAN;
 
 static inline void rs_endian_init(void)
 {
-    if (endianness == UNKNOWN_ENDIAN)
+    if (endianness == RS_UNKNOWN_ENDIAN)
     {
         /* figure out what our endianness is! */
         short word = 0x0001;
         char* byte = (char*)(&word);
-        endianness = byte[0] ? LITTLE_ENDIAN : BIG_ENDIAN;
+        endianness = byte[0] ? RS_LITTLE_ENDIAN : RS_BIG_ENDIAN;
     }
 }
 
 uint16_t rs_endian_uint16(uint16_t in)
 {
     rs_endian_init();
-    return (endianness == LITTLE_ENDIAN) ? ((in >> 8) | (in << 8)) : in;
+    return (endianness == RS_LITTLE_ENDIAN) ? ((in >> 8) | (in << 8)) : in;
 }
 
 int16_t rs_endian_int16(int16_t in)
@@ -37,13 +110,13 @@ int16_t rs_endian_int16(int16_t in)
 uint32_t rs_endian_uint24(uint32_t in)
 {
     rs_endian_init();
-    return (endianness == LITTLE_ENDIAN) ? (rs_endian_uint32(in) >> 8) : in;
+    return (endianness == RS_LITTLE_ENDIAN) ? (rs_endian_uint32(in) >> 8) : in;
 }
 
 uint32_t rs_endian_uint32(uint32_t in)
 {
     rs_endian_init();
-    return (endianness == LITTLE_ENDIAN) ? (((in & 0x000000FF) << 24) + ((in & 0x0000FF00) << 8) + ((in & 0x00FF0000) >> 8) + ((in & 0xFF000000) >> 24)) : in;
+    return (endianness == RS_LITTLE_ENDIAN) ? (((in & 0x000000FF) << 24) + ((in & 0x0000FF00) << 8) + ((in & 0x00FF0000) >> 8) + ((in & 0xFF000000) >> 24)) : in;
 }
 
 int32_t rs_endian_int32(int32_t in)
@@ -56,7 +129,7 @@ uint64_t rs_endian_uint64(uint64_t in)
 {
     rs_endian_init();
     
-    if (endianness == LITTLE_ENDIAN)
+    if (endianness == RS_LITTLE_ENDIAN)
     {
         uint64_t ret = 0;
         ret += (in & 0x00000000000000FF) << 56;
@@ -94,3 +167,229 @@ double rs_endian_double(double in)
     tmp_p = (void*)(&tmp);
     return ((double*)tmp_p)[0];
 }
+
+#endif /* RS_ENDIAN_BIG_HOST || RS_ENDIAN_LITTLE_HOST */
+
+/*
+ * bulk converters
+ */
+
+/* each kernel converts as many whole vectors as it can, and returns
+ * how many values that was -- the rest are done one at a time
+ */
+typedef size_t (*RSEndianKernel)(uint8_t* dest, const uint8_t* src, size_t count);
+
+/* plain C, used for the tails, and everywhere without SIMD */
+static void _rs_endian_convert_u16_scalar(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        uint16_t tmp;
+        memcpy(&tmp, src + i * 2, 2);
+        tmp = rs_endian_uint16(tmp);
+        memcpy(dest + i * 2, &tmp, 2);
+    }
+}
+
+static void _rs_endian_convert_u32_scalar(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        uint32_t tmp;
+        memcpy(&tmp, src + i * 4, 4);
+        tmp = rs_endian_uint32(tmp);
+        memcpy(dest + i * 4, &tmp, 4);
+    }
+}
+
+static void _rs_endian_convert_u64_scalar(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        uint64_t tmp;
+        memcpy(&tmp, src + i * 8, 8);
+        tmp = rs_endian_uint64(tmp);
+        memcpy(dest + i * 8, &tmp, 8);
+    }
+}
+
+#if defined(RS_ENDIAN_SSE2) && defined(RS_ENDIAN_LITTLE_HOST)
+
+/* SSE2 has no byte shuffle, so swap bytes within 16-bit words with
+ * shifts, after putting the words in order with word shuffles
+ */
+
+static inline __m128i _rs_endian_sse2_swap16(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static size_t _rs_endian_convert_u16_sse2(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i;
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        _mm_storeu_si128((__m128i*)(dest + i * 2), _rs_endian_sse2_swap16(v));
+    }
+    return i;
+}
+
+static size_t _rs_endian_convert_u32_sse2(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i;
+    for (i = 0; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i*)(dest + i * 4), _rs_endian_sse2_swap16(v));
+    }
+    return i;
+}
+
+static size_t _rs_endian_convert_u64_sse2(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i;
+    for (i = 0; i + 2 <= count; i += 2)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 8));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        _mm_storeu_si128((__m128i*)(dest + i * 8), _rs_endian_sse2_swap16(v));
+    }
+    return i;
+}
+
+#endif /* RS_ENDIAN_SSE2 */
+
+#if defined(RS_ENDIAN_AVX2) && defined(RS_ENDIAN_LITTLE_HOST)
+
+/* these are only called if the CPU turns out to have AVX2 */
+#define RS_ENDIAN_AVX2_KERNEL(name, width, shuffle)                     \
+    __attribute__((target("avx2")))                                     \
+    static size_t name(uint8_t* dest, const uint8_t* src, size_t count) \
+    {                                                                   \
+        const __m256i mask = shuffle;                                   \
+        size_t i;                                                       \
+        for (i = 0; i + 32 / width <= count; i += 32 / width)           \
+        {                                                               \
+            __m256i v = _mm256_loadu_si256((const __m256i*)(src + i * width)); \
+            _mm256_storeu_si256((__m256i*)(dest + i * width), _mm256_shuffle_epi8(v, mask)); \
+        }                                                               \
+        return i;                                                       \
+    }
+
+RS_ENDIAN_AVX2_KERNEL(_rs_endian_convert_u16_avx2, 2,
+                      _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                       1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14))
+RS_ENDIAN_AVX2_KERNEL(_rs_endian_convert_u32_avx2, 4,
+                      _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                       3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12))
+RS_ENDIAN_AVX2_KERNEL(_rs_endian_convert_u64_avx2, 8,
+                      _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                       7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8))
+
+#endif /* RS_ENDIAN_AVX2 */
+
+#if defined(RS_ENDIAN_NEON) && defined(RS_ENDIAN_LITTLE_HOST)
+
+static size_t _rs_endian_convert_u16_neon(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i;
+    for (i = 0; i + 8 <= count; i += 8)
+        vst1q_u8(dest + i * 2, vrev16q_u8(vld1q_u8(src + i * 2)));
+    return i;
+}
+
+static size_t _rs_endian_convert_u32_neon(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i;
+    for (i = 0; i + 4 <= count; i += 4)
+        vst1q_u8(dest + i * 4, vrev32q_u8(vld1q_u8(src + i * 4)));
+    return i;
+}
+
+static size_t _rs_endian_convert_u64_neon(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i;
+    for (i = 0; i + 2 <= count; i += 2)
+        vst1q_u8(dest + i * 8, vrev64q_u8(vld1q_u8(src + i * 8)));
+    return i;
+}
+
+#endif /* RS_ENDIAN_NEON */
+
+/* the best kernels this CPU can run, picked the first time they're needed */
+static RSEndianKernel endian_kernels[3] = {NULL, NULL, NULL};
+static bool endian_kernels_chosen = false;
+
+static void _rs_endian_choose_kernels(void)
+{
+    RSEndianKernel kernels[3] = {NULL, NULL, NULL};
+    
+#if defined(RS_ENDIAN_NEON) && defined(RS_ENDIAN_LITTLE_HOST)
+    kernels[0] = _rs_endian_convert_u16_neon;
+    kernels[1] = _rs_endian_convert_u32_neon;
+    kernels[2] = _rs_endian_convert_u64_neon;
+#endif
+    
+#if defined(RS_ENDIAN_SSE2) && defined(RS_ENDIAN_LITTLE_HOST)
+    kernels[0] = _rs_endian_convert_u16_sse2;
+    kernels[1] = _rs_endian_convert_u32_sse2;
+    kernels[2] = _rs_endian_convert_u64_sse2;
+#endif
+    
+#if defined(RS_ENDIAN_AVX2) && defined(RS_ENDIAN_LITTLE_HOST)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels[0] = _rs_endian_convert_u16_avx2;
+        kernels[1] = _rs_endian_convert_u32_avx2;
+        kernels[2] = _rs_endian_convert_u64_avx2;
+    }
+#endif
+    
+    /* every thread that gets here picks the same ones */
+    unsigned int i;
+    for (i = 0; i < 3; i++)
+        __atomic_store_n(&(endian_kernels[i]), kernels[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&endian_kernels_chosen, true, __ATOMIC_RELEASE);
+}
+
+static inline RSEndianKernel _rs_endian_get_kernel(unsigned int which)
+{
+    if (!__atomic_load_n(&endian_kernels_chosen, __ATOMIC_ACQUIRE))
+        _rs_endian_choose_kernels();
+    return __atomic_load_n(&(endian_kernels[which]), __ATOMIC_RELAXED);
+}
+
+void rs_endian_convert_u16_array(void* dest, const void* src, size_t count)
+{
+    size_t done = 0;
+    RSEndianKernel kernel = _rs_endian_get_kernel(0);
+    if (kernel)
+        done = kernel(dest, src, count);
+    _rs_endian_convert_u16_scalar((uint8_t*)dest + done * 2, (const uint8_t*)src + done * 2, count - done);
+}
+
+void rs_endian_convert_u32_array(void* dest, const void* src, size_t count)
+{
+    size_t done = 0;
+    RSEndianKernel kernel = _rs_endian_get_kernel(1);
+    if (kernel)
+        done = kernel(dest, src, count);
+    _rs_endian_convert_u32_scalar((uint8_t*)dest + done * 4, (const uint8_t*)src + done * 4, count - done);
+}
+
+void rs_endian_convert_u64_array(void* dest, const void* src, size_t count)
+{
+    size_t done = 0;
+    RSEndianKernel kernel = _rs_endian_get_kernel(2);
+    if (kernel)
+        done = kernel(dest, src, count);
+    _rs_endian_convert_u64_scalar((uint8_t*)dest + done * 8, (const uint8_t*)src + done * 8, count - done);
+}
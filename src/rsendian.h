@@ -7,6 +7,8 @@
 #define __RS_ENDIAN_H_INCLUDED__
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 
 /* basic big endian converters */
 
@@ -24,4 +26,94 @@ int64_t rs_endian_int64(int64_t in);
 float rs_endian_float(float in);
 double rs_endian_double(double in);
 
+/* bulk converters -- convert count big endian values at src into
+ * native endian values at dest, or the other way around. Neither
+ * needs to be aligned, and dest may be the same as src (but must not
+ * overlap it otherwise). These use SIMD instructions when the CPU has
+ * them, so they are much faster than a loop over the functions above.
+ */
+
+void rs_endian_convert_u16_array(void* dest, const void* src, size_t count);
+void rs_endian_convert_u32_array(void* dest, const void* src, size_t count);
+void rs_endian_convert_u64_array(void* dest, const void* src, size_t count);
+
+/* when the compiler knows the byte order, the converters above are
+ * replaced with inline versions, which are a single instruction (or
+ * nothing at all) instead of a function call
+ */
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define RS_ENDIAN_BIG_HOST
+#elif defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define RS_ENDIAN_LITTLE_HOST
+#endif
+
+#if defined(RS_ENDIAN_BIG_HOST) || defined(RS_ENDIAN_LITTLE_HOST)
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+#define _rs_endian_swap16(in) __builtin_bswap16(in)
+#define _rs_endian_swap32(in) __builtin_bswap32(in)
+#define _rs_endian_swap64(in) __builtin_bswap64(in)
+#else
+static inline uint16_t _rs_endian_swap16(uint16_t in)
+{
+    return (uint16_t)((in >> 8) | (in << 8));
+}
+
+static inline uint32_t _rs_endian_swap32(uint32_t in)
+{
+    return ((in & 0x000000FF) << 24) | ((in & 0x0000FF00) << 8) | ((in & 0x00FF0000) >> 8) | ((in & 0xFF000000) >> 24);
+}
+
+static inline uint64_t _rs_endian_swap64(uint64_t in)
+{
+    return ((uint64_t)_rs_endian_swap32((uint32_t)in) << 32) | _rs_endian_swap32((uint32_t)(in >> 32));
+}
+#endif
+
+#ifdef RS_ENDIAN_BIG_HOST
+#define _rs_endian_inline_uint16(in) ((uint16_t)(in))
+#define _rs_endian_inline_uint24(in) ((uint32_t)(in))
+#define _rs_endian_inline_uint32(in) ((uint32_t)(in))
+#define _rs_endian_inline_uint64(in) ((uint64_t)(in))
+#else
+#define _rs_endian_inline_uint16(in) _rs_endian_swap16((uint16_t)(in))
+#define _rs_endian_inline_uint24(in) (_rs_endian_swap32((uint32_t)(in)) >> 8)
+#define _rs_endian_inline_uint32(in) _rs_endian_swap32((uint32_t)(in))
+#define _rs_endian_inline_uint64(in) _rs_endian_swap64((uint64_t)(in))
+#endif
+
+static inline float _rs_endian_inline_float(float in)
+{
+    uint32_t tmp;
+    memcpy(&tmp, &in, sizeof(tmp));
+    tmp = _rs_endian_inline_uint32(tmp);
+    memcpy(&in, &tmp, sizeof(tmp));
+    return in;
+}
+
+static inline double _rs_endian_inline_double(double in)
+{
+    uint64_t tmp;
+    memcpy(&tmp, &in, sizeof(tmp));
+    tmp = _rs_endian_inline_uint64(tmp);
+    memcpy(&in, &tmp, sizeof(tmp));
+    return in;
+}
+
+/* rsendian.c defines this, so it can define the functions themselves */
+#ifndef RS_ENDIAN_NO_INLINE
+#define rs_endian_uint16(in) _rs_endian_inline_uint16(in)
+#define rs_endian_int16(in) ((int16_t)_rs_endian_inline_uint16(in))
+#define rs_endian_uint24(in) _rs_endian_inline_uint24(in)
+#define rs_endian_uint32(in) _rs_endian_inline_uint32(in)
+#define rs_endian_int32(in) ((int32_t)_rs_endian_inline_uint32(in))
+#define rs_endian_uint64(in) _rs_endian_inline_uint64(in)
+#define rs_endian_int64(in) ((int64_t)_rs_endian_inline_uint64(in))
+#define rs_endian_float(in) _rs_endian_inline_float(in)
+#define rs_endian_double(in) _rs_endian_inline_double(in)
+#endif /* RS_ENDIAN_NO_INLINE */
+
+#endif /* RS_ENDIAN_BIG_HOST || RS_ENDIAN_LITTLE_HOST */
+
 #endif /* __RS_ENDIAN_H_INCLUDED__ */
@@ -0,0 +1,355 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "slice.h"
+
+#include "memory.h"
+#include "error.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(HAVE_PTHREAD) && defined(HAVE_TLS)
+#define RS_SLICE_ENABLED
+#include <pthread.h>
+#endif
+
+#ifdef RS_SLICE_ENABLED
+
+/* slices come in 16 byte steps, up to 128 bytes */
+#define RS_SLICE_ALIGN 16
+#define RS_SLICE_CLASSES 8
+#define RS_SLICE_MAX (RS_SLICE_ALIGN * RS_SLICE_CLASSES)
+#define RS_SLICE_CLASS(size) (((size) + RS_SLICE_ALIGN - 1) / RS_SLICE_ALIGN - 1)
+#define RS_SLICE_CLASS_SIZE(class) (((class) + 1) * RS_SLICE_ALIGN)
+
+/* 64kb slabs */
+#define RS_SLICE_SLAB_SIZE (1024 * 64)
+
+/* how many slices move between a thread cache and the global lists
+ * at once -- threads hold at most twice this many per class
+ */
+#define RS_SLICE_BATCH 64
+
+/* free slices are linked through their first word */
+typedef struct _RSSliceLink RSSliceLink;
+struct _RSSliceLink
+{
+    RSSliceLink* next;
+};
+
+/* global state for one size class, protected by slice_lock */
+typedef struct
+{
+    RSSliceLink* free;
+    size_t free_count;
+
+    /* the unused part of the newest slab */
+    uint8_t* slab_head;
+    uint8_t* slab_end;
+
+    /* how many slices have been cut out of slabs */
+    size_t carved;
+} RSSliceClass;
+
+/* per-thread free lists -- counters are only written by the owning
+ * thread, but read by rs_slice_get_stats, hence the atomics
+ */
+typedef struct _RSSliceCache RSSliceCache;
+struct _RSSliceCache
+{
+    RSSliceLink* free[RS_SLICE_CLASSES];
+    size_t count[RS_SLICE_CLASSES];
+    size_t allocations;
+
+    /* registry of live caches */
+    RSSliceCache* next;
+};
+
+static pthread_mutex_t slice_lock = PTHREAD_MUTEX_INITIALIZER;
+static RSSliceClass slice_classes[RS_SLICE_CLASSES];
+static size_t slice_slab_bytes = 0;
+/* allocations made by threads that have exited */
+static size_t slice_retired_allocations = 0;
+static RSSliceCache* slice_caches = NULL;
+
+static pthread_once_t slice_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slice_key;
+static bool slice_always_malloc = false;
+static __thread RSSliceCache* slice_cache = NULL;
+
+/* a thread is exiting, so give its slices back */
+static void _rs_slice_cache_destroy(void* data)
+{
+    RSSliceCache* cache = data;
+    RSSliceCache** cachep;
+    unsigned int class;
+
+    pthread_mutex_lock(&slice_lock);
+    for (class = 0; class < RS_SLICE_CLASSES; class++)
+    {
+        while (cache->free[class])
+        {
+            RSSliceLink* link = cache->free[class];
+            cache->free[class] = link->next;
+            link->next = slice_classes[class].free;
+            slice_classes[class].free = link;
+            slice_classes[class].free_count++;
+        }
+    }
+
+    slice_retired_allocations += cache->allocations;
+    for (cachep = &slice_caches; *cachep != NULL; cachep = &((*cachep)->next))
+    {
+        if (*cachep == cache)
+        {
+            *cachep = cache->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&slice_lock);
+
+    if (slice_cache == cache)
+        slice_cache = NULL;
+    rs_memory_push(NULL);
+    rs_free(cache);
+    rs_memory_pop();
+}
+
+static void _rs_slice_init(void)
+{
+    const char* env = getenv("RS_SLICE");
+    if (env && strcmp(env, "always-malloc") == 0)
+        slice_always_malloc = true;
+
+    if (pthread_key_create(&slice_key, _rs_slice_cache_destroy) != 0)
+        slice_always_malloc = true;
+}
+
+/* whether to use slabs at all right now */
+static inline bool _rs_slice_enabled(size_t size)
+{
+    if (size > RS_SLICE_MAX)
+        return false;
+
+    pthread_once(&slice_once, _rs_slice_init);
+    return !slice_always_malloc && rs_get_memory_functions() == NULL;
+}
+
+static RSSliceCache* _rs_slice_get_cache(void)
+{
+    if (slice_cache)
+        return slice_cache;
+
+    rs_memory_push(NULL);
+    RSSliceCache* cache = rs_new0(RSSliceCache, 1);
+    rs_memory_pop();
+    pthread_setspecific(slice_key, cache);
+
+    pthread_mutex_lock(&slice_lock);
+    cache->next = slice_caches;
+    slice_caches = cache;
+    pthread_mutex_unlock(&slice_lock);
+
+    slice_cache = cache;
+    return cache;
+}
+
+/* fill an empty thread free list from the global one, or a slab */
+static void _rs_slice_refill(RSSliceCache* cache, unsigned int class)
+{
+    RSSliceClass* global = &(slice_classes[class]);
+    size_t size = RS_SLICE_CLASS_SIZE(class);
+    size_t count = 0;
+
+    pthread_mutex_lock(&slice_lock);
+
+    while (global->free && count < RS_SLICE_BATCH)
+    {
+        RSSliceLink* link = global->free;
+        global->free = link->next;
+        global->free_count--;
+
+        link->next = cache->free[class];
+        cache->free[class] = link;
+        count++;
+    }
+
+    if (count == 0)
+    {
+        if ((size_t)(global->slab_end - global->slab_head) < size)
+        {
+            rs_memory_push(NULL);
+            /* slabs aren't counted in the memory statistics, the
+             * slices carved out of them are */
+            global->slab_head = _rs_malloc_full(RS_SLICE_SLAB_SIZE, RS_MEMORY_SUBSYSTEMS);
+            rs_memory_pop();
+            global->slab_end = global->slab_head + RS_SLICE_SLAB_SIZE;
+            slice_slab_bytes += RS_SLICE_SLAB_SIZE;
+        }
+
+        while (count < RS_SLICE_BATCH && (size_t)(global->slab_end - global->slab_head) >= size)
+        {
+            RSSliceLink* link = (RSSliceLink*)(global->slab_head);
+            global->slab_head += size;
+            global->carved++;
+
+            link->next = cache->free[class];
+            cache->free[class] = link;
+            count++;
+        }
+    }
+
+    pthread_mutex_unlock(&slice_lock);
+
+    __atomic_store_n(&(cache->count[class]), cache->count[class] + count, __ATOMIC_RELAXED);
+}
+
+/* hand a batch of a thread's free slices back to the global list */
+static void _rs_slice_release(RSSliceCache* cache, unsigned int class)
+{
+    RSSliceClass* global = &(slice_classes[class]);
+    size_t count = 0;
+
+    pthread_mutex_lock(&slice_lock);
+    while (cache->free[class] && count < RS_SLICE_BATCH)
+    {
+        RSSliceLink* link = cache->free[class];
+        cache->free[class] = link->next;
+
+        link->next = global->free;
+        global->free = link;
+        global->free_count++;
+        count++;
+    }
+    pthread_mutex_unlock(&slice_lock);
+
+    __atomic_store_n(&(cache->count[class]), cache->count[class] - count, __ATOMIC_RELAXED);
+}
+
+void* _rs_slice_alloc_full(size_t size, RSMemorySubsystem subsystem)
+{
+    /* pushed memory functions get everything, so arenas work */
+    if (rs_memory_peek() || !_rs_slice_enabled(size))
+        return _rs_malloc_full(size, subsystem);
+
+    unsigned int class = (size == 0) ? 0 : RS_SLICE_CLASS(size);
+    RSSliceCache* cache = _rs_slice_get_cache();
+
+    if (!cache->free[class])
+        _rs_slice_refill(cache, class);
+    rs_assert(cache->free[class]);
+
+    RSSliceLink* link = cache->free[class];
+    cache->free[class] = link->next;
+    __atomic_store_n(&(cache->count[class]), cache->count[class] - 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&(cache->allocations), cache->allocations + 1, __ATOMIC_RELAXED);
+
+    if (_rs_memory_stats_enabled())
+        _rs_memory_count(subsystem, size);
+    return link;
+}
+
+void _rs_slice_free1_full(size_t size, void* ptr, RSMemorySubsystem subsystem)
+{
+    if (!ptr)
+        return;
+
+    if (_rs_memory_get_owner(ptr) || !_rs_slice_enabled(size))
+    {
+        rs_free(ptr);
+        return;
+    }
+
+    if (_rs_memory_stats_enabled())
+        _rs_memory_uncount(subsystem, size);
+
+    unsigned int class = (size == 0) ? 0 : RS_SLICE_CLASS(size);
+    RSSliceCache* cache = _rs_slice_get_cache();
+
+    RSSliceLink* link = ptr;
+    link->next = cache->free[class];
+    cache->free[class] = link;
+    __atomic_store_n(&(cache->count[class]), cache->count[class] + 1, __ATOMIC_RELAXED);
+
+    if (cache->count[class] > 2 * RS_SLICE_BATCH)
+        _rs_slice_release(cache, class);
+}
+
+void rs_slice_get_stats(RSSliceStats* stats)
+{
+    rs_return_if_fail(stats);
+
+    unsigned int class;
+    RSSliceCache* cache;
+
+    memset(stats, 0, sizeof(RSSliceStats));
+
+    pthread_mutex_lock(&slice_lock);
+    stats->slab_bytes = slice_slab_bytes;
+    stats->allocations = slice_retired_allocations;
+    for (class = 0; class < RS_SLICE_CLASSES; class++)
+    {
+        size_t free_count = slice_classes[class].free_count;
+        for (cache = slice_caches; cache != NULL; cache = cache->next)
+            free_count += __atomic_load_n(&(cache->count[class]), __ATOMIC_RELAXED);
+
+        /* other threads may be mid-update, so don't go negative */
+        size_t in_use = 0;
+        if (slice_classes[class].carved > free_count)
+            in_use = slice_classes[class].carved - free_count;
+
+        stats->cached += free_count;
+        stats->in_use += in_use;
+        stats->in_use_bytes += in_use * RS_SLICE_CLASS_SIZE(class);
+    }
+    for (cache = slice_caches; cache != NULL; cache = cache->next)
+        stats->allocations += __atomic_load_n(&(cache->allocations), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&slice_lock);
+}
+
+#else /* !RS_SLICE_ENABLED */
+
+/* no threads or thread-local storage, so just use rs_malloc */
+
+void* _rs_slice_alloc_full(size_t size, RSMemorySubsystem subsystem)
+{
+    return _rs_malloc_full(size, subsystem);
+}
+
+void _rs_slice_free1_full(size_t size, void* ptr, RSMemorySubsystem subsystem)
+{
+    rs_free(ptr);
+}
+
+void rs_slice_get_stats(RSSliceStats* stats)
+{
+    rs_return_if_fail(stats);
+    memset(stats, 0, sizeof(RSSliceStats));
+}
+
+#endif /* RS_SLICE_ENABLED */
+
+void* _rs_slice_alloc0_full(size_t size, RSMemorySubsystem subsystem)
+{
+    return memset(_rs_slice_alloc_full(size, subsystem), 0, size);
+}
+
+void* rs_slice_alloc(size_t size)
+{
+    return _rs_slice_alloc_full(size, RS_MEMORY_OTHER);
+}
+
+void* rs_slice_alloc0(size_t size)
+{
+    return _rs_slice_alloc0_full(size, RS_MEMORY_OTHER);
+}
+
+void rs_slice_free1(size_t size, void* ptr)
+{
+    _rs_slice_free1_full(size, ptr, RS_MEMORY_OTHER);
+}
@@ -0,0 +1,143 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_SLICE_H_INCLUDED__
+#define __RS_SLICE_H_INCLUDED__
+
+#include "memory.h"
+
+#include <stdlib.h>
+
+/**
+ * Slice allocator statistics.
+ *
+ * Filled in by rs_slice_get_stats(). The numbers are a snapshot, and
+ * may be slightly out of date if other threads are allocating at the
+ * same time.
+ *
+ * \sa rs_slice_get_stats
+ */
+typedef struct
+{
+    /** bytes requested from rs_malloc() for slabs */
+    size_t slab_bytes;
+    /** slices currently handed out */
+    size_t in_use;
+    /** bytes currently handed out, rounded up to the size class */
+    size_t in_use_bytes;
+    /** free slices waiting to be reused, in any thread */
+    size_t cached;
+    /** total number of slices ever handed out */
+    size_t allocations;
+} RSSliceStats;
+
+/**
+ * Allocate a small, fixed-size block of memory.
+ *
+ * Slices are carved out of large slabs, and freed slices are kept on
+ * per-thread free lists for reuse, so allocating many tiny objects
+ * (like list cells and tags) wastes no space on malloc bookkeeping
+ * and does not contend on the malloc lock.
+ *
+ * A slice must be freed with rs_slice_free1(), with the same size it
+ * was allocated with. Requests too large for a size class are passed
+ * through to rs_malloc(). If custom memory functions are installed
+ * with rs_set_memory_functions(), or the RS_SLICE environment
+ * variable is set to "always-malloc", every request is passed through
+ * instead. The same goes for requests made while functions are pushed
+ * with rs_memory_push(), so slices can come from an RSArena; those
+ * have to be freed while the same functions are still pushed.
+ *
+ * Slabs are kept around for reuse once allocated, and are not given
+ * back to the system.
+ *
+ * You should generally use rs_slice_new() instead.
+ *
+ * \param size the amount of memory to allocate
+ * \return the allocated memory
+ * \sa rs_slice_alloc0, rs_slice_free1, rs_slice_new
+ */
+void* rs_slice_alloc(size_t size);
+
+/**
+ * Allocate a zero-filled slice.
+ *
+ * This function is exactly like rs_slice_alloc(), but the slice it
+ * returns is already filled with zeros.
+ *
+ * You should generally use rs_slice_new0() instead.
+ *
+ * \param size the amount of memory to allocate
+ * \return the allocated memory, filled with zeros
+ * \sa rs_slice_alloc, rs_slice_free1, rs_slice_new0
+ */
+void* rs_slice_alloc0(size_t size);
+
+/**
+ * Free a slice.
+ *
+ * The size given must be the same size that was given to
+ * rs_slice_alloc(). This does nothing if the pointer is NULL.
+ *
+ * You should generally use rs_slice_free() instead.
+ *
+ * \param size the size the slice was allocated with
+ * \param ptr the slice to free
+ * \sa rs_slice_alloc, rs_slice_free
+ */
+void rs_slice_free1(size_t size, void* ptr);
+
+/**
+ * Get slice allocator statistics.
+ *
+ * \param stats where to write the statistics
+ * \sa RSSliceStats
+ */
+void rs_slice_get_stats(RSSliceStats* stats);
+
+/**
+ * Slice allocator for a single object.
+ *
+ * This uses rs_slice_alloc() to allocate a single object of the given
+ * type, and automatically casts it to the correct pointer type.
+ *
+ * \param type the type to allocate
+ * \return the allocated memory
+ * \sa rs_slice_new0, rs_slice_free
+ */
+#define rs_slice_new(type) ((type*)rs_slice_alloc(sizeof(type)))
+
+/**
+ * Slice allocator for a single object (zero-initialized).
+ *
+ * \param type the type to allocate
+ * \return the allocated memory (filled with zeros)
+ * \sa rs_slice_new, rs_slice_free
+ */
+#define rs_slice_new0(type) ((type*)rs_slice_alloc0(sizeof(type)))
+
+/**
+ * Free a single object allocated with rs_slice_new().
+ *
+ * \param type the type the object was allocated as
+ * \param mem the object to free
+ * \sa rs_slice_new
+ */
+#define rs_slice_free(type, mem) rs_slice_free1(sizeof(type), (mem))
+
+/* internal -- slice allocators that count against a given subsystem
+ * in the memory statistics, like _rs_malloc_full() in memory.h
+ */
+void* _rs_slice_alloc_full(size_t size, RSMemorySubsystem subsystem);
+void* _rs_slice_alloc0_full(size_t size, RSMemorySubsystem subsystem);
+void _rs_slice_free1_full(size_t size, void* ptr, RSMemorySubsystem subsystem);
+
+#ifdef RS_MEMORY_SUBSYSTEM
+#define rs_slice_alloc(size) _rs_slice_alloc_full((size), RS_MEMORY_SUBSYSTEM)
+#define rs_slice_alloc0(size) _rs_slice_alloc0_full((size), RS_MEMORY_SUBSYSTEM)
+#define rs_slice_free1(size, ptr) _rs_slice_free1_full((size), (ptr), RS_MEMORY_SUBSYSTEM)
+#endif
+
+#endif /* __RS_SLICE_H_INCLUDED__ */
@@ -3,24 +3,54 @@
  * See redstone.h for details.
  */
 
+#define RS_MEMORY_SUBSYSTEM RS_MEMORY_TAG
+
 #include "tag.h"
 
 #include "error.h"
 #include "memory.h"
-#include "list.h"
+#include "slice.h"
+#include "array.h"
+
+#include <stddef.h>
 
-/* used in the compound tag RSList */
+/* one entry in a compound tag */
 typedef struct
 {
     char* key;
     RSTag* value;
+    /* hash of key, for the index, rs_tag_hash and rs_tag_equal */
+    uint64_t key_hash;
 } RSTagCompoundNode;
 
+/* compounds with more entries than this get an index */
+#define RS_TAG_COMPOUND_INDEX_MIN 8
+
+/* shared or borrowed storage for array payloads -- the refcount is
+ * atomic, since copies of one tree may end up in different threads
+ */
+typedef struct
+{
+    uint32_t refcount;
+    void* data;
+    
+    /* set for memory from rs_tag_borrow_*_array, which we don't own */
+    bool borrowed;
+    RSTagReleaseFunction release;
+    void* user_data;
+} RSTagBuffer;
+
 struct _RSTag
 {
     uint32_t refcount;
-    RSTagType type;
+    /* an RSTagType */
+    uint8_t type;
+    /* set if a list or compound hash may cover this tag */
+    bool hashed;
     
+    /* only as much of this as the type uses is allocated (see
+     * _rs_tag_size), so numbers don't pay for a hash cache
+     */
     union
     {
         int8_t int_byte;
@@ -33,30 +63,104 @@ struct _RSTag
         
         struct
         {
-            uint32_t size;
-            uint8_t* data;
-        } byte_array;
-        struct
-        {
-            uint32_t size;
-            uint32_t* data;
-        } int_array;
-        char* string;
-        struct
-        {
-            RSTagType type;
-            RSList* items;
-        } list;
-        RSList* compound;
+            /* cached rs_tag_hash, or 0 -- for lists and compounds,
+             * only good while hash_epoch is the current epoch (see
+             * _rs_tag_changed). These are written by readers, so they
+             * are accessed atomically
+             */
+            uint64_t hash;
+            uint32_t hash_epoch;
+            
+            union
+            {
+                struct
+                {
+                    uint32_t size;
+                    uint8_t* data;
+                    /* NULL unless the data is shared with a copy, or borrowed */
+                    RSTagBuffer* buffer;
+                } byte_array;
+                struct
+                {
+                    uint32_t size;
+                    uint32_t* data;
+                    RSTagBuffer* buffer;
+                } int_array;
+                char* string;
+                struct
+                {
+                    RSTagType type;
+                    uint32_t size;
+                    /* lists of numbers keep them here, packed at their own
+                     * width, until something asks for a tag
+                     */
+                    void* values;
+                    /* NULL-terminated element tags -- once a list of numbers
+                     * has these, they are what counts, and values is only
+                     * kept until the next change for readers racing to make
+                     * them (see _rs_tag_list_get_tags)
+                     */
+                    RSTag** tags;
+                } list;
+                struct
+                {
+                    /* the entries in order, and then one with a NULL
+                     * key, so an iterator can be just a node pointer.
+                     * NULL until something is added
+                     */
+                    RSArray* nodes;
+                    /* for big compounds, an open-addressed table of
+                     * node index + 1 (0 is empty), by key hash
+                     */
+                    uint32_t* index;
+                    uint32_t index_mask;
+                } compound;
+            };
+        };
     };
 };
 
+/* bumped whenever a tag that some list or compound hash covers is
+ * changed, since the containers can't be found from there
+ */
+static uint32_t rs_tag_hash_epoch = 1;
+
+/* whether tags of this type are plain numbers */
+static inline bool _rs_tag_is_number(RSTagType type)
+{
+    return type >= RS_TAG_BYTE && type <= RS_TAG_DOUBLE;
+}
+
+/* how many bytes of an RSTag this type uses */
+static inline size_t _rs_tag_size(RSTagType type)
+{
+    if (_rs_tag_is_number(type))
+        return offsetof(RSTag, int_long) + sizeof(int64_t);
+    if (type == RS_TAG_STRING)
+        return offsetof(RSTag, string) + sizeof(char*);
+    return sizeof(RSTag);
+}
+
+/* drops the cached hashes of anything covering a tag -- every change
+ * to a tag goes through here
+ */
+static inline void _rs_tag_changed(RSTag* self)
+{
+    if (!_rs_tag_is_number(self->type))
+        __atomic_store_n(&(self->hash), 0, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&(self->hashed), __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&(self->hashed), false, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&rs_tag_hash_epoch, 1, __ATOMIC_RELAXED);
+    }
+}
+
 RSTag* rs_tag_new0(RSTagType type)
 {
     rs_return_val_if_fail(type != RS_TAG_END, NULL);
     rs_return_val_if_fail(type < RS_INVALID_TAG, NULL);
     
-    RSTag* self = rs_new0(RSTag, 1);
+    RSTag* self = rs_slice_alloc0(_rs_tag_size(type));
     self->refcount = 0; /* floating reference */
     self->type = type;
     return self;
@@ -68,6 +172,417 @@ RSTagType rs_tag_get_type(RSTag* self)
     return self->type;
 }
 
+/* drops this tag's hold on an array payload */
+static void _rs_tag_buffer_release(void* data, RSTagBuffer* buffer)
+{
+    if (!buffer)
+    {
+        rs_free(data);
+        return;
+    }
+    
+    rs_assert(buffer->data == data);
+    if (__atomic_sub_fetch(&(buffer->refcount), 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        if (!buffer->borrowed)
+            rs_free(buffer->data);
+        else if (buffer->release)
+            buffer->release(buffer->data, buffer->user_data);
+        rs_slice_free(RSTagBuffer, buffer);
+    }
+}
+
+/* marks an array payload as shared, and returns the shared buffer.
+ * Copying is a read as far as the original is concerned, so this may
+ * race with other copies of the same tag: the record is installed
+ * atomically, and whoever loses just throws theirs away
+ */
+static RSTagBuffer* _rs_tag_buffer_share(void* data, RSTagBuffer** bufferp)
+{
+    RSTagBuffer* buffer = __atomic_load_n(bufferp, __ATOMIC_ACQUIRE);
+    if (buffer == NULL)
+    {
+        RSTagBuffer* fresh = rs_slice_new0(RSTagBuffer);
+        fresh->refcount = 1;
+        fresh->data = data;
+        
+        if (__atomic_compare_exchange_n(bufferp, &buffer, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            buffer = fresh;
+        } else {
+            rs_slice_free(RSTagBuffer, fresh);
+        }
+    }
+    
+    __atomic_add_fetch(&(buffer->refcount), 1, __ATOMIC_RELAXED);
+    return buffer;
+}
+
+/* whether a copy made now may share this payload -- only if it came
+ * from the memory functions in use. Otherwise, a copy made in an arena
+ * would keep the original's data (and the record for it) alive past
+ * the arena's reset, or the other way around
+ */
+static inline bool _rs_tag_buffer_can_share(void* data)
+{
+    return _rs_memory_get_owner(data) == rs_memory_peek();
+}
+
+/* makes sure an array payload belongs to one tag only, so it can be
+ * written to -- returns the (possibly new) data pointer
+ */
+static void* _rs_tag_buffer_unshare(void* data, size_t size, RSTagBuffer** bufferp)
+{
+    RSTagBuffer* buffer = *bufferp;
+    if (!buffer)
+        return data;
+    
+    *bufferp = NULL;
+    if (__atomic_load_n(&(buffer->refcount), __ATOMIC_ACQUIRE) == 1 && !buffer->borrowed)
+    {
+        /* everyone else let go already, so just take it */
+        rs_slice_free(RSTagBuffer, buffer);
+        return data;
+    }
+    
+    void* copy = rs_memdup(data, size);
+    _rs_tag_buffer_release(data, buffer);
+    return copy;
+}
+
+/* swaps in a new array payload, letting go of the old one */
+static void _rs_tag_buffer_replace(void** datap, uint32_t* sizep, RSTagBuffer** bufferp, void* data, uint32_t size, RSTagBuffer* buffer)
+{
+    void* olddata = *datap;
+    RSTagBuffer* oldbuffer = *bufferp;
+    
+    /* being handed our own payload back (say, from
+     * rs_tag_get_byte_array) only changes the length -- whoever owns
+     * it already keeps on owning it
+     */
+    if (data && data == olddata)
+    {
+        if (buffer)
+            rs_slice_free(RSTagBuffer, buffer);
+        *sizep = size;
+        return;
+    }
+    
+    *datap = data;
+    *sizep = size;
+    *bufferp = buffer;
+    
+    _rs_tag_buffer_release(olddata, oldbuffer);
+}
+
+/* creates the buffer record for borrowed memory */
+static RSTagBuffer* _rs_tag_buffer_borrow(void* data, RSTagReleaseFunction release, void* user_data)
+{
+    RSTagBuffer* buffer = rs_slice_new0(RSTagBuffer);
+    buffer->refcount = 1;
+    buffer->data = data;
+    buffer->borrowed = true;
+    buffer->release = release;
+    buffer->user_data = user_data;
+    return buffer;
+}
+
+/* how many bytes a number of this type takes up, packed */
+static inline uint32_t _rs_tag_number_width(RSTagType type)
+{
+    switch (type)
+    {
+    case RS_TAG_BYTE:
+        return 1;
+    case RS_TAG_SHORT:
+        return 2;
+    case RS_TAG_INT:
+    case RS_TAG_FLOAT:
+        return 4;
+    case RS_TAG_LONG:
+    case RS_TAG_DOUBLE:
+        return 8;
+    default:
+        break;
+    };
+    return 0;
+}
+
+/* whether a list keeps its elements in values, rather than as tags --
+ * only for the list's writer, since readers may race to make tags
+ */
+static inline bool _rs_tag_list_is_packed(RSTag* self)
+{
+    return _rs_tag_is_number(self->list.type) && !self->list.tags;
+}
+
+/* how many elements a list of this size has room for */
+static uint32_t _rs_tag_list_capacity(uint32_t size)
+{
+    uint32_t capacity = 4;
+    if (size == 0)
+        return 0;
+    while (capacity < size)
+        capacity *= 2;
+    return capacity;
+}
+
+/* changes the length of a list -- new elements are NULL, or zero if
+ * packed
+ */
+static void _rs_tag_list_resize(RSTag* self, uint32_t size)
+{
+    uint32_t old_capacity = _rs_tag_list_capacity(self->list.size);
+    uint32_t capacity = _rs_tag_list_capacity(size);
+    uint32_t i;
+    
+    /* nobody is reading any more, so stale values can go */
+    if (self->list.tags && self->list.values)
+    {
+        rs_free(self->list.values);
+        self->list.values = NULL;
+    }
+    
+    if (_rs_tag_list_is_packed(self))
+    {
+        uint32_t width = _rs_tag_number_width(self->list.type);
+        if (capacity == 0)
+        {
+            if (self->list.values)
+                rs_free(self->list.values);
+            self->list.values = NULL;
+        } else {
+            if (capacity != old_capacity)
+                self->list.values = rs_realloc(self->list.values, capacity * width);
+            if (size > self->list.size)
+                memset((uint8_t*)(self->list.values) + self->list.size * width, 0, (size - self->list.size) * width);
+        }
+        self->list.size = size;
+        return;
+    }
+    
+    if (capacity == 0)
+    {
+        if (self->list.tags)
+            rs_free(self->list.tags);
+        self->list.tags = NULL;
+        self->list.size = 0;
+        return;
+    }
+    
+    if (capacity != old_capacity)
+        self->list.tags = rs_realloc(self->list.tags, (capacity + 1) * sizeof(RSTag*));
+    
+    i = (self->list.size < size) ? self->list.size : size;
+    for (; i <= size; i++)
+        self->list.tags[i] = NULL;
+    self->list.size = size;
+}
+
+/* drops every element of a list */
+static void _rs_tag_list_clear(RSTag* self)
+{
+    uint32_t i;
+    if (self->list.tags)
+    {
+        for (i = 0; i < self->list.size; i++)
+        {
+            if (self->list.tags[i])
+                rs_tag_unref(self->list.tags[i]);
+        }
+        rs_free(self->list.tags);
+        self->list.tags = NULL;
+    }
+    
+    if (self->list.values)
+        rs_free(self->list.values);
+    self->list.values = NULL;
+    self->list.size = 0;
+}
+
+/* the element tags of a list, made from its packed numbers if there
+ * aren't any yet. This is a read as far as the list is concerned, so
+ * it may race with other readers: the tags are installed atomically,
+ * and whoever loses throws theirs away. Returns NULL for empty lists.
+ */
+static RSTag** _rs_tag_list_get_tags(RSTag* self)
+{
+    RSTag** tags = __atomic_load_n(&(self->list.tags), __ATOMIC_ACQUIRE);
+    if (tags || self->list.size == 0)
+        return tags;
+    
+    uint32_t width = _rs_tag_number_width(self->list.type);
+    uint32_t capacity = _rs_tag_list_capacity(self->list.size);
+    uint32_t i;
+    
+    /* the tags live as long as the list, so make them where it was */
+    rs_memory_push(_rs_memory_get_owner(self));
+    
+    RSTag** fresh = rs_new0(RSTag*, capacity + 1);
+    for (i = 0; i < self->list.size; i++)
+    {
+        RSTag* tag = rs_tag_new0(self->list.type);
+        memcpy(&(tag->int_byte), (uint8_t*)(self->list.values) + i * width, width);
+        /* the list's hash may already cover this */
+        tag->hashed = true;
+        rs_tag_ref(tag);
+        fresh[i] = tag;
+    }
+    
+    if (__atomic_compare_exchange_n(&(self->list.tags), &tags, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        tags = fresh;
+    } else {
+        for (i = 0; i < self->list.size; i++)
+            rs_tag_unref(fresh[i]);
+        rs_free(fresh);
+    }
+    
+    rs_memory_pop();
+    return tags;
+}
+
+/* switches a list of numbers over to tags for good -- a tag that is
+ * inserted has to stay the tag in the list
+ */
+static void _rs_tag_list_unpack(RSTag* self)
+{
+    if (!_rs_tag_list_is_packed(self))
+        return;
+    
+    if (self->list.size > 0)
+        _rs_tag_list_get_tags(self);
+    else
+        self->list.tags = rs_new0(RSTag*, 1);
+}
+
+/* element i of a list, without making a tag for it -- a packed number
+ * is copied into scratch
+ */
+static RSTag* _rs_tag_list_peek(RSTag* self, uint32_t i, RSTag* scratch)
+{
+    RSTag** tags = __atomic_load_n(&(self->list.tags), __ATOMIC_ACQUIRE);
+    if (tags)
+        return tags[i];
+    
+    uint32_t width = _rs_tag_number_width(self->list.type);
+    memset(scratch, 0, sizeof(RSTag));
+    scratch->type = self->list.type;
+    memcpy(&(scratch->int_byte), (uint8_t*)(self->list.values) + i * width, width);
+    return scratch;
+}
+
+RSTag* rs_tag_copy(RSTag* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    /* the copy starts without any cached hashes -- nothing covers it
+     * yet, and its numbers are new, so a cache carried over wouldn't
+     * be dropped when they change
+     */
+    RSTag* copy = rs_tag_new0(self->type);
+    RSTagCompoundNode* nodes;
+    RSTag** tags;
+    uint32_t i, width;
+    
+    switch (self->type)
+    {
+    case RS_TAG_BYTE:
+        copy->int_byte = self->int_byte;
+        break;
+    case RS_TAG_SHORT:
+        copy->int_short = self->int_short;
+        break;
+    case RS_TAG_INT:
+        copy->int_int = self->int_int;
+        break;
+    case RS_TAG_LONG:
+        copy->int_long = self->int_long;
+        break;
+    case RS_TAG_FLOAT:
+        copy->float_float = self->float_float;
+        break;
+    case RS_TAG_DOUBLE:
+        copy->float_double = self->float_double;
+        break;
+    case RS_TAG_BYTE_ARRAY:
+        copy->byte_array.size = self->byte_array.size;
+        copy->byte_array.data = self->byte_array.data;
+        if (!self->byte_array.data)
+            break;
+        if (_rs_tag_buffer_can_share(self->byte_array.data))
+        {
+            copy->byte_array.buffer = _rs_tag_buffer_share(self->byte_array.data, &(self->byte_array.buffer));
+        } else {
+            copy->byte_array.data = rs_memdup(self->byte_array.data, self->byte_array.size);
+        }
+        break;
+    case RS_TAG_INT_ARRAY:
+        copy->int_array.size = self->int_array.size;
+        copy->int_array.data = self->int_array.data;
+        if (!self->int_array.data)
+            break;
+        if (_rs_tag_buffer_can_share(self->int_array.data))
+        {
+            copy->int_array.buffer = _rs_tag_buffer_share(self->int_array.data, &(self->int_array.buffer));
+        } else {
+            copy->int_array.data = rs_memdup(self->int_array.data, self->int_array.size * sizeof(uint32_t));
+        }
+        break;
+    case RS_TAG_STRING:
+        copy->string = rs_strdup(self->string);
+        break;
+    case RS_TAG_LIST:
+        copy->list.type = self->list.type;
+        _rs_tag_list_resize(copy, self->list.size);
+        if (_rs_tag_is_number(self->list.type))
+        {
+            /* the copy is packed, whether or not the original is */
+            width = _rs_tag_number_width(self->list.type);
+            tags = __atomic_load_n(&(self->list.tags), __ATOMIC_ACQUIRE);
+            if (!tags && self->list.size > 0)
+                memcpy(copy->list.values, self->list.values, self->list.size * width);
+            for (i = 0; tags && i < self->list.size; i++)
+                memcpy((uint8_t*)(copy->list.values) + i * width, &(tags[i]->int_byte), width);
+            break;
+        }
+        
+        for (i = 0; i < self->list.size; i++)
+        {
+            copy->list.tags[i] = rs_tag_copy(self->list.tags[i]);
+            rs_tag_ref(copy->list.tags[i]);
+        }
+        break;
+    case RS_TAG_COMPOUND:
+        if (!self->compound.nodes)
+            break;
+        
+        /* same entries in the same places, so the index carries over */
+        copy->compound.nodes = rs_array_sized_new(sizeof(RSTagCompoundNode), self->compound.nodes->length);
+        rs_array_set_length(copy->compound.nodes, self->compound.nodes->length);
+        nodes = copy->compound.nodes->data;
+        for (i = 0; i + 1 < self->compound.nodes->length; i++)
+        {
+            RSTagCompoundNode* node = &rs_array_index(self->compound.nodes, RSTagCompoundNode, i);
+            nodes[i].key = rs_strdup(node->key);
+            nodes[i].key_hash = node->key_hash;
+            nodes[i].value = rs_tag_copy(node->value);
+            rs_tag_ref(nodes[i].value);
+        }
+        if (self->compound.index)
+        {
+            copy->compound.index = rs_memdup(self->compound.index, (self->compound.index_mask + 1) * sizeof(uint32_t));
+            copy->compound.index_mask = self->compound.index_mask;
+        }
+        break;
+    default:
+        rs_tag_unref(copy);
+        rs_return_val_if_reached(NULL);
+    };
+    
+    return copy;
+}
+
 RSTag* rs_tag_new(RSTagType type, ...)
 {
     va_list ap;
@@ -150,45 +665,46 @@ static void _rs_tag_free(RSTag* self)
     rs_return_if_fail(self);
     rs_return_if_fail(self->refcount == 0);
     
-    RSList* cell;
+    uint32_t i;
     
     switch (self->type)
     {
     case RS_TAG_BYTE_ARRAY:
-        rs_free(self->byte_array.data);
+        _rs_tag_buffer_release(self->byte_array.data, self->byte_array.buffer);
         break;
     case RS_TAG_INT_ARRAY:
-        rs_free(self->int_array.data);
+        _rs_tag_buffer_release(self->int_array.data, self->int_array.buffer);
         break;
     case RS_TAG_STRING:
         rs_free(self->string);
         break;
     case RS_TAG_LIST:
-        rs_list_foreach(self->list.items, (RSListFunction)rs_tag_unref);
-        rs_list_free(self->list.items);
+        _rs_tag_list_clear(self);
         break;
     case RS_TAG_COMPOUND:
-        cell = self->compound;
-        for (; cell != NULL; cell = cell->next)
+        if (!self->compound.nodes)
+            break;
+        
+        for (i = 0; i + 1 < self->compound.nodes->length; i++)
         {
-            RSTagCompoundNode* node = (RSTagCompoundNode*)(cell->data);
-            rs_assert(node);
+            RSTagCompoundNode* node = &rs_array_index(self->compound.nodes, RSTagCompoundNode, i);
             rs_assert(node->key);
             rs_assert(node->value);
             
             rs_free(node->key);
             rs_tag_unref(node->value);
-            rs_free(node);
         }
         
-        rs_list_free(self->compound);
+        rs_array_free(self->compound.nodes);
+        if (self->compound.index)
+            rs_free(self->compound.index);
         break;
     default:
         /* if it's not listed, we'll assume it needs no special handling */
         break;
     };
     
-    rs_free(self);
+    rs_slice_free1(_rs_tag_size(self->type), self);
 }
 
 void rs_tag_ref(RSTag* self)
@@ -200,22 +716,20 @@ void rs_tag_ref(RSTag* self)
 void rs_tag_unref(RSTag* self)
 {
     rs_return_if_fail(self);
-
+    
     if (self->refcount > 0)
         self->refcount--;
     if (self->refcount == 0)
         _rs_tag_free(self);
 }
 
-RSTag* rs_tag_find(RSTag* self, const char* name)
+static RSTag* _rs_tag_find(RSTag* self, const char* name)
 {
-    rs_return_val_if_fail(self && self->type != RS_TAG_END, NULL);
-    rs_return_val_if_fail(name, NULL);
-    
-    RSTag* subtag;
     RSTagIterator it;
+    RSTag* subtag;
+    uint32_t i;
     
-    switch (rs_tag_get_type(self))
+    switch (self->type)
     {
     case RS_TAG_END:
         rs_assert(false);
@@ -231,29 +745,33 @@ RSTag* rs_tag_find(RSTag* self, const char* name)
         /* leaf nodes, no children */
         return NULL;
     case RS_TAG_LIST:
-        /* search each element */
-        rs_tag_list_iterator_init(self, &it);
-        while (rs_tag_list_iterator_next(&it, &subtag))
+    case RS_TAG_COMPOUND:
+        /* first, check to see if it's in this compound */
+        if (self->type == RS_TAG_COMPOUND)
         {
-            RSTag* found = rs_tag_find(subtag, name);
-            if (found)
-                return found;
+            subtag = rs_tag_compound_get(self, name);
+            if (subtag)
+                return subtag;
         }
         
-        return NULL;
-    case RS_TAG_COMPOUND:
-        /* first, check to see if it's in this compound */
-        subtag = rs_tag_compound_get(self, name);
-        if (subtag)
-            return subtag;
-
         /* search each element */
-        rs_tag_compound_iterator_init(self, &it);
-        while (rs_tag_compound_iterator_next(&it, NULL, &subtag))
+        if (self->type == RS_TAG_COMPOUND)
         {
-            RSTag* found = rs_tag_find(subtag, name);
-            if (found)
-                return found;
+            rs_tag_compound_iterator_init(self, &it);
+            while (rs_tag_compound_iterator_next(&it, NULL, &subtag))
+            {
+                RSTag* found = _rs_tag_find(subtag, name);
+                if (found)
+                    return found;
+            }
+        } else if (!_rs_tag_is_number(self->list.type)) {
+            /* (numbers have nothing in them, so skip those lists) */
+            for (i = 0; i < self->list.size; i++)
+            {
+                RSTag* found = _rs_tag_find(self->list.tags[i], name);
+                if (found)
+                    return found;
+            }
         }
         
         return NULL;
@@ -263,6 +781,14 @@ RSTag* rs_tag_find(RSTag* self, const char* name)
     rs_return_val_if_reached(NULL);
 }
 
+RSTag* rs_tag_find(RSTag* self, const char* name)
+{
+    rs_return_val_if_fail(self && self->type != RS_TAG_END, NULL);
+    rs_return_val_if_fail(name, NULL);
+    
+    return _rs_tag_find(self, name);
+}
+
 void rs_tag_print(RSTag* self, FILE* dest)
 {
     rs_return_if_fail(self && self->type != RS_TAG_END);
@@ -271,8 +797,9 @@ void rs_tag_print(RSTag* self, FILE* dest)
     uint32_t length, i;
     RSTagIterator it;
     RSTag* subtag;
+    RSTag scratch;
     const char* subname;
-
+    
     switch (rs_tag_get_type(self))
     {
     case RS_TAG_END:
@@ -289,12 +816,12 @@ void rs_tag_print(RSTag* self, FILE* dest)
         break;
     case RS_TAG_BYTE_ARRAY:
         length = rs_tag_get_byte_array_length(self);
-        if (length != fwrite(rs_tag_get_byte_array(self), 1, length, dest))
+        if (length != fwrite(rs_tag_peek_byte_array(self), 1, length, dest))
             rs_critical("could not write entire byte array");
         break;
     case RS_TAG_INT_ARRAY:
         length = rs_tag_get_int_array_length(self);
-        if (length != fwrite(rs_tag_get_int_array(self), sizeof(uint32_t), length, dest))
+        if (length != fwrite(rs_tag_peek_int_array(self), sizeof(uint32_t), length, dest))
             rs_critical("could not write entire int array");
         break;
     case RS_TAG_STRING:
@@ -304,17 +831,15 @@ void rs_tag_print(RSTag* self, FILE* dest)
         length = rs_tag_list_get_length(self);        
         fprintf(dest, "[");
         
-        rs_tag_list_iterator_init(self, &it);
-        i = 0;
-        while (rs_tag_list_iterator_next(&it, &subtag))
+        for (i = 0; i < length; i++)
         {
-            i++;
+            subtag = _rs_tag_list_peek(self, i, &scratch);
             if (subtag->type == RS_TAG_STRING)
                 fprintf(dest, "\"");
             rs_tag_print(subtag, dest);
             if (subtag->type == RS_TAG_STRING)
                 fprintf(dest, "\"");
-            if (i != length)
+            if (i + 1 != length)
                 fprintf(dest, ", ");
         }
         
@@ -397,6 +922,8 @@ static void rs_tag_print_inner(FILE* dest, RSTag* tag, const char* name, unsigne
     RSTagIterator it;
     const char* subname;
     RSTag* subtag;
+    RSTag scratch;
+    uint32_t i;
     
     switch (rs_tag_get_type(tag))
     {
@@ -426,9 +953,9 @@ static void rs_tag_print_inner(FILE* dest, RSTag* tag, const char* name, unsigne
         rs_tag_print_indent(dest, indent);
         fprintf(dest, "{\n");
         
-        rs_tag_list_iterator_init(tag, &it);
-        while (rs_tag_list_iterator_next(&it, &subtag))
+        for (i = 0; i < tag->list.size; i++)
         {
+            subtag = _rs_tag_list_peek(tag, i, &scratch);
             rs_tag_print_inner(dest, subtag, NULL, indent + 1);
         }
         
@@ -462,32 +989,429 @@ void rs_tag_pretty_print(RSTag* self, FILE* dest)
     rs_tag_print_inner(dest, self, NULL, 0);
 }
 
-/* for integers */
-int64_t rs_tag_get_integer(RSTag* self)
+/* helpers for rs_tag_hash -- a murmur3-style mix, 8 bytes at a time */
+#define RS_TAG_HASH_K1 0x87c37b91114253d5ULL
+#define RS_TAG_HASH_K2 0x4cf5ad432745937fULL
+
+static inline uint64_t _rs_tag_hash_rotl(uint64_t x, int r)
 {
-    rs_return_val_if_fail(self, 0);
-    switch (self->type)
-    {
-    case RS_TAG_BYTE:
-        return self->int_byte;
-    case RS_TAG_SHORT:
-        return self->int_short;
-    case RS_TAG_INT:
-        return self->int_int;
-    case RS_TAG_LONG:
-        return self->int_long;
-    default:
-        /* fall through to error */
-        break;
-    };
-    
-    rs_critical("rs_tag_get_integer called on non-integer type");
-    return 0;
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t _rs_tag_hash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t _rs_tag_hash_combine(uint64_t h, uint64_t k)
+{
+    k *= RS_TAG_HASH_K1;
+    k = _rs_tag_hash_rotl(k, 31);
+    k *= RS_TAG_HASH_K2;
+    h ^= k;
+    return _rs_tag_hash_rotl(h, 27) * 5 + 0x52dce729;
+}
+
+static uint64_t _rs_tag_hash_bytes(const void* data, size_t len, uint64_t seed)
+{
+    const uint8_t* bytes = data;
+    uint64_t h = seed ^ (len * RS_TAG_HASH_K2);
+    uint64_t k;
+    
+    while (len >= 8)
+    {
+        memcpy(&k, bytes, 8);
+        h = _rs_tag_hash_combine(h, k);
+        bytes += 8;
+        len -= 8;
+    }
+    
+    if (len > 0)
+    {
+        k = 0;
+        memcpy(&k, bytes, len);
+        h = _rs_tag_hash_combine(h, k);
+    }
+    
+    return _rs_tag_hash_mix(h);
+}
+
+/* the cached hash of a tag, or 0 if there isn't one */
+static inline uint64_t _rs_tag_cached_hash(RSTag* self)
+{
+    if (_rs_tag_is_number(self->type))
+        return 0;
+    
+    uint64_t h = __atomic_load_n(&(self->hash), __ATOMIC_RELAXED);
+    if (h && (self->type == RS_TAG_LIST || self->type == RS_TAG_COMPOUND))
+    {
+        if (__atomic_load_n(&(self->hash_epoch), __ATOMIC_RELAXED) != __atomic_load_n(&rs_tag_hash_epoch, __ATOMIC_RELAXED))
+            return 0;
+    }
+    
+    return h;
+}
+
+/* the hash of a child, marking it as covered by its parent's */
+static inline uint64_t _rs_tag_hash_child(RSTag* child)
+{
+    if (!__atomic_load_n(&(child->hashed), __ATOMIC_RELAXED))
+        __atomic_store_n(&(child->hashed), true, __ATOMIC_RELAXED);
+    return rs_tag_hash(child);
+}
+
+/* hash of a compound key */
+static inline uint64_t _rs_tag_key_hash(const char* key)
+{
+    return _rs_tag_hash_bytes(key, strlen(key), 0);
+}
+
+/* the first node of a compound, or NULL if it never had any --
+ * the last one has a NULL key
+ */
+static inline RSTagCompoundNode* _rs_tag_compound_nodes(RSTag* self)
+{
+    return self->compound.nodes ? self->compound.nodes->data : NULL;
+}
+
+/* how many entries a compound has */
+static inline uint32_t _rs_tag_compound_length(RSTag* self)
+{
+    return self->compound.nodes ? self->compound.nodes->length - 1 : 0;
+}
+
+/* adds node i of a compound to its index */
+static inline void _rs_tag_compound_index_add(RSTag* self, uint32_t i)
+{
+    uint64_t key_hash = rs_array_index(self->compound.nodes, RSTagCompoundNode, i).key_hash;
+    uint32_t mask = self->compound.index_mask;
+    uint32_t slot;
+    
+    for (slot = key_hash & mask; self->compound.index[slot]; slot = (slot + 1) & mask)
+        ;
+    self->compound.index[slot] = i + 1;
+}
+
+/* rebuilds a compound's index from scratch, or drops it if the
+ * compound is small enough to search
+ */
+static void _rs_tag_compound_reindex(RSTag* self)
+{
+    uint32_t length = _rs_tag_compound_length(self);
+    uint32_t capacity = 16;
+    uint32_t i;
+    
+    if (self->compound.index)
+        rs_free(self->compound.index);
+    self->compound.index = NULL;
+    self->compound.index_mask = 0;
+    if (length <= RS_TAG_COMPOUND_INDEX_MIN)
+        return;
+    
+    /* at most half full, to keep probes short */
+    while (capacity < length * 2)
+        capacity *= 2;
+    self->compound.index = rs_new0(uint32_t, capacity);
+    self->compound.index_mask = capacity - 1;
+    for (i = 0; i < length; i++)
+        _rs_tag_compound_index_add(self, i);
+}
+
+/* finds the node for a key, given its hash */
+static RSTagCompoundNode* _rs_tag_compound_lookup(RSTag* self, const char* key, uint64_t key_hash)
+{
+    RSTagCompoundNode* nodes = _rs_tag_compound_nodes(self);
+    RSTagCompoundNode* node;
+    uint32_t mask = self->compound.index_mask;
+    uint32_t slot;
+    
+    if (!self->compound.index)
+    {
+        for (node = nodes; node && node->key; node++)
+        {
+            if (node->key_hash == key_hash && strcmp(node->key, key) == 0)
+                return node;
+        }
+        return NULL;
+    }
+    
+    for (slot = key_hash & mask; self->compound.index[slot]; slot = (slot + 1) & mask)
+    {
+        node = &(nodes[self->compound.index[slot] - 1]);
+        if (node->key_hash == key_hash && strcmp(node->key, key) == 0)
+            return node;
+    }
+    return NULL;
+}
+
+/* finds the node for a key -- small compounds are just searched, so
+ * the key is only hashed if there is an index
+ */
+static RSTagCompoundNode* _rs_tag_compound_find(RSTag* self, const char* key)
+{
+    RSTagCompoundNode* node;
+    
+    if (self->compound.index)
+        return _rs_tag_compound_lookup(self, key, _rs_tag_key_hash(key));
+    
+    for (node = _rs_tag_compound_nodes(self); node && node->key; node++)
+    {
+        if (strcmp(node->key, key) == 0)
+            return node;
+    }
+    return NULL;
+}
+
+/* adds an entry to the end of a compound, without checking whether
+ * the key is already there. Takes over key, and a reference to value
+ */
+static void _rs_tag_compound_append(RSTag* self, char* key, uint64_t key_hash, RSTag* value)
+{
+    RSTagCompoundNode node;
+    uint32_t length;
+    
+    if (!self->compound.nodes)
+    {
+        self->compound.nodes = rs_array_sized_new(sizeof(RSTagCompoundNode), 4);
+        rs_array_set_length(self->compound.nodes, 1);
+    }
+    
+    node.key = key;
+    node.value = value;
+    node.key_hash = key_hash;
+    rs_array_insert_vals(self->compound.nodes, self->compound.nodes->length - 1, &node, 1);
+    
+    length = _rs_tag_compound_length(self);
+    if (self->compound.index && length * 2 <= self->compound.index_mask + 1)
+        _rs_tag_compound_index_add(self, length - 1);
+    else if (length > RS_TAG_COMPOUND_INDEX_MIN)
+        _rs_tag_compound_reindex(self);
+}
+
+uint64_t rs_tag_hash(RSTag* self)
+{
+    rs_return_val_if_fail(self, 0);
+    
+    uint64_t h = self->type;
+    uint64_t sum;
+    uint32_t epoch;
+    RSTagCompoundNode* node;
+    RSTag scratch;
+    uint32_t i;
+    
+    switch (self->type)
+    {
+    case RS_TAG_BYTE:
+    case RS_TAG_SHORT:
+    case RS_TAG_INT:
+    case RS_TAG_LONG:
+        return _rs_tag_hash_mix(_rs_tag_hash_combine(h, rs_tag_get_integer(self)));
+    case RS_TAG_FLOAT:
+    case RS_TAG_DOUBLE:
+        /* floats are compared bit-for-bit, so hash them that way too */
+        if (self->type == RS_TAG_FLOAT)
+        {
+            uint32_t bits;
+            memcpy(&bits, &(self->float_float), sizeof(float));
+            sum = bits;
+        } else {
+            memcpy(&sum, &(self->float_double), sizeof(double));
+        }
+        return _rs_tag_hash_mix(_rs_tag_hash_combine(h, sum));
+    default:
+        break;
+    };
+    
+    /* everything else is worth caching */
+    sum = _rs_tag_cached_hash(self);
+    if (sum)
+        return sum;
+    
+    /* taken first, so a change made meanwhile can only make this
+     * stale, not wrong
+     */
+    epoch = __atomic_load_n(&rs_tag_hash_epoch, __ATOMIC_RELAXED);
+    
+    switch (self->type)
+    {
+    case RS_TAG_BYTE_ARRAY:
+        h = _rs_tag_hash_bytes(self->byte_array.data, self->byte_array.size, h);
+        break;
+    case RS_TAG_INT_ARRAY:
+        h = _rs_tag_hash_bytes(self->int_array.data, self->int_array.size * sizeof(uint32_t), h);
+        break;
+    case RS_TAG_STRING:
+        h = _rs_tag_hash_bytes(self->string, strlen(self->string), h);
+        break;
+    case RS_TAG_LIST:
+        /* order matters */
+        h = _rs_tag_hash_combine(h, self->list.type);
+        for (i = 0; i < self->list.size; i++)
+            h = _rs_tag_hash_combine(h, _rs_tag_hash_child(_rs_tag_list_peek(self, i, &scratch)));
+        h = _rs_tag_hash_mix(h);
+        break;
+    case RS_TAG_COMPOUND:
+        /* order doesn't matter, so sum up key/value pair hashes */
+        sum = 0;
+        for (node = _rs_tag_compound_nodes(self); node && node->key; node++)
+            sum += _rs_tag_hash_mix(_rs_tag_hash_combine(node->key_hash, _rs_tag_hash_child(node->value)));
+        h = _rs_tag_hash_mix(_rs_tag_hash_combine(h, sum));
+        break;
+    default:
+        rs_return_val_if_reached(0);
+    };
+    
+    /* 0 means no cached hash */
+    if (h == 0)
+        h = 1;
+    
+    __atomic_store_n(&(self->hash_epoch), epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&(self->hash), h, __ATOMIC_RELAXED);
+    return h;
+}
+
+/* inner part of rs_tag_equal, once the whole trees have been hashed */
+static bool _rs_tag_equal(RSTag* a, RSTag* b);
+
+/* helper for _rs_tag_equal -- matches up keys through b's index (or
+ * their hashes, if it's small), rather than comparing every key
+ */
+static bool _rs_tag_compound_equal(RSTag* a, RSTag* b)
+{
+    RSTagCompoundNode* node;
+    
+    if (_rs_tag_compound_length(a) != _rs_tag_compound_length(b))
+        return false;
+    
+    for (node = _rs_tag_compound_nodes(a); node && node->key; node++)
+    {
+        RSTagCompoundNode* other = _rs_tag_compound_lookup(b, node->key, node->key_hash);
+        if (!other || !_rs_tag_equal(node->value, other->value))
+            return false;
+    }
+    
+    return true;
+}
+
+static bool _rs_tag_equal(RSTag* a, RSTag* b)
+{
+    uint64_t ahash, bhash;
+    RSTag ascratch, bscratch;
+    uint32_t i;
+    
+    if (a == b)
+        return true;
+    if (a->type != b->type)
+        return false;
+    
+    /* cheap rejection, since hashes are cached all the way down */
+    ahash = _rs_tag_cached_hash(a);
+    bhash = _rs_tag_cached_hash(b);
+    if (ahash && bhash && ahash != bhash)
+        return false;
+    
+    switch (a->type)
+    {
+    case RS_TAG_BYTE:
+    case RS_TAG_SHORT:
+    case RS_TAG_INT:
+    case RS_TAG_LONG:
+        return rs_tag_get_integer(a) == rs_tag_get_integer(b);
+    case RS_TAG_FLOAT:
+        return memcmp(&(a->float_float), &(b->float_float), sizeof(float)) == 0;
+    case RS_TAG_DOUBLE:
+        return memcmp(&(a->float_double), &(b->float_double), sizeof(double)) == 0;
+    case RS_TAG_BYTE_ARRAY:
+        if (a->byte_array.size != b->byte_array.size)
+            return false;
+        if (a->byte_array.data == b->byte_array.data)
+            return true;
+        return memcmp(a->byte_array.data, b->byte_array.data, a->byte_array.size) == 0;
+    case RS_TAG_INT_ARRAY:
+        if (a->int_array.size != b->int_array.size)
+            return false;
+        if (a->int_array.data == b->int_array.data)
+            return true;
+        return memcmp(a->int_array.data, b->int_array.data, a->int_array.size * sizeof(uint32_t)) == 0;
+    case RS_TAG_STRING:
+        return strcmp(a->string, b->string) == 0;
+    case RS_TAG_LIST:
+        if (a->list.type != b->list.type || a->list.size != b->list.size)
+            return false;
+        if (a->list.size == 0)
+            return true;
+        
+        /* packed numbers are compared bit-for-bit, like number tags */
+        if (_rs_tag_is_number(a->list.type) &&
+            !__atomic_load_n(&(a->list.tags), __ATOMIC_ACQUIRE) &&
+            !__atomic_load_n(&(b->list.tags), __ATOMIC_ACQUIRE))
+            return memcmp(a->list.values, b->list.values, a->list.size * _rs_tag_number_width(a->list.type)) == 0;
+        
+        for (i = 0; i < a->list.size; i++)
+        {
+            if (!_rs_tag_equal(_rs_tag_list_peek(a, i, &ascratch), _rs_tag_list_peek(b, i, &bscratch)))
+                return false;
+        }
+        return true;
+    case RS_TAG_COMPOUND:
+        return _rs_tag_compound_equal(a, b);
+    default:
+        rs_return_val_if_reached(false);
+    };
+    
+    rs_return_val_if_reached(false);
+}
+
+bool rs_tag_equal(RSTag* a, RSTag* b)
+{
+    rs_return_val_if_fail(a && b, false);
+    
+    if (a == b)
+        return true;
+    if (a->type != b->type)
+        return false;
+    
+    /* this caches the hash of every tag in both trees, so most
+     * differences are found without going all the way down
+     */
+    if (rs_tag_hash(a) != rs_tag_hash(b))
+        return false;
+    
+    return _rs_tag_equal(a, b);
+}
+
+/* for integers */
+int64_t rs_tag_get_integer(RSTag* self)
+{
+    rs_return_val_if_fail(self, 0);
+    switch (self->type)
+    {
+    case RS_TAG_BYTE:
+        return self->int_byte;
+    case RS_TAG_SHORT:
+        return self->int_short;
+    case RS_TAG_INT:
+        return self->int_int;
+    case RS_TAG_LONG:
+        return self->int_long;
+    default:
+        /* fall through to error */
+        break;
+    };
+    
+    rs_critical("rs_tag_get_integer called on non-integer type");
+    return 0;
 }
 
 void rs_tag_set_integer(RSTag* self, int64_t val)
 {
     rs_return_if_fail(self);
+    _rs_tag_changed(self);
     switch (self->type)
     {
     case RS_TAG_BYTE:
@@ -526,6 +1450,7 @@ void rs_tag_set_float(RSTag* self, double val)
     rs_return_if_fail(self);
     rs_return_if_fail(self->type == RS_TAG_FLOAT || self->type == RS_TAG_DOUBLE);
     
+    _rs_tag_changed(self);
     if (self->type == RS_TAG_FLOAT)
     {
         self->float_float = val;
@@ -536,6 +1461,16 @@ void rs_tag_set_float(RSTag* self, double val)
 
 /* for byte arrays */
 uint8_t* rs_tag_get_byte_array(RSTag* self)
+{
+    rs_return_val_if_fail(self && self->type == RS_TAG_BYTE_ARRAY, NULL);
+    
+    /* the caller may write to this, so it can't be shared or trusted */
+    _rs_tag_changed(self);
+    self->byte_array.data = _rs_tag_buffer_unshare(self->byte_array.data, self->byte_array.size, &(self->byte_array.buffer));
+    return self->byte_array.data;
+}
+
+const uint8_t* rs_tag_peek_byte_array(RSTag* self)
 {
     rs_return_val_if_fail(self && self->type == RS_TAG_BYTE_ARRAY, NULL);
     return self->byte_array.data;
@@ -550,15 +1485,40 @@ uint32_t rs_tag_get_byte_array_length(RSTag* self)
 void rs_tag_set_byte_array(RSTag* self, uint32_t len, uint8_t* data)
 {
     rs_return_if_fail(self && self->type == RS_TAG_BYTE_ARRAY);
-    uint8_t* olddata = self->byte_array.data;
-    self->byte_array.data = rs_memdup(data, len);
-    self->byte_array.size = len;
-    if (olddata)
-        rs_free(olddata);
+    _rs_tag_changed(self);
+    _rs_tag_buffer_replace((void**)&(self->byte_array.data), &(self->byte_array.size), &(self->byte_array.buffer),
+                           rs_memdup(data, len), len, NULL);
+}
+
+void rs_tag_take_byte_array(RSTag* self, uint32_t len, uint8_t* data)
+{
+    rs_return_if_fail(self && self->type == RS_TAG_BYTE_ARRAY);
+    _rs_tag_changed(self);
+    _rs_tag_buffer_replace((void**)&(self->byte_array.data), &(self->byte_array.size), &(self->byte_array.buffer),
+                           data, len, NULL);
+}
+
+void rs_tag_borrow_byte_array(RSTag* self, uint32_t len, uint8_t* data, RSTagReleaseFunction release, void* user_data)
+{
+    rs_return_if_fail(self && self->type == RS_TAG_BYTE_ARRAY);
+    _rs_tag_changed(self);
+    rs_return_if_fail(data);
+    _rs_tag_buffer_replace((void**)&(self->byte_array.data), &(self->byte_array.size), &(self->byte_array.buffer),
+                           data, len, _rs_tag_buffer_borrow(data, release, user_data));
 }
 
 /* for int arrays */
 uint32_t* rs_tag_get_int_array(RSTag* self)
+{
+    rs_return_val_if_fail(self && self->type == RS_TAG_INT_ARRAY, NULL);
+    
+    /* the caller may write to this, so it can't be shared or trusted */
+    _rs_tag_changed(self);
+    self->int_array.data = _rs_tag_buffer_unshare(self->int_array.data, self->int_array.size * sizeof(uint32_t), &(self->int_array.buffer));
+    return self->int_array.data;
+}
+
+const uint32_t* rs_tag_peek_int_array(RSTag* self)
 {
     rs_return_val_if_fail(self && self->type == RS_TAG_INT_ARRAY, NULL);
     return self->int_array.data;
@@ -573,11 +1533,26 @@ uint32_t rs_tag_get_int_array_length(RSTag* self)
 void rs_tag_set_int_array(RSTag* self, uint32_t len, uint32_t* data)
 {
     rs_return_if_fail(self && self->type == RS_TAG_INT_ARRAY);
-    uint32_t* olddata = self->int_array.data;
-    self->int_array.data = rs_memdup(data, len * sizeof(uint32_t));
-    self->int_array.size = len;
-    if (olddata)
-        rs_free(olddata);
+    _rs_tag_changed(self);
+    _rs_tag_buffer_replace((void**)&(self->int_array.data), &(self->int_array.size), &(self->int_array.buffer),
+                           rs_memdup(data, len * sizeof(uint32_t)), len, NULL);
+}
+
+void rs_tag_take_int_array(RSTag* self, uint32_t len, uint32_t* data)
+{
+    rs_return_if_fail(self && self->type == RS_TAG_INT_ARRAY);
+    _rs_tag_changed(self);
+    _rs_tag_buffer_replace((void**)&(self->int_array.data), &(self->int_array.size), &(self->int_array.buffer),
+                           data, len, NULL);
+}
+
+void rs_tag_borrow_int_array(RSTag* self, uint32_t len, uint32_t* data, RSTagReleaseFunction release, void* user_data)
+{
+    rs_return_if_fail(self && self->type == RS_TAG_INT_ARRAY);
+    _rs_tag_changed(self);
+    rs_return_if_fail(data);
+    _rs_tag_buffer_replace((void**)&(self->int_array.data), &(self->int_array.size), &(self->int_array.buffer),
+                           data, len, _rs_tag_buffer_borrow(data, release, user_data));
 }
 
 /* for strings */
@@ -590,6 +1565,7 @@ const char* rs_tag_get_string(RSTag* self)
 void rs_tag_set_string(RSTag* self, const char* str)
 {
     rs_return_if_fail(self && self->type == RS_TAG_STRING);
+    _rs_tag_changed(self);
     char* oldstring = self->string;
     self->string = rs_strdup(str);
     if (oldstring)
@@ -601,7 +1577,7 @@ void rs_tag_list_iterator_init(RSTag* self, RSTagIterator* it)
     rs_return_if_fail(self && self->type == RS_TAG_LIST);
     rs_return_if_fail(it);
     
-    *it = self->list.items;
+    *it = _rs_tag_list_get_tags(self);
 }
 
 bool rs_tag_list_iterator_next(RSTagIterator* it, RSTag** tag)
@@ -609,12 +1585,12 @@ bool rs_tag_list_iterator_next(RSTagIterator* it, RSTag** tag)
     rs_return_val_if_fail(it, false);
     rs_return_val_if_fail(tag, false);
     
-    RSList* cell = (RSList*)(*it);
-    if (!cell)
+    RSTag** slot = (RSTag**)(*it);
+    if (!slot || !(*slot))
         return false;
     
-    *tag = (RSTag*)(cell->data);
-    *it = cell->next;
+    *tag = *slot;
+    *it = slot + 1;
     
     return true;
 }
@@ -628,36 +1604,52 @@ RSTagType rs_tag_list_get_type(RSTag* self)
 void rs_tag_list_set_type(RSTag* self, RSTagType type)
 {
     rs_return_if_fail(self && self->type == RS_TAG_LIST);
-    if (self->list.items != NULL)
+    if (self->list.size != 0)
     {
         rs_critical("rs_tag_list_set_type called on non-empty list");
         return;
     }
+    _rs_tag_changed(self);
     self->list.type = type;
 }
 
 uint32_t rs_tag_list_get_length(RSTag* self)
 {
     rs_return_val_if_fail(self && self->type == RS_TAG_LIST, 0);
-    return rs_list_size(self->list.items);
+    return self->list.size;
 }
 
 RSTag* rs_tag_list_get(RSTag* self, uint32_t i)
 {
     rs_return_val_if_fail(self && self->type == RS_TAG_LIST, NULL);
-    return (RSTag*)rs_list_nth(self->list.items, i);
+    
+    if (i >= self->list.size)
+    {
+        rs_critical("list index out of range: %i", i);
+        return NULL;
+    }
+    
+    return _rs_tag_list_get_tags(self)[i];
 }
 
 void rs_tag_list_delete(RSTag* self, uint32_t i)
 {
     rs_return_if_fail(self && self->type == RS_TAG_LIST);
     
-    RSList* cell = rs_list_nth_cell(self->list.items, i);
-    if (cell)
+    if (i >= self->list.size)
+        return;
+    
+    _rs_tag_changed(self);
+    if (_rs_tag_list_is_packed(self))
     {
-        rs_tag_unref((RSTag*)(cell->data));
-        self->list.items = rs_list_remove(self->list.items, cell);
+        uint32_t width = _rs_tag_number_width(self->list.type);
+        uint8_t* values = self->list.values;
+        memmove(values + i * width, values + (i + 1) * width, (self->list.size - i - 1) * width);
+    } else {
+        rs_tag_unref(self->list.tags[i]);
+        memmove(&(self->list.tags[i]), &(self->list.tags[i + 1]), (self->list.size - i - 1) * sizeof(RSTag*));
     }
+    _rs_tag_list_resize(self, self->list.size - 1);
 }
 
 void rs_tag_list_insert(RSTag* self, uint32_t i, RSTag* tag)
@@ -666,38 +1658,265 @@ void rs_tag_list_insert(RSTag* self, uint32_t i, RSTag* tag)
     rs_return_if_fail(tag);
     rs_return_if_fail(tag->type == self->list.type);
     
-    RSList* cell = rs_list_cell_new();
+    uint32_t size = self->list.size;
+    if (i > size)
+        i = size;
+    
+    _rs_tag_changed(self);
+    _rs_tag_list_unpack(self);
+    _rs_tag_list_resize(self, size + 1);
+    memmove(&(self->list.tags[i + 1]), &(self->list.tags[i]), (size - i) * sizeof(RSTag*));
     
     rs_tag_ref(tag);
-    cell->data = tag;
-    cell->next = NULL;
+    self->list.tags[i] = tag;
+}
+
+void rs_tag_list_reverse(RSTag* self)
+{
+    rs_return_if_fail(self && self->type == RS_TAG_LIST);
     
-    if (i == 0)
+    uint32_t i, j;
+    
+    if (self->list.size == 0)
+        return;
+    
+    _rs_tag_changed(self);
+    if (_rs_tag_list_is_packed(self))
     {
-        cell->next = self->list.items;
-        self->list.items = cell;
+        uint32_t width = _rs_tag_number_width(self->list.type);
+        uint8_t* values = self->list.values;
+        uint8_t tmp[8];
+        for (i = 0, j = self->list.size - 1; i < j; i++, j--)
+        {
+            memcpy(tmp, values + i * width, width);
+            memcpy(values + i * width, values + j * width, width);
+            memcpy(values + j * width, tmp, width);
+        }
         return;
     }
     
-    uint32_t len = rs_tag_list_get_length(self);
-    if (i >= len)
+    for (i = 0, j = self->list.size - 1; i < j; i++, j--)
+    {
+        RSTag* tag = self->list.tags[i];
+        self->list.tags[i] = self->list.tags[j];
+        self->list.tags[j] = tag;
+    }
+}
+
+/* checks that a bulk accessor is used on the right kind of list */
+static bool _rs_tag_list_check_numeric(RSTag* self, bool floating, const char* func)
+{
+    switch (self->list.type)
+    {
+    case RS_TAG_BYTE:
+    case RS_TAG_SHORT:
+    case RS_TAG_INT:
+    case RS_TAG_LONG:
+        if (!floating)
+            return true;
+        break;
+    case RS_TAG_FLOAT:
+    case RS_TAG_DOUBLE:
+        if (floating)
+            return true;
+        break;
+    default:
+        break;
+    };
+    
+    rs_critical("%s called on list of %s", func, floating ? "non-floats" : "non-integers");
+    return false;
+}
+
+uint32_t rs_tag_list_get_integers(RSTag* self, int64_t* out, uint32_t n)
+{
+    rs_return_val_if_fail(self && self->type == RS_TAG_LIST, 0);
+    rs_return_val_if_fail(out || n == 0, 0);
+    if (!_rs_tag_list_check_numeric(self, false, "rs_tag_list_get_integers"))
+        return 0;
+    
+    RSTag** tags = __atomic_load_n(&(self->list.tags), __ATOMIC_ACQUIRE);
+    const void* values = self->list.values;
+    uint32_t i;
+    
+    if (n > self->list.size)
+        n = self->list.size;
+    if (n == 0)
+        return 0;
+    
+    if (tags)
+    {
+        for (i = 0; i < n; i++)
+            out[i] = rs_tag_get_integer(tags[i]);
+        return n;
+    }
+    
+    switch (self->list.type)
+    {
+    case RS_TAG_BYTE:
+        for (i = 0; i < n; i++)
+            out[i] = ((const int8_t*)values)[i];
+        break;
+    case RS_TAG_SHORT:
+        for (i = 0; i < n; i++)
+            out[i] = ((const int16_t*)values)[i];
+        break;
+    case RS_TAG_INT:
+        for (i = 0; i < n; i++)
+            out[i] = ((const int32_t*)values)[i];
+        break;
+    default:
+        memcpy(out, values, n * sizeof(int64_t));
+        break;
+    };
+    return n;
+}
+
+uint32_t rs_tag_list_get_floats(RSTag* self, float* out, uint32_t n)
+{
+    rs_return_val_if_fail(self && self->type == RS_TAG_LIST, 0);
+    rs_return_val_if_fail(out || n == 0, 0);
+    if (!_rs_tag_list_check_numeric(self, true, "rs_tag_list_get_floats"))
+        return 0;
+    
+    RSTag** tags = __atomic_load_n(&(self->list.tags), __ATOMIC_ACQUIRE);
+    const void* values = self->list.values;
+    uint32_t i;
+    
+    if (n > self->list.size)
+        n = self->list.size;
+    if (n == 0)
+        return 0;
+    
+    if (tags)
+    {
+        for (i = 0; i < n; i++)
+            out[i] = rs_tag_get_float(tags[i]);
+    } else if (self->list.type == RS_TAG_FLOAT) {
+        memcpy(out, values, n * sizeof(float));
+    } else {
+        for (i = 0; i < n; i++)
+            out[i] = ((const double*)values)[i];
+    }
+    return n;
+}
+
+uint32_t rs_tag_list_get_doubles(RSTag* self, double* out, uint32_t n)
+{
+    rs_return_val_if_fail(self && self->type == RS_TAG_LIST, 0);
+    rs_return_val_if_fail(out || n == 0, 0);
+    if (!_rs_tag_list_check_numeric(self, true, "rs_tag_list_get_doubles"))
+        return 0;
+    
+    RSTag** tags = __atomic_load_n(&(self->list.tags), __ATOMIC_ACQUIRE);
+    const void* values = self->list.values;
+    uint32_t i;
+    
+    if (n > self->list.size)
+        n = self->list.size;
+    if (n == 0)
+        return 0;
+    
+    if (tags)
     {
-        RSList* last = rs_list_nth_cell(self->list.items, len - 1);
-        last->next = cell;
+        for (i = 0; i < n; i++)
+            out[i] = rs_tag_get_float(tags[i]);
+    } else if (self->list.type == RS_TAG_DOUBLE) {
+        memcpy(out, values, n * sizeof(double));
     } else {
-        RSList* prev = rs_list_nth_cell(self->list.items, i - 1);
-        RSList* next = prev->next;
-        
-        prev->next = cell;
-        cell->next = next;
+        for (i = 0; i < n; i++)
+            out[i] = ((const float*)values)[i];
     }
+    return n;
 }
 
-void rs_tag_list_reverse(RSTag* self)
+/* helper for the bulk setters -- empties a list, and packs n zeroes
+ * into it
+ */
+static void _rs_tag_list_reset(RSTag* self, uint32_t n)
+{
+    _rs_tag_changed(self);
+    _rs_tag_list_clear(self);
+    _rs_tag_list_resize(self, n);
+}
+
+void rs_tag_list_set_integers(RSTag* self, const int64_t* values, uint32_t n)
+{
+    rs_return_if_fail(self && self->type == RS_TAG_LIST);
+    rs_return_if_fail(values || n == 0);
+    if (!_rs_tag_list_check_numeric(self, false, "rs_tag_list_set_integers"))
+        return;
+    
+    uint32_t i;
+    
+    _rs_tag_list_reset(self, n);
+    if (n == 0)
+        return;
+    
+    void* packed = self->list.values;
+    switch (self->list.type)
+    {
+    case RS_TAG_BYTE:
+        for (i = 0; i < n; i++)
+            ((int8_t*)packed)[i] = values[i];
+        break;
+    case RS_TAG_SHORT:
+        for (i = 0; i < n; i++)
+            ((int16_t*)packed)[i] = values[i];
+        break;
+    case RS_TAG_INT:
+        for (i = 0; i < n; i++)
+            ((int32_t*)packed)[i] = values[i];
+        break;
+    default:
+        memcpy(packed, values, n * sizeof(int64_t));
+        break;
+    };
+}
+
+void rs_tag_list_set_floats(RSTag* self, const float* values, uint32_t n)
+{
+    rs_return_if_fail(self && self->type == RS_TAG_LIST);
+    rs_return_if_fail(values || n == 0);
+    if (!_rs_tag_list_check_numeric(self, true, "rs_tag_list_set_floats"))
+        return;
+    
+    uint32_t i;
+    
+    _rs_tag_list_reset(self, n);
+    if (n == 0)
+        return;
+    
+    if (self->list.type == RS_TAG_FLOAT)
+    {
+        memcpy(self->list.values, values, n * sizeof(float));
+    } else {
+        for (i = 0; i < n; i++)
+            ((double*)(self->list.values))[i] = values[i];
+    }
+}
+
+void rs_tag_list_set_doubles(RSTag* self, const double* values, uint32_t n)
 {
     rs_return_if_fail(self && self->type == RS_TAG_LIST);
-    self->list.items = rs_list_reverse(self->list.items);
-}       
+    rs_return_if_fail(values || n == 0);
+    if (!_rs_tag_list_check_numeric(self, true, "rs_tag_list_set_doubles"))
+        return;
+    
+    uint32_t i;
+    
+    _rs_tag_list_reset(self, n);
+    if (n == 0)
+        return;
+    
+    if (self->list.type == RS_TAG_DOUBLE)
+    {
+        memcpy(self->list.values, values, n * sizeof(double));
+    } else {
+        for (i = 0; i < n; i++)
+            ((float*)(self->list.values))[i] = values[i];
+    }
+}
 
 /* for compounds */
 void rs_tag_compound_iterator_init(RSTag* self, RSTagIterator* it)
@@ -705,25 +1924,23 @@ void rs_tag_compound_iterator_init(RSTag* self, RSTagIterator* it)
     rs_return_if_fail(self && self->type == RS_TAG_COMPOUND);
     rs_return_if_fail(it);
     
-    *it = self->compound;
+    *it = _rs_tag_compound_nodes(self);
 }
 
 bool rs_tag_compound_iterator_next(RSTagIterator* it, const char** key, RSTag** value)
 {
     rs_return_val_if_fail(it, false);
     
-    RSList* cell = (RSList*)(*it);
-    if (!cell)
+    RSTagCompoundNode* node = (RSTagCompoundNode*)(*it);
+    if (!node || !node->key)
         return false;
     
-    RSTagCompoundNode* node = (RSTagCompoundNode*)(cell->data);
-    
     if (key)
         *key = node->key;
     if (value)
         *value = node->value;
     
-    *it = cell->next;
+    *it = node + 1;
     
     return true;
 }
@@ -731,7 +1948,7 @@ bool rs_tag_compound_iterator_next(RSTagIterator* it, const char** key, RSTag**
 uint32_t rs_tag_compound_get_length(RSTag* self)
 {
     rs_return_val_if_fail(self && self->type == RS_TAG_COMPOUND, 0);
-    return rs_list_size(self->compound);
+    return _rs_tag_compound_length(self);
 }
 
 RSTag* rs_tag_compound_get(RSTag* self, const char* key)
@@ -739,23 +1956,14 @@ RSTag* rs_tag_compound_get(RSTag* self, const char* key)
     rs_return_val_if_fail(self && self->type == RS_TAG_COMPOUND, NULL);
     rs_return_val_if_fail(key, NULL);
     
-    RSList* cell = self->compound;
-    for (; cell != NULL; cell = cell->next)
-    {
-        RSTagCompoundNode* node = (RSTagCompoundNode*)(cell->data);
-        rs_assert(node && node->key);
-        
-        if (strcmp(node->key, key) == 0)
-            return node->value;
-    }
-    
-    return NULL;
+    RSTagCompoundNode* node = _rs_tag_compound_find(self, key);
+    return node ? node->value : NULL;
 }
 
 RSTag* rs_tag_compound_get_chainv(RSTag* self, va_list ap)
 {
     rs_return_val_if_fail(self && self->type == RS_TAG_COMPOUND, NULL);
-
+    
     const char* key;
     RSTag* tag = self;
     while (tag && (key = va_arg(ap, const char*)))
@@ -787,15 +1995,21 @@ void rs_tag_compound_set(RSTag* self, const char* key, RSTag* value)
     rs_return_if_fail(self && self->type == RS_TAG_COMPOUND);
     rs_return_if_fail(key && value);
     
-    rs_tag_compound_delete(self, key);
-    
-    RSTagCompoundNode* node = rs_new0(RSTagCompoundNode, 1);
-    
-    node->key = rs_strdup(key);
+    /* ref first, in case value is already stored under key */
     rs_tag_ref(value);
-    node->value = value;
+    _rs_tag_changed(self);
+    
+    /* an existing key keeps its place */
+    RSTagCompoundNode* node = _rs_tag_compound_find(self, key);
+    if (node)
+    {
+        RSTag* old = node->value;
+        node->value = value;
+        rs_tag_unref(old);
+        return;
+    }
     
-    self->compound = rs_list_push(self->compound, node);
+    _rs_tag_compound_append(self, rs_strdup(key), _rs_tag_key_hash(key), value);
 }
 
 void rs_tag_compound_delete(RSTag* self, const char* key)
@@ -803,16 +2017,293 @@ void rs_tag_compound_delete(RSTag* self, const char* key)
     rs_return_if_fail(self && self->type == RS_TAG_COMPOUND);
     rs_return_if_fail(key);
     
-    RSList* cell = self->compound;
-    for (; cell != NULL; cell = cell->next)
+    RSTagCompoundNode* node = _rs_tag_compound_find(self, key);
+    if (!node)
+        return;
+    
+    _rs_tag_changed(self);
+    RSTag* value = node->value;
+    rs_free(node->key);
+    rs_array_remove_index(self->compound.nodes, node - _rs_tag_compound_nodes(self));
+    
+    /* everything after it moved down, so the index is out of date */
+    if (self->compound.index)
+        _rs_tag_compound_reindex(self);
+    rs_tag_unref(value);
+}
+
+/* tag builder */
+
+/* one open compound or list */
+typedef struct
+{
+    /* NULL if the container couldn't be added, in which case
+     * everything up to its end() is dropped
+     */
+    RSTag* tag;
+    /* elements actually in a list -- the list itself may be larger
+     * until it is ended, to honor the size hint
+     */
+    uint32_t count;
+} RSTagBuilderFrame;
+
+struct _RSTagBuilder
+{
+    RSTag* root;
+    
+    RSTagBuilderFrame* frames;
+    unsigned int depth;
+    unsigned int frames_size;
+};
+
+RSTagBuilder* rs_tag_builder_new(void)
+{
+    RSTagBuilder* self = rs_new0(RSTagBuilder, 1);
+    return self;
+}
+
+void rs_tag_builder_free(RSTagBuilder* self)
+{
+    rs_return_if_fail(self);
+    
+    if (self->root)
+        rs_tag_unref(self->root);
+    if (self->frames)
+        rs_free(self->frames);
+    rs_free(self);
+}
+
+/* makes room for one more element in an open list, and returns its
+ * index -- lists of numbers stay packed while they are built
+ */
+static uint32_t _rs_tag_builder_list_next(RSTagBuilderFrame* frame)
+{
+    RSTag* list = frame->tag;
+    if (frame->count == list->list.size)
+        _rs_tag_list_resize(list, list->list.size < 4 ? 4 : list->list.size * 2);
+    return frame->count++;
+}
+
+/* adds a child tag to whatever is open, sinking its floating
+ * reference. Returns false (and drops the tag) if it doesn't fit.
+ */
+static bool _rs_tag_builder_append(RSTagBuilder* self, const char* key, RSTag* tag)
+{
+    rs_tag_ref(tag);
+    
+    if (self->depth == 0)
     {
-        RSTagCompoundNode* node = (RSTagCompoundNode*)(cell->data);
-        rs_assert(node && node->key);
+        if (self->root)
+        {
+            rs_critical("rs_tag_builder already has a finished root tag");
+            rs_tag_unref(tag);
+            return false;
+        }
         
-        if (strcmp(node->key, key) == 0)
-            break;
+        self->root = tag;
+        return true;
+    }
+    
+    RSTagBuilderFrame* frame = &(self->frames[self->depth - 1]);
+    RSTag* parent = frame->tag;
+    
+    if (!parent)
+    {
+        /* already complained about when it was opened */
+        rs_tag_unref(tag);
+        return false;
+    }
+    
+    if (parent->type == RS_TAG_COMPOUND)
+    {
+        if (!key)
+        {
+            rs_critical("rs_tag_builder needs a key inside a compound");
+            rs_tag_unref(tag);
+            return false;
+        }
+        
+        _rs_tag_compound_append(parent, rs_strdup(key), _rs_tag_key_hash(key), tag);
+        return true;
+    }
+    
+    if (tag->type != parent->list.type)
+    {
+        rs_critical("rs_tag_builder: %s does not belong in list of %s", rs_tag_get_type_name(tag->type), rs_tag_get_type_name(parent->list.type));
+        rs_tag_unref(tag);
+        return false;
+    }
+    
+    /* the caller may still use the tag, so it goes in as is, and
+     * the list is built out of tags from here on
+     */
+    if (_rs_tag_list_is_packed(parent))
+    {
+        _rs_tag_list_resize(parent, frame->count);
+        _rs_tag_list_unpack(parent);
+    }
+    
+    uint32_t i = _rs_tag_builder_list_next(frame);
+    parent->list.tags[i] = tag;
+    return true;
+}
+
+/* adds a number -- inside lists, it goes straight into the packed
+ * values, without a tag of its own
+ */
+static void _rs_tag_builder_append_number(RSTagBuilder* self, const char* key, RSTag* scratch)
+{
+    if (self->depth > 0)
+    {
+        RSTagBuilderFrame* frame = &(self->frames[self->depth - 1]);
+        RSTag* parent = frame->tag;
+        if (!parent)
+            return;
+        if (parent->type == RS_TAG_LIST && parent->list.type == scratch->type && _rs_tag_list_is_packed(parent))
+        {
+            uint32_t width = _rs_tag_number_width(scratch->type);
+            uint32_t i = _rs_tag_builder_list_next(frame);
+            memcpy((uint8_t*)(parent->list.values) + i * width, &(scratch->int_byte), width);
+            return;
+        }
+    }
+    
+    RSTag* tag = rs_tag_new0(scratch->type);
+    memcpy(&(tag->int_long), &(scratch->int_long), sizeof(int64_t));
+    _rs_tag_builder_append(self, key, tag);
+}
+
+/* opens a new container -- if it can't be added, it is still opened,
+ * but dead, so that its contents and end() don't end up in the parent
+ */
+static void _rs_tag_builder_push(RSTagBuilder* self, const char* key, RSTag* tag)
+{
+    if (!_rs_tag_builder_append(self, key, tag))
+        tag = NULL;
+    
+    if (self->depth == self->frames_size)
+    {
+        self->frames_size = self->frames_size ? self->frames_size * 2 : 8;
+        self->frames = rs_renew(RSTagBuilderFrame, self->frames, self->frames_size);
+    }
+    
+    RSTagBuilderFrame* frame = &(self->frames[self->depth]);
+    frame->tag = tag;
+    frame->count = 0;
+    self->depth++;
+}
+
+void rs_tag_builder_begin_compound(RSTagBuilder* self, const char* key)
+{
+    rs_return_if_fail(self);
+    _rs_tag_builder_push(self, key, rs_tag_new0(RS_TAG_COMPOUND));
+}
+
+void rs_tag_builder_begin_list(RSTagBuilder* self, const char* key, RSTagType type, uint32_t size_hint)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(type < RS_INVALID_TAG);
+    
+    RSTag* list = rs_tag_new0(RS_TAG_LIST);
+    list->list.type = type;
+    if (size_hint > 0 && type != RS_TAG_END)
+        _rs_tag_list_resize(list, size_hint);
+    
+    _rs_tag_builder_push(self, key, list);
+}
+
+void rs_tag_builder_end(RSTagBuilder* self)
+{
+    rs_return_if_fail(self);
+    
+    if (self->depth == 0)
+    {
+        rs_critical("rs_tag_builder_end called with nothing open");
+        return;
     }
     
-    if (cell)
-        self->compound = rs_list_remove(self->compound, cell);
+    self->depth--;
+    RSTagBuilderFrame* frame = &(self->frames[self->depth]);
+    if (frame->tag && frame->tag->type == RS_TAG_LIST)
+        _rs_tag_list_resize(frame->tag, frame->count);
+}
+
+RSTag* rs_tag_builder_finish(RSTagBuilder* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    if (self->depth > 0)
+    {
+        rs_critical("rs_tag_builder_finish called with %u tags still open", self->depth);
+        while (self->depth > 0)
+            rs_tag_builder_end(self);
+    }
+    
+    RSTag* root = self->root;
+    self->root = NULL;
+    
+    /* hand our reference over as a floating one */
+    if (root && root->refcount > 0)
+        root->refcount--;
+    return root;
+}
+
+void rs_tag_builder_add_integer(RSTagBuilder* self, const char* key, RSTagType type, int64_t val)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(type >= RS_TAG_BYTE && type <= RS_TAG_LONG);
+    
+    RSTag scratch;
+    memset(&scratch, 0, sizeof(RSTag));
+    scratch.type = type;
+    rs_tag_set_integer(&scratch, val);
+    _rs_tag_builder_append_number(self, key, &scratch);
+}
+
+void rs_tag_builder_add_float(RSTagBuilder* self, const char* key, RSTagType type, double val)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(type == RS_TAG_FLOAT || type == RS_TAG_DOUBLE);
+    
+    RSTag scratch;
+    memset(&scratch, 0, sizeof(RSTag));
+    scratch.type = type;
+    rs_tag_set_float(&scratch, val);
+    _rs_tag_builder_append_number(self, key, &scratch);
+}
+
+void rs_tag_builder_add_string(RSTagBuilder* self, const char* key, const char* str)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(str);
+    
+    RSTag* tag = rs_tag_new0(RS_TAG_STRING);
+    tag->string = rs_strdup(str);
+    _rs_tag_builder_append(self, key, tag);
+}
+
+void rs_tag_builder_add_byte_array(RSTagBuilder* self, const char* key, uint32_t len, uint8_t* data)
+{
+    rs_return_if_fail(self);
+    
+    RSTag* tag = rs_tag_new0(RS_TAG_BYTE_ARRAY);
+    rs_tag_set_byte_array(tag, len, data);
+    _rs_tag_builder_append(self, key, tag);
+}
+
+void rs_tag_builder_add_int_array(RSTagBuilder* self, const char* key, uint32_t len, uint32_t* data)
+{
+    rs_return_if_fail(self);
+    
+    RSTag* tag = rs_tag_new0(RS_TAG_INT_ARRAY);
+    rs_tag_set_int_array(tag, len, data);
+    _rs_tag_builder_append(self, key, tag);
+}
+
+void rs_tag_builder_add_tag(RSTagBuilder* self, const char* key, RSTag* tag)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(tag);
+    
+    _rs_tag_builder_append(self, key, tag);
 }
@@ -17,6 +17,9 @@ typedef struct _RSTag RSTag;
 /* used by iteration over contained tags, in lists/compounds */
 typedef void* RSTagIterator;
 
+/* called when a tag lets go of borrowed array memory */
+typedef void (*RSTagReleaseFunction)(void* data, void* user_data);
+
 typedef enum
 {
     /* not exposed API-wise, but used internally */
@@ -66,9 +69,33 @@ RSTag* rs_tag_new(RSTagType type, ...);
 void rs_tag_ref(RSTag* self);
 void rs_tag_unref(RSTag* self);
 
+/* copy-on-write copy. The copy has tags of its own all the way down,
+ * so anything fetched from either tree can be changed without
+ * affecting the other, but array data is shared between them until
+ * one side changes it (through rs_tag_get_*_array() or a setter). As
+ * the arrays are most of a chunk, stamping out copies of a template is
+ * cheap. Reading never copies, so any number of threads may read a tree
+ * (or copy it) at once.
+ */
+RSTag* rs_tag_copy(RSTag* self);
+
 /* finds the first tag with this name, recursively */
 RSTag* rs_tag_find(RSTag* self, const char* name);
 
+/* structural hash and equality -- compound key order is ignored, and
+ * floats are compared bit-for-bit. Every hash but a number's is cached
+ * in the tag, and setters drop it, so repeated comparisons of
+ * mostly-unchanged trees are cheap; if you write through a pointer from
+ * rs_tag_get_*_array() after hashing, call it again so the cache is
+ * dropped. Changing a tag inside a hashed list or compound drops every
+ * cached list and compound hash, since the containers can't be found
+ * from the tag. Hashing only writes to the caches, so it is safe for
+ * several threads to hash or compare one tree at once. Hashes are not
+ * stable across platforms or versions, so don't store them.
+ */
+uint64_t rs_tag_hash(RSTag* self);
+bool rs_tag_equal(RSTag* a, RSTag* b);
+
 /* helpers for writing out tags */
 void rs_tag_print(RSTag* self, FILE* dest);
 void rs_tag_pretty_print(RSTag* self, FILE* dest);
@@ -81,21 +108,43 @@ void rs_tag_set_integer(RSTag* self, int64_t val);
 double rs_tag_get_float(RSTag* self);
 void rs_tag_set_float(RSTag* self, double val);
 
-/* for byte arrays */
+/* for byte arrays
+ * get_ un-shares the data (see rs_tag_copy) so it can be written to,
+ * peek_ is for reading only and never copies
+ */
 uint8_t* rs_tag_get_byte_array(RSTag* self);
+const uint8_t* rs_tag_peek_byte_array(RSTag* self);
 uint32_t rs_tag_get_byte_array_length(RSTag* self);
 void rs_tag_set_byte_array(RSTag* self, uint32_t len, uint8_t* data);
+/* set_ copies data. take_ adopts data, which must come from rs_malloc()
+ * and is rs_free()'d by the tag. borrow_ uses memory the tag does not
+ * own, and calls release (if not NULL) once no tag uses it any more;
+ * get_ will copy borrowed data before handing it out.
+ */
+void rs_tag_take_byte_array(RSTag* self, uint32_t len, uint8_t* data);
+void rs_tag_borrow_byte_array(RSTag* self, uint32_t len, uint8_t* data, RSTagReleaseFunction release, void* user_data);
 
-/* for int arrays */
+/* for int arrays (get_/peek_ as for byte arrays) */
 uint32_t* rs_tag_get_int_array(RSTag* self);
+const uint32_t* rs_tag_peek_int_array(RSTag* self);
 uint32_t rs_tag_get_int_array_length(RSTag* self);
 void rs_tag_set_int_array(RSTag* self, uint32_t len, uint32_t* data);
+void rs_tag_take_int_array(RSTag* self, uint32_t len, uint32_t* data);
+void rs_tag_borrow_int_array(RSTag* self, uint32_t len, uint32_t* data, RSTagReleaseFunction release, void* user_data);
 
 /* for strings */
 const char* rs_tag_get_string(RSTag* self);
 void rs_tag_set_string(RSTag* self, const char* str);
 
-/* for lists */
+/* for lists
+ * lists of numbers keep their values packed at their own width (as
+ * the bulk setters, parsing, copying and the builder all leave them),
+ * and only make element tags when one is asked for, through get or the
+ * iterator. From then on the list holds on to those tags, so use the
+ * bulk accessors below where you can. Inserting a tag (or adding one
+ * with rs_tag_builder_add_tag()) switches the list over to tags too,
+ * and it stays exactly the tag you inserted.
+ */
 void rs_tag_list_iterator_init(RSTag* self, RSTagIterator* it);
 bool rs_tag_list_iterator_next(RSTagIterator* it, RSTag** tag);
 RSTagType rs_tag_list_get_type(RSTag* self);
@@ -106,8 +155,24 @@ RSTag* rs_tag_list_get(RSTag* self, uint32_t i);
 void rs_tag_list_delete(RSTag* self, uint32_t i);
 void rs_tag_list_insert(RSTag* self, uint32_t i, RSTag* tag);
 void rs_tag_list_reverse(RSTag* self);
-
-/* for compounds */
+/* bulk access for lists of numbers -- conversion is automatic, as for
+ * rs_tag_get_integer() and rs_tag_get_float(). get_ copies out at most
+ * n elements and returns how many it copied. set_ replaces the whole
+ * list with n elements; the list type must already be set.
+ */
+uint32_t rs_tag_list_get_integers(RSTag* self, int64_t* out, uint32_t n);
+uint32_t rs_tag_list_get_floats(RSTag* self, float* out, uint32_t n);
+uint32_t rs_tag_list_get_doubles(RSTag* self, double* out, uint32_t n);
+void rs_tag_list_set_integers(RSTag* self, const int64_t* values, uint32_t n);
+void rs_tag_list_set_floats(RSTag* self, const float* values, uint32_t n);
+void rs_tag_list_set_doubles(RSTag* self, const double* values, uint32_t n);
+
+/* for compounds
+ * entries keep the order they were added in, and setting a key that
+ * is already there replaces its value in place. Big compounds keep a
+ * hash index, so get, set and delete don't search every key. The
+ * compound must not be changed while iterating over it.
+ */
 void rs_tag_compound_iterator_init(RSTag* self, RSTagIterator* it);
 bool rs_tag_compound_iterator_next(RSTagIterator* it, const char** key, RSTag** value);
 uint32_t rs_tag_compound_get_length(RSTag* self);
@@ -117,4 +182,37 @@ RSTag* rs_tag_compound_get_chain(RSTag* self, ...);
 void rs_tag_compound_set(RSTag* self, const char* key, RSTag* value);
 void rs_tag_compound_delete(RSTag* self, const char* key);
 
+/* builder for making large trees quickly, without varargs. Open
+ * compounds and lists with begin_, fill them with add_, and close them
+ * with end(); finish() then returns the root tag (floating), and the
+ * builder can be reused.
+ *
+ * key is the name inside the enclosing compound, and must be NULL
+ * everywhere else. Keys are appended in order without checking for
+ * duplicates, so each key must be used only once per compound.
+ * size_hint is the expected list length, and may be 0. A tag that
+ * doesn't fit where it is added (no key in a compound, or the wrong
+ * type for a list) is dropped with a warning; if it was a container,
+ * everything added to it up to its end() is dropped too.
+ */
+struct _RSTagBuilder;
+typedef struct _RSTagBuilder RSTagBuilder;
+
+RSTagBuilder* rs_tag_builder_new(void);
+void rs_tag_builder_free(RSTagBuilder* self);
+void rs_tag_builder_begin_compound(RSTagBuilder* self, const char* key);
+void rs_tag_builder_begin_list(RSTagBuilder* self, const char* key, RSTagType type, uint32_t size_hint);
+void rs_tag_builder_end(RSTagBuilder* self);
+RSTag* rs_tag_builder_finish(RSTagBuilder* self);
+
+void rs_tag_builder_add_integer(RSTagBuilder* self, const char* key, RSTagType type, int64_t val);
+void rs_tag_builder_add_float(RSTagBuilder* self, const char* key, RSTagType type, double val);
+void rs_tag_builder_add_string(RSTagBuilder* self, const char* key, const char* str);
+/* arrays are copied -- use add_tag() with an rs_tag_take_*_array() tag
+ * to avoid that
+ */
+void rs_tag_builder_add_byte_array(RSTagBuilder* self, const char* key, uint32_t len, uint8_t* data);
+void rs_tag_builder_add_int_array(RSTagBuilder* self, const char* key, uint32_t len, uint32_t* data);
+void rs_tag_builder_add_tag(RSTagBuilder* self, const char* key, RSTag* tag);
+
 #endif /* __RS_TAG_H_INCLUDED__ */
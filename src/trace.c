@@ -0,0 +1,65 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "trace.h"
+
+#include <time.h>
+
+static RSTraceFunction trace_begin = NULL;
+static RSTraceFunction trace_end = NULL;
+static void* trace_user_data = NULL;
+
+bool _rs_trace_enabled = false;
+
+static const char* span_names[RS_TRACE_SPANS] = {
+    "decompress",
+    "compress",
+    "nbt-parse",
+    "nbt-write",
+    "region-shrink",
+    "region-remap",
+    "region-grow",
+    "region-sync",
+};
+
+void rs_set_trace_hooks(RSTraceFunction begin, RSTraceFunction end, void* user_data)
+{
+    trace_begin = begin;
+    trace_end = end;
+    trace_user_data = user_data;
+    _rs_trace_enabled = (begin || end);
+}
+
+const char* rs_trace_get_span_name(RSTraceSpan span)
+{
+    if ((unsigned int)span >= RS_TRACE_SPANS)
+        return NULL;
+    return span_names[span];
+}
+
+static inline uint64_t _rs_trace_get_time(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == 0)
+        return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+    /* good enough to tell a slow save from a fast one */
+    return (uint64_t)time(NULL) * 1000000000;
+}
+
+void _rs_trace_emit(bool begin, RSTraceSpan span, size_t bytes)
+{
+    RSTraceFunction hook = begin ? trace_begin : trace_end;
+    if (!hook)
+        return;
+    
+    RSTraceEvent event;
+    event.span = span;
+    event.timestamp = _rs_trace_get_time();
+    event.bytes = bytes;
+    hook(&event, trace_user_data);
+}
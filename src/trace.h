@@ -0,0 +1,129 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_TRACE_H_INCLUDED__
+#define __RS_TRACE_H_INCLUDED__
+
+#include "util.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * The pieces of work that trace hooks are told about.
+ *
+ * Spans don't nest within one thread: rs_nbt_parse(), for example,
+ * reports an RS_TRACE_DECOMPRESS span, then an RS_TRACE_NBT_PARSE
+ * span.
+ *
+ * \sa rs_set_trace_hooks
+ */
+typedef enum
+{
+    /** decompressing data, with rs_decompress() and friends */
+    RS_TRACE_DECOMPRESS,
+    /** compressing data, with rs_compress() and friends */
+    RS_TRACE_COMPRESS,
+    /** turning decompressed NBT data into tags, in rs_nbt_parse() */
+    RS_TRACE_NBT_PARSE,
+    /** turning tags into uncompressed NBT data, in rs_nbt_write() */
+    RS_TRACE_NBT_WRITE,
+    /** moving chunks down over ones that shrank, in rs_region_flush() */
+    RS_TRACE_REGION_SHRINK,
+    /** resizing and remapping the region file, in rs_region_flush() */
+    RS_TRACE_REGION_REMAP,
+    /** moving chunks up to make room for ones that grew, or writing
+     * out every chunk of a new file, in rs_region_flush() */
+    RS_TRACE_REGION_GROW,
+    /** waiting for the region file to reach the disk */
+    RS_TRACE_REGION_SYNC,
+    
+    /** the number of span kinds */
+    RS_TRACE_SPANS
+} RSTraceSpan;
+
+/**
+ * Something that happened, as passed to trace hooks.
+ *
+ * \sa RSTraceFunction
+ */
+typedef struct
+{
+    /** what is being done */
+    RSTraceSpan span;
+    /** when, in nanoseconds, from an arbitrary (but fixed) start */
+    uint64_t timestamp;
+    /**
+     * how much data is involved. When a span begins, this is the size
+     * of its input, or 0 if that isn't known yet. When it ends, this
+     * is the size of its output: bytes (de)compressed, parsed or
+     * written, bytes moved and written in a region pass, or the size
+     * of the region file for a remap or sync.
+     */
+    size_t bytes;
+} RSTraceEvent;
+
+/**
+ * Trace hook type.
+ *
+ * \param event what happened, only valid during the call
+ * \param user_data the pointer given to rs_set_trace_hooks()
+ * \sa rs_set_trace_hooks
+ */
+typedef void (*RSTraceFunction)(const RSTraceEvent* event, void* user_data);
+
+/**
+ * Set the trace hooks.
+ *
+ * Once these are set, begin is called at the start of each span listed
+ * in RSTraceSpan, and end is called when it finishes, from whatever
+ * thread did the work. Hooks should be quick, since they run in the
+ * middle of it.
+ *
+ * When no hooks are set, tracing costs one well-predicted branch per
+ * span, and the clock is never read. Only change the hooks while no
+ * other thread is using libredstone.
+ *
+ * \param begin called when a span begins, or NULL
+ * \param end called when a span ends, or NULL
+ * \param user_data passed to both hooks
+ * \sa RSTraceSpan, rs_trace_get_span_name
+ */
+void rs_set_trace_hooks(RSTraceFunction begin, RSTraceFunction end, void* user_data);
+
+/**
+ * Get a name for a span kind.
+ *
+ * \param span the span kind
+ * \return a short, lowercase name like "decompress", or NULL if
+ * span is out of range
+ */
+const char* rs_trace_get_span_name(RSTraceSpan span);
+
+/** Internal flag, true when any hook is set; don't use! */
+extern bool _rs_trace_enabled;
+/** Internal event emitter, don't use! */
+void _rs_trace_emit(bool begin, RSTraceSpan span, size_t bytes);
+
+#ifdef __GNUC__
+#define _RS_TRACE_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define _RS_TRACE_UNLIKELY(x) (x)
+#endif
+
+/** Internal: mark the start of a span, don't use! */
+#define _rs_trace_begin(span, bytes) RS_STMT_START { \
+        if (_RS_TRACE_UNLIKELY(_rs_trace_enabled))   \
+            _rs_trace_emit(true, (span), (bytes));   \
+    } RS_STMT_END
+
+/** Internal: mark the end of a span, don't use! */
+#define _rs_trace_end(span, bytes) RS_STMT_START {  \
+        if (_RS_TRACE_UNLIKELY(_rs_trace_enabled))  \
+            _rs_trace_emit(false, (span), (bytes)); \
+    } RS_STMT_END
+
+#endif /* __RS_TRACE_H_INCLUDED__ */
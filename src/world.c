@@ -0,0 +1,773 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#define RS_MEMORY_SUBSYSTEM RS_MEMORY_REGION
+
+#include "config.h"
+#include "world.h"
+
+#include "error.h"
+#include "memory.h"
+#include "array.h"
+#include "hashmap.h"
+#include "rsendian.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* runs of more chunks than this are split in two, so idle workers can
+ * take half
+ */
+#define RS_WORLD_SPLIT_SIZE 64
+
+/* one region file in the world */
+struct RegionFile
+{
+    int x, z;
+    bool anvil;
+    char* path;
+};
+
+struct _RSWorld
+{
+    char* path;
+    
+    /* struct RegionFile, sorted by position */
+    RSArray* regions;
+};
+
+static int _rs_world_compare_regions(const void* a, const void* b)
+{
+    const struct RegionFile* ra = a;
+    const struct RegionFile* rb = b;
+    
+    if (ra->x != rb->x)
+        return (ra->x < rb->x) ? -1 : 1;
+    if (ra->z != rb->z)
+        return (ra->z < rb->z) ? -1 : 1;
+    /* .mca files first, since they replace .mcr files */
+    return (int)rb->anvil - (int)ra->anvil;
+}
+
+RSWorld* rs_world_open(const char* path)
+{
+    rs_return_val_if_fail(path, NULL);
+    
+    char* region_path = rs_malloc(strlen(path) + strlen("/region") + 1);
+    sprintf(region_path, "%s/region", path);
+    DIR* dir = opendir(region_path);
+    if (!dir)
+    {
+        rs_free(region_path);
+        return NULL;
+    }
+    
+    RSWorld* self = rs_new0(RSWorld, 1);
+    self->path = rs_strdup(path);
+    self->regions = rs_array_new(sizeof(struct RegionFile));
+    
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        struct RegionFile region;
+        int end = 0;
+        if (sscanf(entry->d_name, "r.%d.%d.%n", &(region.x), &(region.z), &end) != 2 || end == 0)
+            continue;
+        if (strcmp(entry->d_name + end, "mca") == 0)
+        {
+            region.anvil = true;
+        } else if (strcmp(entry->d_name + end, "mcr") == 0) {
+            region.anvil = false;
+        } else {
+            continue;
+        }
+        
+        region.path = rs_malloc(strlen(region_path) + strlen(entry->d_name) + 2);
+        sprintf(region.path, "%s/%s", region_path, entry->d_name);
+        
+        /* empty files are left behind by some tools -- there's nothing
+         * in them to read
+         */
+        struct stat stat_buf;
+        if (stat(region.path, &stat_buf) < 0 || stat_buf.st_size < 8192)
+        {
+            rs_free(region.path);
+            continue;
+        }
+        
+        rs_array_append(self->regions, region);
+    }
+    closedir(dir);
+    rs_free(region_path);
+    
+    /* sort, and drop .mcr files that have a .mca file to replace them */
+    rs_array_sort(self->regions, _rs_world_compare_regions);
+    size_t i;
+    for (i = 1; i < self->regions->length; i++)
+    {
+        struct RegionFile* prev = &rs_array_index(self->regions, struct RegionFile, i - 1);
+        struct RegionFile* region = &rs_array_index(self->regions, struct RegionFile, i);
+        if (prev->x == region->x && prev->z == region->z)
+        {
+            rs_free(region->path);
+            rs_array_remove_index(self->regions, i);
+            i--;
+        }
+    }
+    
+    return self;
+}
+
+void rs_world_close(RSWorld* self)
+{
+    rs_return_if_fail(self);
+    
+    size_t i;
+    for (i = 0; i < self->regions->length; i++)
+        rs_free(rs_array_index(self->regions, struct RegionFile, i).path);
+    rs_array_free(self->regions);
+    rs_free(self->path);
+    rs_free(self);
+}
+
+unsigned int rs_world_get_region_count(RSWorld* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return self->regions->length;
+}
+
+void rs_world_get_region_position(RSWorld* self, unsigned int i, int* x, int* z)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(i < self->regions->length);
+    
+    struct RegionFile* region = &rs_array_index(self->regions, struct RegionFile, i);
+    if (x)
+        *x = region->x;
+    if (z)
+        *z = region->z;
+}
+
+RSRegion* rs_world_open_region(RSWorld* self, unsigned int i, bool write)
+{
+    rs_return_val_if_fail(self, NULL);
+    rs_return_val_if_fail(i < self->regions->length, NULL);
+    
+    return rs_region_open(rs_array_index(self->regions, struct RegionFile, i).path, write);
+}
+
+/*
+ * parallel iteration
+ */
+
+/* a run of chunks in one region, [begin, end) in x + z*32 order */
+typedef struct
+{
+    unsigned int region;
+    uint16_t begin, end;
+} RSWorldTask;
+
+typedef struct _RSWorldJob RSWorldJob;
+
+typedef struct
+{
+    RSWorldJob* job;
+    unsigned int index;
+    
+    /* the owner takes tasks from the back, others steal from the front */
+    RSArray* tasks;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+    
+    RSDecompressor* decompressor;
+    RSArena* arena;
+    void* data;
+} RSWorldWorker;
+
+struct _RSWorldJob
+{
+    RSWorld* world;
+    RSWorldChunkFilter filter;
+    RSWorldChunkFunction callback;
+    void* user_data;
+    
+    RSWorldWorker* workers;
+    unsigned int nworkers;
+    
+    /* tasks queued or running -- workers stop when this hits 0 */
+    unsigned int pending;
+    /* tasks queued -- workers with nothing to do wait for more */
+    unsigned int queued;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+#endif
+    bool failed;
+};
+
+static inline void _rs_world_worker_lock(RSWorldWorker* worker)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&(worker->lock));
+#endif
+}
+
+static inline void _rs_world_worker_unlock(RSWorldWorker* worker)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&(worker->lock));
+#endif
+}
+
+/* wakes workers waiting for tasks, after some are queued (or the last
+ * one is done, when all of them go)
+ */
+static inline void _rs_world_job_wake(RSWorldJob* job, bool all)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&(job->lock));
+    if (all)
+    {
+        pthread_cond_broadcast(&(job->wake));
+    } else {
+        pthread_cond_signal(&(job->wake));
+    }
+    pthread_mutex_unlock(&(job->lock));
+#endif
+}
+
+/* waits until a task is queued, or everything is done */
+static inline void _rs_world_job_wait(RSWorldJob* job)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&(job->lock));
+    while (__atomic_load_n(&(job->pending), __ATOMIC_ACQUIRE) > 0 && __atomic_load_n(&(job->queued), __ATOMIC_ACQUIRE) == 0)
+        pthread_cond_wait(&(job->wake), &(job->lock));
+    pthread_mutex_unlock(&(job->lock));
+#endif
+}
+
+static bool _rs_world_take_task(RSWorldWorker* worker, RSWorldTask* task)
+{
+    /* the newest task of our own first, since its region is likely
+     * still in the cache
+     */
+    _rs_world_worker_lock(worker);
+    if (worker->tasks->length > 0)
+    {
+        *task = rs_array_index(worker->tasks, RSWorldTask, worker->tasks->length - 1);
+        rs_array_set_length(worker->tasks, worker->tasks->length - 1);
+        _rs_world_worker_unlock(worker);
+        __atomic_sub_fetch(&(worker->job->queued), 1, __ATOMIC_ACQ_REL);
+        return true;
+    }
+    _rs_world_worker_unlock(worker);
+    
+    /* then the oldest (and biggest) task of someone else */
+    RSWorldJob* job = worker->job;
+    unsigned int k;
+    for (k = 1; k < job->nworkers; k++)
+    {
+        RSWorldWorker* victim = &(job->workers[(worker->index + k) % job->nworkers]);
+        _rs_world_worker_lock(victim);
+        if (victim->tasks->length > 0)
+        {
+            *task = rs_array_index(victim->tasks, RSWorldTask, 0);
+            rs_array_remove_index(victim->tasks, 0);
+            _rs_world_worker_unlock(victim);
+            __atomic_sub_fetch(&(job->queued), 1, __ATOMIC_ACQ_REL);
+            return true;
+        }
+        _rs_world_worker_unlock(victim);
+    }
+    
+    return false;
+}
+
+static void _rs_world_run_task(RSWorldWorker* worker, RSWorldTask* task)
+{
+    RSWorldJob* job = worker->job;
+    RSRegion* region = rs_world_open_region(job->world, task->region, false);
+    if (!region)
+    {
+        __atomic_store_n(&(job->failed), true, __ATOMIC_RELAXED);
+        return;
+    }
+    
+    int rx, rz;
+    rs_world_get_region_position(job->world, task->region, &rx, &rz);
+    
+    unsigned int i;
+    for (i = task->begin; i < task->end; i++)
+    {
+        uint8_t x = i % 32;
+        uint8_t z = i / 32;
+        if (!rs_region_contains_chunk(region, x, z))
+            continue;
+        if (job->filter && !job->filter(rx * 32 + x, rz * 32 + z, rs_region_get_chunk_timestamp(region, x, z), job->user_data))
+            continue;
+        
+        /* the region keeps its dictionary, so load it outside the arena */
+        RSCompressionType enc = rs_region_get_chunk_compression(region, x, z);
+        RSDictionary* dictionary = (enc == RS_ZSTD) ? rs_region_get_dictionary(region) : NULL;
+        
+        rs_memory_push(rs_arena_get_memory_functions(worker->arena));
+        
+        uint8_t* rawdata;
+        size_t rawdatalen;
+        rs_decompressor_decompress_full(worker->decompressor, enc, dictionary,
+                                        rs_region_get_chunk_data(region, x, z), rs_region_get_chunk_length(region, x, z),
+                                        &rawdata, &rawdatalen);
+        RSNBT* chunk = rawdata ? rs_nbt_parse(rawdata, rawdatalen, RS_UNCOMPRESSED) : NULL;
+        if (chunk)
+        {
+            job->callback(rx * 32 + x, rz * 32 + z, chunk, worker->data, job->user_data);
+        } else {
+            __atomic_store_n(&(job->failed), true, __ATOMIC_RELAXED);
+        }
+        
+        /* everything from this chunk is in the arena, so there is no
+         * need to free it piece by piece
+         */
+        rs_memory_pop();
+        rs_arena_reset(worker->arena);
+    }
+    
+    rs_region_close(region);
+}
+
+static void* _rs_world_worker(void* data)
+{
+    RSWorldWorker* worker = data;
+    RSWorldJob* job = worker->job;
+    
+    while (__atomic_load_n(&(job->pending), __ATOMIC_ACQUIRE) > 0)
+    {
+        RSWorldTask task;
+        if (!_rs_world_take_task(worker, &task))
+        {
+            /* everything left is running, but might still be split */
+            _rs_world_job_wait(job);
+            continue;
+        }
+        
+        /* keep the first part, and leave the rest to whoever gets to
+         * it first
+         */
+        while (task.end - task.begin > RS_WORLD_SPLIT_SIZE)
+        {
+            RSWorldTask rest = task;
+            rest.begin = task.begin + (task.end - task.begin) / 2;
+            task.end = rest.begin;
+            
+            __atomic_add_fetch(&(job->pending), 1, __ATOMIC_RELAXED);
+            _rs_world_worker_lock(worker);
+            rs_array_append(worker->tasks, rest);
+            _rs_world_worker_unlock(worker);
+            __atomic_add_fetch(&(job->queued), 1, __ATOMIC_ACQ_REL);
+            _rs_world_job_wake(job, false);
+        }
+        
+        _rs_world_run_task(worker, &task);
+        if (__atomic_sub_fetch(&(job->pending), 1, __ATOMIC_ACQ_REL) == 0)
+            _rs_world_job_wake(job, true);
+    }
+    
+    return NULL;
+}
+
+bool rs_world_foreach_chunk_parallel(RSWorld* self, RSWorldChunkFilter filter, RSWorldChunkFunction callback, void* user_data, unsigned int nthreads)
+{
+    return rs_world_foreach_chunk_parallel_full(self, filter, callback, NULL, user_data, nthreads);
+}
+
+bool rs_world_foreach_chunk_parallel_full(RSWorld* self, RSWorldChunkFilter filter, RSWorldChunkFunction callback, const RSWorldReducer* reducer, void* user_data, unsigned int nthreads)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(callback, false);
+    
+#ifdef HAVE_PTHREAD
+    if (nthreads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (cpus > 0) ? cpus : 1;
+    }
+#else
+    nthreads = 1;
+#endif
+    
+    RSWorldJob job;
+    memset(&job, 0, sizeof(job));
+    job.world = self;
+    job.filter = filter;
+    job.callback = callback;
+    job.user_data = user_data;
+    job.nworkers = nthreads;
+    job.workers = rs_new0(RSWorldWorker, nthreads);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&(job.lock), NULL);
+    pthread_cond_init(&(job.wake), NULL);
+#endif
+    
+    unsigned int w;
+    for (w = 0; w < nthreads; w++)
+    {
+        RSWorldWorker* worker = &(job.workers[w]);
+        worker->job = &job;
+        worker->index = w;
+        worker->tasks = rs_array_new(sizeof(RSWorldTask));
+#ifdef HAVE_PTHREAD
+        pthread_mutex_init(&(worker->lock), NULL);
+#endif
+        worker->decompressor = rs_decompressor_new();
+        worker->arena = rs_arena_new(0);
+        if (reducer && reducer->worker_data_size > 0)
+            worker->data = rs_malloc0(reducer->worker_data_size);
+        if (reducer && reducer->init)
+            reducer->init(worker->data, user_data);
+    }
+    
+    /* deal out whole regions to start with */
+    unsigned int i;
+    for (i = 0; i < self->regions->length; i++)
+    {
+        RSWorldTask task = {i, 0, 32 * 32};
+        rs_array_append(job.workers[i % nthreads].tasks, task);
+        job.pending++;
+        job.queued++;
+    }
+    
+#ifdef HAVE_PTHREAD
+    /* the calling thread is worker 0, and if a thread can't be started
+     * the others steal its work
+     */
+    pthread_t* threads = rs_new0(pthread_t, nthreads);
+    unsigned int started = 0;
+    while (started + 1 < nthreads && pthread_create(&(threads[started]), NULL, _rs_world_worker, &(job.workers[started + 1])) == 0)
+        started++;
+    _rs_world_worker(&(job.workers[0]));
+    
+    unsigned int t;
+    for (t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+    rs_free(threads);
+#else
+    _rs_world_worker(&(job.workers[0]));
+#endif
+    
+    for (w = 0; w < nthreads; w++)
+    {
+        RSWorldWorker* worker = &(job.workers[w]);
+        if (reducer && reducer->reduce)
+            reducer->reduce(worker->data, user_data);
+        
+        rs_free(worker->data);
+        rs_arena_free(worker->arena);
+        rs_decompressor_free(worker->decompressor);
+#ifdef HAVE_PTHREAD
+        pthread_mutex_destroy(&(worker->lock));
+#endif
+        rs_array_free(worker->tasks);
+    }
+    rs_free(job.workers);
+#ifdef HAVE_PTHREAD
+    pthread_cond_destroy(&(job.wake));
+    pthread_mutex_destroy(&(job.lock));
+#endif
+    
+    return !job.failed;
+}
+
+/*
+ * change manifests
+ */
+
+/* "RSMF", then a version, then big-endian entries */
+#define RS_WORLD_MANIFEST_MAGIC 0x52534d46
+#define RS_WORLD_MANIFEST_VERSION 1
+
+struct ManifestEntry
+{
+    int32_t x, z;
+    uint32_t timestamp;
+    uint32_t length;
+    uint64_t hash;
+    
+    /* the rs_world_changed_since() call that last saw this chunk */
+    uint32_t seen;
+};
+
+struct _RSWorldManifest
+{
+    /* struct ManifestEntry*, keyed by chunk position */
+    RSHashMap* entries;
+    uint32_t generation;
+};
+
+static inline int64_t _rs_world_manifest_key(int x, int z)
+{
+    return (int64_t)(((uint64_t)(uint32_t)x << 32) | (uint32_t)z);
+}
+
+static struct ManifestEntry* _rs_world_manifest_add(RSWorldManifest* self, int x, int z)
+{
+    struct ManifestEntry* entry = rs_new0(struct ManifestEntry, 1);
+    entry->x = x;
+    entry->z = z;
+    rs_hash_map_insert_int(self->entries, _rs_world_manifest_key(x, z), entry);
+    return entry;
+}
+
+RSWorldManifest* rs_world_manifest_new(void)
+{
+    RSWorldManifest* self = rs_new0(RSWorldManifest, 1);
+    self->entries = rs_hash_map_new_full(RS_HASH_MAP_INTEGER_KEYS, rs_free);
+    return self;
+}
+
+RSWorldManifest* rs_world_manifest_load(const char* path)
+{
+    rs_return_val_if_fail(path, NULL);
+    
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    
+    uint32_t header[3];
+    if (fread(header, sizeof(uint32_t), 3, f) != 3 ||
+        rs_endian_uint32(header[0]) != RS_WORLD_MANIFEST_MAGIC ||
+        rs_endian_uint32(header[1]) != RS_WORLD_MANIFEST_VERSION)
+    {
+        fclose(f);
+        return NULL;
+    }
+    
+    RSWorldManifest* self = rs_world_manifest_new();
+    uint32_t count = rs_endian_uint32(header[2]);
+    uint32_t i;
+    for (i = 0; i < count; i++)
+    {
+        uint32_t fields[6];
+        if (fread(fields, sizeof(uint32_t), 6, f) != 6)
+        {
+            rs_world_manifest_free(self);
+            fclose(f);
+            return NULL;
+        }
+        
+        struct ManifestEntry* entry = _rs_world_manifest_add(self, rs_endian_int32(fields[0]), rs_endian_int32(fields[1]));
+        entry->timestamp = rs_endian_uint32(fields[2]);
+        entry->length = rs_endian_uint32(fields[3]);
+        entry->hash = ((uint64_t)rs_endian_uint32(fields[4]) << 32) | rs_endian_uint32(fields[5]);
+    }
+    
+    fclose(f);
+    return self;
+}
+
+static int _rs_world_compare_entries(const void* a, const void* b)
+{
+    const struct ManifestEntry* ea = *(struct ManifestEntry* const*)a;
+    const struct ManifestEntry* eb = *(struct ManifestEntry* const*)b;
+    
+    if (ea->x != eb->x)
+        return (ea->x < eb->x) ? -1 : 1;
+    if (ea->z != eb->z)
+        return (ea->z < eb->z) ? -1 : 1;
+    return 0;
+}
+
+bool rs_world_manifest_save(RSWorldManifest* self, const char* path)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(path, false);
+    
+    /* write entries in order, so the same world gives the same file */
+    RSArray* sorted = rs_array_sized_new(sizeof(struct ManifestEntry*), rs_hash_map_get_size(self->entries));
+    RSHashMapIterator it;
+    void* value;
+    rs_hash_map_iterator_init(self->entries, &it);
+    while (rs_hash_map_iterator_next_int(&it, NULL, &value))
+        rs_array_append(sorted, value);
+    rs_array_sort(sorted, _rs_world_compare_entries);
+    
+    FILE* f = fopen(path, "wb");
+    if (!f)
+    {
+        rs_array_free(sorted);
+        return false;
+    }
+    
+    uint32_t header[3];
+    header[0] = rs_endian_uint32(RS_WORLD_MANIFEST_MAGIC);
+    header[1] = rs_endian_uint32(RS_WORLD_MANIFEST_VERSION);
+    header[2] = rs_endian_uint32(sorted->length);
+    bool ok = (fwrite(header, sizeof(uint32_t), 3, f) == 3);
+    
+    size_t i;
+    for (i = 0; ok && i < sorted->length; i++)
+    {
+        struct ManifestEntry* entry = rs_array_index(sorted, struct ManifestEntry*, i);
+        uint32_t fields[6];
+        fields[0] = rs_endian_uint32((uint32_t)entry->x);
+        fields[1] = rs_endian_uint32((uint32_t)entry->z);
+        fields[2] = rs_endian_uint32(entry->timestamp);
+        fields[3] = rs_endian_uint32(entry->length);
+        fields[4] = rs_endian_uint32(entry->hash >> 32);
+        fields[5] = rs_endian_uint32(entry->hash & 0xffffffff);
+        ok = (fwrite(fields, sizeof(uint32_t), 6, f) == 6);
+    }
+    
+    if (fclose(f) != 0)
+        ok = false;
+    rs_array_free(sorted);
+    return ok;
+}
+
+void rs_world_manifest_free(RSWorldManifest* self)
+{
+    rs_return_if_fail(self);
+    
+    rs_hash_map_free(self->entries);
+    rs_free(self);
+}
+
+/* a fast, non-cryptographic hash of a chunk's stored data, read a word
+ * at a time (big-endian, so manifests move between machines)
+ */
+static uint64_t _rs_world_hash(const uint8_t* data, size_t len)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ len;
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        hash = (hash ^ rs_endian_uint64(word)) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+        data += 8;
+        len -= 8;
+    }
+    
+    uint64_t tail = 0;
+    while (len > 0)
+    {
+        tail = (tail << 8) | *data;
+        data++;
+        len--;
+    }
+    hash = (hash ^ tail) * 0xff51afd7ed558ccdULL;
+    
+    /* finish off like splitmix64 */
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+RSArray* rs_world_changed_since(RSWorld* self, RSWorldManifest* manifest)
+{
+    rs_return_val_if_fail(self, NULL);
+    rs_return_val_if_fail(manifest, NULL);
+    
+    RSArray* changes = rs_array_new(sizeof(RSWorldChange));
+    uint32_t generation = ++(manifest->generation);
+    
+    unsigned int i;
+    for (i = 0; i < self->regions->length; i++)
+    {
+        int rx, rz;
+        rs_world_get_region_position(self, i, &rx, &rz);
+        RSRegion* region = rs_world_open_region(self, i, false);
+        unsigned int c;
+        
+        if (!region)
+        {
+            /* we can't tell what happened to these, so they stay as
+             * they were, rather than being reported as deleted
+             */
+            for (c = 0; c < 32 * 32; c++)
+            {
+                struct ManifestEntry* entry = rs_hash_map_lookup_int(manifest->entries, _rs_world_manifest_key(rx * 32 + c % 32, rz * 32 + c / 32));
+                if (entry)
+                    entry->seen = generation;
+            }
+            continue;
+        }
+        
+        for (c = 0; c < 32 * 32; c++)
+        {
+            uint8_t x = c % 32;
+            uint8_t z = c / 32;
+            if (!rs_region_contains_chunk(region, x, z))
+                continue;
+            
+            RSWorldChange change = {rx * 32 + x, rz * 32 + z, RS_CHUNK_ADDED};
+            uint32_t timestamp = rs_region_get_chunk_timestamp(region, x, z);
+            uint32_t length = rs_region_get_chunk_length(region, x, z);
+            struct ManifestEntry* entry = rs_hash_map_lookup_int(manifest->entries, _rs_world_manifest_key(change.x, change.z));
+            
+            if (entry)
+            {
+                entry->seen = generation;
+                
+                /* the timestamp table is the cheap check; only chunks
+                 * that fail it get hashed
+                 */
+                if (entry->timestamp == timestamp && entry->length == length)
+                    continue;
+                
+                uint64_t hash = _rs_world_hash(rs_region_get_chunk_data(region, x, z), length);
+                entry->timestamp = timestamp;
+                if (entry->length == length && entry->hash == hash)
+                    continue;
+                
+                entry->length = length;
+                entry->hash = hash;
+                change.type = RS_CHUNK_MODIFIED;
+            } else {
+                entry = _rs_world_manifest_add(manifest, change.x, change.z);
+                entry->timestamp = timestamp;
+                entry->length = length;
+                entry->hash = _rs_world_hash(rs_region_get_chunk_data(region, x, z), length);
+                entry->seen = generation;
+            }
+            
+            rs_array_append(changes, change);
+        }
+        
+        rs_region_close(region);
+    }
+    
+    /* anything not seen this time has been deleted */
+    RSArray* deleted = rs_array_new(sizeof(int64_t));
+    RSHashMapIterator it;
+    int64_t key;
+    void* value;
+    rs_hash_map_iterator_init(manifest->entries, &it);
+    while (rs_hash_map_iterator_next_int(&it, &key, &value))
+    {
+        struct ManifestEntry* entry = value;
+        if (entry->seen == generation)
+            continue;
+        
+        RSWorldChange change = {entry->x, entry->z, RS_CHUNK_DELETED};
+        rs_array_append(changes, change);
+        rs_array_append(deleted, key);
+    }
+    
+    size_t d;
+    for (d = 0; d < deleted->length; d++)
+        rs_hash_map_remove_int(manifest->entries, rs_array_index(deleted, int64_t, d));
+    rs_array_free(deleted);
+    
+    return changes;
+}
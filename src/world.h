@@ -0,0 +1,270 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_WORLD_H_INCLUDED__
+#define __RS_WORLD_H_INCLUDED__
+
+#include "region.h"
+#include "nbt.h"
+#include "array.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct _RSWorld;
+/**
+ * The world data type.
+ *
+ * This is an opaque handle for a world directory, and the region
+ * files in its region/ subdirectory.
+ */
+typedef struct _RSWorld RSWorld;
+
+/**
+ * Chunk filter type, used by rs_world_foreach_chunk_parallel().
+ *
+ * Filters are called before a chunk is decompressed, so they are a
+ * cheap way to skip chunks. x and z are chunk coordinates in the
+ * world, not within a region.
+ *
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \param timestamp the last modified time of the chunk
+ * \param user_data the pointer given with the filter
+ * \return true to visit the chunk, false to skip it
+ */
+typedef bool (*RSWorldChunkFilter)(int x, int z, uint32_t timestamp, void* user_data);
+
+/**
+ * Chunk callback type, used by rs_world_foreach_chunk_parallel().
+ *
+ * The chunk, and anything allocated with rs_malloc() during the call,
+ * comes from the worker's arena (see rs_memory_push()), and is thrown
+ * away once the callback returns. Keep results in worker_data.
+ *
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \param chunk the parsed chunk
+ * \param worker_data this worker's data (see RSWorldReducer), or NULL
+ * \param user_data the pointer given with the callback
+ */
+typedef void (*RSWorldChunkFunction)(int x, int z, RSNBT* chunk, void* worker_data, void* user_data);
+
+/**
+ * Per-worker results for rs_world_foreach_chunk_parallel_full().
+ *
+ * Each worker thread gets its own worker_data, so callbacks can add up
+ * results without any locking. When every chunk is done, reduce is
+ * called once for each worker, one at a time, to combine them.
+ *
+ * \sa rs_world_foreach_chunk_parallel_full
+ */
+typedef struct
+{
+    /** the size of each worker's data, which starts out zeroed */
+    size_t worker_data_size;
+    /** optional -- sets up a worker's data, before any chunks */
+    void (*init)(void* worker_data, void* user_data);
+    /** optional -- combines a worker's data into user_data */
+    void (*reduce)(void* worker_data, void* user_data);
+} RSWorldReducer;
+
+/**
+ * Open a world.
+ *
+ * This finds the region files (r.X.Z.mca, or r.X.Z.mcr if there is no
+ * .mca) in the region/ subdirectory of path. The regions themselves
+ * are only opened when they are needed.
+ *
+ * \param path the path to the world directory
+ * \return the new world, or NULL if it has no region directory
+ * \sa rs_world_close
+ */
+RSWorld* rs_world_open(const char* path);
+
+/**
+ * Close a world, and free everything associated with it.
+ *
+ * \param self the world to close
+ * \sa rs_world_open
+ */
+void rs_world_close(RSWorld* self);
+
+/**
+ * Get the number of regions in a world.
+ *
+ * Regions are numbered from 0, in order of their x, then z,
+ * coordinates.
+ *
+ * \param self the world
+ * \return the number of regions
+ */
+unsigned int rs_world_get_region_count(RSWorld* self);
+
+/**
+ * Get the coordinates of a region in a world.
+ *
+ * \param self the world
+ * \param i the index of the region
+ * \param x where to put the x coordinate of the region, or NULL
+ * \param z where to put the z coordinate of the region, or NULL
+ * \sa rs_world_get_region_count
+ */
+void rs_world_get_region_position(RSWorld* self, unsigned int i, int* x, int* z);
+
+/**
+ * Open one of the regions in a world.
+ *
+ * \param self the world
+ * \param i the index of the region
+ * \param write whether to open the region in write mode
+ * \return the region, which must be closed with rs_region_close(), or
+ * NULL
+ * \sa rs_world_get_region_count, rs_region_open
+ */
+RSRegion* rs_world_open_region(RSWorld* self, unsigned int i, bool write);
+
+/**
+ * Visit every chunk in a world, on several threads.
+ *
+ * This is rs_world_foreach_chunk_parallel_full() without per-worker
+ * results.
+ *
+ * \param self the world
+ * \param filter decides which chunks to visit, or NULL for all
+ * \param callback called with each parsed chunk
+ * \param user_data passed to filter and callback
+ * \param nthreads how many threads to use, or 0 for one per processor
+ * \return true if every chunk visited could be parsed
+ * \sa rs_world_foreach_chunk_parallel_full
+ */
+bool rs_world_foreach_chunk_parallel(RSWorld* self, RSWorldChunkFilter filter, RSWorldChunkFunction callback, void* user_data, unsigned int nthreads);
+
+/**
+ * Visit every chunk in a world, on several threads, and reduce the
+ * results.
+ *
+ * Each worker has its own queue of work: whole regions to start with,
+ * split into smaller runs of chunks when they are large. Workers that
+ * run out take work from the others, so one slow region does not hold
+ * up the rest. Each worker also has its own RSDecompressor, and parses
+ * chunks into its own RSArena, which is emptied after every chunk.
+ *
+ * filter and callback are called from the worker threads, in no
+ * particular order, and may run at the same time as each other. A
+ * chunk that can't be parsed is skipped, and this returns false once
+ * the rest are done.
+ *
+ * \param self the world
+ * \param filter decides which chunks to visit, or NULL for all
+ * \param callback called with each parsed chunk
+ * \param reducer how to keep per-worker results, or NULL for none
+ * \param user_data passed to filter, callback, and reducer
+ * \param nthreads how many threads to use, or 0 for one per processor
+ * \return true if every chunk visited could be parsed
+ * \sa RSWorldReducer, rs_world_foreach_chunk_parallel
+ */
+bool rs_world_foreach_chunk_parallel_full(RSWorld* self, RSWorldChunkFilter filter, RSWorldChunkFunction callback, const RSWorldReducer* reducer, void* user_data, unsigned int nthreads);
+
+struct _RSWorldManifest;
+/**
+ * The world manifest data type.
+ *
+ * A manifest remembers the timestamp, payload length and a hash of
+ * every chunk in a world, as of the last call to
+ * rs_world_changed_since(). Keep one on disk next to each world (see
+ * rs_world_manifest_save()) to find out which chunks changed between
+ * runs.
+ *
+ * \sa rs_world_changed_since
+ */
+typedef struct _RSWorldManifest RSWorldManifest;
+
+/**
+ * The ways a chunk can change.
+ *
+ * \sa RSWorldChange
+ */
+typedef enum
+{
+    /** the chunk is new since the manifest */
+    RS_CHUNK_ADDED,
+    /** the chunk's data is different */
+    RS_CHUNK_MODIFIED,
+    /** the chunk is gone */
+    RS_CHUNK_DELETED
+} RSWorldChangeType;
+
+/**
+ * A changed chunk, returned by rs_world_changed_since().
+ */
+typedef struct
+{
+    /** the x coordinate of the chunk, in the world */
+    int x;
+    /** the z coordinate of the chunk, in the world */
+    int z;
+    /** what happened to it */
+    RSWorldChangeType type;
+} RSWorldChange;
+
+/**
+ * Create a new, empty manifest.
+ *
+ * Every chunk in a world is new to an empty manifest.
+ *
+ * \return the new manifest
+ * \sa rs_world_manifest_load, rs_world_manifest_free
+ */
+RSWorldManifest* rs_world_manifest_new(void);
+
+/**
+ * Load a manifest written by rs_world_manifest_save().
+ *
+ * \param path the path to the manifest file
+ * \return the manifest, or NULL if it can't be read
+ * \sa rs_world_manifest_save
+ */
+RSWorldManifest* rs_world_manifest_load(const char* path);
+
+/**
+ * Write a manifest to a file.
+ *
+ * \param self the manifest to write
+ * \param path the path to write it to
+ * \return true on success
+ * \sa rs_world_manifest_load
+ */
+bool rs_world_manifest_save(RSWorldManifest* self, const char* path);
+
+/**
+ * Free a manifest.
+ *
+ * \param self the manifest to free
+ */
+void rs_world_manifest_free(RSWorldManifest* self);
+
+/**
+ * Find the chunks that changed since a manifest was made.
+ *
+ * Chunks whose timestamp and payload length match the manifest are
+ * assumed to be unchanged, without reading them. Any others are hashed
+ * (compressed, as they are stored), and only count as modified if the
+ * hash is different.
+ *
+ * The manifest is then brought up to date with the world, so saving
+ * it afterwards records that these changes have been seen. Chunks in a
+ * region file that can't be opened are left as they were in the
+ * manifest, and not reported at all.
+ *
+ * \param self the world
+ * \param manifest the manifest to compare with, and update
+ * \return an array of RSWorldChange, to be freed with rs_array_free()
+ * \sa rs_world_manifest_save
+ */
+RSArray* rs_world_changed_since(RSWorld* self, RSWorldManifest* manifest);
+
+#endif /* __RS_WORLD_H_INCLUDED__ */
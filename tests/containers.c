@@ -0,0 +1,354 @@
+/*
+ * This program is part of libredstone.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* checks RSArray and RSHashMap -- growing, removing, iterating, and
+ * keys that collide
+ */
+
+#include "redstone.h"
+#include <string.h>
+#include <stdio.h>
+
+static unsigned int failures = 0;
+
+#define check(expr)                                                     \
+    do {                                                                \
+        if (!(expr))                                                    \
+        {                                                               \
+            fprintf(stderr, "%s:%i: check failed: %s\n", __FILE__, __LINE__, #expr); \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+/* the same as hashmap.c, so tests can pick keys that collide */
+#define HOME_SLOTS 16
+
+static size_t home_slot(int64_t key)
+{
+    uint64_t hash = (uint64_t)key;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash & (HOME_SLOTS - 1);
+}
+
+/* finds n keys, starting from *next, that all live in one home slot */
+static void find_colliding(size_t slot, int64_t* next, int64_t* keys, unsigned int n)
+{
+    unsigned int found = 0;
+    for (; found < n; (*next)++)
+    {
+        if (home_slot(*next) == slot)
+            keys[found++] = *next;
+    }
+}
+
+static int compare_ints(const void* a, const void* b)
+{
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static void test_array(void)
+{
+    RSArray* array = rs_array_new(sizeof(int));
+    check(array->length == 0);
+    
+    /* one at a time, through several doublings */
+    int i;
+    for (i = 0; i < 10000; i++)
+        rs_array_append(array, i);
+    check(array->length == 10000);
+    bool in_order = true;
+    for (i = 0; i < 10000; i++)
+        in_order = in_order && rs_array_index(array, int, i) == i;
+    check(in_order);
+    
+    /* growing by more than double at once */
+    int many[100000];
+    for (i = 0; i < 100000; i++)
+        many[i] = -i;
+    rs_array_append_vals(array, many, 100000);
+    check(array->length == 110000);
+    check(rs_array_index(array, int, 9999) == 9999);
+    check(rs_array_index(array, int, 109999) == -99999);
+    
+    rs_array_set_length(array, 3);
+    int middle[] = {10, 11};
+    rs_array_insert_vals(array, 1, middle, 2);
+    check(array->length == 5);
+    check(rs_array_index(array, int, 0) == 0);
+    check(rs_array_index(array, int, 1) == 10);
+    check(rs_array_index(array, int, 2) == 11);
+    check(rs_array_index(array, int, 3) == 1);
+    check(rs_array_index(array, int, 4) == 2);
+    
+    /* 0 10 11 1 2 => 0 11 1 2 => 0 2 1 */
+    rs_array_remove_index(array, 1);
+    check(array->length == 4);
+    check(rs_array_index(array, int, 1) == 11);
+    rs_array_remove_index_fast(array, 1);
+    check(array->length == 3);
+    check(rs_array_index(array, int, 1) == 2);
+    rs_array_remove_index_fast(array, 2);
+    check(array->length == 2);
+    
+    /* new elements from set_length are zeroed */
+    rs_array_set_length(array, 6);
+    check(rs_array_index(array, int, 5) == 0);
+    rs_array_sort(array, compare_ints);
+    check(rs_array_index(array, int, 0) == 0);
+    check(rs_array_index(array, int, 5) == 2);
+    
+    rs_array_clear(array);
+    check(array->length == 0);
+    rs_array_free(array);
+    
+    /* reserving up front means no moves later */
+    array = rs_array_sized_new(sizeof(int), 1000);
+    void* data = array->data;
+    for (i = 0; i < 1000; i++)
+        rs_array_append(array, i);
+    check(array->data == data);
+    rs_array_free(array);
+}
+
+static unsigned int freed = 0;
+
+static void count_free(void* value)
+{
+    if (value)
+        freed++;
+}
+
+static void test_hash_map_grow(void)
+{
+    RSHashMap* map = rs_hash_map_new(RS_HASH_MAP_INTEGER_KEYS);
+    check(rs_hash_map_lookup_int(map, 0) == NULL);
+    check(!rs_hash_map_remove_int(map, 0));
+    
+    /* values are key + 1, so none of them are NULL */
+    int64_t i;
+    for (i = 0; i < 50000; i++)
+        rs_hash_map_insert_int(map, i * 7 - 100000, (void*)(intptr_t)(i + 1));
+    check(rs_hash_map_get_size(map) == 50000);
+    
+    bool all_found = true;
+    for (i = 0; i < 50000; i++)
+        all_found = all_found && rs_hash_map_lookup_int(map, i * 7 - 100000) == (void*)(intptr_t)(i + 1);
+    check(all_found);
+    check(!rs_hash_map_contains_int(map, 1 - 100000));
+    
+    /* replacing keeps the size the same */
+    rs_hash_map_insert_int(map, -100000, (void*)(intptr_t)42);
+    check(rs_hash_map_get_size(map) == 50000);
+    check(rs_hash_map_lookup_int(map, -100000) == (void*)(intptr_t)42);
+    
+    rs_hash_map_free(map);
+}
+
+static void test_hash_map_collisions(void)
+{
+    RSHashMap* map = rs_hash_map_new(RS_HASH_MAP_INTEGER_KEYS);
+    
+    /* a run of keys that all want the last slot, so the run wraps
+     * around to the start of the table
+     */
+    int64_t next = 0;
+    int64_t keys[8];
+    find_colliding(HOME_SLOTS - 1, &next, keys, 5);
+    find_colliding(1, &next, keys + 5, 3);
+    
+    unsigned int i;
+    for (i = 0; i < 8; i++)
+        rs_hash_map_insert_int(map, keys[i], (void*)(intptr_t)(i + 1));
+    check(rs_hash_map_get_size(map) == 8);
+    for (i = 0; i < 8; i++)
+        check(rs_hash_map_lookup_int(map, keys[i]) == (void*)(intptr_t)(i + 1));
+    
+    /* take them out from the front of each run, so everything after
+     * has to shift back -- including across the wrap, and the slot-1
+     * keys that got pushed out of their home
+     */
+    unsigned int order[] = {0, 5, 2, 7, 1, 3, 6, 4};
+    unsigned int removed;
+    for (removed = 0; removed < 8; removed++)
+    {
+        check(rs_hash_map_remove_int(map, keys[order[removed]]));
+        check(!rs_hash_map_remove_int(map, keys[order[removed]]));
+        check(rs_hash_map_get_size(map) == 7 - removed);
+    
+        unsigned int j;
+        for (j = 0; j < 8; j++)
+        {
+            bool gone = false;
+            unsigned int k;
+            for (k = 0; k <= removed; k++)
+                gone = gone || order[k] == j;
+            check(rs_hash_map_lookup_int(map, keys[j]) == (gone ? NULL : (void*)(intptr_t)(j + 1)));
+        }
+    }
+    
+    rs_hash_map_free(map);
+}
+
+static void test_hash_map_remove(void)
+{
+    RSHashMap* map = rs_hash_map_new(RS_HASH_MAP_INTEGER_KEYS);
+    
+    /* remove every other key, then check the rest are still reachable
+     * with nothing left behind to skip over
+     */
+    int64_t i;
+    for (i = 0; i < 4096; i++)
+        rs_hash_map_insert_int(map, i, (void*)(intptr_t)(i + 1));
+    for (i = 0; i < 4096; i += 2)
+        check(rs_hash_map_remove_int(map, i));
+    check(rs_hash_map_get_size(map) == 2048);
+    
+    bool right = true;
+    for (i = 0; i < 4096; i++)
+        right = right && rs_hash_map_lookup_int(map, i) == ((i & 1) ? (void*)(intptr_t)(i + 1) : NULL);
+    check(right);
+    
+    /* put them back, and take the others out */
+    for (i = 0; i < 4096; i += 2)
+        rs_hash_map_insert_int(map, i, (void*)(intptr_t)(i + 1));
+    for (i = 1; i < 4096; i += 2)
+        check(rs_hash_map_remove_int(map, i));
+    check(rs_hash_map_get_size(map) == 2048);
+    
+    right = true;
+    for (i = 0; i < 4096; i++)
+        right = right && rs_hash_map_lookup_int(map, i) == ((i & 1) ? NULL : (void*)(intptr_t)(i + 1));
+    check(right);
+    
+    rs_hash_map_free(map);
+}
+
+static void test_hash_map_iterate(void)
+{
+    RSHashMap* map = rs_hash_map_new(RS_HASH_MAP_INTEGER_KEYS);
+    RSHashMapIterator it;
+    int64_t key;
+    void* value;
+    
+    rs_hash_map_iterator_init(map, &it);
+    check(!rs_hash_map_iterator_next_int(&it, &key, &value));
+    
+    int64_t i;
+    for (i = 0; i < 1000; i++)
+        rs_hash_map_insert_int(map, i, (void*)(intptr_t)(i + 1));
+    for (i = 0; i < 1000; i += 3)
+        rs_hash_map_remove_int(map, i);
+    
+    /* every key left comes out exactly once, with its value */
+    uint8_t seen[1000];
+    memset(seen, 0, sizeof(seen));
+    size_t count = 0;
+    bool right = true;
+    rs_hash_map_iterator_init(map, &it);
+    while (rs_hash_map_iterator_next_int(&it, &key, &value))
+    {
+        right = right && key >= 0 && key < 1000 && key % 3 != 0;
+        right = right && value == (void*)(intptr_t)(key + 1);
+        if (key >= 0 && key < 1000)
+            seen[key]++;
+        count++;
+    }
+    check(right);
+    check(count == rs_hash_map_get_size(map));
+    
+    right = true;
+    for (i = 0; i < 1000; i++)
+        right = right && seen[i] == (i % 3 != 0);
+    check(right);
+    
+    rs_hash_map_free(map);
+}
+
+static void test_hash_map_strings(void)
+{
+    freed = 0;
+    RSHashMap* map = rs_hash_map_new_full(RS_HASH_MAP_STRING_KEYS, count_free);
+    
+    /* keys are copied, so the buffer can be reused */
+    char key[32];
+    unsigned int i;
+    for (i = 0; i < 500; i++)
+    {
+        sprintf(key, "key%u", i);
+        rs_hash_map_insert(map, key, (void*)(intptr_t)(i + 1));
+    }
+    check(rs_hash_map_get_size(map) == 500);
+    check(rs_hash_map_lookup(map, "key0") == (void*)(intptr_t)1);
+    check(rs_hash_map_lookup(map, "key499") == (void*)(intptr_t)500);
+    check(!rs_hash_map_contains(map, "key500"));
+    check(!rs_hash_map_contains(map, ""));
+    
+    /* replacing frees the old value, but not when it's the same one */
+    rs_hash_map_insert(map, "key7", (void*)(intptr_t)1000);
+    check(freed == 1);
+    rs_hash_map_insert(map, "key7", (void*)(intptr_t)1000);
+    check(freed == 1);
+    check(rs_hash_map_remove(map, "key7"));
+    check(freed == 2);
+    check(!rs_hash_map_contains(map, "key7"));
+    
+    RSHashMapIterator it;
+    const char* k;
+    void* value;
+    size_t count = 0;
+    bool right = true;
+    rs_hash_map_iterator_init(map, &it);
+    while (rs_hash_map_iterator_next(&it, &k, &value))
+    {
+        right = right && strncmp(k, "key", 3) == 0 && (intptr_t)value == atoi(k + 3) + 1;
+        count++;
+    }
+    check(right);
+    check(count == 499);
+    
+    rs_hash_map_clear(map);
+    check(freed == 501);
+    check(rs_hash_map_get_size(map) == 0);
+    check(rs_hash_map_lookup(map, "key1") == NULL);
+    
+    /* still usable after a clear */
+    rs_hash_map_insert(map, "again", (void*)(intptr_t)1);
+    check(rs_hash_map_lookup(map, "again") == (void*)(intptr_t)1);
+    rs_hash_map_free(map);
+    check(freed == 502);
+}
+
+int main(void)
+{
+    test_array();
+    test_hash_map_grow();
+    test_hash_map_collisions();
+    test_hash_map_remove();
+    test_hash_map_iterate();
+    test_hash_map_strings();
+    
+    if (failures)
+    {
+        fprintf(stderr, "%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
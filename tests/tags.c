@@ -0,0 +1,462 @@
+/*
+ * This program is part of libredstone.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* checks tag copies, hashing and equality -- in particular, that a
+ * change made after hashing is always seen -- and packed lists
+ */
+
+#include "redstone.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned int failures = 0;
+
+#define check(expr)                                                     \
+    do {                                                                \
+        if (!(expr))                                                    \
+        {                                                               \
+            fprintf(stderr, "%s:%i: check failed: %s\n", __FILE__, __LINE__, #expr); \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+/* something like an entity: a Pos list, a name, and a nested compound */
+static RSTag* make_entity(double x, int64_t level)
+{
+    double pos[] = {x, 64.0, -2.5};
+    
+    RSTag* list = rs_tag_new0(RS_TAG_LIST);
+    rs_tag_list_set_type(list, RS_TAG_DOUBLE);
+    rs_tag_list_set_doubles(list, pos, 3);
+    
+    RSTag* inner = rs_tag_new(RS_TAG_COMPOUND,
+                              "xPos", rs_tag_new(RS_TAG_INT, 3),
+                              "Level", rs_tag_new(RS_TAG_LONG, 0),
+                              NULL);
+    rs_tag_set_integer(rs_tag_compound_get(inner, "Level"), level);
+    
+    RSTag* entity = rs_tag_new(RS_TAG_COMPOUND,
+                               "Pos", list,
+                               "id", rs_tag_new(RS_TAG_STRING, "Pig"),
+                               "Data", inner,
+                               NULL);
+    rs_tag_ref(entity);
+    return entity;
+}
+
+static void test_change_list_in_copy(void)
+{
+    RSTag* original = make_entity(1.0, 7);
+    uint64_t hash = rs_tag_hash(original);
+    
+    RSTag* copy = rs_tag_copy(original);
+    rs_tag_ref(copy);
+    check(rs_tag_hash(copy) == hash);
+    check(rs_tag_equal(copy, original));
+    
+    /* change the copy's Pos, one element at a time */
+    RSTag* pos = rs_tag_compound_get(copy, "Pos");
+    rs_tag_set_float(rs_tag_list_get(pos, 0), 5.0);
+    
+    RSTag* expected = make_entity(5.0, 7);
+    check(rs_tag_hash(copy) != hash);
+    check(rs_tag_hash(copy) == rs_tag_hash(expected));
+    check(rs_tag_equal(copy, expected));
+    check(rs_tag_equal(expected, copy));
+    check(!rs_tag_equal(copy, original));
+    
+    /* and the original is as it was */
+    RSTag* unchanged = make_entity(1.0, 7);
+    check(rs_tag_hash(original) == hash);
+    check(rs_tag_equal(original, unchanged));
+    
+    rs_tag_unref(unchanged);
+    rs_tag_unref(expected);
+    rs_tag_unref(copy);
+    rs_tag_unref(original);
+}
+
+static void test_change_nested_in_copy(void)
+{
+    RSTag* original = make_entity(1.0, 7);
+    uint64_t hash = rs_tag_hash(original);
+    
+    /* a copy of a copy, hashed at each step */
+    RSTag* first = rs_tag_copy(original);
+    rs_tag_ref(first);
+    check(rs_tag_hash(first) == hash);
+    RSTag* copy = rs_tag_copy(first);
+    rs_tag_ref(copy);
+    check(rs_tag_hash(copy) == hash);
+    
+    rs_tag_set_integer(rs_tag_compound_get_chain(copy, "Data", "Level", NULL), 8);
+    
+    RSTag* expected = make_entity(1.0, 8);
+    check(rs_tag_hash(copy) == rs_tag_hash(expected));
+    check(rs_tag_equal(copy, expected));
+    check(!rs_tag_equal(copy, first));
+    check(rs_tag_equal(first, original));
+    
+    rs_tag_unref(expected);
+    rs_tag_unref(copy);
+    rs_tag_unref(first);
+    rs_tag_unref(original);
+}
+
+static void test_change_after_hash(void)
+{
+    RSTag* entity = make_entity(1.0, 7);
+    RSTag* other = make_entity(1.0, 7);
+    check(rs_tag_equal(entity, other));
+    
+    /* a bulk set on a list that was hashed, inside a compound that
+     * was hashed
+     */
+    double pos[] = {1.0, 65.0, -2.5};
+    rs_tag_list_set_doubles(rs_tag_compound_get(entity, "Pos"), pos, 3);
+    check(!rs_tag_equal(entity, other));
+    check(rs_tag_hash(entity) != rs_tag_hash(other));
+    
+    /* putting it back makes them equal again */
+    rs_tag_set_float(rs_tag_list_get(rs_tag_compound_get(entity, "Pos"), 1), 64.0);
+    check(rs_tag_equal(entity, other));
+    check(rs_tag_hash(entity) == rs_tag_hash(other));
+    
+    rs_tag_set_string(rs_tag_compound_get(other, "id"), "Cow");
+    check(!rs_tag_equal(entity, other));
+    
+    rs_tag_unref(other);
+    rs_tag_unref(entity);
+}
+
+/* tag allocations currently live, or -1 if statistics aren't kept */
+static long tags_in_use(void)
+{
+    RSMemoryStats stats;
+    rs_memory_get_stats(&stats);
+    if (!stats.enabled)
+        return -1;
+    return stats.subsystems[RS_MEMORY_TAG].in_use;
+}
+
+static void test_packed_list(void)
+{
+    int64_t values[] = {-300, 0, 7, 32767, -32768};
+    int64_t out[5];
+    uint32_t i;
+    
+    RSTag* packed = rs_tag_new0(RS_TAG_LIST);
+    rs_tag_ref(packed);
+    rs_tag_list_set_type(packed, RS_TAG_SHORT);
+    rs_tag_list_set_integers(packed, values, 5);
+    check(rs_tag_list_get_length(packed) == 5);
+    check(rs_tag_list_get_integers(packed, out, 5) == 5);
+    check(memcmp(out, values, sizeof(values)) == 0);
+    
+    /* the same list, made out of tags */
+    RSTag* tagged = rs_tag_new0(RS_TAG_LIST);
+    rs_tag_ref(tagged);
+    rs_tag_list_set_type(tagged, RS_TAG_SHORT);
+    for (i = 0; i < 5; i++)
+        rs_tag_list_insert(tagged, i, rs_tag_new(RS_TAG_SHORT, (int)values[i]));
+    check(rs_tag_hash(packed) == rs_tag_hash(tagged));
+    check(rs_tag_equal(packed, tagged));
+    check(rs_tag_equal(tagged, packed));
+    
+    /* reverse and delete work on either */
+    rs_tag_list_reverse(packed);
+    rs_tag_list_delete(packed, 1);
+    rs_tag_list_reverse(tagged);
+    rs_tag_list_delete(tagged, 1);
+    check(rs_tag_list_get_integers(packed, out, 5) == 4);
+    check(out[0] == -32768 && out[1] == 7 && out[2] == 0 && out[3] == -300);
+    check(rs_tag_equal(packed, tagged));
+    
+    /* an element tag is the element from then on, even after hashing */
+    uint64_t hash = rs_tag_hash(packed);
+    RSTag* element = rs_tag_list_get(packed, 2);
+    check(rs_tag_get_integer(element) == 0);
+    check(rs_tag_list_get(packed, 2) == element);
+    rs_tag_set_integer(element, 5);
+    check(rs_tag_hash(packed) != hash);
+    check(rs_tag_list_get_integers(packed, out, 5) == 4 && out[2] == 5);
+    check(!rs_tag_equal(packed, tagged));
+    rs_tag_set_integer(rs_tag_list_get(tagged, 2), 5);
+    check(rs_tag_equal(packed, tagged));
+    
+    /* copies are packed again, and equal */
+    RSTag* copy = rs_tag_copy(tagged);
+    rs_tag_ref(copy);
+    check(rs_tag_equal(copy, packed));
+    check(rs_tag_hash(copy) == rs_tag_hash(tagged));
+    
+    rs_tag_unref(copy);
+    rs_tag_unref(tagged);
+    rs_tag_unref(packed);
+}
+
+static void test_packed_insert(void)
+{
+    double values[] = {0.5, 1.5};
+    double out[3];
+    
+    RSTag* list = rs_tag_new0(RS_TAG_LIST);
+    rs_tag_ref(list);
+    rs_tag_list_set_type(list, RS_TAG_DOUBLE);
+    rs_tag_list_set_doubles(list, values, 2);
+    
+    /* an inserted tag stays the tag in the list */
+    RSTag* mine = rs_tag_new(RS_TAG_DOUBLE, 2.5);
+    rs_tag_ref(mine);
+    rs_tag_list_insert(list, 1, mine);
+    check(rs_tag_list_get(list, 1) == mine);
+    rs_tag_set_float(mine, 3.5);
+    check(rs_tag_list_get_doubles(list, out, 3) == 3);
+    check(out[0] == 0.5 && out[1] == 3.5 && out[2] == 1.5);
+    rs_tag_unref(mine);
+    
+    /* into an empty list, too */
+    RSTag* empty = rs_tag_new0(RS_TAG_LIST);
+    rs_tag_ref(empty);
+    rs_tag_list_set_type(empty, RS_TAG_FLOAT);
+    mine = rs_tag_new(RS_TAG_FLOAT, 1.0);
+    rs_tag_list_insert(empty, 0, mine);
+    check(rs_tag_list_get(empty, 0) == mine);
+    check(rs_tag_list_get_doubles(empty, out, 3) == 1 && out[0] == 1.0);
+    
+    /* and with the builder, after some packed numbers */
+    RSTagBuilder* builder = rs_tag_builder_new();
+    rs_tag_builder_begin_list(builder, NULL, RS_TAG_DOUBLE, 8);
+    rs_tag_builder_add_float(builder, NULL, RS_TAG_DOUBLE, 0.5);
+    mine = rs_tag_new(RS_TAG_DOUBLE, 2.5);
+    rs_tag_builder_add_tag(builder, NULL, mine);
+    rs_tag_builder_add_float(builder, NULL, RS_TAG_DOUBLE, 1.5);
+    rs_tag_builder_end(builder);
+    RSTag* built = rs_tag_builder_finish(builder);
+    rs_tag_ref(built);
+    rs_tag_builder_free(builder);
+    rs_tag_set_float(mine, 3.5);
+    check(rs_tag_list_get(built, 1) == mine);
+    check(rs_tag_equal(built, list));
+    
+    rs_tag_unref(built);
+    rs_tag_unref(empty);
+    rs_tag_unref(list);
+}
+
+static void test_packed_no_tags(void)
+{
+    double values[1000];
+    double out[1000];
+    uint32_t i;
+    
+    for (i = 0; i < 1000; i++)
+        values[i] = i * 0.25;
+    
+    RSTag* list = rs_tag_new0(RS_TAG_LIST);
+    rs_tag_ref(list);
+    rs_tag_list_set_type(list, RS_TAG_FLOAT);
+    
+    /* setting, reading, copying and hashing make no element tags */
+    long before = tags_in_use();
+    rs_tag_list_set_doubles(list, values, 1000);
+    RSTag* copy = rs_tag_copy(list);
+    rs_tag_ref(copy);
+    check(rs_tag_equal(list, copy));
+    check(rs_tag_list_get_doubles(copy, out, 1000) == 1000);
+    check(memcmp(out, values, sizeof(values)) == 0);
+    if (before >= 0)
+        check(tags_in_use() - before <= 4);
+    
+    /* the builder packs numbers too */
+    RSTagBuilder* builder = rs_tag_builder_new();
+    rs_tag_builder_begin_list(builder, NULL, RS_TAG_FLOAT, 0);
+    for (i = 0; i < 1000; i++)
+        rs_tag_builder_add_float(builder, NULL, RS_TAG_FLOAT, values[i]);
+    rs_tag_builder_end(builder);
+    RSTag* built = rs_tag_builder_finish(builder);
+    rs_tag_ref(built);
+    rs_tag_builder_free(builder);
+    check(rs_tag_equal(built, list));
+    if (before >= 0)
+        check(tags_in_use() - before <= 8);
+    
+    /* asking for one makes them all */
+    check(rs_tag_get_float(rs_tag_list_get(built, 999)) == values[999]);
+    if (before >= 0)
+        check(tags_in_use() - before > 1000);
+    check(rs_tag_equal(built, list));
+    
+    rs_tag_unref(built);
+    rs_tag_unref(copy);
+    rs_tag_unref(list);
+}
+
+static void test_number_size(void)
+{
+    RSMemoryStats stats;
+    RSTag* numbers[100];
+    uint32_t i;
+    
+    rs_memory_get_stats(&stats);
+    if (!stats.enabled)
+        return;
+    size_t before = stats.subsystems[RS_MEMORY_TAG].bytes;
+    
+    /* a number has no hash cache, so it is just a header and a value */
+    for (i = 0; i < 100; i++)
+    {
+        numbers[i] = rs_tag_new(RS_TAG_LONG, (int)i);
+        rs_tag_ref(numbers[i]);
+    }
+    rs_memory_get_stats(&stats);
+    check(stats.subsystems[RS_MEMORY_TAG].bytes - before <= 100 * 16);
+    
+    for (i = 0; i < 100; i++)
+        rs_tag_unref(numbers[i]);
+}
+
+static void test_packed_arena(void)
+{
+    int64_t values[] = {1, 2, 3};
+    RSTag* list = rs_tag_new0(RS_TAG_LIST);
+    rs_tag_ref(list);
+    rs_tag_list_set_type(list, RS_TAG_INT);
+    rs_tag_list_set_integers(list, values, 3);
+    
+    /* element tags made while an arena is pushed still belong to the
+     * list, not the arena
+     */
+    RSArena* arena = rs_arena_new(0);
+    rs_memory_push(rs_arena_get_memory_functions(arena));
+    RSTag* element = rs_tag_list_get(list, 1);
+    rs_memory_pop();
+    rs_arena_reset(arena);
+    rs_arena_free(arena);
+    
+    check(element == rs_tag_list_get(list, 1));
+    rs_tag_set_integer(element, 20);
+    int64_t out[3];
+    check(rs_tag_list_get_integers(list, out, 3) == 3 && out[1] == 20);
+    
+    rs_tag_unref(list);
+}
+
+static void test_compound(void)
+{
+    char key[16];
+    uint32_t i;
+    
+    RSTag* forward = rs_tag_new0(RS_TAG_COMPOUND);
+    rs_tag_ref(forward);
+    RSTag* backward = rs_tag_new0(RS_TAG_COMPOUND);
+    rs_tag_ref(backward);
+    
+    /* big enough to be indexed, filled in opposite orders */
+    for (i = 0; i < 100; i++)
+    {
+        sprintf(key, "key%u", i);
+        rs_tag_compound_set(forward, key, rs_tag_new(RS_TAG_INT, (int)i));
+        sprintf(key, "key%u", 99 - i);
+        rs_tag_compound_set(backward, key, rs_tag_new(RS_TAG_INT, (int)(99 - i)));
+    }
+    check(rs_tag_compound_get_length(forward) == 100);
+    check(rs_tag_equal(forward, backward));
+    check(rs_tag_hash(forward) == rs_tag_hash(backward));
+    for (i = 0; i < 100; i++)
+    {
+        sprintf(key, "key%u", i);
+        RSTag* value = rs_tag_compound_get(forward, key);
+        check(value && rs_tag_get_integer(value) == i);
+    }
+    check(rs_tag_compound_get(forward, "key100") == NULL);
+    
+    /* setting a key that's there replaces it in place */
+    rs_tag_compound_set(forward, "key50", rs_tag_new(RS_TAG_INT, -1));
+    check(rs_tag_compound_get_length(forward) == 100);
+    check(rs_tag_get_integer(rs_tag_compound_get(forward, "key50")) == -1);
+    check(!rs_tag_equal(forward, backward));
+    
+    /* entries come out in the order they were added */
+    RSTagIterator it;
+    const char* name;
+    RSTag* value;
+    i = 0;
+    rs_tag_compound_iterator_init(forward, &it);
+    while (rs_tag_compound_iterator_next(&it, &name, &value))
+    {
+        sprintf(key, "key%u", i);
+        check(strcmp(name, key) == 0);
+        i++;
+    }
+    check(i == 100);
+    
+    /* deleting keeps everything else findable */
+    for (i = 0; i < 100; i += 2)
+    {
+        sprintf(key, "key%u", i);
+        rs_tag_compound_delete(forward, key);
+    }
+    rs_tag_compound_delete(forward, "key0");
+    check(rs_tag_compound_get_length(forward) == 50);
+    for (i = 0; i < 100; i++)
+    {
+        sprintf(key, "key%u", i);
+        check((rs_tag_compound_get(forward, key) != NULL) == (i % 2 == 1));
+    }
+    
+    /* down to a small one, and copied */
+    for (i = 1; i < 95; i += 2)
+    {
+        sprintf(key, "key%u", i);
+        rs_tag_compound_delete(forward, key);
+    }
+    check(rs_tag_compound_get_length(forward) == 3);
+    check(rs_tag_compound_get(forward, "key97") != NULL);
+    RSTag* copy = rs_tag_copy(backward);
+    rs_tag_ref(copy);
+    check(rs_tag_equal(copy, backward));
+    check(rs_tag_get_integer(rs_tag_compound_get(copy, "key7")) == 7);
+    
+    rs_tag_unref(copy);
+    rs_tag_unref(backward);
+    rs_tag_unref(forward);
+}
+
+int main(void)
+{
+    /* before anything is allocated, so the numbers are right */
+    setenv("RS_MEMORY_STATS", "1", 1);
+    
+    test_change_list_in_copy();
+    test_change_nested_in_copy();
+    test_change_after_hash();
+    test_packed_list();
+    test_packed_insert();
+    test_packed_no_tags();
+    test_number_size();
+    test_packed_arena();
+    test_compound();
+    
+    if (failures)
+    {
+        fprintf(stderr, "%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -17,10 +17,18 @@
 
 #include "redstone.h"
 #include "config.h"
+#include "terrain.h"
 #include <sys/stat.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #if HAVE_MKDIR
 #  if MKDIR_TAKES_ONE_ARG
@@ -34,225 +42,224 @@
 #  endif
 #endif
 
-#define index_block(blocks, x, y, z) ((blocks)[y + (z) * 128 + (x) * 128 * 16])
-#define set_half_byte(dest, x, y, z, val)                               \
-    do                                                                  \
-    {                                                                   \
-        uint16_t index = ((y) + (z) * 128 + (x) * 128 * 16) / 2;        \
-        if ((y) % 2 == 0)                                               \
-        {                                                               \
-            dest[index] &= ~0x0F;                                       \
-            dest[index] |= val & 0x0F;                                  \
-        } else {                                                        \
-            dest[index] &= ~0xF0;                                       \
-            dest[index] |= (val << 4) & 0xF0;                           \
-        }                                                               \
-    } while (0)
-
-void generate_terrain(int cx, int cz, uint8_t* blocks)
+RSTag* create_level_dat(uint8_t spawn_height)
 {
-    int x, y, z;
+    RSTagBuilder* builder = rs_tag_builder_new();
     
-    for (x = 0; x < 16; x++)
-    {
-        for (z = 0; z < 16; z++)
-        {
-            for (y = 0; y < 128; y++)
-            {
-                int local_x = cx * 16 + x;
-                int local_z = cz * 16 + z;
-                int local_y = y * 4 - 256;
-                
-                if (local_x < 0)
-                    local_x *= -1;
-                if (local_z < 0)
-                    local_z *= -1;
-                local_x -= 256;
-                local_z -= 256;
-                
-                if (y < 64)
-                    index_block(blocks, x, y, z) = 3;
-                if (y == 64)
-                    index_block(blocks, x, y, z) = 2;
-                
-                if (local_x * local_x + local_y * local_y + local_z * local_z < 240 * 240)
-                {
-                    index_block(blocks, x, y, z) = 1;
-                    if (local_x * local_x + local_y * local_y + local_z * local_z < 200 * 200)
-                    {
-                        index_block(blocks, x, y, z) = 0;
-                    } else {
-                        float orerand = (float)rand()/(float)RAND_MAX;
-                        if (orerand < 0.01)
-                        {
-                            index_block(blocks, x, y, z) = 56;
-                        } else if (orerand < 0.05) {
-                            index_block(blocks, x, y, z) = 14;
-                        } else if (orerand < 0.12) {
-                            index_block(blocks, x, y, z) = 15;
-                        } else if (orerand < 0.3) {
-                            index_block(blocks, x, y, z) = 16;
-                        }
-                    }
-                }
-                
-                if (((local_x <= 1 && local_x >= 0) || (local_z <= 1 && local_z >= 0)) && (y >= 64 && y < 68))
-                    index_block(blocks, x, y, z) = (y == 64 ? 17 : 0);
-            }
-        }
-    }
+    rs_tag_builder_begin_compound(builder, NULL);
+    rs_tag_builder_begin_compound(builder, "Data");
+    
+    rs_tag_builder_add_integer(builder, "Time", RS_TAG_LONG, 0);
+    rs_tag_builder_add_integer(builder, "LastPlayed", RS_TAG_LONG, 0);
+    
+    rs_tag_builder_begin_compound(builder, "Player");
+    
+    /* entity fields */
+    rs_tag_builder_begin_list(builder, "Pos", RS_TAG_DOUBLE, 3);
+    rs_tag_builder_add_float(builder, NULL, RS_TAG_DOUBLE, 0.0);
+    rs_tag_builder_add_float(builder, NULL, RS_TAG_DOUBLE, spawn_height + 2.66);
+    rs_tag_builder_add_float(builder, NULL, RS_TAG_DOUBLE, 0.0);
+    rs_tag_builder_end(builder);
+    rs_tag_builder_begin_list(builder, "Motion", RS_TAG_DOUBLE, 3);
+    rs_tag_builder_add_float(builder, NULL, RS_TAG_DOUBLE, 0.0);
+    rs_tag_builder_add_float(builder, NULL, RS_TAG_DOUBLE, 0.0);
+    rs_tag_builder_add_float(builder, NULL, RS_TAG_DOUBLE, 0.0);
+    rs_tag_builder_end(builder);
+    rs_tag_builder_begin_list(builder, "Rotation", RS_TAG_FLOAT, 2);
+    rs_tag_builder_add_float(builder, NULL, RS_TAG_FLOAT, 0.0);
+    rs_tag_builder_add_float(builder, NULL, RS_TAG_FLOAT, 0.0);
+    rs_tag_builder_end(builder);
+    rs_tag_builder_add_float(builder, "FallDistance", RS_TAG_FLOAT, 0.0);
+    rs_tag_builder_add_integer(builder, "Fire", RS_TAG_SHORT, -20);
+    rs_tag_builder_add_integer(builder, "Air", RS_TAG_SHORT, 300);
+    rs_tag_builder_add_integer(builder, "OnGround", RS_TAG_BYTE, 1);
+    
+    /* mob fields */
+    rs_tag_builder_add_integer(builder, "AttackTime", RS_TAG_SHORT, 0);
+    rs_tag_builder_add_integer(builder, "DeathTime", RS_TAG_SHORT, 0);
+    rs_tag_builder_add_integer(builder, "Health", RS_TAG_SHORT, 20);
+    rs_tag_builder_add_integer(builder, "HurtTime", RS_TAG_SHORT, 0);
+    
+    /* player fields */
+    rs_tag_builder_begin_list(builder, "Inventory", RS_TAG_END, 0);
+    rs_tag_builder_end(builder);
+    rs_tag_builder_add_integer(builder, "Score", RS_TAG_INT, 0);
+    rs_tag_builder_add_integer(builder, "Dimension", RS_TAG_INT, 0);
+    
+    rs_tag_builder_end(builder);
+    
+    rs_tag_builder_add_integer(builder, "SpawnX", RS_TAG_INT, 0);
+    rs_tag_builder_add_integer(builder, "SpawnY", RS_TAG_INT, spawn_height);
+    rs_tag_builder_add_integer(builder, "SpawnZ", RS_TAG_INT, 0);
+    rs_tag_builder_add_integer(builder, "SizeOnDisk", RS_TAG_LONG, 0);
+    rs_tag_builder_add_integer(builder, "RandomSeed", RS_TAG_LONG, 0);
+    rs_tag_builder_add_integer(builder, "version", RS_TAG_INT, 19132);
+    rs_tag_builder_add_string(builder, "LevelName", "mapgen");
+    rs_tag_builder_add_integer(builder, "raining", RS_TAG_BYTE, 0);
+    rs_tag_builder_add_integer(builder, "thundering", RS_TAG_BYTE, 0);
+    rs_tag_builder_add_integer(builder, "rainTime", RS_TAG_INT, 0);
+    rs_tag_builder_add_integer(builder, "thunderTime", RS_TAG_INT, 0);
+    
+    rs_tag_builder_end(builder);
+    rs_tag_builder_end(builder);
+    
+    RSTag* level_dat = rs_tag_builder_finish(builder);
+    rs_tag_builder_free(builder);
+    return level_dat;
 }
 
-void generate_heightmap(uint8_t* blocks, uint8_t* heightmap)
+/* shared by all the threads generating regions */
+typedef struct
 {
-    int x, y, z;
-    for (x = 0; x < 16; x++)
-    {
-        for (z = 0; z < 16; z++)
-        {
-            for (y = 127; y >= 0; y--)
-            {
-                if (index_block(blocks, x, y, z) != 0)
-                    break;
-            }
-            /* note weird index ordering */
-            heightmap[z + 16 * x] = y + 1;
-        }
-    }
-}
+    const char* dest;
+    int radius;
+    uint32_t seed;
+    uint32_t timestamp;
+    
+    unsigned int next;
+    bool failed;
+    
+    /* only written by whoever generates chunk (0, 0) */
+    uint8_t spawn_height;
+} MapgenJob;
 
-void generate_skylight(uint8_t* blocks, uint8_t* heightmap, uint8_t* skylight)
+static bool generate_region(MapgenJob* job, int rx, int rz, RSTagBuilder* builder, RSTag* empty, TerrainScratch* scratch)
 {
-    int x, y, z;
-    for (x = 0; x < 16; x++)
+    char* path = rs_malloc(strlen(job->dest) + 128);
+    sprintf(path, "%s/region/r.%i.%i.mcr", job->dest, rx, rz);
+    RSRegion* region = rs_region_open(path, true);
+    if (!region)
     {
-        for (z = 0; z < 16; z++)
+        fprintf(stderr, "could not create %s\n", path);
+        rs_free(path);
+        return false;
+    }
+    rs_free(path);
+    
+    RSCompressionType enc = rs_region_get_compression(region);
+    const RSCompressionOptions* options = rs_region_get_compression_options(region);
+    bool success = true;
+    int cx, cz;
+    for (cx = 0; cx < 32 && success; cx++)
+    {
+        for (cz = 0; cz < 32 && success; cz++)
         {
-            uint8_t height = heightmap[z + 16 * x];
-            for (y = 0; y < 128; y++)
+            uint8_t* zero_height = NULL;
+            if (rx == 0 && rz == 0 && cx == 0 && cz == 0)
+                zero_height = &(job->spawn_height);
+            
+            RSNBT* nbt = rs_nbt_new();
+            rs_nbt_set_root(nbt, create_chunk(builder, empty, scratch, rx * 32 + cx, rz * 32 + cz, job->seed, zero_height));
+            
+            /* every chunk gets the same timestamp, which is fixed
+             * when a seed is given, so the same seed always gives
+             * the same files
+             */
+            void* data;
+            size_t len;
+            success = rs_nbt_write_full(nbt, &data, &len, enc, options);
+            rs_nbt_free(nbt);
+            if (!success)
             {
-                if (y >= height)
-                {
-                    set_half_byte(skylight, x, y, z, 0x0F);
-                }
+                fprintf(stderr, "error generating chunks\n");
+                break;
             }
+            
+            rs_region_set_chunk_data_full(region, cx, cz, data, len, enc, job->timestamp);
+            rs_free(data);
         }
     }
+    
+    rs_region_close(region);
+    return success;
 }
 
-RSTag* create_chunk(int x, int z, uint8_t* zero_height)
+static void* mapgen_worker(void* data)
 {
-    uint8_t* blocks = rs_malloc0(0x8000);
-    uint8_t* blocklight = rs_malloc0(0x4000);
-    uint8_t* skylight = rs_malloc0(0x4000);
-    uint8_t* data = rs_malloc0(0x4000);
-    uint8_t* heightmap = rs_malloc0(0x100);
+    MapgenJob* job = data;
+    unsigned int side = 2 * job->radius;
+    unsigned int count = side * side;
     
-    generate_terrain(x, z, blocks);
-    generate_heightmap(blocks, heightmap);
-    generate_skylight(blocks, heightmap, skylight);
+    /* chunks are built with one builder per thread, and share these
+     * empty arrays */
+    RSTagBuilder* builder = rs_tag_builder_new();
+    RSTag* empty = take_byte_array(0x4000, rs_malloc0(0x4000));
+    rs_tag_ref(empty);
+    TerrainScratch* scratch = rs_new(TerrainScratch, 1);
     
-    if (zero_height)
-        *zero_height = heightmap[0];
-    
-    RSTag* level = rs_tag_new(RS_TAG_COMPOUND,
-                              "xPos", rs_tag_new(RS_TAG_INT, x),
-                              "zPos", rs_tag_new(RS_TAG_INT, z),
-                              "Blocks", rs_tag_new(RS_TAG_BYTE_ARRAY, 0x8000, blocks),
-                              "BlockLight", rs_tag_new(RS_TAG_BYTE_ARRAY, 0x4000, blocklight),
-                              "SkyLight", rs_tag_new(RS_TAG_BYTE_ARRAY, 0x4000, skylight),
-                              "Data", rs_tag_new(RS_TAG_BYTE_ARRAY, 0x4000, data),
-                              "HeightMap", rs_tag_new(RS_TAG_BYTE_ARRAY, 0x100, heightmap),
-                              "Entities", rs_tag_new(RS_TAG_LIST, NULL),
-                              "TileEntities", rs_tag_new(RS_TAG_LIST, NULL),
-                              "TerrainPopulated", rs_tag_new(RS_TAG_BYTE, 1),
-                              "LastUpdate", rs_tag_new(RS_TAG_LONG, 0),
-                              NULL);
-    
-    rs_free(blocks);
-    rs_free(blocklight);
-    rs_free(skylight);
-    rs_free(data);
-    rs_free(heightmap);
+    while (!__atomic_load_n(&(job->failed), __ATOMIC_RELAXED))
+    {
+        unsigned int i = __atomic_fetch_add(&(job->next), 1, __ATOMIC_RELAXED);
+        if (i >= count)
+            break;
+        
+        printf("writing region %u of %u ...\n", i + 1, count);
+        if (!generate_region(job, (int)(i / side) - job->radius, (int)(i % side) - job->radius, builder, empty, scratch))
+            __atomic_store_n(&(job->failed), true, __ATOMIC_RELAXED);
+    }
     
-    return rs_tag_new(RS_TAG_COMPOUND, "Level", level, NULL);
+    rs_free(scratch);
+    rs_tag_unref(empty);
+    rs_tag_builder_free(builder);
+    return NULL;
 }
 
-RSTag* create_level_dat(uint8_t spawn_height)
+static void usage(const char* name)
 {
-    RSTag* player =
-        rs_tag_new(RS_TAG_COMPOUND,
-                   /* entity fields */
-                   "Pos", rs_tag_new(RS_TAG_LIST,
-                                     rs_tag_new(RS_TAG_DOUBLE, 0.0),
-                                     rs_tag_new(RS_TAG_DOUBLE, spawn_height + 2.66),
-                                     rs_tag_new(RS_TAG_DOUBLE, 0.0),
-                                     NULL),
-                   "Motion", rs_tag_new(RS_TAG_LIST,
-                                        rs_tag_new(RS_TAG_DOUBLE, 0.0),
-                                        rs_tag_new(RS_TAG_DOUBLE, 0.0),
-                                        rs_tag_new(RS_TAG_DOUBLE, 0.0),
-                                        NULL),
-                   "Rotation", rs_tag_new(RS_TAG_LIST,
-                                          rs_tag_new(RS_TAG_FLOAT, 0.0),
-                                          rs_tag_new(RS_TAG_FLOAT, 0.0),
-                                          NULL),
-                   "FallDistance", rs_tag_new(RS_TAG_FLOAT, 0.0),
-                   "Fire", rs_tag_new(RS_TAG_SHORT, -20),
-                   "Air", rs_tag_new(RS_TAG_SHORT, 300),
-                   "OnGround", rs_tag_new(RS_TAG_BYTE, 1),
-                   
-                   /* mob fields */
-                   "AttackTime", rs_tag_new(RS_TAG_SHORT, 0),
-                   "DeathTime", rs_tag_new(RS_TAG_SHORT, 0),
-                   "Health", rs_tag_new(RS_TAG_SHORT, 20),
-                   "HurtTime", rs_tag_new(RS_TAG_SHORT, 0),
-                   
-                   /* player fields */
-                   "Inventory", rs_tag_new(RS_TAG_LIST, NULL),
-                   "Score", rs_tag_new(RS_TAG_INT, 0),
-                   "Dimension", rs_tag_new(RS_TAG_INT, 0),
-                   NULL);
-    
-    RSTag* data = rs_tag_new(RS_TAG_COMPOUND,
-                             "Time", rs_tag_new(RS_TAG_LONG, 0),
-                             "LastPlayed", rs_tag_new(RS_TAG_LONG, 0),
-                             "Player", player,
-                             "SpawnX", rs_tag_new(RS_TAG_INT, 0),
-                             "SpawnY", rs_tag_new(RS_TAG_INT, spawn_height),
-                             "SpawnZ", rs_tag_new(RS_TAG_INT, 0),
-                             "SizeOnDisk", rs_tag_new(RS_TAG_LONG, 0),
-                             "RandomSeed", rs_tag_new(RS_TAG_LONG, 0),
-                             "version", rs_tag_new(RS_TAG_INT, 19132),
-                             "LevelName", rs_tag_new(RS_TAG_STRING, "mapgen"),
-                             "raining", rs_tag_new(RS_TAG_BYTE, 0),
-                             "thundering", rs_tag_new(RS_TAG_BYTE, 0),
-                             "rainTime", rs_tag_new(RS_TAG_INT, 0),
-                             "thunderTime", rs_tag_new(RS_TAG_INT, 0),
-                             NULL);
-    
-    return rs_tag_new(RS_TAG_COMPOUND, "Data", data, NULL);
+    fprintf(stderr, "usage: %s [-j threads] [--seed seed] [-r radius] [--timestamp time] [dest]\n", name);
+    fprintf(stderr, "the timestamp defaults to now, or to 0 when a seed is given\n");
+    exit(1);
 }
 
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    MapgenJob job;
+    memset(&job, 0, sizeof(job));
+    job.radius = 2;
+    job.spawn_height = 64;
+    unsigned int nthreads = 0;
+    bool have_seed = false;
+    bool have_timestamp = false;
+    
+    int arg;
+    for (arg = 1; arg < argc; arg++)
     {
-        fprintf(stderr, "usage: %s [dest]\n", argv[0]);
-        return 1;
+        if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc)
+        {
+            nthreads = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--seed") == 0 && arg + 1 < argc) {
+            job.seed = strtoul(argv[++arg], NULL, 10);
+            have_seed = true;
+        } else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            job.radius = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--timestamp") == 0 && arg + 1 < argc) {
+            job.timestamp = strtoul(argv[++arg], NULL, 10);
+            have_timestamp = true;
+        } else if (argv[arg][0] != '-' && !job.dest) {
+            job.dest = argv[arg];
+        } else {
+            usage(argv[0]);
+        }
     }
     
+    if (!job.dest || job.radius < 1)
+        usage(argv[0]);
+    
+    /* a seeded run should be reproducible, so don't use the clock */
+    if (!have_timestamp)
+        job.timestamp = have_seed ? 0 : time(NULL);
+    
     /* create dest */
-    if (mkdir(argv[1], 0777) == -1 && errno != EEXIST)
+    if (mkdir(job.dest, 0777) == -1 && errno != EEXIST)
     {
-        fprintf(stderr, "could not create %s\n", argv[1]);
+        fprintf(stderr, "could not create %s\n", job.dest);
         return 1;
     }
     
-    char* tmps = rs_malloc(strlen(argv[1]) + 128);
+    char* tmps = rs_malloc(strlen(job.dest) + 128);
     
     /* create dest/region */
-    sprintf(tmps, "%s/region", argv[1]);
+    sprintf(tmps, "%s/region", job.dest);
     if (mkdir(tmps, 0777) == -1 && errno != EEXIST)
     {
         fprintf(stderr, "could not create %s\n", tmps);
@@ -260,76 +267,45 @@ int main(int argc, char* argv[])
         return 1;
     }
     
-    /* iterate through all regions / chunks */
-    int radius = 2;
-    int i = 0;
-    int rx, rz, cx, cz;
-    bool success = true;
-    uint8_t spawn_height = 64;
-    for (rx = -radius; rx < radius; rx++)
+    /* regions are handed out one at a time, and each chunk has its own
+     * random numbers, so the thread count doesn't change the output
+     */
+#ifdef HAVE_PTHREAD
+    if (nthreads == 0)
     {
-        for (rz = -radius; rz < radius; rz++)
-        {
-            sprintf(tmps, "%s/region/r.%i.%i.mcr", argv[1], rx, rz);
-            RSRegion* region = rs_region_open(tmps, true);
-            if (!region)
-            {
-                success = false;
-                fprintf(stderr, "could not create %s\n", tmps);
-                break;
-            }
-            
-            i++;
-            printf("writing region %i of %i ...\n", i, 4 * radius * radius);
-            for (cx = 0; cx < 32; cx++)
-            {
-                for (cz = 0; cz < 32; cz++)
-                {
-                    RSTag* chunk = NULL;
-                    if (rx == 0 && rz == 0 && cx == 0 && cz == 0)
-                    {
-                        chunk = create_chunk(rx * 32 + cx, rz * 32 + cz, &spawn_height);
-                    } else {
-                        chunk = create_chunk(rx * 32 + cx, rz * 32 + cz, NULL);
-                    }
-                    RSNBT* nbt = rs_nbt_new();
-                    rs_nbt_set_root(nbt, chunk);
-                    success = rs_nbt_write_to_region(nbt, region, cx, cz);
-                    rs_nbt_free(nbt);
-                    
-                    if (!success)
-                    {
-                        fprintf(stderr, "error generating chunks\n");
-                        break;
-                    }
-                }
-                
-                if (!success)
-                    break;
-            }
-            
-            rs_region_close(region);
-            
-            if (!success)
-                break;
-        }
-        
-        if (!success)
-            break;
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (cpus > 0) ? cpus : 1;
     }
     
-    if (!success)
+    /* this thread works too, and picks up the slack if a thread can't
+     * be started
+     */
+    pthread_t* threads = rs_new0(pthread_t, nthreads);
+    unsigned int started = 0;
+    while (started + 1 < nthreads && pthread_create(&(threads[started]), NULL, mapgen_worker, &job) == 0)
+        started++;
+    mapgen_worker(&job);
+    
+    unsigned int t;
+    for (t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+    rs_free(threads);
+#else
+    mapgen_worker(&job);
+#endif
+    
+    if (job.failed)
     {
         rs_free(tmps);
         return 1;
     }
-
+    
     /* create level.dat file */
-    sprintf(tmps, "%s/level.dat", argv[1]);
-    RSTag* level_dat = create_level_dat(spawn_height);
+    sprintf(tmps, "%s/level.dat", job.dest);
+    RSTag* level_dat = create_level_dat(job.spawn_height);
     RSNBT* level_nbt = rs_nbt_new();
     rs_nbt_set_root(level_nbt, level_dat);
-    success = rs_nbt_write_to_file(level_nbt, tmps);
+    bool success = rs_nbt_write_to_file(level_nbt, tmps);
     rs_nbt_free(level_nbt);
     
     rs_free(tmps);
@@ -15,9 +15,31 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* prints the chunks in a region file, or with a world directory,
+ * statistics for the whole world as JSON
+ */
+
 #include "redstone.h"
+#include "config.h"
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* how many of the largest chunks to list */
+#define LARGEST_CHUNKS 10
+
+/* compression ratio histogram buckets -- below 1x, then doubling, up
+ * to 32x and over
+ */
+#define RATIO_BUCKETS 7
+static const double ratio_limits[RATIO_BUCKETS - 1] = {1.0, 2.0, 4.0, 8.0, 16.0, 32.0};
+
 const char* get_compression_string(RSCompressionType type)
 {
     switch (type)
@@ -26,6 +48,12 @@ const char* get_compression_string(RSCompressionType type)
         return "zlib";
     case RS_GZIP:
         return "gzip";
+    case RS_UNCOMPRESSED:
+        return "none";
+    case RS_LZ4:
+        return "lz4";
+    case RS_ZSTD:
+        return "zstd";
     default:
         /* fall through to "unknown" */
         break;
@@ -34,12 +62,371 @@ const char* get_compression_string(RSCompressionType type)
     return "unknown";
 }
 
-int main(int argc, char** argv)
+typedef struct
+{
+    int x, z;
+    uint32_t compressed;
+    size_t uncompressed;
+} ChunkSize;
+
+/* everything we find out about one region */
+typedef struct
+{
+    int x, z;
+    bool opened;
+    unsigned int chunks;
+    unsigned int bad_chunks;
+    uint32_t sectors;
+    uint32_t used_sectors;
+    uint32_t free_sectors;
+    uint32_t free_runs;
+    uint64_t file_bytes;
+    uint64_t compressed_bytes;
+    uint64_t uncompressed_bytes;
+    unsigned int compression[RS_ZSTD + 1];
+    unsigned int ratios[RATIO_BUCKETS];
+    
+    /* largest first */
+    ChunkSize largest[LARGEST_CHUNKS];
+    unsigned int largest_count;
+} RegionStats;
+
+typedef struct
+{
+    RSWorld* world;
+    bool deep;
+    RegionStats* regions;
+    unsigned int next;
+} StatsJob;
+
+/* the size chunks are ranked by -- uncompressed, if we know it */
+static inline uint64_t chunk_size_key(const ChunkSize* size)
+{
+    return size->uncompressed ? size->uncompressed : size->compressed;
+}
+
+static void add_largest(ChunkSize* largest, unsigned int* count, const ChunkSize* size)
+{
+    unsigned int i = *count;
+    if (i == LARGEST_CHUNKS)
+    {
+        if (chunk_size_key(&(largest[i - 1])) >= chunk_size_key(size))
+            return;
+        i--;
+    } else {
+        (*count)++;
+    }
+    
+    /* insertion sort, since there are only a handful */
+    while (i > 0 && chunk_size_key(&(largest[i - 1])) < chunk_size_key(size))
+    {
+        largest[i] = largest[i - 1];
+        i--;
+    }
+    largest[i] = *size;
+}
+
+static void scan_region(StatsJob* job, unsigned int index, RSDecompressor* decompressor)
+{
+    RegionStats* stats = &(job->regions[index]);
+    rs_world_get_region_position(job->world, index, &(stats->x), &(stats->z));
+    
+    RSRegion* reg = rs_world_open_region(job->world, index, false);
+    if (!reg)
+        return;
+    stats->opened = true;
+    
+    stats->sectors = rs_region_get_sector_count(reg);
+    stats->file_bytes = (uint64_t)stats->sectors * 4096;
+    
+    /* which sectors are in use -- the first two hold the tables */
+    uint8_t* used = calloc(stats->sectors, 1);
+    if (stats->sectors >= 2)
+        used[0] = used[1] = 1;
+    
+    int x, z;
+    for (z = 0; z < 32; z++)
+    {
+        for (x = 0; x < 32; x++)
+        {
+            if (!rs_region_contains_chunk(reg, x, z))
+                continue;
+            
+            uint32_t offset, count, s;
+            rs_region_get_chunk_sectors(reg, x, z, &offset, &count);
+            for (s = offset; s < offset + count && s < stats->sectors; s++)
+                used[s] = 1;
+            
+            RSCompressionType enc = rs_region_get_chunk_compression(reg, x, z);
+            ChunkSize size = {stats->x * 32 + x, stats->z * 32 + z, rs_region_get_chunk_length(reg, x, z), 0};
+            stats->chunks++;
+            stats->compressed_bytes += size.compressed;
+            stats->compression[enc <= RS_ZSTD ? enc : RS_UNKNOWN_COMPRESSION]++;
+            
+            if (job->deep)
+            {
+                uint8_t* raw;
+                RSDictionary* dictionary = (enc == RS_ZSTD) ? rs_region_get_dictionary(reg) : NULL;
+                rs_decompressor_decompress_full(decompressor, enc, dictionary, rs_region_get_chunk_data(reg, x, z), size.compressed, &raw, &(size.uncompressed));
+                if (!raw)
+                {
+                    stats->bad_chunks++;
+                    size.uncompressed = 0;
+                } else {
+                    rs_free(raw);
+                    stats->uncompressed_bytes += size.uncompressed;
+                    
+                    double ratio = size.compressed ? (double)size.uncompressed / size.compressed : 0.0;
+                    unsigned int bucket = 0;
+                    while (bucket < RATIO_BUCKETS - 1 && ratio >= ratio_limits[bucket])
+                        bucket++;
+                    stats->ratios[bucket]++;
+                }
+            }
+            
+            add_largest(stats->largest, &(stats->largest_count), &size);
+        }
+    }
+    
+    uint32_t s;
+    for (s = 0; s < stats->sectors; s++)
+    {
+        if (used[s])
+        {
+            stats->used_sectors++;
+            continue;
+        }
+        
+        stats->free_sectors++;
+        if (s == 0 || used[s - 1])
+            stats->free_runs++;
+    }
+    free(used);
+    
+    rs_region_close(reg);
+}
+
+static void* stats_worker(void* data)
+{
+    StatsJob* job = data;
+    RSDecompressor* decompressor = rs_decompressor_new();
+    unsigned int count = rs_world_get_region_count(job->world);
+    
+    while (true)
+    {
+        unsigned int i = __atomic_fetch_add(&(job->next), 1, __ATOMIC_RELAXED);
+        if (i >= count)
+            break;
+        scan_region(job, i, decompressor);
+    }
+    
+    rs_decompressor_free(decompressor);
+    return NULL;
+}
+
+static void print_json_string(const char* str)
 {
-    if (argc != 2)
+    putchar('"');
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+        {
+            printf("\\%c", *str);
+        } else if ((unsigned char)*str < 0x20) {
+            printf("\\u%04x", (unsigned char)*str);
+        } else {
+            putchar(*str);
+        }
+    }
+    putchar('"');
+}
+
+static void print_largest(const char* indent, ChunkSize* largest, unsigned int count, bool deep)
+{
+    unsigned int i;
+    for (i = 0; i < count; i++)
+    {
+        printf("%s{\"x\": %i, \"z\": %i, \"compressed_bytes\": %u", indent, largest[i].x, largest[i].z, largest[i].compressed);
+        if (deep)
+            printf(", \"uncompressed_bytes\": %zu", largest[i].uncompressed);
+        printf("}%s\n", i + 1 < count ? "," : "");
+    }
+}
+
+static int world_stats(const char* path, bool deep, unsigned int nthreads)
+{
+    RSWorld* world = rs_world_open(path);
+    if (!world)
+    {
+        fprintf(stderr, "could not find regions in %s\n", path);
         return 1;
+    }
+    
+    unsigned int count = rs_world_get_region_count(world);
+    StatsJob job;
+    job.world = world;
+    job.deep = deep;
+    job.regions = rs_new0(RegionStats, count > 0 ? count : 1);
+    job.next = 0;
+    
+#ifdef HAVE_PTHREAD
+    if (nthreads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (cpus > 0) ? cpus : 1;
+    }
+    if (nthreads > count)
+        nthreads = count > 0 ? count : 1;
+    
+    /* this thread works too, and picks up the slack if a thread can't
+     * be started
+     */
+    pthread_t* threads = rs_new0(pthread_t, nthreads);
+    unsigned int started = 0;
+    while (started + 1 < nthreads && pthread_create(&(threads[started]), NULL, stats_worker, &job) == 0)
+        started++;
+    stats_worker(&job);
+    
+    unsigned int t;
+    for (t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+    rs_free(threads);
+#else
+    stats_worker(&job);
+#endif
+    
+    /* add it all up */
+    RegionStats total;
+    memset(&total, 0, sizeof(total));
+    unsigned int i, j;
+    for (i = 0; i < count; i++)
+    {
+        RegionStats* stats = &(job.regions[i]);
+        total.chunks += stats->chunks;
+        total.bad_chunks += stats->bad_chunks;
+        total.sectors += stats->sectors;
+        total.used_sectors += stats->used_sectors;
+        total.free_sectors += stats->free_sectors;
+        total.free_runs += stats->free_runs;
+        total.file_bytes += stats->file_bytes;
+        total.compressed_bytes += stats->compressed_bytes;
+        total.uncompressed_bytes += stats->uncompressed_bytes;
+        for (j = 0; j <= RS_ZSTD; j++)
+            total.compression[j] += stats->compression[j];
+        for (j = 0; j < RATIO_BUCKETS; j++)
+            total.ratios[j] += stats->ratios[j];
+        for (j = 0; j < stats->largest_count; j++)
+            add_largest(total.largest, &(total.largest_count), &(stats->largest[j]));
+    }
+    
+    printf("{\n");
+    printf("  \"world\": ");
+    print_json_string(path);
+    printf(",\n");
+    printf("  \"deep\": %s,\n", deep ? "true" : "false");
+    printf("  \"regions\": %u,\n", count);
+    printf("  \"chunks\": %u,\n", total.chunks);
+    printf("  \"file_bytes\": %llu,\n", (unsigned long long)total.file_bytes);
+    printf("  \"compressed_bytes\": %llu,\n", (unsigned long long)total.compressed_bytes);
+    printf("  \"sectors\": %u,\n", total.sectors);
+    printf("  \"used_sectors\": %u,\n", total.used_sectors);
+    printf("  \"free_sectors\": %u,\n", total.free_sectors);
+    printf("  \"free_runs\": %u,\n", total.free_runs);
+    
+    printf("  \"compression\": {");
+    bool first = true;
+    for (j = 0; j <= RS_ZSTD; j++)
+    {
+        if (total.compression[j] == 0)
+            continue;
+        printf("%s\"%s\": %u", first ? "" : ", ", get_compression_string(j), total.compression[j]);
+        first = false;
+    }
+    printf("},\n");
+    
+    if (deep)
+    {
+        printf("  \"uncompressed_bytes\": %llu,\n", (unsigned long long)total.uncompressed_bytes);
+        printf("  \"bad_chunks\": %u,\n", total.bad_chunks);
+        printf("  \"compression_ratio\": %.3f,\n", total.compressed_bytes ? (double)total.uncompressed_bytes / total.compressed_bytes : 0.0);
+        printf("  \"ratio_histogram\": [\n");
+        for (j = 0; j < RATIO_BUCKETS; j++)
+        {
+            printf("    {\"min\": %g, ", j > 0 ? ratio_limits[j - 1] : 0.0);
+            if (j < RATIO_BUCKETS - 1)
+            {
+                printf("\"max\": %g, ", ratio_limits[j]);
+            } else {
+                printf("\"max\": null, ");
+            }
+            printf("\"chunks\": %u}%s\n", total.ratios[j], j + 1 < RATIO_BUCKETS ? "," : "");
+        }
+        printf("  ],\n");
+    }
+    
+    printf("  \"largest_chunks\": [\n");
+    print_largest("    ", total.largest, total.largest_count, deep);
+    printf("  ],\n");
+    
+    printf("  \"region_list\": [\n");
+    for (i = 0; i < count; i++)
+    {
+        RegionStats* stats = &(job.regions[i]);
+        printf("    {\"x\": %i, \"z\": %i, ", stats->x, stats->z);
+        if (!stats->opened)
+        {
+            printf("\"error\": \"could not open region\"}%s\n", i + 1 < count ? "," : "");
+            continue;
+        }
+        printf("\"chunks\": %u, \"compressed_bytes\": %llu, ", stats->chunks, (unsigned long long)stats->compressed_bytes);
+        if (deep)
+            printf("\"uncompressed_bytes\": %llu, ", (unsigned long long)stats->uncompressed_bytes);
+        printf("\"sectors\": %u, \"used_sectors\": %u, \"free_sectors\": %u, \"free_runs\": %u}%s\n",
+               stats->sectors, stats->used_sectors, stats->free_sectors, stats->free_runs, i + 1 < count ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+    
+    rs_free(job.regions);
+    rs_world_close(world);
+    return 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [region file]\n", name);
+    fprintf(stderr, "       %s [--deep] [-j threads] [world directory]\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = NULL;
+    bool deep = false;
+    unsigned int nthreads = 0;
+    int arg;
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--deep") == 0)
+        {
+            deep = true;
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            nthreads = strtoul(argv[++arg], NULL, 10);
+        } else if (argv[arg][0] != '-' && !path) {
+            path = argv[arg];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    
+    if (!path)
+        usage(argv[0]);
+    
+    struct stat stat_buf;
+    if (stat(path, &stat_buf) == 0 && S_ISDIR(stat_buf.st_mode))
+        return world_stats(path, deep, nthreads);
     
-    RSRegion* reg = rs_region_open(argv[1], false);
+    RSRegion* reg = rs_region_open(path, false);
     rs_assert(reg);
 	
     int x = 0, z = 0;
@@ -0,0 +1,199 @@
+/*
+ * This program is part of libredstone.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "terrain.h"
+
+#include <string.h>
+
+#define index_block(blocks, x, y, z) ((blocks)[y + (z) * 128 + (x) * 128 * 16])
+#define set_half_byte(dest, x, y, z, val)                               \
+    do                                                                  \
+    {                                                                   \
+        uint16_t index = ((y) + (z) * 128 + (x) * 128 * 16) / 2;        \
+        if ((y) % 2 == 0)                                               \
+        {                                                               \
+            dest[index] &= ~0x0F;                                       \
+            dest[index] |= val & 0x0F;                                  \
+        } else {                                                        \
+            dest[index] &= ~0xF0;                                       \
+            dest[index] |= (val << 4) & 0xF0;                           \
+        }                                                               \
+    } while (0)
+
+/* a small, fast generator, so every chunk gets the same ores whatever
+ * order chunks are made in, and on every C library
+ */
+static uint32_t terrain_random_init(uint32_t seed, int cx, int cz)
+{
+    uint32_t state = seed ^ 0x9e3779b9;
+    state = (state ^ (uint32_t)cx) * 0x85ebca6b;
+    state = (state ^ (uint32_t)cz) * 0xc2b2ae35;
+    state ^= state >> 16;
+    return state ? state : 1;
+}
+
+static float terrain_random(uint32_t* state)
+{
+    /* xorshift32 */
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return (float)(*state >> 8) / (float)(1 << 24);
+}
+
+void generate_terrain(int cx, int cz, uint32_t seed, uint8_t* blocks)
+{
+    int x, y, z;
+    uint32_t random = terrain_random_init(seed, cx, cz);
+    
+    for (x = 0; x < 16; x++)
+    {
+        for (z = 0; z < 16; z++)
+        {
+            for (y = 0; y < 128; y++)
+            {
+                int local_x = cx * 16 + x;
+                int local_z = cz * 16 + z;
+                int local_y = y * 4 - 256;
+                
+                if (local_x < 0)
+                    local_x *= -1;
+                if (local_z < 0)
+                    local_z *= -1;
+                local_x -= 256;
+                local_z -= 256;
+                
+                if (y < 64)
+                    index_block(blocks, x, y, z) = 3;
+                if (y == 64)
+                    index_block(blocks, x, y, z) = 2;
+                
+                if (local_x * local_x + local_y * local_y + local_z * local_z < 240 * 240)
+                {
+                    index_block(blocks, x, y, z) = 1;
+                    if (local_x * local_x + local_y * local_y + local_z * local_z < 200 * 200)
+                    {
+                        index_block(blocks, x, y, z) = 0;
+                    } else {
+                        float orerand = terrain_random(&random);
+                        if (orerand < 0.01)
+                        {
+                            index_block(blocks, x, y, z) = 56;
+                        } else if (orerand < 0.05) {
+                            index_block(blocks, x, y, z) = 14;
+                        } else if (orerand < 0.12) {
+                            index_block(blocks, x, y, z) = 15;
+                        } else if (orerand < 0.3) {
+                            index_block(blocks, x, y, z) = 16;
+                        }
+                    }
+                }
+                
+                if (((local_x <= 1 && local_x >= 0) || (local_z <= 1 && local_z >= 0)) && (y >= 64 && y < 68))
+                    index_block(blocks, x, y, z) = (y == 64 ? 17 : 0);
+            }
+        }
+    }
+}
+
+void generate_heightmap(uint8_t* blocks, uint8_t* heightmap)
+{
+    int x, y, z;
+    for (x = 0; x < 16; x++)
+    {
+        for (z = 0; z < 16; z++)
+        {
+            for (y = 127; y >= 0; y--)
+            {
+                if (index_block(blocks, x, y, z) != 0)
+                    break;
+            }
+            /* note weird index ordering */
+            heightmap[z + 16 * x] = y + 1;
+        }
+    }
+}
+
+void generate_skylight(uint8_t* blocks, uint8_t* heightmap, uint8_t* skylight)
+{
+    int x, y, z;
+    for (x = 0; x < 16; x++)
+    {
+        for (z = 0; z < 16; z++)
+        {
+            uint8_t height = heightmap[z + 16 * x];
+            for (y = 0; y < 128; y++)
+            {
+                if (y >= height)
+                {
+                    set_half_byte(skylight, x, y, z, 0x0F);
+                }
+            }
+        }
+    }
+}
+
+RSTag* take_byte_array(uint32_t len, uint8_t* data)
+{
+    RSTag* tag = rs_tag_new0(RS_TAG_BYTE_ARRAY);
+    rs_tag_take_byte_array(tag, len, data);
+    return tag;
+}
+
+static RSTag* borrow_byte_array(uint32_t len, uint8_t* data)
+{
+    RSTag* tag = rs_tag_new0(RS_TAG_BYTE_ARRAY);
+    rs_tag_borrow_byte_array(tag, len, data, NULL, NULL);
+    return tag;
+}
+
+RSTag* create_chunk(RSTagBuilder* builder, RSTag* empty, TerrainScratch* scratch, int x, int z, uint32_t seed, uint8_t* zero_height)
+{
+    /* the generators only fill in what isn't empty */
+    memset(scratch->blocks, 0, sizeof(scratch->blocks));
+    memset(scratch->skylight, 0, sizeof(scratch->skylight));
+    
+    generate_terrain(x, z, seed, scratch->blocks);
+    generate_heightmap(scratch->blocks, scratch->heightmap);
+    generate_skylight(scratch->blocks, scratch->heightmap, scratch->skylight);
+    
+    if (zero_height)
+        *zero_height = scratch->heightmap[0];
+    
+    rs_tag_builder_begin_compound(builder, NULL);
+    rs_tag_builder_begin_compound(builder, "Level");
+    
+    rs_tag_builder_add_integer(builder, "xPos", RS_TAG_INT, x);
+    rs_tag_builder_add_integer(builder, "zPos", RS_TAG_INT, z);
+    rs_tag_builder_add_tag(builder, "Blocks", borrow_byte_array(0x8000, scratch->blocks));
+    rs_tag_builder_add_tag(builder, "SkyLight", borrow_byte_array(0x4000, scratch->skylight));
+    rs_tag_builder_add_tag(builder, "HeightMap", borrow_byte_array(0x100, scratch->heightmap));
+    /* copies share the empty arrays */
+    rs_tag_builder_add_tag(builder, "BlockLight", rs_tag_copy(empty));
+    rs_tag_builder_add_tag(builder, "Data", rs_tag_copy(empty));
+    rs_tag_builder_begin_list(builder, "Entities", RS_TAG_END, 0);
+    rs_tag_builder_end(builder);
+    rs_tag_builder_begin_list(builder, "TileEntities", RS_TAG_END, 0);
+    rs_tag_builder_end(builder);
+    rs_tag_builder_add_integer(builder, "TerrainPopulated", RS_TAG_BYTE, 1);
+    rs_tag_builder_add_integer(builder, "LastUpdate", RS_TAG_LONG, 0);
+    
+    rs_tag_builder_end(builder);
+    rs_tag_builder_end(builder);
+    
+    return rs_tag_builder_finish(builder);
+}
@@ -0,0 +1,52 @@
+/*
+ * This program is part of libredstone.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* the terrain generator behind mapgen, shared with the benchmarks */
+
+#ifndef __RS_TOOLS_TERRAIN_H_INCLUDED__
+#define __RS_TOOLS_TERRAIN_H_INCLUDED__
+
+#include "redstone.h"
+
+/* blocks is 16 * 128 * 16 bytes, in old (pre-Anvil) chunk order; the
+ * same seed and chunk position always give the same blocks
+ */
+void generate_terrain(int cx, int cz, uint32_t seed, uint8_t* blocks);
+void generate_heightmap(uint8_t* blocks, uint8_t* heightmap);
+void generate_skylight(uint8_t* blocks, uint8_t* heightmap, uint8_t* skylight);
+
+/* wraps a generated buffer in a tag, without copying it */
+RSTag* take_byte_array(uint32_t len, uint8_t* data);
+
+/* the buffers a chunk is generated in, reused from chunk to chunk */
+typedef struct
+{
+    uint8_t blocks[0x8000];
+    uint8_t skylight[0x4000];
+    uint8_t heightmap[0x100];
+} TerrainScratch;
+
+/* builds a whole chunk with builder; empty is a 0x4000-byte array tag
+ * that copies are made from, and zero_height (if not NULL) gets the
+ * height of the column at (0, 0)
+ *
+ * the chunk borrows its arrays from scratch, so it must be written out
+ * and freed before scratch is used for the next one
+ */
+RSTag* create_chunk(RSTagBuilder* builder, RSTag* empty, TerrainScratch* scratch, int x, int z, uint32_t seed, uint8_t* zero_height);
+
+#endif /* __RS_TOOLS_TERRAIN_H_INCLUDED__ */
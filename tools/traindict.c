@@ -0,0 +1,238 @@
+/*
+ * This program is part of libredstone.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* trains a zstd dictionary on chunks from a world, and saves it as
+ * region/dict.zstd, where regions will find it
+ */
+
+#include "redstone.h"
+#include <dirent.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* zstd suggests about 100 times as much sample data as dictionary */
+#define SAMPLE_RATIO 100
+#define DEFAULT_DICTIONARY_SIZE (1024 * 110)
+
+typedef struct
+{
+    unsigned long priority;
+    uint8_t* data;
+    size_t size;
+} Sample;
+
+/* samples are picked evenly from the whole world: every chunk gets a
+ * random priority, and the lowest ones are kept, up to budget bytes.
+ * They're kept in a max-heap, so the next one to drop is on top.
+ */
+typedef struct
+{
+    Sample* heap;
+    unsigned int count;
+    unsigned int allocated;
+    size_t total;
+    size_t budget;
+    unsigned long seen;
+} Samples;
+
+static unsigned long random_priority(void)
+{
+    return (unsigned long)rand() * ((unsigned long)RAND_MAX + 1) + rand();
+}
+
+static void swap_samples(Samples* samples, unsigned int a, unsigned int b)
+{
+    Sample tmp = samples->heap[a];
+    samples->heap[a] = samples->heap[b];
+    samples->heap[b] = tmp;
+}
+
+/* whether a chunk with this priority would be kept, so chunks that
+ * wouldn't be don't need decompressing
+ */
+static bool want_sample(Samples* samples, unsigned long priority)
+{
+    return samples->total < samples->budget || priority < samples->heap[0].priority;
+}
+
+static void add_sample(Samples* samples, unsigned long priority, uint8_t* data, size_t len)
+{
+    unsigned int i, child;
+
+    if (len > samples->budget)
+    {
+        rs_free(data);
+        return;
+    }
+
+    if (samples->count == samples->allocated)
+    {
+        samples->allocated = samples->allocated ? samples->allocated * 2 : 256;
+        samples->heap = rs_renew(Sample, samples->heap, samples->allocated);
+    }
+
+    i = samples->count++;
+    samples->heap[i].priority = priority;
+    samples->heap[i].data = data;
+    samples->heap[i].size = len;
+    samples->total += len;
+    for (; i > 0 && samples->heap[(i - 1) / 2].priority < samples->heap[i].priority; i = (i - 1) / 2)
+        swap_samples(samples, i, (i - 1) / 2);
+
+    /* over budget, so drop the highest priorities */
+    while (samples->total > samples->budget)
+    {
+        samples->total -= samples->heap[0].size;
+        rs_free(samples->heap[0].data);
+        samples->heap[0] = samples->heap[--(samples->count)];
+
+        for (i = 0; (child = 2 * i + 1) < samples->count; i = child)
+        {
+            if (child + 1 < samples->count && samples->heap[child + 1].priority > samples->heap[child].priority)
+                child++;
+            if (samples->heap[child].priority <= samples->heap[i].priority)
+                break;
+            swap_samples(samples, i, child);
+        }
+    }
+}
+
+static bool is_region_file(const char* name)
+{
+    size_t len = strlen(name);
+    if (len < 4)
+        return false;
+    return strcmp(name + len - 4, ".mca") == 0 || strcmp(name + len - 4, ".mcr") == 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "usage: %s [world] [dictionary size]\n", argv[0]);
+        return 1;
+    }
+
+    size_t capacity = DEFAULT_DICTIONARY_SIZE;
+    if (argc == 3)
+        capacity = strtoul(argv[2], NULL, 10);
+
+    char* tmps = rs_malloc(strlen(argv[1]) + 512);
+    sprintf(tmps, "%s/region", argv[1]);
+    DIR* dir = opendir(tmps);
+    if (!dir)
+    {
+        fprintf(stderr, "could not open %s\n", tmps);
+        rs_free(tmps);
+        return 1;
+    }
+
+    Samples* samples = rs_new0(Samples, 1);
+    samples->budget = capacity * SAMPLE_RATIO;
+    srand(0);
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (!is_region_file(entry->d_name) || strlen(entry->d_name) > 256)
+            continue;
+
+        sprintf(tmps, "%s/region/%s", argv[1], entry->d_name);
+        RSRegion* region = rs_region_open(tmps, false);
+        if (!region)
+        {
+            fprintf(stderr, "could not open %s, skipping\n", tmps);
+            continue;
+        }
+
+        uint8_t x, z;
+        for (z = 0; z < 32; z++)
+        {
+            for (x = 0; x < 32; x++)
+            {
+                if (!rs_region_contains_chunk(region, x, z))
+                    continue;
+
+                samples->seen++;
+                unsigned long priority = random_priority();
+                if (!want_sample(samples, priority))
+                    continue;
+
+                RSCompressionType enc = rs_region_get_chunk_compression(region, x, z);
+                RSDictionary* dictionary = (enc == RS_ZSTD) ? rs_region_get_dictionary(region) : NULL;
+                uint8_t* data;
+                size_t len;
+                rs_decompress_full(enc, dictionary, rs_region_get_chunk_data(region, x, z), rs_region_get_chunk_length(region, x, z), &data, &len);
+                if (data)
+                    add_sample(samples, priority, data, len);
+            }
+        }
+
+        rs_region_close(region);
+    }
+    closedir(dir);
+
+    if (samples->count == 0)
+    {
+        fprintf(stderr, "no chunks found in %s\n", argv[1]);
+        rs_free(samples->heap);
+        rs_free(samples);
+        rs_free(tmps);
+        return 1;
+    }
+
+    /* the trainer wants all the samples in one buffer */
+    uint8_t* all = rs_malloc(samples->total);
+    size_t* sizes = rs_new(size_t, samples->count);
+    size_t total = 0;
+    unsigned int i;
+    for (i = 0; i < samples->count; i++)
+    {
+        memcpy(all + total, samples->heap[i].data, samples->heap[i].size);
+        sizes[i] = samples->heap[i].size;
+        total += samples->heap[i].size;
+        rs_free(samples->heap[i].data);
+    }
+
+    printf("training on %u of %lu chunks (%lu bytes)...\n", samples->count, samples->seen, (unsigned long)total);
+    RSDictionary* dictionary = rs_dictionary_train(all, sizes, samples->count, capacity);
+    rs_free(all);
+    rs_free(sizes);
+    rs_free(samples->heap);
+    rs_free(samples);
+
+    if (!dictionary)
+    {
+        fprintf(stderr, "training failed (is libredstone built with zstd?)\n");
+        rs_free(tmps);
+        return 1;
+    }
+
+    sprintf(tmps, "%s/region/dict.zstd", argv[1]);
+    bool success = rs_dictionary_write_to_file(dictionary, tmps);
+    if (success)
+    {
+        printf("wrote %lu byte dictionary to %s\n", (unsigned long)rs_dictionary_get_length(dictionary), tmps);
+    } else {
+        fprintf(stderr, "could not write %s\n", tmps);
+    }
+
+    rs_dictionary_unref(dictionary);
+    rs_free(tmps);
+    return success ? 0 : 1;
+}